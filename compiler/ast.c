@@ -171,9 +171,11 @@ a_procDecl a_procDecl_Func(int pos, a_name name, a_formals formals,
 //========================================================================
 
 // Formals
-a_formals a_Formals(t_formal type, a_paramDeclSeq params, a_formals next) {
+a_formals a_Formals(t_formal type, bool val, a_paramDeclSeq params, 
+        a_formals next) {
     a_formals p = chkalloc(sizeof(*p));
     p->type = type;
+    p->val = val;
     p->params = params;
     p->next = next;
     return p;
@@ -284,6 +286,7 @@ a_stmt a_stmt_In(int pos, a_elem elem, a_expr expr) {
     p->pos = pos;
     p->u.io.dst = elem;
     p->u.io.src = expr;
+    p->u.io.count = NULL;
     return p;
 }
 
@@ -294,6 +297,21 @@ a_stmt a_stmt_Out(int pos, a_elem elem, a_expr expr) {
     p->pos = pos;
     p->u.io.dst = elem;
     p->u.io.src = expr;
+    p->u.io.count = NULL;
+    return p;
+}
+
+// stmt_input of an array: count words from the subscripted element
+a_stmt a_stmt_InArray(int pos, a_elem elem, a_elem array, a_expr count) {
+    a_stmt p = a_stmt_In(pos, elem, a_expr_monadic(pos, t_expr_none, array));
+    p->u.io.count = count;
+    return p;
+}
+
+// stmt_output of an array: count words from the subscripted element
+a_stmt a_stmt_OutArray(int pos, a_elem elem, a_elem array, a_expr count) {
+    a_stmt p = a_stmt_Out(pos, elem, a_expr_monadic(pos, t_expr_none, array));
+    p->u.io.count = count;
     return p;
 }
 
@@ -304,6 +322,23 @@ a_stmt a_stmt_On(int pos, a_elem dest, a_elem pCall) {
     p->pos = pos;
     p->u.on.dest = dest;
     p->u.on.pCall = pCall;
+    p->u.on.handle = NULL;
+    return p;
+}
+
+// stmt_on without waiting for completion: the handle is set to join it
+a_stmt a_stmt_OnAsync(int pos, a_elem handle, a_elem dest, a_elem pCall) {
+    a_stmt p = a_stmt_On(pos, dest, pCall);
+    p->u.on.handle = handle;
+    return p;
+}
+
+// stmt_join
+a_stmt a_stmt_Join(int pos, a_expr handle) {
+    a_stmt p = chkalloc(sizeof(*p));
+    p->type = t_stmt_join;
+    p->pos = pos;
+    p->u.join.handle = handle;
     return p;
 }
 
@@ -338,6 +373,18 @@ a_stmt a_stmt_Par(int pos, a_stmtPar list) {
     return p;
 }
 
+// stmt_Rep
+a_stmt a_stmt_Rep(int pos, a_elem var, a_expr base, a_expr count, a_stmt stmt) {
+    a_stmt p = chkalloc(sizeof(*p));
+    p->type = t_stmt_rep;
+    p->pos = pos;
+    p->u.rep.var = var;
+    p->u.rep.base = base;
+    p->u.rep.count = count;
+    p->u.rep.stmt = stmt;
+    return p;
+}
+
 // stmt_Seq
 a_stmt a_stmt_Seq(int pos, a_stmtSeq list) {
     a_stmt p = chkalloc(sizeof(*p));
@@ -170,6 +170,7 @@ struct _a_procDecl {
 // Formals
 struct _a_formals {
     t_formal type;
+    bool val; // read-only array
     a_paramDeclSeq params;
     a_formals next;
 };
@@ -206,10 +207,12 @@ struct _a_stmt {
         t_stmt_input,
         t_stmt_output,
         t_stmt_on,
+        t_stmt_join,
         t_stmt_alias,
         t_stmt_connect,
         t_stmt_seq,
-        t_stmt_par
+        t_stmt_par,
+        t_stmt_rep
     } type;
     int pos;
     union {
@@ -231,6 +234,12 @@ struct _a_stmt {
             a_expr post;
             a_stmt stmt;
         } for_;
+        struct {
+            a_elem var;
+            a_expr base;
+            a_expr count;
+            a_stmt stmt;
+        } rep;
         struct {
             a_name name;
             a_exprList exprList;
@@ -242,11 +251,16 @@ struct _a_stmt {
         struct {
             a_elem dst; // (left)
             a_expr src;
+            a_expr count; // words of an array transfer, or NULL
         } io;
         struct {
             a_elem dest;
             a_elem pCall;
+            a_elem handle; // of an asynchronous on, or NULL
         } on;
+        struct {
+            a_expr handle;
+        } join;
         struct {
             a_elem dst;
             a_elem array;
@@ -347,7 +361,7 @@ a_procDecl     a_procDecl_Proc (int, a_name, a_formals, a_varDecls, a_stmt);
 a_procDecl     a_procDecl_Func (int, a_name, a_formals, a_varDecls, a_stmt);
 
 // Formal parameters
-a_formals      a_Formals       (t_formal, a_paramDeclSeq, a_formals);
+a_formals      a_Formals       (t_formal, bool, a_paramDeclSeq, a_formals);
 a_paramDeclSeq a_ParamDeclSeq  (a_varId, a_paramDeclSeq);
 
 // Statements
@@ -362,11 +376,16 @@ a_stmt         a_stmt_PCall    (int, a_name, a_exprList);
 a_stmt         a_stmt_Ass      (int, a_elem, a_expr);
 a_stmt         a_stmt_In       (int, a_elem, a_expr);
 a_stmt         a_stmt_Out      (int, a_elem, a_expr);
+a_stmt         a_stmt_InArray  (int, a_elem, a_elem, a_expr);
+a_stmt         a_stmt_OutArray (int, a_elem, a_elem, a_expr);
 a_stmt         a_stmt_On       (int, a_elem, a_elem);
+a_stmt         a_stmt_OnAsync  (int, a_elem, a_elem, a_elem);
+a_stmt         a_stmt_Join     (int, a_expr);
 a_stmt         a_stmt_Alias    (int, a_elem, a_elem, a_expr);
 a_stmt         a_stmt_Connect  (int, a_elem, a_elem, a_elem);
 a_stmt         a_stmt_Seq      (int, a_stmtSeq);
 a_stmt         a_stmt_Par      (int, a_stmtPar);
+a_stmt         a_stmt_Rep      (int, a_elem, a_expr, a_expr, a_stmt);
 
 // Expressions
 a_exprList     a_Exprlist      (a_expr, a_exprList);
@@ -138,6 +138,9 @@ static void p_formals(FILE *o, a_formals p) {
     // For each set of type declartations
     for(; p!=NULL; p=p->next) {
 
+        if(p->val)
+            fprintf(o, "val ");
+
         // For each declaration of the type
         for(f=p->params; f!=NULL; f=f->next)
             fprintf(o, "%s%s", f->param->name->name, 
@@ -203,18 +206,38 @@ static void p_stmt(FILE *o, int d, a_stmt p) {
         break;
     case t_stmt_input:
         indent(o, d); 
-        fprintf(o, "%s ? %s", elem(p->u.io.dst), expr(p->u.io.src));
+        if(p->u.io.count != NULL) {
+            a_elem a = p->u.io.src->u.monadic.elem;
+            fprintf(o, "%s ? %s[%s..%s]", elem(p->u.io.dst), 
+                    a->u.sub.name->name, expr(a->u.sub.expr), 
+                    expr(p->u.io.count));
+        }
+        else
+            fprintf(o, "%s ? %s", elem(p->u.io.dst), expr(p->u.io.src));
         break;
     case t_stmt_output:
         indent(o, d); 
-        fprintf(o, "%s ! %s", elem(p->u.io.dst), expr(p->u.io.src));
+        if(p->u.io.count != NULL) {
+            a_elem a = p->u.io.src->u.monadic.elem;
+            fprintf(o, "%s ! %s[%s..%s]", elem(p->u.io.dst), 
+                    a->u.sub.name->name, expr(a->u.sub.expr), 
+                    expr(p->u.io.count));
+        }
+        else
+            fprintf(o, "%s ! %s", elem(p->u.io.dst), expr(p->u.io.src));
         break;
     case t_stmt_on:
         indent(o, d); 
+        if(p->u.on.handle != NULL)
+            fprintf(o, "%s := ", elem(p->u.on.handle));
         fprintf(o, "on %s : %s", 
                 elem(p->u.on.dest), 
                 elem(p->u.on.pCall));
         break;
+    case t_stmt_join:
+        indent(o, d); 
+        fprintf(o, "join %s", expr(p->u.join.handle));
+        break;
     case t_stmt_alias:
         indent(o, d); 
         fprintf(o, "%s alias %s[%s..]", 
@@ -234,6 +257,11 @@ static void p_stmt(FILE *o, int d, a_stmt p) {
         p_stmtPar(o, d, p->u.par);
         indent(o, d-1); fprintf(o, "}"); 
         break;
+    case t_stmt_rep:
+        indent(o, d); fprintf(o, "par %s := %s for %s do\n", elem(p->u.rep.var), 
+                expr(p->u.rep.base), expr(p->u.rep.count));
+        p_stmt(o, d+1, p->u.rep.stmt);
+        break;
     case t_stmt_seq:
         indent(o, d-1); fprintf(o, "{\n"); 
         p_stmtSeq(o, d, p->u.seq);
@@ -3,11 +3,14 @@
 #include "irt.h"
 #include "irtprinter.h"
 #include "statistics.h"
+#include "../include/definitions.h"
 
 // A basic block data structure
 struct block_ {
     bool mark;
     label start;
+    int counter;         // index of its profile counter, or -1
+    long count;          // profiled executions, or -1 if unknown
     list stmts;
     union {
         struct {
@@ -24,14 +27,21 @@ struct block_ {
 static list  split(structures, list);
 static list  schedule(list);
 static void  removeUnreachable(list);
-static void  adjustJumps(structures, frame, list);
+static void  adjustJumps(list);
 static void  blockVisitor(block);
 static void  markBlocks(list, bool);
+static void  instrument(frame, list, label, int *);
 static block find(list, label);
 static block Block(label, list);
 
-// Main method to compute and schedult basic blocks
-void basicBlocks(structures s) {
+// Main method to compute and schedult basic blocks. If profiling, each
+// block is instrumented to count its executions. Given the block
+// frequencies of a profile, the traces follow the hottest paths.
+void basicBlocks(structures s, bool countBlocks, profile freqs) {
+
+    label counters = countBlocks ?
+        lblMap_NewNamedLabel(s->lbl, LBL_PROFILE) : NULL;
+    int numCounters = 0;
 
     // Loop through each process
     iterator it = it_begin(s->ir->procs);
@@ -46,21 +56,40 @@ void basicBlocks(structures s) {
         //printf("BEFORE:\n");
         //blc_dump(stdout, blocks);
 
+        // Look up their executions
+        if(freqs != NULL) {
+            iterator blockIt = it_begin(blocks);
+            while(it_hasNext(blockIt)) {
+                block b = it_next(blockIt);
+                b->count = prf_block(freqs, frm_name(proc->frm),
+                        lbl_name(b->start));
+            }
+            it_free(&blockIt);
+        }
+
         // Sequence them
         blocks = schedule(blocks);
 
         // Adjust jumps
-        adjustJumps(s, proc->frm, blocks);
+        adjustJumps(blocks);
 
         // Remove any uneachable blocks
         removeUnreachable(blocks);
 
+        // Count the executions of each block
+        if(countBlocks)
+            instrument(proc->frm, blocks, counters, &numCounters);
+
         //printf("AFTER:\n");
         //blc_dump(stdout, blocks);
         
         proc->blocks = blocks;
     }
     it_free(&it);
+
+    // The counters, in the data section
+    if(countBlocks)
+        ir_NewGlobal(s->ir, LBL_PROFILE, numCounters, counters);
 }
 
 // Basic block: begins with a label, no other labels occur in the block. Any
@@ -155,7 +184,8 @@ list split(structures s, list stmts) {
 // a flattened list of statements. Also, fill in the block successors as they
 // are found, instead of label references.
 // The last block remains in its position so is initially marked, then added to
-// the traceList at the end
+// the traceList at the end. With block counts, a trace continues into the
+// hotter successor of a CJUMP, so that it falls through on the hot path.
 static list schedule(list blocks) {
       
     // Create a duplicate list of blocks
@@ -189,8 +219,11 @@ static list schedule(list blocks) {
             // examine the successors of b, if is an unmarked successor b = c
             if(b->succ.label.b != NULL) {
                 block succ = find(blocks, b->succ.label.b);
+                block taken = find(blocks, b->succ.label.a);
                 b->succ.block.b = succ;
-                b->succ.block.a = find(blocks, b->succ.label.a);
+                b->succ.block.a = taken;
+                if(!taken->mark && taken->count > succ->count)
+                    succ = taken;
                 //printf("block %s succ by %s\n", lbl_name(b->start), lbl_name(succ->start));
                 if(!succ->mark) 
                     b = succ;
@@ -219,13 +252,13 @@ static list schedule(list blocks) {
 
 // Adjust the blocks:
 //    1 Leave any CJUMP followed immediately by its FALSE label
-//    2 Negate condition for any CJUMP immediately followed by TRUE
+//    2 Leave any CJUMP followed immediately by its TRUE label, which is 
+//      generated as a branch on false
 //    3 For any CJUMP followed by neither label we rewrite as:
 //       CJUMP(cond, a, b, l_t, l_f) ==>
 //           CJUMP(cond, a, b, l_t, l_f)
-//           LABEL l'_f
 //           JUMP(NAME l_f)
-static void adjustJumps(structures s, frame f, list blocks) {
+static void adjustJumps(list blocks) {
 
     // For each block and statement
     iterator blockIt = it_begin(blocks);
@@ -244,22 +277,12 @@ static void adjustJumps(structures s, frame f, list blocks) {
             if(lbl_compare(falseBranch->u.NAME, next->start)) {
                 //list_removeFirst(next->stmts);
             } 
-            // 2: negate condition
+            // 2: branch on false
             else if(lbl_compare(trueBranch->u.NAME, next->start)) {
-                temp t = frm_addNewTemp(f, t_tmp_local);
-                i_stmt e = i_Move(i_Temp(t), i_Binop(i_xor, 
-                            i_Const(0xFFFFFFFF), stmt->u.CJUMP.expr));
-                iterator it = it_end(b->stmts);
-                it_insertAfter(it, e);
-                it_free(&it);
-                stmt->u.CJUMP.expr = i_Temp(t);
             }
             // 3: rewrite with false JUMP
-            else {
-                label f = lblMap_NewLabel(s->lbl);
-                list_insertLast(b->stmts, i_Jump(i_Name(f)));
-                list_insertLast(b->stmts, i_Label(f));
-            }
+            else
+                list_insertLast(b->stmts, i_Jump(i_Name(falseBranch->u.NAME)));
         }
     }
     it_free(&blockIt);
@@ -284,6 +307,36 @@ static void removeUnreachable(list blocks) {
     it_free(&it);
 }
 
+// Increment a counter in the data section at the start of each block:
+//   LABEL l
+//   t1 := k
+//   t2 := MEM(dp, counters, t1)
+//   t2 := t2 + 1
+//   MEM(dp, counters, t1) := t2
+// The labels are unchanged, so a profile of the blocks applies to the same
+// program compiled without counters.
+static void instrument(frame f, list blocks, label counters, int *n) {
+    iterator it = it_begin(blocks);
+    while(it_hasNext(it)) {
+        block b = it_next(it);
+        temp index = frm_addNewTemp(f, t_tmp_local);
+        temp count = frm_addNewTemp(f, t_tmp_local);
+        i_expr mem = i_Mem(t_mem_dp, i_Name(counters), i_Temp(index));
+        
+        b->counter = (*n)++;
+        i_stmt l = list_removeFirst(b->stmts);
+        list_insertFirst(b->stmts, i_Move(mem, i_Temp(count)));
+        list_insertFirst(b->stmts, i_Move(i_Temp(count),
+                    i_Binop(i_plus, i_Temp(count), i_Const(1))));
+        list_insertFirst(b->stmts, i_Move(i_Temp(count),
+                    i_Mem(t_mem_dp, i_Name(counters), i_Temp(index))));
+        list_insertFirst(b->stmts, i_Move(i_Temp(index),
+                    i_Const(b->counter)));
+        list_insertFirst(b->stmts, l);
+    }
+    it_free(&it);
+}
+
 // Recursively visit basic blocks
 static void blockVisitor(block b) {
     //printf("visitng block %s\n", blc_name(b));
@@ -386,6 +439,26 @@ static void markBlocks(list blocks, bool v) {
     it_free(&it);
 }
 
+// Write the profile counter of each block, with its procedure and label:
+//   counters <label>
+//   <index> <procedure> <block label>
+void blc_profileMap(FILE *out, structures s) {
+    fprintf(out, "counters %s\n", lbl_name(ir_dpLoc(s->ir, LBL_PROFILE)));
+    iterator it = it_begin(s->ir->procs);
+    while(it_hasNext(it)) {
+        ir_proc proc = it_next(it);
+        iterator blockIt = it_begin(proc->blocks);
+        while(it_hasNext(blockIt)) {
+            block b = it_next(blockIt);
+            if(b->counter != -1)
+                fprintf(out, "%d %s %s\n", b->counter, frm_name(proc->frm),
+                        lbl_name(b->start));
+        }
+        it_free(&blockIt);
+    }
+    it_free(&it);
+}
+
 // Print the blocks
 void blc_dump(FILE *out, list blocks) {
     iterator it = it_begin(blocks);
@@ -413,6 +486,8 @@ static block Block(label start, list stmts) {
     b->mark = false;
     b->start = start;
     b->stmts = stmts;
+    b->counter = -1;
+    b->count = -1;
     b->succ.label.a = NULL;
     b->succ.label.b = NULL;
     return b;
@@ -434,3 +509,7 @@ list blc_stmts(block b) {
     return b->stmts;
 }
 
+long blc_count(block b) {
+    return b->count;
+}
+
@@ -6,17 +6,20 @@
 #include "list.h"
 #include "frame.h"
 #include "structures.h"
+#include "../profiler/profile.h"
 
 typedef struct block_ *block;
 
-void   basicBlocks(structures);
+void   basicBlocks(structures, bool countBlocks, profile);
 list   blc_stmtSeq(list);
 void   blc_labelStmts(list);
 void   blc_dump(FILE *, list);
+void   blc_profileMap(FILE *, structures);
 
 // Block object methods
 string blc_name(block b);
 list   blc_stmts(block b);
+long   blc_count(block b);
 block  blc_getSucc1(block);
 block  blc_getSucc2(block);
 
@@ -0,0 +1,19 @@
+#include "channel.h"
+
+// Channel protocols:
+//
+// Transfers over the system channel array are bracketed by a handshake of
+// control tokens, to open a route through the switch and to close it again.
+// The sequences emitted for each end are given here. They are tested, with
+// the closure protocols of the runtime, against an emulated channel in
+// tests/protocol.
+
+// The control token operations of one end of a handshake: the output end
+// sends its token first and the input end acknowledges it
+int chn_handshake(bool output, int token, chn_op *ops) {
+    ops[0].op = output ? t_chn_outct : t_chn_chkct;
+    ops[1].op = output ? t_chn_chkct : t_chn_outct;
+    ops[0].token = token;
+    ops[1].token = token;
+    return 2;
+}
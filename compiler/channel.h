@@ -0,0 +1,22 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "util.h"
+
+#define CT_BEGIN 0x0
+#define CT_END   0x1
+
+// Control token operations performed by a channel end
+typedef enum {
+    t_chn_outct,
+    t_chn_chkct
+} t_chnOp;
+
+typedef struct {
+    t_chnOp op;
+    int token;
+} chn_op;
+
+int chn_handshake(bool output, int token, chn_op *ops);
+
+#endif
@@ -3,10 +3,12 @@
 #include "statistics.h"
 #include "instructions.h"
 #include "irtprinter.h"
+#include "stack.h"
+#include "channel.h"
+#include "route.h"
+#include "wcet.h"
 
 #define DEBUG 0
-#define CT_BEGIN 0x0
-#define CT_END   0x1
 
 static void gen_proc        (FILE *, structures, frame, list);
 static void gen_stmt        (FILE *, structures, frame, i_stmt, bool);
@@ -15,14 +17,20 @@ static void gen_cjump       (FILE *, i_stmt);
 static void gen_move        (FILE *, structures, frame, i_stmt);
 static void gen_input       (FILE *, i_stmt);
 static void gen_output      (FILE *, i_stmt);
+static void gen_open        (FILE *, i_stmt);
+static void gen_close       (FILE *, i_stmt);
+static void gen_handshake   (FILE *, int, bool, int);
+static void gen_chanEnd     (FILE *, int, i_expr);
 static void gen_fork        (FILE *, i_stmt);
 static void gen_forkSet     (FILE *, i_stmt);
+static void gen_forkSp      (FILE *, i_stmt);
 static void gen_forkSync    (FILE *, i_stmt);
 static void gen_join        (FILE *, i_stmt);
 static void gen_on          (FILE *, structures, frame, i_stmt);
+static void gen_onJoin      (FILE *, frame, i_stmt);
 static void gen_connect     (FILE *, frame, i_stmt);
 static void gen_return      (FILE *, structures, i_stmt, bool);
-static void gen_fnCall      (FILE *, structures, frame, i_expr, int);
+static void gen_fnCall      (FILE *, structures, frame, i_stmt, int);
 static void gen_pCall       (FILE *, structures, frame, i_stmt);
 static void gen_binop       (FILE *, structures, int, i_expr);
 static void gen_temp        (FILE *, int, i_expr);
@@ -34,6 +42,7 @@ static void gen_load        (FILE *, frame, i_expr, i_expr);
 static void gen_store       (FILE *, frame, i_expr, i_expr);
 static void gen_data        (FILE *, structures, list);
 static void gen_consts      (FILE *, list);
+static void gen_connTable   (FILE *);
 static void gen_jumpTable   (FILE *, structures);
 //static void gen_constRefs   (FILE *, list);
 
@@ -56,8 +65,11 @@ void gen_program(FILE *asmOut, FILE *jumpTabOut, FILE *cpOut, structures s) {
         proc->pos = i++; 
     }
     it_free(&it);
+    stk_init(s);
 
     emit(asmOut, ".extern %s", LBL_MIGRATE);
+    emit(asmOut, ".extern %s", LBL_MIGRATE_ASYNC);
+    emit(asmOut, ".extern %s", LBL_JOIN_ASYNC);
     emit(asmOut, ".extern %s", LBL_INIT_THREAD);
     emit(asmOut, ".extern %s", LBL_CHAN_ARRAY);
     emit(asmOut, "\n.text\n");
@@ -86,6 +98,46 @@ void gen_program(FILE *asmOut, FILE *jumpTabOut, FILE *cpOut, structures s) {
     
     // Generate constants in a seperate file
     gen_consts(cpOut, s->ir->consts);
+    gen_connTable(cpOut);
+}
+
+// Generate procedures removed from the program into a scratch file, numbered
+// after its own, giving the bytes of each with the padding to word-align it
+void gen_procBytes(structures s, list removed, int *bytes) {
+    
+    FILE *out = tmpfile();
+    if(out == NULL) {
+        err_fatal("opening scratch file");
+        return;
+    }
+    
+    list procs = s->ir->procs;
+    s->ir->procs = list_Copy(procs);
+    list_appendList(s->ir->procs, removed);
+    int i = list_size(procs);
+    iterator it = it_begin(removed);
+    while(it_hasNext(it)) {
+        ir_proc proc = it_next(it);
+        proc->pos = i++;
+    }
+    it_free(&it);
+    stk_init(s);
+
+    i = 0;
+    emit_bytes();
+    it = it_begin(removed);
+    while(it_hasNext(it)) {
+        ir_proc proc = it_next(it);
+        gen_proc(out, s, proc->frm, proc->stmts.ir);
+        int n = emit_bytes();
+        bytes[i++] = (n + BYTES_PER_WORD - 1) / BYTES_PER_WORD * BYTES_PER_WORD;
+    }
+    it_free(&it);
+    fclose(out);
+
+    list_delete(s->ir->procs);
+    s->ir->procs = procs;
+    stk_init(s);
 }
 
 // Generate a sequence of assembly instructions
@@ -105,6 +157,9 @@ void gen_proc(FILE *out, structures s, frame frm, list stmts) {
     }
     it_free(&it);
 
+    // Size the stacks of any forked threads
+    stk_sizeThreads(s, frm, stmts);
+
     // Begin emission of procedure instructions
     emit_sec(out, name);
     emit(out, ".globl %s", name);
@@ -112,6 +167,7 @@ void gen_proc(FILE *out, structures s, frame frm, list stmts) {
     emit(out, ".align 4"); // Word-align procedures so they can be read from memory
     fprintf(out, "%s:\n", name);
 
+    wct_beginProc(name);
     frm_genPrologue(frm, out);
 
     it = it_begin(stmts);
@@ -123,6 +179,7 @@ void gen_proc(FILE *out, structures s, frame frm, list stmts) {
     it_free(&it);
 
     frm_genEpilogue(frm, out);
+    wct_endProc();
     fprintf(out, "\n%s:\n", procBottomLblStr(name));
     emit(out, ".cc_bottom %s.function\n", name);
     emit(out, "");
@@ -139,17 +196,21 @@ static void gen_stmt(FILE *out, structures s, frame f, i_stmt stmt, bool last) {
     //printf("gen stmt %d\n", stmt->pos);
     switch (stmt->type) {
     case t_LABEL:  
-        fprintf(out, "%s:\n", lbl_name(stmt->u.LABEL)); break;
+        fprintf(out, "%s:\n", lbl_name(stmt->u.LABEL));
+        wct_label(lbl_name(stmt->u.LABEL));            break;
     case t_JUMP:     gen_jump(out, stmt);               break;
     case t_CJUMP:    gen_cjump(out, stmt);              break;
     case t_MOVE:     gen_move(out, s, f, stmt);         break;
     case t_INPUT:    gen_input(out, stmt);              break;
     case t_OUTPUT:   gen_output(out, stmt);             break;
+    case t_OPEN:     gen_open(out, stmt);               break;
+    case t_CLOSE:    gen_close(out, stmt);              break;
     case t_FORK:     gen_fork(out, stmt);               break;
     case t_FORKSET:  gen_forkSet(out, stmt);            break;
     case t_FORKSYNC: gen_forkSync(out, stmt);           break;
     case t_JOIN:     gen_join(out, stmt);               break;
     case t_ON:       gen_on(out, s, f, stmt);           break;
+    case t_ONJOIN:   gen_onJoin(out, f, stmt);          break;
     case t_CONNECT:  gen_connect(out, f, stmt);         break;
     case t_RETURN:   gen_return(out, s, stmt, last);    break;
     case t_PCALL:    gen_pCall(out, s, f, stmt);        break;
@@ -172,8 +233,12 @@ static void gen_jump(FILE *out, i_stmt stmt) {
 static void gen_cjump(FILE *out, i_stmt stmt) {
     temp t = stmt->u.CJUMP.expr->u.TEMP;
     label trueBranch = (label) stmt->u.CJUMP.then->u.NAME;
+    label falseBranch = (label) stmt->u.CJUMP.other->u.NAME;
 
-    if(stmt->pos < lbl_pos(trueBranch))
+    // Fall through to the true branch
+    if(lbl_pos(trueBranch) == stmt->pos + 1)
+        emit_1rl(out, i_BF, tmp_reg(t), lbl_name(falseBranch));
+    else if(stmt->pos < lbl_pos(trueBranch))
         emit_1rl(out, i_BT, tmp_reg(t), lbl_name(trueBranch));
     else
         emit_1rl(out, i_BT, tmp_reg(t), lbl_name(trueBranch));
@@ -202,7 +267,7 @@ static void gen_move(FILE *out, structures s, frame f, i_stmt stmt) {
         case t_CONST:  gen_const   (out, s, dstReg, src);    break;
         case t_BINOP:  gen_binop   (out, s, dstReg, src);    break;
         case t_MEM:    gen_load    (out, f, dst, src);       break;
-        case t_FCALL:  gen_fnCall  (out, s, f, src, dstReg); break;
+        case t_FCALL:  gen_fnCall  (out, s, f, stmt, dstReg); break;
         default: assert(0 &&
                 "Invalid move src i_expr type for source t_TEMP");
         }
@@ -223,17 +288,13 @@ static void gen_input(FILE *o, i_stmt stmt) {
     
     switch(src->type) {
     case t_TEMP:
-        emit_2r(o, i_IN, tmp_reg(src->u.TEMP), tmp_reg(dst->u.TEMP));
+        emit_2r(o, i_IN, tmp_reg(dst->u.TEMP), tmp_reg(src->u.TEMP));
         break;
     case t_SYS: {
-        int offreg = tmp_reg(src->u.SYS.value->u.TEMP);
-        emit_1rl(o, i_LDAWDP, 11, LBL_CHAN_ARRAY);
-        emit_3r (o, i_LDW, 11, 11, offreg);
-        emit_1ru(o, i_CHKCT, 11, CT_BEGIN); 
-        emit_1ru(o, i_OUTCT, 11, CT_BEGIN); 
-        emit_2r (o, i_OUT, 11, tmp_reg(dst->u.TEMP));
-        emit_1ru(o, i_CHKCT, 11, CT_END); 
-        emit_1ru(o, i_OUTCT, 11, CT_END); 
+        gen_chanEnd(o, 11, src);
+        gen_handshake(o, 11, false, CT_BEGIN);
+        emit_2r (o, i_IN, tmp_reg(dst->u.TEMP), 11);
+        gen_handshake(o, 11, false, CT_END);
         break;
     }
     default: assert("output dst not TEMP or SYS");
@@ -253,21 +314,54 @@ static void gen_output(FILE *o, i_stmt stmt) {
         emit_2r(o, i_OUT, tmp_reg(dst->u.TEMP), tmp_reg(src->u.TEMP));
         break;
     case t_SYS: {
-        int offreg = tmp_reg(dst->u.SYS.value->u.TEMP);
-        emit_1rl(o, i_LDAWDP, 11, LBL_CHAN_ARRAY);
-        emit_3r (o, i_LDW, 11, 11, offreg);
-        emit_1ru(o, i_OUTCT, 11, CT_BEGIN); 
-        emit_1ru(o, i_CHKCT, 11, CT_BEGIN); 
+        gen_chanEnd(o, 11, dst);
+        gen_handshake(o, 11, true, CT_BEGIN);
         emit_2r (o, i_OUT, 11, tmp_reg(src->u.TEMP));
-        emit_1ru(o, i_OUTCT, 11, CT_END); 
-        emit_1ru(o, i_CHKCT, 11, CT_END); 
+        gen_handshake(o, 11, true, CT_END);
         break;
     }
     default: assert("output dst not TEMP or SYS");
     }
 }
 
-// Fork a set of synchronous threads
+// Open a system channel for a stream of words
+static void gen_open(FILE *o, i_stmt stmt) {
+    i_expr end = stmt->u.STREAM.end;
+    bool output = stmt->u.STREAM.output;
+    assert(end->type == t_TEMP && "open end not TEMP");
+    gen_chanEnd(o, tmp_reg(end->u.TEMP), stmt->u.STREAM.chan);
+    gen_handshake(o, tmp_reg(end->u.TEMP), output, CT_BEGIN);
+}
+
+// Close a system channel after a stream of words
+static void gen_close(FILE *o, i_stmt stmt) {
+    i_expr end = stmt->u.STREAM.end;
+    assert(end->type == t_TEMP && "close end not TEMP");
+    gen_handshake(o, tmp_reg(end->u.TEMP), stmt->u.STREAM.output, CT_END);
+}
+
+// Make one end of a control token handshake
+static void gen_handshake(FILE *o, int reg, bool output, int token) {
+    chn_op ops[2];
+    int n = chn_handshake(output, token, ops);
+    int i;
+    for(i=0; i<n; i++)
+        emit_1ru(o, ops[i].op == t_chn_outct ? i_OUTCT : i_CHKCT, 
+                reg, ops[i].token);
+}
+
+// Load the resource identifier of a channel in the system array
+static void gen_chanEnd(FILE *o, int reg, i_expr chan) {
+    assert(chan->type == t_SYS && "channel not SYS");
+    int offreg = tmp_reg(chan->u.SYS.value->u.TEMP);
+    emit_1rl(o, i_LDAWDP, 11, LBL_CHAN_ARRAY);
+    emit_3r (o, i_LDW, reg, 11, offreg);
+}
+
+// Fork a set of synchronous threads. The stack space for all of them is
+// taken from the global sp at once, leaving its base in the space register.
+// For replicated threads, it is the space for each times their count, and 
+// the space register is left at the sp of the first.
 static void gen_fork(FILE *out, i_stmt stmt) {
     emit(out, "%s Begin fork", ASM_COMMENT);
 
@@ -278,8 +372,27 @@ static void gen_fork(FILE *out, i_stmt stmt) {
     int syncReg = tmp_reg(stmt->u.FORK.t1->u.TEMP);
     int spaceReg = tmp_reg(stmt->u.FORK.t3->u.TEMP); 
     
+    // Move sp away: space := sp - space * count and save it
+    if(stmt->u.FORK.count != NULL) {
+        int countReg = tmp_reg(stmt->u.FORK.count->u.TEMP);
+        emit_1ru(out, i_LDC,     spaceReg, stmt->u.FORK.space);
+        emit_3r (out, i_MUL,     spaceReg, countReg, spaceReg);
+        emit_1rl(out, i_LDWDP,   REG_GDEST, "sp");
+        emit_3r (out, i_SUB,     spaceReg, REG_GDEST, spaceReg);
+        emit_1rl(out, i_STWDP,   spaceReg, "sp");
+        emit_1ru(out, i_LDC,     REG_GDEST, stmt->u.FORK.spOff);
+        emit_3r (out, i_ADD,     spaceReg, spaceReg, REG_GDEST);
+    }
+    
+    // Move sp away: space := sp - space and save it
+    else if(stmt->u.FORK.space > 0) {
+        emit_1rl(out, i_LDWDP,   REG_GDEST, "sp");
+        emit_1ru(out, i_LDC,     spaceReg, stmt->u.FORK.space);
+        emit_3r (out, i_SUB,     spaceReg, REG_GDEST, spaceReg);
+        emit_1rl(out, i_STWDP,   spaceReg, "sp");
+    }
+    
     // Get a synchroniser
-    emit_1ru(out, i_LDC, spaceReg, THREAD_STACK_SPACE);
     emit_1ru(out, i_GETR, syncReg, RES_TYPE_SYNC);
 }
 
@@ -301,11 +414,35 @@ static void gen_forkSet(FILE *out, i_stmt stmt) {
     emit_l  (out, i_LDAP,    lbl_name(stmt->u.FORKSET.l));
     emit_2r (out, i_TINITLR, REG_GDEST, thread);
 
-    // Move sp away: sp -= 0x1000 and save it
-    emit_1rl(out, i_LDWDP,   REG_GDEST, "sp");
-    emit_3r (out, i_SUB,     REG_GDEST, REG_GDEST, space);
-    emit_1rl(out, i_STWDP,   REG_GDEST, "sp");
+    // Set sp within the fork's space, by the index of a replicated thread
+    gen_forkSp(out, stmt);
+    emit_3r (out, i_ADD,     REG_GDEST, space, REG_GDEST);
     emit_2r (out, i_TINITSP, REG_GDEST, thread);
+
+    // Copy the spilled values it reads into its frame, stepping the space
+    // register to each slot in turn and back, as r11 carries each value
+    if(stmt->u.FORKSET.numSlots > 0) {
+        int base = 0;
+        int i;
+        gen_forkSp(out, stmt);
+        emit_3r (out, i_ADD,     space, space, REG_GDEST);
+        for(i=0; i<stmt->u.FORKSET.numSlots; i++) {
+            int slot = stmt->u.FORKSET.slots[i];
+            if(!gen_inImmRangeS(slot - base)) {
+                emit_1ru(out, i_LDC,  REG_GDEST, BYTES_PER_WORD * (slot - base));
+                emit_3r (out, i_ADD,  space, space, REG_GDEST);
+                base = slot;
+            }
+            emit_1ru(out, i_LDWSP, REG_GDEST, slot);
+            emit_2ru(out, i_STWI,  REG_GDEST, space, slot - base);
+        }
+        if(base > 0) {
+            emit_1ru(out, i_LDC,  REG_GDEST, BYTES_PER_WORD * base);
+            emit_3r (out, i_SUB,  space, space, REG_GDEST);
+        }
+        gen_forkSp(out, stmt);
+        emit_3r (out, i_SUB,     space, space, REG_GDEST);
+    }
     
     // Setup dp, cp
     emit_1ru(out, i_LDAWDP,  REG_GDEST, 0);
@@ -313,19 +450,38 @@ static void gen_forkSet(FILE *out, i_stmt stmt) {
     emit_1ru(out, i_LDAWCP,  REG_GDEST, 0);
     emit_2r (out, i_TINITCP, REG_GDEST, thread);
 
-    // Copy register values
-    emit_3r (out, i_TSETR, thread, 0,  0);
-    emit_3r (out, i_TSETR, thread, 1,  1);
-    emit_3r (out, i_TSETR, thread, 2,  2);
-    emit_3r (out, i_TSETR, thread, 3,  3);
-    emit_3r (out, i_TSETR, thread, 4,  4);
-    emit_3r (out, i_TSETR, thread, 5,  5);
-    emit_3r (out, i_TSETR, thread, 6,  6);
-    emit_3r (out, i_TSETR, thread, 7,  7);
-    emit_3r (out, i_TSETR, thread, 8,  8);
-    emit_3r (out, i_TSETR, thread, 9,  9);
-    emit_3r (out, i_TSETR, thread, 10, 10);
-    emit_3r (out, i_TSETR, thread, 11, 11);
+    // Copy the values of registers live into the thread
+    bool regs[NUM_GPRS];
+    int reg;
+    for(reg=0; reg<NUM_GPRS; reg++)
+        regs[reg] = stmt->u.FORKSET.live == NULL;
+    if(stmt->u.FORKSET.live != NULL) {
+        iterator it = it_begin(set_elements(stmt->u.FORKSET.live));
+        while(it_hasNext(it)) {
+            temp t = it_next(it);
+            if(tmp_getAccess(t) == t_tmpAccess_reg 
+                    && tmp_reg(t) >= 0 && tmp_reg(t) < NUM_GPRS)
+                regs[tmp_reg(t)] = true;
+        }
+        it_free(&it);
+    }
+    for(reg=0; reg<NUM_GPRS; reg++) {
+        if(regs[reg])
+            emit_3r(out, i_TSETR, thread, reg, reg);
+        else
+            stat_numElidedRegCopies++;
+    }
+}
+
+// Load the byte offset of a thread's sp in its fork's space
+static void gen_forkSp(FILE *out, i_stmt stmt) {
+    if(stmt->u.FORKSET.index != NULL) {
+        int index = tmp_reg(stmt->u.FORKSET.index->u.TEMP);
+        emit_1ru(out, i_LDC,     REG_GDEST, stmt->u.FORKSET.stride);
+        emit_3r (out, i_MUL,     REG_GDEST, index, REG_GDEST);
+    }
+    else 
+        emit_1ru(out, i_LDC,     REG_GDEST, stmt->u.FORKSET.spOff);
 }
 
 // Synchronise (run) threads
@@ -363,16 +519,22 @@ static void gen_on(FILE *o, structures s, frame f, i_stmt stmt) {
 
     // Calculate the size of the closure and extend the frame to accommodate it
     int numProcs = 1 + list_size(ir_childCalls(proc));
-    // |header| + 2*#args + #procs + |preserved|
-    int closureSize = 2 + 2*list_size(args) + numProcs + 3;
+    // |header| + 2*#args + #procs
+    int closureSize = CLOSURE_ARGS + 2*list_size(args) + numProcs;
     int extend = closureSize - frm_numOutArgs(f);
+    if(extend < 0) extend = 0;
+
+    // The handle of an asynchronous on is returned in r0
+    int handleReg = stmt->u.ON.handle == NULL ? -1 
+        : tmp_reg(stmt->u.ON.handle->u.TEMP);
+
+    // Preserve any of r0-r3 live across the migration, before sp moves
+    frm_preserveLiveRegs(f, o, stmt->out, handleReg, true);
     
-    // If we need to extend, save the original sp value
-    if(extend) {
-        emit_1ru(o, i_LDAWSP, 11, 0);
-        emit_1ru(o, i_STWSP, 11, frm_outArgOff(f));
+    // Extend the stack below the outgoing arguments. The closure then fills
+    // them and the new space, and never the preserved registers above.
+    if(extend)
         emit_u(o, i_EXTSP, extend);
-    }
 
     // sp[c] := number of arguments
     emit_1ru(o, i_LDC, 11, list_size(args));
@@ -382,9 +544,22 @@ static void gen_on(FILE *o, structures s, frame f, i_stmt stmt) {
     emit_1ru(o, i_LDC, 11, numProcs);
     emit_1ru(o, i_STWSP, 11, spOff++);
 
-    // sp[c+2] ... sp[c+2+|args|]: arguments
+    // sp[c+2] := argument modes
     signature sig = sigTab_lookup(s->sig, frm_name(proc->frm));
-    int i=0;
+    int modes = 0;
+    int i;
+    for(i=0; i<list_size(args); i++) {
+        t_formal type = sig_getFmlType(sig, i);
+        if(type == t_formal_intArray || type == t_formal_chanArray)
+            modes |= sig_getFmlMode(sig, i) << (2*i);
+        else
+            modes |= ARG_MODE_IN << (2*i);
+    }
+    emit_1ru(o, i_LDC, 11, modes);
+    emit_1ru(o, i_STWSP, 11, spOff++);
+
+    // sp[c+3] ... sp[c+3+|args|]: arguments
+    i = 0;
     iterator it = it_begin(args);
     while(it_hasNext(it)) {
         
@@ -412,7 +587,7 @@ static void gen_on(FILE *o, structures s, frame f, i_stmt stmt) {
     emit_1ru(o, i_LDC,   11, proc->pos+JUMP_INDEX_OFFSET);
     emit_1ru(o, i_STWSP, 11, spOff++);
 
-    // sp[c+2+|args|+1] ... sp[c+2+|args|+1+|children|]
+    // sp[c+3+|args|+1] ... sp[c+3+|args|+1+|children|]
     it = it_begin(ir_childCalls(proc));
     while(it_hasNext(it)) {
         ir_proc child = it_next(it);
@@ -423,11 +598,6 @@ static void gen_on(FILE *o, structures s, frame f, i_stmt stmt) {
     }
     it_free(&it);
 
-    // Preserve r0, r1, r2
-    emit_1ru(o, i_STWSP, 0, spOff++);
-    emit_1ru(o, i_STWSP, 1, spOff++);
-    emit_1ru(o, i_STWSP, 2, spOff++);
-    
     assert((spOff - closureOffset == closureSize) && "invlalid closure size");
 
     // r0 (arg1) := destination
@@ -439,23 +609,48 @@ static void gen_on(FILE *o, structures s, frame f, i_stmt stmt) {
     // r2 (arg3) := closure array length (hidden array length argument)
     emit_1ru(o, i_LDC, 2, closureSize);
 
-    // Call the migration routine
-    emit(o, "bla cp[%d]", JUMPI_MIGRATE);
+    // Call the migration routine, or start it without waiting and move the
+    // handle out of r0 before it is overwritten
+    if(handleReg == -1)
+        emit_bla(o, JUMPI_MIGRATE);
+    else {
+        emit_bla(o, JUMPI_MIGRATE_ASYNC);
+        if(handleReg != 0)
+            emit_2r(o, i_MOVE, handleReg, 0);
+    }
        
-    // Restore saved registers
-    emit_1ru(o, i_LDWSP, 0, spOff-3);
-    emit_1ru(o, i_LDWSP, 1, spOff-2);
-    emit_1ru(o, i_LDWSP, 2, spOff-1);
-    
     // Contract stack
     if(extend) {
-        emit_1ru(o, i_LDWSP, 11, extend+frm_outArgOff(f));
+        emit_1ru(o, i_LDAWSP, 11, extend);
         emit_1r (o, i_SETSP, 11);
     }
 
+    // Restore saved registers
+    frm_preserveLiveRegs(f, o, stmt->out, handleReg, false);
+
     emit(o, "/* end on */");
 }
 
+// Join an asynchronous on: wait for it to complete and receive its results
+static void gen_onJoin(FILE *o, frame f, i_stmt stmt) {
+    
+    i_expr handle = stmt->u.ONJOIN.handle;
+    assert(handle->type == t_TEMP && "ONJOIN handle not TEMP");
+
+    emit(o, "/* begin join */");
+
+    // Preserve any of r0-r3 live across the call
+    frm_preserveLiveRegs(f, o, stmt->out, -1, true);
+    
+    gen_temp(o, 0, handle);
+    emit_bla(o, JUMPI_JOIN_ASYNC);
+    
+    // Restore r0-r3
+    frm_preserveLiveRegs(f, o, stmt->out, -1, false);
+    
+    emit(o, "/* end join */");
+}
+
 // Generate a connect statement
 static void gen_connect(FILE *o, frame f, i_stmt stmt) {
     
@@ -475,11 +670,8 @@ static void gen_connect(FILE *o, frame f, i_stmt stmt) {
 
     emit(o, "/* begin connect */");
 
-    // Preserve r0, r1, r2
-    int offset = frm_preservedOff(f);
-    emit_1ru(o, i_STWSP, 0, offset);
-    emit_1ru(o, i_STWSP, 1, offset+1);
-    emit_1ru(o, i_STWSP, 2, offset+2);
+    // Preserve any of r0-r3 live across the call
+    frm_preserveLiveRegs(f, o, stmt->out, -1, true);
   
     // Move the temps into the parameter regs
     gen_temp(o, 0, to->u.SYS.value);
@@ -487,12 +679,10 @@ static void gen_connect(FILE *o, frame f, i_stmt stmt) {
     gen_temp(o, 2, c2->u.SYS.value);
 
     // Call connect
-    emit(o, "bla cp[%d]", JUMPI_CONNECT);
+    emit_bla(o, JUMPI_CONNECT);
     
-    // Restore r0, r1, r2
-    emit_1ru(o, i_LDWSP, 0, offset);
-    emit_1ru(o, i_LDWSP, 1, offset+1);
-    emit_1ru(o, i_LDWSP, 2, offset+2);
+    // Restore r0-r3
+    frm_preserveLiveRegs(f, o, stmt->out, -1, false);
     
     emit(o, "/* end connect */");
 }
@@ -509,23 +699,27 @@ static void gen_return(FILE *out, structures s, i_stmt stmt, bool last) {
     default: assert(0 && "Invalid return i_expr type");
     }
     
-    // Jump to the epilogue (will always be at end)
-    if(!last)
-        emit_l(out, i_BU, lbl_name(stmt->u.RETURN.end->u.NAME));
+    // Jump to the epilogue (will always be at end), unless it follows
+    label end = stmt->u.RETURN.end->u.NAME;
+    if(!last && lbl_pos(end) != stmt->pos + 1)
+        emit_l(out, i_BU, lbl_name(end));
 }
 
 // Generate a procedure call
 static void gen_pCall(FILE *out, structures s, frame f, i_stmt stmt) {
     string name = lbl_name(stmt->u.PCALL.proc->u.NAME);
     ir_proc p = list_getFirst(s->ir->procs, name, &isNamedProc);
-    frm_genCall(f, stmt->u.PCALL.proc, stmt->u.PCALL.args, -1, p->pos, out);
+    frm_genCall(f, stmt->u.PCALL.proc, stmt->u.PCALL.args, stmt->out, 
+            -1, p->pos, out);
 }
 
 // Generate a function call; work out if it's a forward of backwards reference
-static void gen_fnCall(FILE *out, structures s, frame f, i_expr expr, int dstReg) {
+static void gen_fnCall(FILE *out, structures s, frame f, i_stmt stmt, int dstReg) {
+    i_expr expr = stmt->u.MOVE.src;
     string name = lbl_name(expr->u.FCALL.func->u.NAME);
     ir_proc p = list_getFirst(s->ir->procs, name, &isNamedProc);
-    frm_genCall(f, expr->u.FCALL.func, expr->u.FCALL.args, dstReg, p->pos, out);
+    frm_genCall(f, expr->u.FCALL.func, expr->u.FCALL.args, stmt->out, 
+            dstReg, p->pos, out);
 }
 
 //========================================================================
@@ -561,12 +755,14 @@ static void gen_binop(FILE *out, structures s, int dstReg, i_expr binop) {
     case t_TEMP: regB = tmp_reg(right->u.TEMP); break;
     case t_CONST:
         imm = right->u.CONST;
-        isImm = gen_inImmRangeS(imm)
+        isImm = (gen_inImmRangeS(imm)
             && (opType == i_plus
              || opType == i_minus
-             || opType == i_eq
-             || opType == i_lshift
-             || opType == i_rshift);
+             || opType == i_eq))
+            || (gen_inBitpRange(imm)
+            && (opType == i_lshift
+             || opType == i_rshift
+             || opType == i_ashr));
         if(!isImm) {
             regB = dstReg;
             gen_const(out, s, regB, right);
@@ -584,6 +780,7 @@ static void gen_binop(FILE *out, structures s, int dstReg, i_expr binop) {
         case i_eq:     op = i_EQI;  break;
         case i_lshift: op = i_SHLI; break;
         case i_rshift: op = i_SHRI; break;
+        case i_ashr:   op = i_ASHRI; break;
         default: assert(0 && "unrecognised imm BINOP");
         }
         emit_2ru(out, op, dstReg, regA, imm);
@@ -608,6 +805,14 @@ static void gen_binop(FILE *out, structures s, int dstReg, i_expr binop) {
             emit_3r(out,  i_LSS, dstReg, regA, regB);
             emit_2ru(out, i_EQI, dstReg, dstReg, 0);
             break;
+
+        // High word of an unsigned multiply: lmul d:e = x * y + v + w, using
+        // r11 as the discarded low word and zero addends
+        case i_mulhu:
+            emit_1ru(out, i_LDC, REG_GDEST, 0);
+            emit_l6r(out, i_LMUL, dstReg, REG_GDEST, regA, regB, 
+                    REG_GDEST, REG_GDEST);
+            break;
     
         // Regular BINOPs
         default:
@@ -622,6 +827,7 @@ static void gen_binop(FILE *out, structures s, int dstReg, i_expr binop) {
             case i_xor:    op = i_XOR;  break;
             case i_lshift: op = i_SHL;  break; 
             case i_rshift: op = i_SHR;  break;
+            case i_ashr:   op = i_ASHR; break;
             case i_eq:     op = i_EQ;   break; 
             case i_ls:     op = i_LSS;  break;
             default: assert(0 && "unrecognised BINOP");
@@ -970,6 +1176,28 @@ static void gen_consts(FILE *out, list consts) {
     }
 }
 
+// Generate the static channel routing table: a (core, chan) pair for each
+// program channel, or CONN_NONE if it is connected at run time
+static void gen_connTable(FILE *out) {
+    int i, core, dest;
+
+    emit_sec(out, "Channel routing table");
+    emit(out, ".section .cp.rodata, \"ac\", @progbits");
+    emit(out, ".align 4\n");
+    
+    emit(out, ".globl %s", LBL_CONN_TABLE);
+    emit(out, ".globl %s.globound", LBL_CONN_TABLE);
+    emit(out, ".set %s.globound, %d", LBL_CONN_TABLE,
+            BYTES_PER_WORD*2*NUM_PROG_CHANS);
+    fprintf(out, "%s:\n", LBL_CONN_TABLE);
+    for(i=0; i<NUM_PROG_CHANS; i++) {
+        if(rte_dest(i, &core, &dest))
+            emit(out, ".word %d, %d", core, dest);
+        else
+            emit(out, ".word %d, %d", CONN_NONE, CONN_NONE);
+    }
+}
+
 // Generate jump table
 static void gen_jumpTable(FILE *out, structures s) {
     
@@ -986,6 +1214,8 @@ static void gen_jumpTable(FILE *out, structures s) {
     emit(out, ".word %s", LBL_MIGRATE);
     emit(out, ".word %s", LBL_INIT_THREAD);
     emit(out, ".word %s", LBL_CONNECT);
+    emit(out, ".word %s", LBL_MIGRATE_ASYNC);
+    emit(out, ".word %s", LBL_JOIN_ASYNC);
 
     // Jump table
     iterator it = it_begin(s->ir->procs);
@@ -1107,6 +1337,12 @@ bool gen_inImmRangeL(int value) {
     return value < 0xFFFF;
 }
 
+// Shift immediates are encoded as a bit position: 1-8, 16, 24 or 32
+bool gen_inBitpRange(int value) {
+    return (value >= 1 && value <= 8) 
+        || value == 16 || value == 24 || value == 32;
+}
+
 // =======================================================================
 // Assembly emission
 // =======================================================================
@@ -15,8 +15,10 @@
 #define REG_GDEST      11
 
 void   gen_program     (FILE *, FILE *, FILE *, structures);
+void   gen_procBytes   (structures, list, int *);
 string gen_procLabelStr(string);
 bool   gen_inImmRangeS (int);
 bool   gen_inImmRangeL (int);
+bool   gen_inBitpRange (int);
 
 #endif
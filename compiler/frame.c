@@ -3,6 +3,7 @@
 #include "frame.h"
 #include "codegen.h"
 #include "instructions.h"
+#include "statistics.h"
 
 // Register usage types
 typedef enum {
@@ -28,6 +29,8 @@ struct frame_ {
     int arraySpace;
     int localSpace;
     int numPreserved;
+    int numElided;
+    int numShared;
     int inArgOffset;
     tempMap temps;
     regUsageType regUsage[NUM_GPRS];
@@ -86,7 +89,7 @@ static frm_access   InFrame(t_accessType, string, int);
 static frm_access   InReg(t_accessType, string, int);
 static bool         cmpAccessName(void *, void *);
 static string       savedRegStr(int);
-static void         preserveParamRegs(frame, FILE *, int, bool);
+static void         liveParamRegs(frame, set, int, bool *);
 static void         initArgs(FILE *, list);
 static string       accessStr(frm_access);
 static t_accessType getFormalAccessType(t_formal);
@@ -100,6 +103,11 @@ frame frm_New(label name, list refs) {
     f->maxOutArgs = 0;
     f->numOutArgs = 0;
     f->numUsedParamRegs = 0;
+    f->arraySpace = 0;
+    f->localSpace = 0;
+    f->numPreserved = 0;
+    f->numElided = 0;
+    f->numShared = 0;
     f->inArgOffset = 0;
     f->temps = tmp_New();
     f->formals = list_New();
@@ -193,6 +201,35 @@ int frm_allocLocal(frame f, string name) {
     return a->u.offset;
 }
 
+// Return the index of the local (spill) slot at a local offset, or -1 if the
+// offset is not a local slot
+int frm_localSlot(frame f, int offset) {
+    int slot = offset - f->arraySpace;
+    return slot >= 0 && slot < f->localSpace ? slot : -1;
+}
+
+// Return the number of local (spill) slots
+int frm_numLocalSlots(frame f) {
+    return f->localSpace;
+}
+
+// Share local slots between locals with disjoint live ranges, where colour
+// maps each original slot to its new one
+void frm_shareLocals(frame f, int *colour, int numColours) {
+    iterator it = it_begin(f->locals);
+    while(it_hasNext(it)) {
+        frm_access a = it_next(it);
+        if(a->type == t_access_local) {
+            int slot = frm_localSlot(f, a->u.offset);
+            if(slot != -1)
+                a->u.offset = f->arraySpace + colour[slot];
+        }
+    }
+    it_free(&it);
+    f->numShared += f->localSpace - numColours;
+    f->localSpace = numColours;
+}
+
 // Allocate space for a perserved register
 static int frm_allocPreserved(frame f, int reg) {
     //printf("allocating preserved r%d in %s\n", reg, frm_name(f));
@@ -342,9 +379,12 @@ void frm_setUsedRegs(frame f, list usedRegs) {
         if(reg >= NUM_PARAM_REGS && reg < NUM_GPRS)
             frm_allocPreserved(f, reg);
 
-        // If we need to preserve any of r0-r3 
-        if(reg < NUM_PARAM_REGS /*&& reg < f->maxOutArgs*/)
-            frm_allocPreserved(f, reg);
+        // If we need to preserve any of r0-r3: only around calls, so a leaf
+        // procedure needs no space for them
+        if(reg >= 0 && reg < NUM_PARAM_REGS) {
+            if(f->branchLink) frm_allocPreserved(f, reg);
+            else              f->numElided++;
+        }
     }
     it_free(&it);
 }
@@ -361,6 +401,13 @@ void frm_setUsedRegs(frame f, list usedRegs) {
 //  - Load m params passed on stack from SP[n+1] to SP[n+m]
 void frm_genPrologue(frame f, FILE *out) {
     //fprintf(out, "; Procedure prologue: %s\n", frm_name(f));
+    
+    // A frameless leaf has nothing to save and no stack to extend
+    if(frm_isFrameless(f)) {
+        stat_numFramelessProcs++;
+        return;
+    }
+
     emit_u(out, i_ENTSP, frm_size(f));
 
     int i;
@@ -393,29 +440,54 @@ void frm_genEpilogue(frame f, FILE *out) {
         }
     }
     
+    // A frameless leaf returns with "RETSP 0", i.e. a plain branch to lr
     emit_u(out, i_RETSP, frm_size(f));
 }
 
-// Store or load presevred parameter registers (r0-r3), excluding the
-// destination register
-// TODO: if a param reg is not used in the function body - i.e. it is not
-// returned in the used set, then don't preserve it otherwise this assertion
-// will trigger
-static void preserveParamRegs(frame f, FILE *out, int dstReg, bool store) {
+// Mark the parameter registers (r0-r3) holding a value that is live-out of
+// a call site, excluding the destination register. Without liveness
+// information fall back to every parameter register used in the frame.
+static void liveParamRegs(frame f, set live, int dstReg, bool *regs) {
     int reg;
+    for(reg=0; reg<NUM_PARAM_REGS; reg++)
+        regs[reg] = live == NULL && f->regUsage[reg] != t_regUsage_unused;
+    
+    if(live != NULL) {
+        iterator it = it_begin(set_elements(live));
+        while(it_hasNext(it)) {
+            temp t = it_next(it);
+            if(tmp_getAccess(t) == t_tmpAccess_reg 
+                    && tmp_reg(t) >= 0 && tmp_reg(t) < NUM_PARAM_REGS)
+                regs[tmp_reg(t)] = true;
+        }
+        it_free(&it);
+    }
+    
+    if(dstReg >= 0 && dstReg < NUM_PARAM_REGS)
+        regs[dstReg] = false;
+}
+
+// Store or load the parameter registers (r0-r3) that are live across a call,
+// i.e. in the live-out set of the call statement. A register that is dead
+// after the call does not need to be saved. Returns the number preserved.
+int frm_preserveLiveRegs(frame f, FILE *out, set live, int dstReg, bool store) {
+    bool regs[NUM_PARAM_REGS];
+    int reg, n = 0;
+    liveParamRegs(f, live, dstReg, regs);
     for(reg=0; reg<NUM_PARAM_REGS; reg++) {
-        if(f->regUsage[reg] != t_regUsage_unused) {
+        if(regs[reg]) {
             frm_access a = list_getFirst(f->preserved, 
                     savedRegStr(reg), &cmpAccessName);
             //printf("preserving param reg %d\n", reg);
             assert(a != NULL && "frm_access NULL for parameter register");
-            if(reg != dstReg) {
-                int offset = frm_preservedOff(f) + a->u.offset;
-                if(store) emit_1ru(out, i_STWSP, reg, offset);
-                else      emit_1ru(out, i_LDWSP, reg, offset);
-            }
+            int offset = frm_preservedOff(f) + a->u.offset;
+            if(store) emit_1ru(out, i_STWSP, reg, offset);
+            else      emit_1ru(out, i_LDWSP, reg, offset);
+            n++;
         }
     }
+    if(store) stat_numCallerSaves += n;
+    return n;
 }
 
 // Initialise procedure call arguments
@@ -458,13 +530,13 @@ static void initArgs(FILE *out, list args) {
 //   pushed on stack from sp[1] to sp[m+1]
 // - Call function f with "bl f" (LR = pc+1)
 // - Read return values 1-4 from r0-r3 and 5-r from SP[m+1] to SP[m+k]
-void frm_genCall(frame f, i_expr proc, list args, int dstReg, 
+void frm_genCall(frame f, i_expr proc, list args, set live, int dstReg, 
         int callIndex, FILE *out) {
 
     emit(out, "%s begin call %s", ASM_COMMENT, lbl_name(proc->u.NAME));
     
-    // Preserve param regs
-    preserveParamRegs(f, out, dstReg, true);
+    // Preserve param regs live across the call
+    frm_preserveLiveRegs(f, out, live, dstReg, true);
     
     // Move parameter values into registers and stack locations
     initArgs(out, args);
@@ -480,11 +552,22 @@ void frm_genCall(frame f, i_expr proc, list args, int dstReg,
         emit_2r(out, i_MOVE, dstReg, 0);
 
     // Restore saved parameter registers
-    preserveParamRegs(f, out, dstReg, false);
+    frm_preserveLiveRegs(f, out, live, dstReg, false);
 
     emit(out, "%s end call %s", ASM_COMMENT, name);
 }
 
+// A leaf procedure makes no calls, migrations or connects
+bool frm_isLeaf(frame f) {
+    return !f->branchLink;
+}
+
+// A frameless procedure is a leaf with no spills, local arrays or preserved
+// registers, so it has no stack frame and needs no prologue or epilogue
+bool frm_isFrameless(frame f) {
+    return frm_isLeaf(f) && frm_size(f) == 0;
+}
+
 // Frame offsets for memory accesses
 int frm_size(frame f) {
     return f->branchLink 
@@ -506,6 +589,10 @@ int frm_arrayOff(frame f) {
     return frm_preservedOff(f) + f->numPreserved; 
 }
 
+int frm_arraySpace(frame f) {
+    return f->arraySpace;
+}
+
 int frm_localOff(frame f) {
     return frm_arrayOff(f) + f->arraySpace; 
 }
@@ -613,9 +700,16 @@ void frm_dump(FILE *out, frame f) {
     fprintf(out, "  # used param regs:    %d\n", f->numUsedParamRegs);
     fprintf(out, "  # array space:        %d\n", f->arraySpace);
     fprintf(out, "  # local space:        %d\n", f->localSpace);
+    fprintf(out, "  # shared local slots: %d\n", f->numShared);
     fprintf(out, "  # preserved regs:     %d\n", f->numPreserved);
     fprintf(out, "  # outgoing arg space: %d\n", f->maxOutArgs);
 
+    fprintf(out, "\nLeaf:\n");
+    fprintf(out, "  Leaf procedure:       %s\n", frm_isLeaf(f) ? "yes" : "no");
+    fprintf(out, "  Frameless:            %s\n", frm_isFrameless(f) ? "yes" : "no");
+    fprintf(out, "  # words saved:        %d\n", f->numElided + f->numShared);
+    fprintf(out, "  # instructions saved: %d\n", frm_isFrameless(f) ? 1 : 0);
+
     fprintf(out, "\nFormal accesses:\n");
     iterator it = it_begin(f->formals);
     while(it_hasNext(it)) {
@@ -29,6 +29,9 @@ frame      frm_New(label, list formals);
 frm_formal frm_Formal(string, t_formal);
 int        frm_allocArray(frame, string, int);
 int        frm_allocLocal(frame, string);
+int        frm_localSlot(frame, int);
+int        frm_numLocalSlots(frame);
+void       frm_shareLocals(frame, int *, int);
 void       frm_pCallArgs(frame, int);
 //void       frm_migrateArgs(frame, int);
 int        frm_arrayOffset(frame, string);
@@ -48,13 +51,17 @@ void       frm_setUsedRegs(frame, list);
 // Calling convention
 void       frm_genPrologue(frame, FILE *);
 void       frm_genEpilogue(frame, FILE *);
-void       frm_genCall(frame, i_expr, list, int, int, FILE *);
+void       frm_genCall(frame, i_expr, list, set, int, int, FILE *);
+int        frm_preserveLiveRegs(frame, FILE *, set, int, bool);
 
 // Offsets
+bool       frm_isLeaf(frame);
+bool       frm_isFrameless(frame);
 int        frm_size(frame);
 int        frm_outArgOff(frame);
 int        frm_preservedOff(frame);
 int        frm_arrayOff(frame);
+int        frm_arraySpace(frame);
 int        frm_localOff(frame);
 int        frm_inArgOff(frame);
 int        frm_numOutArgs(frame);
@@ -1,4 +1,12 @@
+#include <stdlib.h>
 #include "instructions.h"
+#include "wcet.h"
+
+// Bytes of the instructions emitted since they were last taken
+static int numBytes = 0;
+
+static int size   (t_inst, bool, unsigned long);
+static int sizeImm(t_inst, string);
 
 // Emit a section heading
 void emit_sec(FILE *o, string title) {
@@ -15,8 +23,23 @@ void emit(FILE *o, const string format, ...) {
     fprintf(o, "\n");
 }
 
+// Call a runtime routine through its jump table entry
+void emit_bla(FILE *o, int index) {
+    numBytes += size(i_BLACP, false, index);
+    emit(o, "bla cp[%d]", index);
+}
+
+// Return the bytes of the instructions emitted since the last call
+int emit_bytes(void) {
+    int n = numBytes;
+    numBytes = 0;
+    return n;
+}
+
 // 3 register
 void emit_3r(FILE *o, t_inst mn, int op1, int op2, int op3) {
+    wct_inst(mn, op1, NULL);
+    numBytes += size(mn, false, 0);
     switch(mn) {
     case i_ADD:  emit(o, "%-6s r%d, r%d, r%d", "add",  op1, op2, op3);  break; 
     case i_SUB:  emit(o, "%-6s r%d, r%d, r%d", "sub",  op1, op2, op3);  break; 
@@ -30,6 +53,7 @@ void emit_3r(FILE *o, t_inst mn, int op1, int op2, int op3) {
     case i_SHR:  emit(o, "%-6s r%d, r%d, r%d", "shr",  op1, op2, op3);  break; 
     case i_EQ:   emit(o, "%-6s r%d, r%d, r%d", "eq",   op1, op2, op3);  break; 
     case i_LSS:  emit(o, "%-6s r%d, r%d, r%d", "lss",  op1, op2, op3);  break;  
+    case i_ASHR: emit(o, "%-6s r%d, r%d, r%d", "ashr", op1, op2, op3);  break;
     case i_LDW:  emit(o, "%-6s r%d, r%d[r%d]", "ldw",  op1, op2, op3);  break;  
     case i_STW:  emit(o, "%-6s r%d, r%d[r%d]", "stw",  op1, op2, op3);  break;
     case i_TSETR: emit(o, "%-6s t[r%d]:r%d, r%d", "set", op1, op2, op3); break;
@@ -39,12 +63,15 @@ void emit_3r(FILE *o, t_inst mn, int op1, int op2, int op3) {
 
 // 2 register unsigned
 void emit_2ru(FILE *o, t_inst mn, int op1, int op2, unsigned int imm) {
+    wct_inst(mn, op1, NULL);
+    numBytes += size(mn, false, imm);
     switch(mn) {
     case i_ADDI:  emit(o, "%-6s r%d, r%d, %d", "add", op1, op2, imm); break; 
     case i_SUBI:  emit(o, "%-6s r%d, r%d, %d", "sub", op1, op2, imm); break; 
     case i_EQI:   emit(o, "%-6s r%d, r%d, %d", "eq",  op1, op2, imm); break; 
     case i_SHLI:  emit(o, "%-6s r%d, r%d, %d", "shl", op1, op2, imm); break; 
     case i_SHRI:  emit(o, "%-6s r%d, r%d, %d", "shr", op1, op2, imm); break;
+    case i_ASHRI: emit(o, "%-6s r%d, r%d, %d", "ashr", op1, op2, imm); break;
     case i_LDAWF: emit(o, "%-6s r%d, r%d[%d]", "ldaw", op1, op2, imm); break;
     case i_STWI:  emit(o, "%-6s r%d, r%d[%d]", "stw", op1, op2, imm); break;
     case i_LDWI:
@@ -54,6 +81,8 @@ void emit_2ru(FILE *o, t_inst mn, int op1, int op2, unsigned int imm) {
 
 // 2 register
 void emit_2r(FILE *o, t_inst mn, int op1, int op2) {
+    wct_inst(mn, op1, NULL);
+    numBytes += size(mn, false, 0);
     switch(mn) {
     case i_MOVE:    emit(o, "%-6s r%d, r%d",      "mov",    op1, op2); break;
     case i_IN:      emit(o, "%-6s r%d, res[r%d]", "in",     op1, op2); break;
@@ -79,6 +108,8 @@ void emit_1ru(FILE *o, t_inst mn, int op1, unsigned int imm) {
 
 // 1 register unsigned (string)
 void emit_1rl(FILE *o, t_inst mn, int op1, string imm) {
+    wct_inst(mn, op1, imm);
+    numBytes += sizeImm(mn, imm);
     switch(mn) {
     case i_BF:     emit(o, "%-6s r%d, %s",      "bf",    op1, imm); break;
     case i_BT:     emit(o, "%-6s r%d, %s",      "bt",    op1, imm); break; 
@@ -101,6 +132,8 @@ void emit_1rl(FILE *o, t_inst mn, int op1, string imm) {
 
 // 1 register
 void emit_1r(FILE *o, t_inst mn, int op1) {
+    wct_inst(mn, op1, NULL);
+    numBytes += size(mn, false, 0);
     switch(mn) {
     case i_SETSP: emit(o, "%-6s sp, r%d",  "set",   op1); break; 
     case i_SETDP: emit(o, "%-6s dp, r%d",  "set",   op1); break; 
@@ -119,6 +152,8 @@ void emit_u(FILE *o, t_inst mn, unsigned int imm) {
 
 // Immediate label 
 void emit_l(FILE *o, t_inst mn, string imm) {
+    wct_inst(mn, -1, imm);
+    numBytes += sizeImm(mn, imm);
     switch(mn) {
     case i_BL:     emit(o, "%-6s %s",          "bl",    imm); break;
     case i_BU:     emit(o, "%-6s %s",          "bu",    imm); break; 
@@ -135,6 +170,8 @@ void emit_l(FILE *o, t_inst mn, string imm) {
 
 // 0 register
 void emit_0r(FILE *o, t_inst mn) {
+    wct_inst(mn, -1, NULL);
+    numBytes += size(mn, false, 0);
     switch(mn) {
     case i_SSYNC:  emit(o, "%-6s", "ssync");  break; 
     case i_WAITEU: emit(o, "%-6s", "waiteu"); break; 
@@ -142,3 +179,44 @@ void emit_0r(FILE *o, t_inst mn) {
     }
 }
 
+
+// Long 6 register
+void emit_l6r(FILE *o, t_inst mn, int op1, int op2, int op3, int op4, 
+        int op5, int op6) {
+    wct_inst(mn, op1, NULL);
+    numBytes += size(mn, false, 0);
+    switch(mn) {
+    case i_LMUL: emit(o, "%-6s r%d, r%d, r%d, r%d, r%d, r%d", "lmul", 
+                         op1, op2, op3, op4, op5, op6); break;
+    default: assert(0 && "invalid l6r instruction");
+    }
+}
+
+// The bytes of an instruction, as the simulator encodes it: long if its
+// immediate is a label or too wide for the short form
+static int size(t_inst mn, bool isLabel, unsigned long imm) {
+    switch(mn) {
+    case i_MUL: case i_DIVS: case i_REMS: case i_XOR: case i_ASHR:
+    case i_ASHRI: case i_LMUL: case i_TSETR: case i_TINITPC:
+    case i_TINITLR: case i_TINITSP: case i_TINITDP: case i_TINITCP:
+    case i_LDAP: case i_BL:
+        return 4;
+    case i_LDWDP: case i_STWDP: case i_LDAWDP: case i_LDWCP:
+    case i_LDAWCP: case i_BLACP:
+        return isLabel || imm > 63 ? 4 : 2;
+    case i_LDC: case i_LDWSP: case i_STWSP: case i_LDAWSP:
+    case i_ENTSP: case i_EXTSP: case i_RETSP: case i_GETR:
+    case i_LDAWF: case i_STWI: case i_LDWI:
+        return imm > 63 ? 4 : 2;
+    default:
+        return 2;
+    }
+}
+
+// The bytes of an instruction with a label or number immediate
+static int sizeImm(t_inst mn, string imm) {
+    char *end;
+    unsigned long n = strtoul(imm, &end, 0);
+    bool isLabel = end == imm || *end != '\0';
+    return size(mn, isLabel, isLabel ? 0 : n);
+}
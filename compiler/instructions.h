@@ -1,3 +1,6 @@
+#ifndef INSTRUCTIONS_H
+#define INSTRUCTIONS_H
+
 #include <stdio.h>
 #include <stdarg.h>
 #include "util.h"
@@ -19,6 +22,7 @@ typedef enum {
     i_SHR,
     i_EQ,
     i_LSS,
+    i_ASHR,
     i_LDW,
     i_STW,
     i_TSETR,
@@ -44,6 +48,7 @@ typedef enum {
     i_EQI,
     i_SHLI,
     i_SHRI,
+    i_ASHRI,
     i_LDWI,
     i_STWI,
     i_LDAWF,
@@ -85,7 +90,10 @@ typedef enum {
 
     // 0r
     i_SSYNC,
-    i_WAITEU
+    i_WAITEU,
+
+    // l6r
+    i_LMUL
 } t_inst;
 
 void emit_3r  (FILE *, t_inst, int, int, int);
@@ -97,7 +105,11 @@ void emit_1rl (FILE *, t_inst, int, string);
 void emit_0r  (FILE *, t_inst);
 void emit_u   (FILE *, t_inst, unsigned int);
 void emit_l   (FILE *, t_inst, string);
+void emit_l6r (FILE *, t_inst, int, int, int, int, int, int);
 
 void emit_sec (FILE *, string);
 void emit     (FILE *, const string, ...);
+void emit_bla (FILE *, int);
+int  emit_bytes(void);
 
+#endif
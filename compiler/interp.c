@@ -0,0 +1,1240 @@
+#include <stdlib.h>
+#include "interp.h"
+#include "ir.h"
+#include "irt.h"
+#include "frame.h"
+#include "signature.h"
+#include "table.h"
+#include "route.h"
+#include "error.h"
+#include "translate.h"
+#include "../include/definitions.h"
+#include "../include/platform.h"
+
+#define DEBUG 0
+
+// Words of memory on each core
+#define MEM_WORDS    (RAM_SIZE / BYTES_PER_WORD)
+
+// Statements a thread runs before the next is scheduled
+#define QUANTUM      16
+
+// Statements executed before a run is stopped
+#define MAX_STEPS    100000000
+
+// Resource type of a channel end identifier
+#define RES_CHANEND  2
+
+// IR interpreter:
+//
+// The translated statement lists of the procedures are executed directly,
+// before blocks are sequenced or registers allocated. Each core has its own
+// memory, laid out as constants, then globals, then a stack for each of its
+// threads. Temps are held by each activation of a procedure, and the local
+// arrays of a procedure are allocated on the stack of its thread.
+//
+// Threads are scheduled in turn on a single host thread, each running until
+// it blocks or for a quantum of statements. A FORKSET starts a thread with a
+// copy of the temps of its parent and sharing its frame, and a master JOIN
+// waits until the slaves of its fork have reached theirs. An on starts a
+// thread on the destination core, with the arrays it reads copied to the
+// stack of that thread and those it writes copied back when it completes,
+// or at the join of an asynchronous on.
+//
+// Program channels are queues of words at each channel end. An input blocks
+// until its end holds a word, and an output until its word has been taken,
+// except within an open stream, which waits only at the close. Outputs to
+// port 0 are written to the output as characters and to any other port as a
+// line. The run stops at the first runtime error or when every thread has
+// finished or blocked, and then reports the statements executed by each
+// procedure.
+
+typedef struct code_   *code;
+typedef struct act_    *act;
+typedef struct thread_ *thread;
+typedef struct mig_    *mig;
+
+// A procedure prepared for execution
+struct code_ {
+    ir_proc proc;
+    string name;
+    i_stmt *stmts;
+    int numStmts;
+    table temps;         // temp name -> index + 1
+    int numTemps;
+    unsigned long count; // statements executed
+};
+
+// An activation of a procedure
+struct act_ {
+    code c;
+    int pc;
+    unsigned *temps;
+    unsigned fp;         // byte address of its local arrays
+    int space;           // words of stack it releases on return
+    act caller;
+};
+
+// The words queued at a channel end and where its outputs go
+typedef struct {
+    unsigned *buf;
+    int head, tail, size;
+    unsigned put, taken;
+    int destCore, destChan;
+} endpoint;
+
+// A thread on a core
+struct thread_ {
+    int core;
+    int slot;
+    unsigned sp;         // word index of the top of its stack
+    unsigned limit;      // word index of the bottom of its stack
+    act top;
+    mig runs;            // the migration a host thread runs
+    mig waits;           // the migration a guest waits for
+    endpoint *out;       // where an output waits for its word to be taken
+    endpoint *stream;    // where an open stream sends
+    unsigned ticket;
+    bool done;
+};
+
+// A call migrated to another core
+struct mig_ {
+    int core;
+    int numArgs;
+    unsigned *addr;      // guest address of each array argument
+    unsigned *host;      // host address of each array argument
+    unsigned *len;
+    int *modes;
+    unsigned **results;  // contents of the arrays written
+    bool done;
+};
+
+typedef struct {
+    unsigned *mem;
+    bool slots[MAX_THREADS];
+    endpoint chans[NUM_PROG_CHANS];
+    int asyncs;
+} core;
+
+static structures    str;
+static FILE         *output;
+static table         codeTab;
+static table         dataTab;
+static table         dataLblTab;
+static table         cpTab;
+static list          codes;
+static unsigned      dpBase;
+static unsigned      stackBase;
+static unsigned      slotWords;
+static core          cores[NUM_CORES];
+static thread       *threads;
+static int           numThreads;
+static int           maxThreads;
+static thread        mainThread;
+static int          *syncs;
+static int           numSyncs;
+static mig          *migs;
+static int           numMigs;
+static unsigned long steps;
+static int           numSpawned;
+static int           numMigrations;
+static unsigned long numWords;
+static bool          halted;
+static bool          progress;
+
+static void      prepare    (void);
+static code      Code       (ir_proc);
+static void      collectStmt(code, i_stmt);
+static void      collect    (code, i_expr);
+static bool      layout     (void);
+static void      run        (void);
+static void      step       (thread);
+static void      complete   (act, int);
+static void      stmt_input (thread, act, i_stmt);
+static void      stmt_output(thread, act, i_stmt);
+static void      stmt_open  (thread, act, i_stmt);
+static void      stmt_close (thread, act, i_stmt);
+static void      stmt_fork  (thread, act, i_stmt);
+static void      stmt_join  (thread, act, i_stmt);
+static void      stmt_on    (thread, act, i_stmt);
+static void      stmt_onJoin(thread, act, i_stmt);
+static void      stmt_connect(thread, act, i_stmt);
+static thread    spawn      (thread, int);
+static void      exitThread (thread);
+static act       activate   (thread, code, unsigned *, int);
+static void      call       (thread, i_expr, list);
+static void      ret        (thread, unsigned);
+static mig       migrate    (thread, int, code, list);
+static void      copyBack   (thread, mig);
+static unsigned *evalArgs   (thread, list);
+static unsigned  eval       (thread, i_expr);
+static unsigned  binop      (thread, t_binop, unsigned, unsigned);
+static unsigned  sys        (thread, i_expr);
+static unsigned  address    (thread, i_expr);
+static void      store      (thread, i_expr, unsigned);
+static unsigned *word       (thread, int, unsigned);
+static unsigned *tempSlot   (thread, temp);
+static unsigned  dataAddr   (ir_data);
+static endpoint *chanend    (thread, unsigned);
+static endpoint *destination(thread, endpoint *);
+static void      push       (endpoint *, unsigned);
+static unsigned  portIn     (unsigned);
+static void      portOut    (unsigned, unsigned);
+static void      deadlock   (void);
+static void      fault      (thread, string, ...);
+static void      report     (FILE *);
+
+// Execute the translated program, starting with main on core 0, and report
+// the statements executed by each procedure. Returns FAIL on a runtime error.
+int itp_run(structures s, FILE *out) {
+
+    str = s;
+    output = out;
+    steps = 0;
+    numSpawned = 0;
+    numMigrations = 0;
+    numWords = 0;
+    halted = false;
+    numThreads = 0;
+    maxThreads = 0;
+    threads = NULL;
+    numSyncs = 0;
+    syncs = NULL;
+    numMigs = 0;
+    migs = NULL;
+
+    prepare();
+    if(!layout())
+        return FAIL;
+
+    // Start main on core 0
+    code c = tab_lookup(codeTab, LBL_MAIN);
+    assert(c != NULL && "no main procedure");
+    mainThread = spawn(NULL, 0);
+    mainThread->top = activate(mainThread, c, NULL, 0);
+
+    run();
+    fflush(out);
+    if(!halted)
+        report(out);
+    return halted ? FAIL : SUCCESS;
+}
+
+//========================================================================
+// Preparation
+//========================================================================
+
+// Prepare each procedure and index the globals
+static void prepare(void) {
+
+    codeTab = tab_New();
+    codes = list_New();
+    iterator it = it_begin(str->ir->procs);
+    while(it_hasNext(it)) {
+        code c = Code(it_next(it));
+        tab_insert(codeTab, c->name, c);
+        list_add(codes, c);
+    }
+    it_free(&it);
+
+    dataTab = tab_New();
+    dataLblTab = tab_New();
+    it = it_begin(str->ir->data);
+    while(it_hasNext(it)) {
+        ir_data g = it_next(it);
+        tab_insert(dataTab, g->name, g);
+        tab_insert(dataLblTab, lbl_name(g->l), g);
+    }
+    it_free(&it);
+}
+
+// Index the statements, labels and temps of a procedure. Label positions
+// are reused by code generation, so a run must be the last stage.
+static code Code(ir_proc p) {
+    code c = chkalloc(sizeof(*c));
+    c->proc = p;
+    c->name = frm_name(p->frm);
+    c->numStmts = list_size(p->stmts.ir);
+    c->stmts = chkalloc(sizeof(i_stmt) * c->numStmts);
+    c->temps = tab_New();
+    c->numTemps = 0;
+    c->count = 0;
+
+    int i = 0;
+    iterator it = it_begin(p->stmts.ir);
+    while(it_hasNext(it)) {
+        i_stmt st = it_next(it);
+        c->stmts[i] = st;
+        if(st->type == t_LABEL)
+            lbl_setPos(st->u.LABEL, i);
+        collectStmt(c, st);
+        i++;
+    }
+    it_free(&it);
+
+    // Formals may not be used
+    it = it_begin(frm_formalAccesses(p->frm));
+    while(it_hasNext(it)) {
+        string name = frm_access_name(it_next(it));
+        if(tab_lookup(c->temps, name) == NULL)
+            tab_insert(c->temps, name, (void *) (size_t) ++c->numTemps);
+    }
+    it_free(&it);
+    return c;
+}
+
+// Collect the temps of a statement
+static void collectStmt(code c, i_stmt st) {
+    iterator it;
+    switch(st->type) {
+    case t_CJUMP:    collect(c, st->u.CJUMP.expr);                   break;
+    case t_MOVE:     collect(c, st->u.MOVE.dst);
+                     collect(c, st->u.MOVE.src);                     break;
+    case t_INPUT:
+    case t_OUTPUT:   collect(c, st->u.IO.dst);
+                     collect(c, st->u.IO.src);                       break;
+    case t_OPEN:
+    case t_CLOSE:    collect(c, st->u.STREAM.end);
+                     collect(c, st->u.STREAM.chan);                  break;
+    case t_FORK:     collect(c, st->u.FORK.t1);                      break;
+    case t_FORKSET:  collect(c, st->u.FORKSET.sync);                 break;
+    case t_JOIN:     collect(c, st->u.JOIN.t1);                      break;
+    case t_ON:       collect(c, st->u.ON.dest);
+                     collect(c, st->u.ON.pCall);
+                     collect(c, st->u.ON.handle);                    break;
+    case t_ONJOIN:   collect(c, st->u.ONJOIN.handle);                break;
+    case t_CONNECT:  collect(c, st->u.CONNECT.to);
+                     collect(c, st->u.CONNECT.c1);
+                     collect(c, st->u.CONNECT.c2);                   break;
+    case t_RETURN:   collect(c, st->u.RETURN.expr);                  break;
+    case t_PCALL:
+        it = it_begin(st->u.PCALL.args);
+        while(it_hasNext(it))
+            collect(c, it_next(it));
+        it_free(&it);
+        break;
+    default:
+        break;
+    }
+}
+
+// Collect the local temps of an expression
+static void collect(code c, i_expr e) {
+    if(e == NULL)
+        return;
+    switch(e->type) {
+    case t_TEMP: {
+        string name = tmp_name(e->u.TEMP);
+        if(tmp_type(e->u.TEMP) == t_tmp_local
+                && tab_lookup(c->temps, name) == NULL)
+            tab_insert(c->temps, name, (void *) (size_t) ++c->numTemps);
+        break;
+    }
+    case t_BINOP:
+        collect(c, e->u.BINOP.left);
+        collect(c, e->u.BINOP.right);
+        break;
+    case t_MEM:
+        collect(c, e->u.MEM.base);
+        collect(c, e->u.MEM.offset);
+        break;
+    case t_SYS:
+        collect(c, e->u.SYS.value);
+        break;
+    case t_FCALL: {
+        iterator it = it_begin(e->u.FCALL.args);
+        while(it_hasNext(it))
+            collect(c, it_next(it));
+        it_free(&it);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Lay out the constants and globals in the memory of each core, divide the
+// rest between the thread stacks and set up the static channel routes
+static bool layout(void) {
+
+    // Strings are stored with their length in the first byte
+    unsigned cpWords = 0;
+    cpTab = tab_New();
+    iterator it = it_begin(str->ir->consts);
+    while(it_hasNext(it)) {
+        ir_data d = it_next(it);
+        tab_insert(cpTab, lbl_name(d->l), (void *) (size_t) (cpWords + 1));
+        cpWords += d->type == t_ir_str ? strlen(d->u.strVal) / 4 + 1 : 1;
+    }
+    it_free(&it);
+    dpBase = cpWords;
+    stackBase = dpBase + str->ir->dpOff;
+    if(stackBase >= MEM_WORDS) {
+        err_report(t_error, -1, "program data exceeds core memory");
+        return false;
+    }
+    slotWords = (MEM_WORDS - stackBase) / MAX_THREADS;
+
+    int i, j;
+    for(i=0; i<NUM_CORES; i++) {
+        core *k = &cores[i];
+        k->mem = chkalloc(sizeof(unsigned) * MEM_WORDS);
+        memset(k->mem, 0, sizeof(unsigned) * MEM_WORDS);
+        k->asyncs = 0;
+        for(j=0; j<MAX_THREADS; j++)
+            k->slots[j] = false;
+
+        // Constants
+        it = it_begin(str->ir->consts);
+        while(it_hasNext(it)) {
+            ir_data d = it_next(it);
+            unsigned off = (size_t) tab_lookup(cpTab, lbl_name(d->l)) - 1;
+            if(d->type == t_ir_str) {
+                int len = strlen(d->u.strVal);
+                k->mem[off] = len & 0xFF;
+                for(j=0; j<len; j++) {
+                    int b = j + 1;
+                    k->mem[off + b/4] |=
+                        ((unsigned char) d->u.strVal[j]) << (8 * (b%4));
+                }
+            }
+            else
+                k->mem[off] = d->u.value;
+        }
+        it_free(&it);
+
+        // Channel ends, with any static route
+        for(j=0; j<NUM_PROG_CHANS; j++) {
+            endpoint *e = &k->chans[j];
+            e->buf = NULL;
+            e->head = e->tail = e->size = 0;
+            e->put = e->taken = 0;
+            if(!rte_dest(j, &e->destCore, &e->destChan))
+                e->destCore = e->destChan = -1;
+        }
+    }
+    return true;
+}
+
+//========================================================================
+// Scheduling
+//========================================================================
+
+// Run each thread in turn until they have all finished or blocked
+static void run(void) {
+    while(!halted && numThreads > 0) {
+        bool any = false;
+        int n = numThreads;
+        int i, j;
+        for(i=0; i<n && !halted; i++) {
+            thread t = threads[i];
+            for(j=0; j<QUANTUM && !t->done && !halted; j++) {
+                progress = false;
+                step(t);
+                if(!progress)
+                    break;
+                any = true;
+            }
+        }
+
+        // Remove the threads that have finished
+        for(i=0, j=0; i<numThreads; i++) {
+            if(threads[i]->done) {
+                if(threads[i] != mainThread)
+                    free(threads[i]);
+            }
+            else
+                threads[j++] = threads[i];
+        }
+        numThreads = j;
+
+        if(!halted && numThreads > 0 && !any) {
+            fflush(output);
+            deadlock();
+            return;
+        }
+        if(steps >= MAX_STEPS) {
+            err_report(t_warning, -1, "run stopped after %lu statements",
+                    steps);
+            return;
+        }
+    }
+}
+
+// Execute the next statement of a thread, unless it is blocked
+static void step(thread t) {
+    act a = t->top;
+    i_stmt st = a->c->stmts[a->pc];
+    if(DEBUG) printf("core %d slot %d %s:%d\n", t->core, t->slot,
+            a->c->name, a->pc);
+
+    switch(st->type) {
+    case t_LABEL:
+        a->pc++;
+        progress = true;
+        break;
+
+    case t_NOP:
+    case t_FORKSYNC:
+        complete(a, a->pc + 1);
+        break;
+
+    case t_JUMP:
+        complete(a, lbl_pos(st->u.JUMP->u.NAME));
+        break;
+
+    case t_CJUMP: {
+        i_expr l = eval(t, st->u.CJUMP.expr) ?
+            st->u.CJUMP.then : st->u.CJUMP.other;
+        complete(a, lbl_pos(l->u.NAME));
+        break;
+    }
+    case t_MOVE: {
+        i_expr src = st->u.MOVE.src;
+        if(src->type == t_FCALL)
+            call(t, src->u.FCALL.func, src->u.FCALL.args);
+        else {
+            store(t, st->u.MOVE.dst, eval(t, src));
+            complete(a, a->pc + 1);
+        }
+        break;
+    }
+    case t_INPUT:    stmt_input  (t, a, st); break;
+    case t_OUTPUT:   stmt_output (t, a, st); break;
+    case t_OPEN:     stmt_open   (t, a, st); break;
+    case t_CLOSE:    stmt_close  (t, a, st); break;
+    case t_FORK:
+    case t_FORKSET:  stmt_fork   (t, a, st); break;
+    case t_JOIN:     stmt_join   (t, a, st); break;
+    case t_ON:       stmt_on     (t, a, st); break;
+    case t_ONJOIN:   stmt_onJoin (t, a, st); break;
+    case t_CONNECT:  stmt_connect(t, a, st); break;
+
+    case t_PCALL:
+        call(t, st->u.PCALL.proc, st->u.PCALL.args);
+        break;
+
+    case t_RETURN: {
+        i_expr e = st->u.RETURN.expr;
+        if(e->type == t_FCALL)
+            call(t, e->u.FCALL.func, e->u.FCALL.args);
+        else {
+            unsigned v = eval(t, e);
+            complete(a, a->pc);
+            ret(t, v);
+        }
+        break;
+    }
+    case t_END:
+        complete(a, a->pc);
+        ret(t, 0);
+        break;
+
+    default: assert(0 && "invalid statement type");
+    }
+}
+
+// Count a statement of an activation as executed and continue from pc
+static void complete(act a, int pc) {
+    a->c->count++;
+    a->pc = pc;
+    steps++;
+    progress = true;
+}
+
+//========================================================================
+// Statements
+//========================================================================
+
+// Input from a channel end, blocking until it holds a word, or a port
+static void stmt_input(thread t, act a, i_stmt st) {
+    unsigned id = eval(t, st->u.IO.src);
+    if(halted)
+        return;
+    if((id & 0xFF) != RES_CHANEND) {
+        store(t, st->u.IO.dst, portIn(id));
+        complete(a, a->pc + 1);
+        return;
+    }
+    endpoint *e = chanend(t, id);
+    if(e == NULL || e->head == e->tail)
+        return;
+    unsigned v = e->buf[e->head++];
+    e->taken++;
+    store(t, st->u.IO.dst, v);
+    complete(a, a->pc + 1);
+}
+
+// Output to a channel end, then block until the word has been taken, or to
+// a port
+static void stmt_output(thread t, act a, i_stmt st) {
+
+    // Waiting for the receiver
+    if(t->out != NULL) {
+        if(t->out->taken < t->ticket)
+            return;
+        t->out = NULL;
+        complete(a, a->pc + 1);
+        return;
+    }
+
+    unsigned id = eval(t, st->u.IO.dst);
+    unsigned v = eval(t, st->u.IO.src);
+    if(halted)
+        return;
+    if((id & 0xFF) != RES_CHANEND) {
+        portOut(id, v);
+        complete(a, a->pc + 1);
+        return;
+    }
+    endpoint *e = chanend(t, id);
+    endpoint *d = e == NULL ? NULL : destination(t, e);
+    if(d == NULL)
+        return;
+    push(d, v);
+    t->ticket = d->put;
+    if(e == t->stream)
+        complete(a, a->pc + 1);
+    else {
+        t->out = d;
+        progress = true;
+    }
+}
+
+// Open a channel for a stream of words
+static void stmt_open(thread t, act a, i_stmt st) {
+    unsigned id = eval(t, st->u.STREAM.chan);
+    endpoint *e = halted ? NULL : chanend(t, id);
+    if(e == NULL)
+        return;
+    if(st->u.STREAM.output) {
+        if(destination(t, e) == NULL)
+            return;
+        t->stream = e;
+        t->ticket = destination(t, e)->put;
+    }
+    store(t, st->u.STREAM.end, id);
+    complete(a, a->pc + 1);
+}
+
+// Close a stream, once an output stream has been taken
+static void stmt_close(thread t, act a, i_stmt st) {
+    if(st->u.STREAM.output && t->stream != NULL) {
+        if(destination(t, t->stream)->taken < t->ticket)
+            return;
+        t->stream = NULL;
+    }
+    complete(a, a->pc + 1);
+}
+
+// A fork takes a new synchroniser and each FORKSET starts a thread on the
+// same core, from a copy of the activation
+static void stmt_fork(thread t, act a, i_stmt st) {
+    if(st->type == t_FORK) {
+        if(numSyncs % 16 == 0)
+            syncs = realloc(syncs, sizeof(int) * (numSyncs + 16));
+        syncs[numSyncs] = 0;
+        store(t, st->u.FORK.t1, numSyncs++);
+        complete(a, a->pc + 1);
+        return;
+    }
+
+    unsigned sync = eval(t, st->u.FORKSET.sync);
+    thread n = spawn(t, t->core);
+    if(n == NULL)
+        return;
+    n->top = activate(n, a->c, a->temps, 0);
+    n->top->fp = a->fp;
+    n->top->pc = lbl_pos(st->u.FORKSET.l);
+    syncs[sync]++;
+    complete(a, a->pc + 1);
+}
+
+// A slave ends at its join and the master waits for them all
+static void stmt_join(thread t, act a, i_stmt st) {
+    unsigned sync = eval(t, st->u.JOIN.t1);
+    if(!st->u.JOIN.master) {
+        complete(a, a->pc);
+        syncs[sync]--;
+        free(a->temps);
+        free(a);
+        exitThread(t);
+        return;
+    }
+    if(syncs[sync] > 0)
+        return;
+    complete(a, lbl_pos(st->u.JOIN.exit));
+}
+
+// Migrate a call and wait for it to complete, or start it and set its
+// handle. As in the runtime, an asynchronous on with no free channel is
+// made synchronously with a handle of 0.
+static void stmt_on(thread t, act a, i_stmt st) {
+
+    // Waiting for a synchronous on
+    if(t->waits != NULL) {
+        if(!t->waits->done)
+            return;
+        copyBack(t, t->waits);
+        t->waits = NULL;
+        complete(a, a->pc + 1);
+        return;
+    }
+
+    int dest = eval(t, st->u.ON.dest);
+    i_expr pCall = st->u.ON.pCall;
+    code c = tab_lookup(codeTab, lbl_name(pCall->u.FCALL.func->u.NAME));
+    assert(c != NULL && "on procedure does not exist");
+    if(halted)
+        return;
+    mig m = migrate(t, dest, c, pCall->u.FCALL.args);
+    if(m == NULL)
+        return;
+
+    i_expr handle = st->u.ON.handle;
+    if(handle != NULL && cores[t->core].asyncs < NUM_ASYNC_CHANS) {
+        cores[t->core].asyncs++;
+        if(numMigs % 16 == 0)
+            migs = realloc(migs, sizeof(mig) * (numMigs + 16));
+        migs[numMigs++] = m;
+        store(t, handle, numMigs);
+        complete(a, a->pc + 1);
+        return;
+    }
+    if(handle != NULL)
+        store(t, handle, 0);
+    t->waits = m;
+    progress = true;
+}
+
+// Wait for an asynchronous on to complete and copy back its results
+static void stmt_onJoin(thread t, act a, i_stmt st) {
+    unsigned h = eval(t, st->u.ONJOIN.handle);
+    if(halted)
+        return;
+    if(h == 0) {
+        complete(a, a->pc + 1);
+        return;
+    }
+    if(h > (unsigned) numMigs || migs[h-1] == NULL) {
+        fault(t, "join of an invalid handle %u", h);
+        return;
+    }
+    mig m = migs[h-1];
+    if(!m->done)
+        return;
+    copyBack(t, m);
+    migs[h-1] = NULL;
+    cores[t->core].asyncs--;
+    complete(a, a->pc + 1);
+}
+
+// Set the destination of a channel end of this core
+static void stmt_connect(thread t, act a, i_stmt st) {
+    int to = eval(t, st->u.CONNECT.to);
+    endpoint *e = chanend(t, eval(t, st->u.CONNECT.c1));
+    unsigned c2 = eval(t, st->u.CONNECT.c2);
+    if(halted || e == NULL)
+        return;
+    e->destCore = to;
+    e->destChan = (c2 >> 8) & 0xFF;
+    complete(a, a->pc + 1);
+}
+
+//========================================================================
+// Threads, calls and migrations
+//========================================================================
+
+// Start a thread on a core, in a free stack slot
+static thread spawn(thread parent, int c) {
+    int i;
+    for(i=0; i<MAX_THREADS && cores[c].slots[i]; i++)
+        ;
+    if(i == MAX_THREADS) {
+        fault(parent, "insufficient threads on core %d", c);
+        return NULL;
+    }
+    cores[c].slots[i] = true;
+
+    thread t = chkalloc(sizeof(*t));
+    t->core = c;
+    t->slot = i;
+    t->limit = stackBase + i * slotWords;
+    t->sp = t->limit + slotWords;
+    t->top = NULL;
+    t->runs = NULL;
+    t->waits = NULL;
+    t->out = NULL;
+    t->stream = NULL;
+    t->ticket = 0;
+    t->done = false;
+
+    if(numThreads == maxThreads) {
+        maxThreads += 16;
+        threads = realloc(threads, sizeof(thread) * maxThreads);
+    }
+    threads[numThreads++] = t;
+    numSpawned++;
+    return t;
+}
+
+// Finish a thread, completing any migration it runs
+static void exitThread(thread t) {
+    mig m = t->runs;
+    if(m != NULL) {
+        int i;
+        for(i=0; i<m->numArgs; i++) {
+            if(m->len[i] == 0 || !(m->modes[i] & ARG_MODE_OUT))
+                continue;
+            m->results[i] = chkalloc(sizeof(unsigned) * m->len[i]);
+            memcpy(m->results[i], &cores[t->core].mem[m->host[i]/4],
+                    sizeof(unsigned) * m->len[i]);
+        }
+        m->done = true;
+    }
+    cores[t->core].slots[t->slot] = false;
+    t->top = NULL;
+    t->done = true;
+    progress = true;
+}
+
+// Activate a procedure on a thread with a copy of the given temps, or with
+// its local arrays allocated on the stack of the thread if temps is NULL
+static act activate(thread t, code c, unsigned *temps, int pc) {
+    act a = chkalloc(sizeof(*a));
+    a->c = c;
+    a->pc = pc;
+    a->caller = NULL;
+    a->temps = chkalloc(sizeof(unsigned) * (c->numTemps + 1));
+    a->space = 0;
+    if(temps != NULL)
+        memcpy(a->temps, temps, sizeof(unsigned) * (c->numTemps + 1));
+    else {
+        memset(a->temps, 0, sizeof(unsigned) * (c->numTemps + 1));
+        a->space = frm_arraySpace(c->proc->frm);
+        if(t->sp - a->space < t->limit) {
+            fault(t, "stack overflow in %s", c->name);
+            a->space = 0;
+        }
+        t->sp -= a->space;
+    }
+    a->fp = t->sp * BYTES_PER_WORD;
+    return a;
+}
+
+// Call a procedure, binding the arguments to its formals. The calling
+// statement completes when it returns.
+static void call(thread t, i_expr proc, list args) {
+    code c = tab_lookup(codeTab, lbl_name(proc->u.NAME));
+    assert(c != NULL && "called procedure does not exist");
+    unsigned *vals = evalArgs(t, args);
+    if(halted) {
+        free(vals);
+        return;
+    }
+
+    act a = activate(t, c, NULL, 0);
+    int i = 0;
+    iterator it = it_begin(frm_formalAccesses(c->proc->frm));
+    while(it_hasNext(it) && i < list_size(args)) {
+        size_t index = (size_t) tab_lookup(c->temps,
+                frm_access_name(it_next(it)));
+        a->temps[index-1] = vals[i++];
+    }
+    it_free(&it);
+    free(vals);
+
+    a->caller = t->top;
+    t->top = a;
+    progress = true;
+}
+
+// Return from the current activation, completing the calling statement
+static void ret(thread t, unsigned v) {
+    act a = t->top;
+    act caller = a->caller;
+    t->sp += a->space;
+    free(a->temps);
+    free(a);
+    if(caller == NULL) {
+        exitThread(t);
+        return;
+    }
+
+    t->top = caller;
+    i_stmt st = caller->c->stmts[caller->pc];
+    switch(st->type) {
+    case t_MOVE:
+        store(t, st->u.MOVE.dst, v);
+        complete(caller, caller->pc + 1);
+        break;
+    case t_RETURN:
+        complete(caller, caller->pc);
+        ret(t, v);
+        break;
+    default:
+        complete(caller, caller->pc + 1);
+        break;
+    }
+}
+
+// Start a call on a host thread of another core. Each array argument is
+// followed by its length, and is copied to the stack of the host thread if
+// the procedure reads it.
+static mig migrate(thread t, int dest, code c, list args) {
+    signature sig = sigTab_lookup(str->sig, c->name);
+    unsigned *vals = evalArgs(t, args);
+    thread h = halted ? NULL : spawn(t, dest);
+    if(h == NULL) {
+        free(vals);
+        return NULL;
+    }
+
+    int n = list_size(args);
+    mig m = chkalloc(sizeof(*m));
+    m->core = dest;
+    m->numArgs = n;
+    m->addr = chkalloc(sizeof(unsigned) * n);
+    m->host = chkalloc(sizeof(unsigned) * n);
+    m->len = chkalloc(sizeof(unsigned) * n);
+    m->modes = chkalloc(sizeof(int) * n);
+    m->results = chkalloc(sizeof(unsigned *) * n);
+    m->done = false;
+
+    int i;
+    unsigned j;
+    for(i=0; i<n; i++) {
+        t_formal type = sig == NULL ? t_formal_int : sig_getFmlType(sig, i);
+        m->len[i] = 0;
+        m->results[i] = NULL;
+        if(type != t_formal_intArray && type != t_formal_chanArray)
+            continue;
+        if(i+1 == n) {
+            fault(t, "array argument of %s not followed by its length",
+                    c->name);
+            break;
+        }
+
+        m->addr[i] = vals[i];
+        m->len[i] = vals[i+1];
+        m->modes[i] = sig_getFmlMode(sig, i);
+        if(h->sp - m->len[i] < h->limit) {
+            fault(t, "arguments of %s exceed the stack on core %d",
+                    c->name, dest);
+            break;
+        }
+        h->sp -= m->len[i];
+        m->host[i] = h->sp * BYTES_PER_WORD;
+        vals[i] = m->host[i];
+        for(j=0; j<m->len[i] && (m->modes[i] & ARG_MODE_IN); j++) {
+            unsigned *from = word(t, t->core, m->addr[i] + j*BYTES_PER_WORD);
+            if(from == NULL)
+                break;
+            cores[dest].mem[h->sp + j] = *from;
+        }
+    }
+    if(halted) {
+        free(vals);
+        return NULL;
+    }
+
+    // Run the call as the base activation of the host thread
+    h->runs = m;
+    h->top = activate(h, c, NULL, 0);
+    iterator it = it_begin(frm_formalAccesses(c->proc->frm));
+    for(i=0; it_hasNext(it) && i<n; i++) {
+        size_t index = (size_t) tab_lookup(c->temps,
+                frm_access_name(it_next(it)));
+        h->top->temps[index-1] = vals[i];
+    }
+    it_free(&it);
+    free(vals);
+    numMigrations++;
+    return m;
+}
+
+// Copy the arrays written by a completed migration back to the guest
+static void copyBack(thread t, mig m) {
+    int i;
+    unsigned j;
+    for(i=0; i<m->numArgs; i++) {
+        if(m->results[i] == NULL)
+            continue;
+        for(j=0; j<m->len[i]; j++) {
+            unsigned *to = word(t, t->core, m->addr[i] + j*BYTES_PER_WORD);
+            if(to != NULL)
+                *to = m->results[i][j];
+        }
+        free(m->results[i]);
+    }
+    free(m->addr);
+    free(m->host);
+    free(m->len);
+    free(m->modes);
+    free(m->results);
+    free(m);
+}
+
+//========================================================================
+// Expressions
+//========================================================================
+
+// Evaluate a list of arguments
+static unsigned *evalArgs(thread t, list args) {
+    unsigned *vals = chkalloc(sizeof(unsigned) * (list_size(args) + 1));
+    int i = 0;
+    iterator it = it_begin(args);
+    while(it_hasNext(it))
+        vals[i++] = eval(t, it_next(it));
+    it_free(&it);
+    return vals;
+}
+
+// Evaluate an expression
+static unsigned eval(thread t, i_expr e) {
+    unsigned *p;
+    switch(e->type) {
+    case t_CONST:
+        return e->u.CONST;
+    case t_TEMP:
+        p = tempSlot(t, e->u.TEMP);
+        return p == NULL ? 0 : *p;
+    case t_BINOP:
+        return binop(t, e->u.BINOP.op,
+                eval(t, e->u.BINOP.left), eval(t, e->u.BINOP.right));
+    case t_MEM:
+        switch(e->u.MEM.type) {
+        case t_mem_spa: case t_mem_dpa: case t_mem_cpa:
+            return address(t, e);
+        default:
+            p = word(t, t->core, address(t, e));
+            return p == NULL ? 0 : *p;
+        }
+    case t_SYS:
+        return sys(t, e);
+    default: assert(0 && "invalid expression type");
+    }
+    return 0;
+}
+
+// Evaluate a binary operation as the instructions generated for it do
+static unsigned binop(thread t, t_binop op, unsigned a, unsigned b) {
+    int sa = (int) a, sb = (int) b;
+    switch(op) {
+    case i_plus:   return a + b;
+    case i_minus:  return a - b;
+    case i_mult:   return a * b;
+    case i_div:
+    case i_rem:
+        if(b == 0) {
+            fault(t, "division by zero");
+            return 0;
+        }
+        if(a == 0x80000000 && sb == -1)
+            return op == i_div ? a : 0;
+        return op == i_div ? (unsigned) (sa / sb) : (unsigned) (sa % sb);
+    case i_or:     return a | b;
+    case i_and:    return a & b;
+    case i_xor:    return a ^ b;
+    case i_lshift: return b >= 32 ? 0 : a << b;
+    case i_rshift: return b >= 32 ? 0 : a >> b;
+    case i_ashr:   return b >= 32 ? (sa < 0 ? ALLONES : 0) : (unsigned) (sa >> b);
+    case i_eq:     return a == b;
+    case i_ne:     return a != b;
+    case i_ls:     return sa < sb;
+    case i_le:     return sa <= sb;
+    case i_gr:     return sa > sb;
+    case i_ge:     return sa >= sb;
+    case i_mulhu:  return (unsigned) (((unsigned long long) a * b) >> 32);
+    default: assert(0 && "invalid binop");
+    }
+    return 0;
+}
+
+// A core number, or the identifier of a channel end of this core
+static unsigned sys(thread t, i_expr e) {
+    string name = lbl_name(e->u.SYS.name->u.NAME);
+    unsigned v = eval(t, e->u.SYS.value);
+    if(streq(name, CORE_ARRAY)) {
+        if(v >= NUM_CORES)
+            fault(t, "invalid core %u", v);
+        return v;
+    }
+    assert(streq(name, CHAN_ARRAY) && "invalid system variable");
+    if(v >= NUM_PROG_CHANS)
+        fault(t, "invalid channel %u", v);
+    return (t->core << 16) | (v << 8) | RES_CHANEND;
+}
+
+// The byte address of a memory access
+static unsigned address(thread t, i_expr e) {
+    i_expr base = e->u.MEM.base;
+    unsigned off = eval(t, e->u.MEM.offset) * BYTES_PER_WORD;
+    switch(e->u.MEM.type) {
+    case t_mem_abs:
+        return eval(t, base) + off;
+    case t_mem_spl:
+    case t_mem_spa:
+        return t->top->fp + off;
+    case t_mem_dp:
+    case t_mem_dpa: {
+        ir_data g = tab_lookup(dataLblTab, lbl_name(base->u.NAME));
+        assert(g != NULL && "global does not exist");
+        return dataAddr(g) + off;
+    }
+    case t_mem_cp:
+    case t_mem_cpa: {
+        size_t index = (size_t) tab_lookup(cpTab, lbl_name(base->u.NAME));
+        assert(index != 0 && "constant does not exist");
+        return (index - 1) * BYTES_PER_WORD + off;
+    }
+    default: assert(0 && "invalid memory access before frames");
+    }
+    return 0;
+}
+
+// Store a value in a temp or memory
+static void store(thread t, i_expr dst, unsigned v) {
+    unsigned *p;
+    switch(dst->type) {
+    case t_TEMP: p = tempSlot(t, dst->u.TEMP);            break;
+    case t_MEM:  p = word(t, t->core, address(t, dst));   break;
+    default: assert(0 && "invalid store destination");
+    }
+    if(p != NULL && !halted)
+        *p = v;
+}
+
+// The word of a core's memory at an address
+static unsigned *word(thread t, int c, unsigned addr) {
+    if(addr % BYTES_PER_WORD != 0 || addr / BYTES_PER_WORD >= MEM_WORDS) {
+        fault(t, "invalid memory access at 0x%x", addr);
+        return NULL;
+    }
+    return &cores[c].mem[addr / BYTES_PER_WORD];
+}
+
+// The value of a temp: a global in memory, or a temp of the activation
+static unsigned *tempSlot(thread t, temp tmp) {
+    string name = tmp_name(tmp);
+    if(tmp_type(tmp) == t_tmp_global) {
+        ir_data g = tab_lookup(dataTab, name);
+        if(g == NULL) {
+            fault(t, "global '%s' has no storage", name);
+            return NULL;
+        }
+        return word(t, t->core, dataAddr(g));
+    }
+    size_t index = (size_t) tab_lookup(t->top->c->temps, name);
+    assert(index != 0 && "temp not collected");
+    return &t->top->temps[index-1];
+}
+
+// The byte address of a global
+static unsigned dataAddr(ir_data g) {
+    return (dpBase + g->off) * BYTES_PER_WORD;
+}
+
+//========================================================================
+// Channels and ports
+//========================================================================
+
+// The channel end with an identifier
+static endpoint *chanend(thread t, unsigned id) {
+    unsigned c = id >> 16, n = (id >> 8) & 0xFF;
+    if((id & 0xFF) != RES_CHANEND || c >= NUM_CORES || n >= NUM_PROG_CHANS) {
+        fault(t, "invalid channel end 0x%x", id);
+        return NULL;
+    }
+    return &cores[c].chans[n];
+}
+
+// The channel end that a channel end outputs to
+static endpoint *destination(thread t, endpoint *e) {
+    if(e->destCore < 0 || e->destCore >= NUM_CORES
+            || e->destChan < 0 || e->destChan >= NUM_PROG_CHANS) {
+        fault(t, "output on an unconnected channel");
+        return NULL;
+    }
+    return &cores[e->destCore].chans[e->destChan];
+}
+
+// Queue a word at a channel end
+static void push(endpoint *e, unsigned v) {
+    if(e->head == e->tail)
+        e->head = e->tail = 0;
+    if(e->tail == e->size) {
+        e->size = e->size == 0 ? 16 : e->size * 2;
+        e->buf = realloc(e->buf, sizeof(unsigned) * e->size);
+    }
+    e->buf[e->tail++] = v;
+    e->put++;
+    numWords++;
+}
+
+// Input from a port: characters from the input for port 0
+static unsigned portIn(unsigned port) {
+    if(port != 0)
+        return 0;
+    int c = getchar();
+    return c == EOF ? ALLONES : (unsigned) c;
+}
+
+// Output to a port: characters to the output for port 0
+static void portOut(unsigned port, unsigned v) {
+    if(port == 0)
+        fputc(v & 0xFF, output);
+    else
+        fprintf(output, "port 0x%x: %u\n", port, v);
+}
+
+//========================================================================
+// Reporting
+//========================================================================
+
+// Report the threads left blocked, which is an error unless main completed
+static void deadlock(void) {
+    int i;
+    for(i=0; i<numThreads; i++) {
+        thread t = threads[i];
+        err_report(mainThread->done ? t_warning : t_error,
+                -1, "deadlock: thread on core %d blocked in %s",
+                t->core, t->top->c->name);
+    }
+    if(!mainThread->done)
+        halted = true;
+}
+
+// Report a runtime error in the procedure a thread is executing, and stop
+static void fault(thread t, string format, ...) {
+    char msg[256];
+    va_list ap;
+    if(halted)
+        return;
+    va_start(ap, format);
+    vsnprintf(msg, sizeof(msg), format, ap);
+    va_end(ap);
+    if(t != NULL && t->top != NULL)
+        err_report(t_error, -1, "%s: %s (core %d)",
+                t->top->c->name, msg, t->core);
+    else
+        err_report(t_error, -1, "%s", msg);
+    halted = true;
+}
+
+// Report the statements executed by each procedure
+static void report(FILE *out) {
+    printTitleRule(out, "Executed statements");
+    iterator it = it_begin(codes);
+    while(it_hasNext(it)) {
+        code c = it_next(it);
+        fprintf(out, "  %-20s %lu\n", c->name, c->count);
+    }
+    it_free(&it);
+    fprintf(out, "  %-20s %lu\n", "Total", steps);
+    fprintf(out, "  Threads:             %d\n", numSpawned);
+    fprintf(out, "  Migrations:          %d\n", numMigrations);
+    fprintf(out, "  Channel words:       %lu\n", numWords);
+    printRule(out);
+}
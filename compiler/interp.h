@@ -0,0 +1,9 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <stdio.h>
+#include "structures.h"
+
+int itp_run(structures, FILE *);
+
+#endif
@@ -2,6 +2,7 @@
 #include "util.h"
 #include "irtprinter.h"
 #include "ir.h"
+#include "../include/definitions.h"
 
 static bool cmpDataName(void *, void *);
 static bool cmpConstVal(void *, void *);
@@ -34,6 +35,7 @@ void ir_NewProc(intRep ir, frame f, a_stmt stmts) {
     p->blocks = NULL;
     p->children = list_New();
     p->pos = -1;
+    p->threads = MAX_THREADS;
     list_add(ir->procs, p);
 }
 
@@ -28,6 +28,7 @@ struct ir_port_ {
 
 struct ir_proc_ {
     int pos;
+    int threads;         // hardware threads free when it runs, with its own
     frame frm;
     list blocks;
     list children;
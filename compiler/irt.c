@@ -4,15 +4,21 @@
 #include "symbol.h"
 #include "irt.h"
 
+static i_stmt Stmt(enum t_i_stmt);
+
 // Statement uses
 static void i_cJumpUses   (i_stmt, set);
 static void i_moveUses    (i_stmt, set);
 static void i_inputUses   (i_stmt, set);
 static void i_outputUses  (i_stmt, set);
+static void i_openUses    (i_stmt, set);
+static void i_closeUses   (i_stmt, set);
 static void i_pcallUses   (i_stmt, set);
 static void i_onUses      (i_stmt, set);
+static void i_onJoinUses  (i_stmt, set);
 static void i_connectUses (i_stmt, set);
 static void i_returnUses  (i_stmt, set);
+static void i_forkUses    (i_stmt, set);
 static void i_forkSetUses (i_stmt, set);
 static void i_forkSyncUses(i_stmt, set);
 static void i_joinUses    (i_stmt, set);
@@ -20,6 +26,8 @@ static void i_joinUses    (i_stmt, set);
 // Statement defs
 static temp i_moveDef   (i_stmt);
 static temp i_inputDef  (i_stmt);
+static temp i_openDef   (i_stmt);
+static temp i_onDef     (i_stmt);
 static void i_forkDef   (i_stmt, set);
 
 // Expression use sets
@@ -32,26 +40,34 @@ static void sysUses     (i_expr, set use);
 // IR node constructors
 // ==================================================================
 
+// A statement, with no liveness sets until they are computed
+static i_stmt Stmt(enum t_i_stmt type) {
+    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
+    p->type = type;
+    p->def = NULL;
+    p->use = NULL;
+    p->in = NULL;
+    p->out = NULL;
+    return p;
+}
+
 // Label
 i_stmt i_Label(label label) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_LABEL;
+    i_stmt p = Stmt(t_LABEL);
     p->u.LABEL = label;
     return p;
 }
  
 // Jump
 i_stmt i_Jump(i_expr label) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_JUMP;
+    i_stmt p = Stmt(t_JUMP);
     p->u.JUMP = label;
     return p;
 }
 
 // CJump
 i_stmt i_CJump(i_expr expr, i_expr then, i_expr other) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_CJUMP;
+    i_stmt p = Stmt(t_CJUMP);
     p->u.CJUMP.expr = expr;
     p->u.CJUMP.then = then;
     p->u.CJUMP.other = other;
@@ -60,8 +76,7 @@ i_stmt i_CJump(i_expr expr, i_expr then, i_expr other) {
  
 // Move
 i_stmt i_Move(i_expr dst, i_expr src) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_MOVE;
+    i_stmt p = Stmt(t_MOVE);
     p->u.MOVE.dst = dst;
     p->u.MOVE.src = src;
     return p;
@@ -69,8 +84,7 @@ i_stmt i_Move(i_expr dst, i_expr src) {
  
 // Input
 i_stmt i_Input(i_expr dst, i_expr src) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_INPUT;
+    i_stmt p = Stmt(t_INPUT);
     p->u.IO.dst = dst;
     p->u.IO.src = src;
     return p;
@@ -78,47 +92,71 @@ i_stmt i_Input(i_expr dst, i_expr src) {
  
 // Output
 i_stmt i_Output(i_expr dst, i_expr src) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_OUTPUT;
+    i_stmt p = Stmt(t_OUTPUT);
     p->u.IO.dst = dst;
     p->u.IO.src = src;
     return p;
 }
 
+// Open a channel for a stream of words
+i_stmt i_Open(i_expr end, i_expr chan, bool output) {
+    i_stmt p = Stmt(t_OPEN);
+    p->u.STREAM.end = end;
+    p->u.STREAM.chan = chan;
+    p->u.STREAM.output = output;
+    return p;
+}
+
+// Close a channel after a stream of words
+i_stmt i_Close(i_expr end, bool output) {
+    i_stmt p = Stmt(t_CLOSE);
+    p->u.STREAM.end = end;
+    p->u.STREAM.chan = NULL;
+    p->u.STREAM.output = output;
+    return p;
+}
+
 // Fork
-i_stmt i_Fork(i_expr t1, i_expr t2, i_expr t3, list threads) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_FORK;
+i_stmt i_Fork(i_expr t1, i_expr t2, i_expr t3, list threads, i_expr count) {
+    i_stmt p = Stmt(t_FORK);
     p->u.FORK.threads = threads;
     p->u.FORK.t1 = t1;
     p->u.FORK.t2 = t2;
     p->u.FORK.t3 = t3;
+    p->u.FORK.count = count;
+    p->u.FORK.space = 0;
+    p->u.FORK.spOff = 0;
     return p;
 }
 
 // ForkSet
-i_stmt i_ForkSet(i_expr sync, i_expr thread, i_expr space, label l) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_FORKSET;
+i_stmt i_ForkSet(i_expr sync, i_expr thread, i_expr space, label l, 
+        i_expr index) {
+    i_stmt p = Stmt(t_FORKSET);
     p->u.FORKSET.sync = sync;
     p->u.FORKSET.thread = thread;
     p->u.FORKSET.space = space;
     p->u.FORKSET.l = l;
+    p->u.FORKSET.stack = -1;
+    p->u.FORKSET.spOff = 0;
+    p->u.FORKSET.live = NULL;
+    p->u.FORKSET.index = index;
+    p->u.FORKSET.stride = 0;
+    p->u.FORKSET.slots = NULL;
+    p->u.FORKSET.numSlots = 0;
     return p;
 }
 
 // ForkSync
 i_stmt i_ForkSync(i_expr sync) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_FORKSYNC;
+    i_stmt p = Stmt(t_FORKSYNC);
     p->u.FORKSYNC.sync = sync;
     return p;
 }
 
 // Join
 i_stmt i_Join(i_expr t1, bool master, label exit) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_JOIN;
+    i_stmt p = Stmt(t_JOIN);
     p->u.JOIN.t1 = t1;
     p->u.JOIN.master = master;
     p->u.JOIN.exit = exit;
@@ -127,26 +165,31 @@ i_stmt i_Join(i_expr t1, bool master, label exit) {
 
 // PCall
 i_stmt i_PCall(i_expr proc, list args) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_PCALL;
+    i_stmt p = Stmt(t_PCALL);
     p->u.PCALL.proc = proc;
     p->u.PCALL.args = args;
     return p;
 }
 
 // On
-i_stmt i_On(i_expr dest, i_expr pCall) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_ON;
+i_stmt i_On(i_expr dest, i_expr pCall, i_expr handle) {
+    i_stmt p = Stmt(t_ON);
     p->u.ON.dest = dest;
     p->u.ON.pCall = pCall;
+    p->u.ON.handle = handle;
+    return p;
+}
+
+// Join an asynchronous on
+i_stmt i_OnJoin(i_expr handle) {
+    i_stmt p = Stmt(t_ONJOIN);
+    p->u.ONJOIN.handle = handle;
     return p;
 }
 
 // Connect
 i_stmt i_Connect(i_expr to, i_expr c1, i_expr c2) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_CONNECT;
+    i_stmt p = Stmt(t_CONNECT);
     p->u.CONNECT.to = to;
     p->u.CONNECT.c1 = c1;
     p->u.CONNECT.c2 = c2;
@@ -155,8 +198,7 @@ i_stmt i_Connect(i_expr to, i_expr c1, i_expr c2) {
 
 // Return
 i_stmt i_Return(i_expr end, i_expr expr) {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_RETURN;
+    i_stmt p = Stmt(t_RETURN);
     p->u.RETURN.end = end;
     p->u.RETURN.expr = expr;
     return p;
@@ -164,15 +206,13 @@ i_stmt i_Return(i_expr end, i_expr expr) {
 
 // Nop
 i_stmt i_Nop() {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_NOP;
+    i_stmt p = Stmt(t_NOP);
     return p;
 }
  
 // End
 i_stmt i_End() {
-    i_stmt p = (i_stmt) chkalloc(sizeof(*p));
-    p->type = t_END;
+    i_stmt p = Stmt(t_END);
     return p;
 }
  
@@ -257,15 +297,20 @@ set i_getUseSet(i_stmt stmt) {
     case t_MOVE:     i_moveUses(stmt, use);    break;
     case t_INPUT:    i_inputUses(stmt, use);   break;
     case t_OUTPUT:   i_outputUses(stmt, use);  break;
+    case t_OPEN:     i_openUses(stmt, use);    break;
+    case t_CLOSE:    i_closeUses(stmt, use);   break;
     case t_PCALL:    i_pcallUses(stmt, use);   break;
     case t_ON:       i_onUses(stmt, use);      break;
+    case t_ONJOIN:   i_onJoinUses(stmt, use);  break;
     case t_CONNECT:  i_connectUses(stmt, use); break;
     case t_RETURN:   i_returnUses(stmt, use);  break;
     case t_FORKSET:  i_forkSetUses(stmt, use); break;
     case t_FORKSYNC: i_forkSyncUses(stmt, use); break;
     case t_JOIN:     i_joinUses(stmt, use);    break;
     
-    case t_FORK: case t_LABEL: case t_JUMP: case t_END:                             
+    case t_FORK:     i_forkUses(stmt, use);    break;
+    
+    case t_LABEL: case t_JUMP: case t_END:                             
         break;
 
     default: assert(0 && "Invalid stmtement type");
@@ -316,7 +361,6 @@ static void i_inputUses(i_stmt s, set use) {
     i_expr dst = s->u.IO.dst;
     allUses(src, use);
     assert(dst->type == t_TEMP && "input dst not TEMP");
-    set_add(use, dst->u.TEMP);
 }
 
 static void i_outputUses(i_stmt s, set use) {
@@ -327,6 +371,18 @@ static void i_outputUses(i_stmt s, set use) {
     set_add(use, src->u.TEMP);
 }
 
+static void i_openUses(i_stmt s, set use) {
+    i_expr chan = s->u.STREAM.chan;
+    assert(chan->type == t_SYS && "open chan not SYS");
+    sysUses(chan, use);
+}
+
+static void i_closeUses(i_stmt s, set use) {
+    i_expr end = s->u.STREAM.end;
+    assert(end->type == t_TEMP && "close end not TEMP");
+    set_add(use, end->u.TEMP);
+}
+
 static void i_pcallUses(i_stmt s, set use) {
     callUses(s->u.PCALL.args, use);
 }
@@ -337,6 +393,10 @@ static void i_onUses(i_stmt s, set use) {
     callUses(fCall->u.FCALL.args, use);
 }
 
+static void i_onJoinUses(i_stmt s, set use) {
+    allUses(s->u.ONJOIN.handle, use);
+}
+
 static void i_connectUses(i_stmt s, set use) {
     allUses(s->u.CONNECT.to, use);
     allUses(s->u.CONNECT.c1, use);
@@ -347,10 +407,17 @@ static void i_returnUses(i_stmt s, set use) {
     allUses(s->u.RETURN.expr, use);
 }
 
+static void i_forkUses(i_stmt s, set use) {
+    if(s->u.FORK.count != NULL)
+        set_add(use, s->u.FORK.count->u.TEMP);
+}
+
 static void i_forkSetUses(i_stmt s, set use) {
     set_add(use, s->u.FORKSET.sync->u.TEMP);
     set_add(use, s->u.FORKSET.thread->u.TEMP);
     set_add(use, s->u.FORKSET.space->u.TEMP);
+    if(s->u.FORKSET.index != NULL)
+        set_add(use, s->u.FORKSET.index->u.TEMP);
 }
 
 static void i_forkSyncUses(i_stmt s, set use) {
@@ -438,11 +505,13 @@ set i_getDefSet(i_stmt stmt) {
     
     case t_MOVE:  t = i_moveDef(stmt);  break;
     case t_INPUT: t = i_inputDef(stmt); break;
+    case t_OPEN:  t = i_openDef(stmt);  break;
+    case t_ON:    t = i_onDef(stmt);    break;
     case t_FORK:  i_forkDef(stmt, def); break;
     
     case t_FORKSET: case t_FORKSYNC: case t_JOIN:   
-    case t_OUTPUT:  case t_CJUMP:    case t_PCALL:    
-    case t_ON:      case t_CONNECT:  case t_RETURN:   
+    case t_OUTPUT:  case t_CJUMP:    case t_PCALL:    case t_CLOSE:
+    case t_ONJOIN:  case t_CONNECT:  case t_RETURN:   
     case t_LABEL:   case t_JUMP:     case t_END:
         break;
 
@@ -473,6 +542,20 @@ static temp i_inputDef(i_stmt s) {
     return dst->u.TEMP;
 }
 
+static temp i_openDef(i_stmt s) {
+    i_expr end = s->u.STREAM.end;
+    assert(end->type == t_TEMP && "open end not TEMP");
+    return end->u.TEMP;
+}
+
+static temp i_onDef(i_stmt s) {
+    i_expr handle = s->u.ON.handle;
+    if(handle == NULL)
+        return NULL;
+    assert(handle->type == t_TEMP && "on handle not TEMP");
+    return handle->u.TEMP;
+}
+
 static void i_forkDef(i_stmt s, set def) {
     set_add(def, s->u.FORK.t1->u.TEMP);
     set_add(def, s->u.FORK.t2->u.TEMP);
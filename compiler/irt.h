@@ -25,7 +25,9 @@ typedef enum {
     i_ls, 
     i_le,
     i_gr,
-    i_ge
+    i_ge,
+    i_ashr,  // arithmetic shift right
+    i_mulhu  // high word of unsigned multiply
 } t_binop;
 
 // Memory base types
@@ -50,6 +52,8 @@ struct i_stmt_ {
         t_MOVE,
         t_INPUT,
         t_OUTPUT,
+        t_OPEN,
+        t_CLOSE,
         t_PAR,
         t_FORK,
         t_FORKSET,
@@ -57,6 +61,7 @@ struct i_stmt_ {
         t_JOIN,
 		t_PCALL,
         t_ON,
+        t_ONJOIN,
         t_CONNECT,
         t_RETURN,
         t_NOP,
@@ -77,6 +82,11 @@ struct i_stmt_ {
             i_expr dst;
             i_expr src;
         } IO;
+        struct {
+            i_expr end;   // channel end TEMP
+            i_expr chan;  // chan[] SYS to open, or NULL
+            bool output;
+        } STREAM;
 		struct {
             i_expr proc;
             list args;
@@ -84,7 +94,11 @@ struct i_stmt_ {
         struct {
             i_expr dest;
             i_expr pCall;
+            i_expr handle; // TEMP set by an asynchronous on, or NULL
         } ON;
+        struct {
+            i_expr handle;
+        } ONJOIN;
         struct {
             i_expr to, c1, c2;
         } CONNECT;
@@ -95,12 +109,22 @@ struct i_stmt_ {
         struct {
             i_expr t1, t2, t3;
             list threads;
+            i_expr count; // replicated threads, or NULL
+            int space; // bytes of stack for all (or each replicated) threads
+            int spOff; // byte offset of the first replicated thread's sp
         } FORK;
         struct {
             i_expr sync;
             i_expr thread;
             i_expr space;
             label l;
+            int stack; // words below sp, or -1 if unbounded
+            int spOff; // byte offset of sp in the fork's space
+            set live;  // temps live into the thread
+            i_expr index; // number of a replicated thread, or NULL
+            int stride;   // bytes between replicated threads
+            int *slots;   // sp offsets of spilled values it reads, ascending
+            int numSlots;
         } FORKSET;
         struct {
             i_expr sync;
@@ -168,13 +192,16 @@ i_stmt i_CJump(i_expr expr, i_expr then, i_expr other);
 i_stmt i_Move(i_expr, i_expr);
 i_stmt i_Input(i_expr, i_expr);
 i_stmt i_Output(i_expr, i_expr);
-i_stmt i_Fork(i_expr, i_expr, i_expr, list);
-i_stmt i_ForkSet(i_expr, i_expr, i_expr, label);
+i_stmt i_Open(i_expr, i_expr, bool);
+i_stmt i_Close(i_expr, bool);
+i_stmt i_Fork(i_expr, i_expr, i_expr, list, i_expr);
+i_stmt i_ForkSet(i_expr, i_expr, i_expr, label, i_expr);
 i_stmt i_ForkSync(i_expr);
 i_stmt i_Join(i_expr, bool, label);
 i_stmt i_PCall(i_expr, list);
 i_stmt i_Return(i_expr, i_expr);
-i_stmt i_On(i_expr, i_expr);
+i_stmt i_On(i_expr, i_expr, i_expr);
+i_stmt i_OnJoin(i_expr);
 i_stmt i_Connect(i_expr, i_expr, i_expr);
 i_stmt i_Nop();
 i_stmt i_End();
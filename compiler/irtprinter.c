@@ -6,7 +6,7 @@
 #include "label.h"
 #include "irtprinter.h"
 
-static char binopStr[][4] = {
+static char binopStr[][6] = {
     "+", 
     "-", 
     "*", 
@@ -22,7 +22,9 @@ static char binopStr[][4] = {
     "<", 
     "<=", 
     ">", 
-    ">="
+    ">=",
+    "ashr",
+    "*hu"
 };
 
 static char memBaseStr[][5] = {
@@ -67,6 +69,8 @@ void print_fork(FILE *out, int d, i_stmt par) {
         fprintf(out, "%s%s", lbl_name(l), it_hasNext(it) ? ", " : "");
     }
     it_free(&it);
+    if(par->u.FORK.count != NULL)
+        fprintf(out, " * %s", p_expr(par->u.FORK.count));
     fprintf(out, ")\n");
 }
 
@@ -125,14 +129,27 @@ void p_stmt(FILE *out, int d, i_stmt stmt) {
             p_expr(stmt->u.IO.src));
         break;
 
+    case t_OPEN:
+        print(out, d+1, "open %s %s %s\n",
+            p_expr(stmt->u.STREAM.end), 
+            stmt->u.STREAM.output ? "!" : "?",
+            p_expr(stmt->u.STREAM.chan));
+        break;
+
+    case t_CLOSE:
+        print(out, d+1, "close %s\n", p_expr(stmt->u.STREAM.end));
+        break;
+
     case t_FORK:
         print_fork(out, d+1, stmt);
         break;
 
     case t_FORKSET:
-        print(out, d+1, "forkSet [%s, %s, %s]: %s\n", p_expr(stmt->u.FORKSET.sync),
+        print(out, d+1, "forkSet [%s, %s, %s]: %s%s%s\n", p_expr(stmt->u.FORKSET.sync),
             p_expr(stmt->u.FORKSET.thread), p_expr(stmt->u.FORKSET.space),
-            lbl_name(stmt->u.FORKSET.l));
+            lbl_name(stmt->u.FORKSET.l), 
+            stmt->u.FORKSET.index != NULL ? " # " : "",
+            stmt->u.FORKSET.index != NULL ? p_expr(stmt->u.FORKSET.index) : "");
         break;
 
     case t_FORKSYNC:
@@ -148,11 +165,17 @@ void p_stmt(FILE *out, int d, i_stmt stmt) {
         break;
 
     case t_ON:
-        print(out, d+1, "on %s : %s\n",
+        print(out, d+1, "%s%son %s : %s\n",
+            stmt->u.ON.handle != NULL ? p_expr(stmt->u.ON.handle) : "",
+            stmt->u.ON.handle != NULL ? " := " : "",
             p_expr(stmt->u.ON.dest),
             p_expr(stmt->u.ON.pCall));
         break;
 
+    case t_ONJOIN:
+        print(out, d+1, "onJoin %s\n", p_expr(stmt->u.ONJOIN.handle));
+        break;
+
     case t_CONNECT:
         print(out, d+1, "connect %s to %s : %s\n",
             p_expr(stmt->u.CONNECT.c1),
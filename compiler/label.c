@@ -7,6 +7,7 @@
 struct label_ {
     string name;
     int pos; // a position index, used in codegen for forward and backwards jumps
+    int bound; // iterations of the loop it heads, or -1 if unknown
 };
 
 // Data structure to record allocated temporaries and labels
@@ -29,6 +30,7 @@ label lblMap_NewLabel(labelMap m) {
     label l = (label) chkalloc(sizeof(*l));
     l->name = StringFmt(".L%d", m->count++);
     l->pos = -1;
+    l->bound = -1;
     tab_insert(m->map, l->name, l);
     return l;
 }
@@ -44,6 +46,7 @@ label lblMap_NewNamedLabel(labelMap m, string name) {
     l = (label) chkalloc(sizeof(*l));
     l->name = StringFmt("%s", name);
     l->pos = -1;
+    l->bound = -1;
     
     tab_insert(m->map, l->name, l);
     //printf("inserted named label %s\n", name);
@@ -82,6 +85,16 @@ int lbl_pos(label l) {
     return l->pos;
 }
 
+void lbl_setBound(label l, int bound) {
+    assert(l != NULL && "Label NULL");
+    l->bound = bound;
+}
+
+int lbl_bound(label l) {
+    assert(l != NULL && "Label NULL");
+    return l->bound;
+}
+
 void lbl_delete(label l) {
     free(l);
 }
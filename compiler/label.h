@@ -20,6 +20,8 @@ string    lbl_name(label);
 bool      lbl_compare(label, label);
 void      lbl_setPos(label, int);
 int       lbl_pos(label);
+void      lbl_setBound(label, int);
+int       lbl_bound(label);
 void      lbl_rename(label, string);
 
 #endif
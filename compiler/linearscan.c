@@ -16,6 +16,7 @@ struct liveInterval_ {
     bool    spill;
     t_spill type;
     string  spilled;
+    unsigned long weight; // profiled executions of its uses and defs
 };
 
 // LiveInterval object methods
@@ -28,6 +29,7 @@ static void         deleteLiveInterval(void *);
 
 // Linear scan methods
 static list         computeLiveIntervals(list blocks);
+static void         addWeights(list intervals, set temps, long count);
 static void         linearScan(frame, list intervals, bool *);
 static void         removePreAllocatedParams(frame, list, list);
 static void         removePreAllocatedRegs(list, list, list);
@@ -36,6 +38,7 @@ static void         expireOldIntervals(list active, list, list, liveInterval);
 static void         addToActive(list active, liveInterval);
 static void         spillInterval(frame, liveInterval);
 static void         spillAtInterval(frame, list active, liveInterval);
+static liveInterval coldest(list active);
 static void         assignRegs(list intervals, list blocks);
 static void         addStackLoads(frame, list liveInts, list blocks);
 static void         setUsedRegs(frame, list intervals);
@@ -94,6 +97,7 @@ static liveInterval LiveInterval(string name, int begin, bool spill, string spil
     r->type     = t_spill_none;
     r->spill    = spill;
     r->spilled  = spilled;
+    r->weight   = 0;
     return r;
 }
 
@@ -184,6 +188,12 @@ static list computeLiveIntervals(list blocks) {
                 }
             }
             it_free(&liveIt);
+
+            // Weigh each access by the executions of the block
+            if(blc_count(b) > 0) {
+                addWeights(intervals, s->use, blc_count(b));
+                addWeights(intervals, s->def, blc_count(b));
+            }
         }
         it_free(&stmtIt);
     }
@@ -193,6 +203,18 @@ static list computeLiveIntervals(list blocks) {
     return intervals;
 }
 
+// Add count to the weight of the interval of each temp in a set
+static void addWeights(list intervals, set temps, long count) {
+    iterator it = it_begin(set_elements(temps));
+    while(it_hasNext(it)) {
+        temp t = it_next(it);
+        liveInterval r = list_getFirst(intervals, tmp_name(t), &cmpNameRange);
+        if(r != NULL)
+            r->weight += count;
+    }
+    it_free(&it);
+}
+
 // Remove all parameter arguments from live intervals and add them to a pre
 // allocated list
 static void removePreAllocatedParams(frame f, list intervals, list preAllocated) {
@@ -316,12 +338,16 @@ static void spillInterval(frame f, liveInterval spill) {
     stat_numSpiltVars++;
 }
 
-// Spill a variable onto the stack: either last active interval or the current one
+// Spill a variable onto the stack: either last active interval or the current one.
+// With a profile, the one accessed least often is spilled instead.
 static void spillAtInterval(frame f, list active, liveInterval i) {
   
-    liveInterval spill = list_tail(active);
+    liveInterval spill = coldest(active);
+    bool weighed = spill != NULL && !i->spill && spill->weight != i->weight;
+    if(!weighed)
+        spill = list_tail(active);
 
-    if(spill->end > i->end) {
+    if(weighed ? spill->weight < i->weight : spill->end > i->end) {
         //printf("\tSpilled %s from active\n", spill->name);
         i->reg = spill->reg;
         spill->reg = -1;
@@ -335,6 +361,20 @@ static void spillAtInterval(frame f, list active, liveInterval i) {
     }
 }
 
+// The active interval with the least weight, ending latest, that is not
+// already a spill reload
+static liveInterval coldest(list active) {
+    liveInterval spill = NULL;
+    iterator it = it_end(active);
+    while(it_hasPrev(it)) {
+        liveInterval j = it_prev(it);
+        if(!j->spill && (spill == NULL || j->weight < spill->weight))
+            spill = j;
+    }
+    it_free(&it);
+    return spill;
+}
+
 // Perform a linear-scan allocation of regsiters by analysing live-ranges. See
 // "Linear scan register allocation, Poletto & Sarkar, 1999"
 static void linearScan(frame frm, list intervals, bool *spilled) {
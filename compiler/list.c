@@ -83,6 +83,7 @@ void list_add(list l, void *item) {
 void list_insertFirst(list l, void *value) {
     item old = l->head;
     l->head = Node(value, NULL, old);
+    if(l->tail == NULL) l->tail = l->head;
     if(old != NULL) old->prev = l->head;
     l->size++;
 }
@@ -113,6 +114,8 @@ void *list_removeFirst(list l) {
     l->head = removed->next;
     if(removed->next != NULL)
         l->head->prev = NULL;
+    else
+        l->tail = NULL;
     void *value = removed->value;
     free(removed);
     l->size--;
@@ -128,6 +131,8 @@ void *list_removeLast(list l) {
     l->tail = removed->prev;
     if(removed->prev != NULL)
         l->tail->next = NULL;
+    else
+        l->head = NULL;
     void *value = removed->value;
     free(removed);
     l->size--;
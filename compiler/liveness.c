@@ -81,6 +81,10 @@ void liveness_compute(list blocks) {
                     set_union(s->out, succStmt->in);
                 }
 
+                // An input writes its destination even if it is dead
+                if(s->type == t_INPUT)
+                    set_union(s->out, s->def);
+
                 // in(s) = use(s) U (out(s)-def(s)
                 set tmp = set_copy(s->out);
                 set_minus(tmp, s->def);
@@ -129,7 +133,8 @@ void liveness_eliminateDead(list blocks) {
             //assert((set_size(s->def) == 0 || set_size(s->def) == 1)
             //        && "Statement definitions > 1");
             
-            if(set_size(s->def) != 0) {
+            // An on is made for its effect, even if its handle is dead
+            if(set_size(s->def) != 0 && s->type != t_ON) {
                 temp t = list_head(set_elements(s->def));
                 if(!set_contains(s->out, tmp_name(t), &tmp_cmpName)) {
                     it_remove(stmtIt);
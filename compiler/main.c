@@ -18,7 +18,12 @@
 #include "ir.h"
 #include "block.h"
 #include "regalloc.h"
+#include "prune.h"
 #include "codegen.h"
+#include "interp.h"
+#include "native.h"
+#include "wcet.h"
+#include "../profiler/profile.h"
 
 #define ASM  "xas"
 #define COMP "xcc"
@@ -45,23 +50,34 @@ int numCores[] = {
 // Global options and variables
 bool       displayAst;
 bool       displayIrt;
+bool       runIrt;
+bool       emitNative;
+bool       countBlocks;
+bool       wcet;
 bool       compileOnly;
 bool       assembleOnly;
 bool       verbose;
 bool       stats;
 bool       outputAsm;
+int        unrollBudget;
 FILE      *in;
 FILE      *asmOut;
 FILE      *jumpTabOut;
 FILE      *cpOut;
+FILE      *mapOut;
 string     inFile;
 string     asmFile;
+string     nativeFile;
 string     jumpTabFile;
 string     cpFile;
+string     mapFile;
+string     freqFile;
+profile    feedback;
 string     elfFile;
 string     xeFile;
 t_target   target;
 a_module   astRoot;
+list       removed;
 structures s;
 
 // Print some usage info
@@ -72,10 +88,16 @@ void printHelp(void) {
     printf("  -v          Verbose\n");
     printf("  -ast        Display AST and quit\n");
     printf("  -ir         Display IR and quit\n");
+    printf("  -run        Execute the IR and quit\n");
+    printf("  -native     Emit C11 for POSIX threads to program.c and quit\n");
 //    printf("  -t=<target> Specify the target device\n"); 
 //    printf("  -s          Display compilation statistics\n");
 //    printf("  -S          Compile, do not assemble\n");
 //    printf("  -c          Compile and assemble, do not link\n");
+    printf("  -u=<n>      Unroll budget in IR statements per loop (0 disables)\n");
+    printf("  -pg         Count block executions, mapped in program.map\n");
+    printf("  -f=<file>   Optimise with the block frequencies of sireprof -o\n");
+    printf("  -wcet       Report worst-case cycles and stack depth\n");
     printf("  -o <file>   Output file\n");
 }
 
@@ -91,22 +113,39 @@ void setTarget(char *arg) {
     else err_fatal("invalid target");
 }
 
+// Set the loop unrolling budget
+void setUnroll(char *arg) {
+    char *end;
+    arg += 3;
+    unrollBudget = strtol(arg, &end, 10);
+    if(*arg == '\0' || *end != '\0' || unrollBudget < 0) 
+        err_fatal("invalid unroll budget");
+}
+
 // Parse command line options and input files
 int parseOptions(int argc, char **argv) {
    
     // Default options
     displayAst   = false;
     displayIrt   = false;
+    runIrt       = false;
+    emitNative   = false;
+    countBlocks  = false;
+    wcet         = false;
     compileOnly  = false;
     assembleOnly = false;
     verbose      = false;
     stats        = false;
     asmFile      = "program.S";
+    nativeFile   = "program.c";
     jumpTabFile  = "jumpTable.S";
     cpFile       = "cp.S";
+    mapFile      = "program.map";
+    freqFile     = NULL;
     elfFile      = "out.o";
     xeFile       = "out.xe";
     target       = tgt_XC1;
+    unrollBudget = 32;
 
     // Get options
     while((argc > 1) && (argv[1][0] == '-')) {
@@ -115,8 +154,14 @@ int parseOptions(int argc, char **argv) {
         case 'v': verbose = true;           break;
         case 'a': displayAst = true;        break;
         case 'i': displayIrt = true;        break;
+        case 'r': runIrt = true;            break;
+        case 'n': emitNative = true;        break;
+        case 'p': countBlocks = true;       break;
+        case 'f': freqFile = argv[1] + 3;   break;
+        case 'w': wcet = true;              break;
         case 't': setTarget(argv[1]);       break;
         case 's': stats = true;             break;
+        case 'u': setUnroll(argv[1]);       break;
         case 'S': compileOnly = true;       break;
         case 'c': assembleOnly = true;      break;
         case 'o': xeFile = String(argv[1]); break;
@@ -193,8 +238,67 @@ int stage_sem() {
 int stage_irt() {
     
     if(verbose) printf("Translating IR\n");
+
+    if(freqFile != NULL) {
+        feedback = prf_loadFreqs(freqFile);
+        if(feedback == NULL)
+            return FAIL;
+    }
+    
+    translate(s, unrollBudget, feedback);
+    
+    if(err_anyErrors()) {
+        err_summary();
+        return FAIL;
+    }
+
+    return SUCCESS;
+}
+
+// IR execution stage
+int stage_run() {
+    
+    if(verbose) printf("Executing IR\n");
+    
+    if(err_anyErrors() || itp_run(s, stdout)) {
+        err_summary();
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+// Native C generation stage
+int stage_native() {
     
-    translate(s);
+    if(verbose) printf("Generating %s\n", nativeFile);
+    
+    if(err_anyErrors()) {
+        err_summary();
+        return FAIL;
+    }
+
+    FILE *nativeOut = fopen(nativeFile, "w");
+    if(nativeOut == NULL) { 
+        err_fatal("opening C file %s\n", nativeFile); 
+        return FAIL; 
+    }
+    ntv_program(nativeOut, s);
+    fclose(nativeOut);
+    return SUCCESS;
+}
+
+// Unreachable procedure elimination stage
+int stage_prune() {
+    
+    if(verbose) printf("Removing unreachable procedures\n");
+    
+    removed = prn_unreachable(s);
+    int n = list_size(s->ir->procs);
+    if(n > JUMP_TAB_SIZE-JUMP_INDEX_OFFSET) {
+        err_fatal("%d procedures exceed the %d jump table entries", n,
+                JUMP_TAB_SIZE-JUMP_INDEX_OFFSET);
+        return FAIL;
+    }
     return SUCCESS;
 }
 
@@ -203,7 +307,7 @@ int stage_seq() {
     
     if(verbose) printf("Sequencing basic blocks\n");
     
-    basicBlocks(s);
+    basicBlocks(s, countBlocks, feedback);
     return SUCCESS;
 }
 
@@ -240,12 +344,27 @@ int stage_gen() {
     }
 
     // Generate the assembly code
+    if(wcet) wct_begin();
     gen_program(asmOut, jumpTabOut, cpOut, s);
    
     fclose(asmOut);
     fclose(jumpTabOut);
     fclose(cpOut);
 
+    // Bound the execution of each procedure
+    if(wcet) wct_report(stdout, s);
+
+    // Map the profile counters to their blocks
+    if(countBlocks) {
+        mapOut = fopen(mapFile, "w");
+        if(mapOut == NULL) { 
+            err_fatal("opening map file %s\n", mapFile); 
+            return FAIL; 
+        }
+        blc_profileMap(mapOut, s);
+        fclose(mapOut);
+    }
+
     return SUCCESS;
 }
 
@@ -382,9 +501,18 @@ int main(int argc, char **argv) {
 
     if(stage_sem()) return FAIL;
     if(stage_irt()) return FAIL;
+    if(runIrt) {
+        if(stage_run()) return FAIL;
+        return SUCCESS;
+    }
+    if(emitNative) {
+        if(stage_native()) return FAIL;
+        return SUCCESS;
+    }
 
     // Middle
     //ir_display(s->ir, stdout);
+    if(stage_prune()) return FAIL;
     if(stage_seq()) return FAIL;
     if(stage_reg()) return FAIL;
     if(displayIrt) {
@@ -404,7 +532,10 @@ int main(int argc, char **argv) {
     //if(stage_bin()) return FAIL;
 
     // Display statistics info
-    if(stats) stats_dump(stdout);
+    if(stats) {
+        stats_dump(stdout);
+        prn_report(stdout, s, removed, numCores[target]);
+    }
 
     return SUCCESS;
 }
@@ -0,0 +1,857 @@
+#include <stdlib.h>
+#include "native.h"
+#include "ir.h"
+#include "irt.h"
+#include "frame.h"
+#include "signature.h"
+#include "table.h"
+#include "route.h"
+#include "translate.h"
+#include "../include/definitions.h"
+#include "../include/platform.h"
+
+#define DEBUG 0
+
+// Native backend:
+//
+// The translated statement lists of the procedures are emitted as C11, to be
+// compiled with the runtime in runtime/native.h and run on POSIX threads.
+// Each procedure becomes a C function of its formals, its temps become
+// locals and its jumps become gotos. Values are words and memory is
+// addressed as on the XS1, in the memory of the core a thread runs on.
+//
+// A procedure containing a par keeps its temps in a frame, and its body is
+// a function that a slave thread enters at the label of its branch with a
+// copy of the frame, as a FORKSET starts a thread with a copy of the temps
+// of its parent. A slave arrives at the barrier of its fork at its JOIN and
+// the master waits there until they all have. An on calls a thunk of the
+// procedure on a thread of the destination core, which unpacks the
+// arguments.
+
+typedef struct proc_ *proc;
+
+// A procedure being emitted
+struct proc_ {
+    ir_proc p;
+    string name;
+    table temps;         // temp name -> index + 1
+    list tempNames;
+    table labels;        // labels jumped to or started by a FORKSET
+    table entries;       // label name -> entry of its slave thread
+    int numEntries;
+    int numForks;
+    bool par;            // has a frame for slave threads
+};
+
+static structures str;
+static FILE      *out;
+static table      dataTab;
+static table      dataLblTab;
+static table      cpTab;
+static table      onTab;
+static unsigned   cpWords;
+static int        forkNum;
+
+static proc     Proc        (ir_proc);
+static void     collectStmt (proc, i_stmt);
+static void     collect     (proc, i_expr);
+static void     useLabel    (proc, label);
+static void     layout      (void);
+static void     onTargets   (list);
+static void     genConsts   (void);
+static void     genPrototype(proc, bool);
+static void     genThunk    (string);
+static void     genProc     (proc);
+static void     genBody     (proc);
+static void     genStmt     (proc, i_stmt, bool);
+static void     genOn       (proc, i_stmt);
+static void     genMove     (proc, i_expr, i_expr);
+static void     genLvalue   (proc, i_expr);
+static void     genCall     (proc, i_expr, list);
+static void     genExpr     (proc, i_expr);
+static void     genBinop    (proc, t_binop, i_expr, i_expr);
+static void     genAddr     (proc, i_expr);
+static void     genTemp     (proc, temp);
+static unsigned constAddr   (i_expr);
+static string   cName       (string, string);
+static string   labelName   (label);
+
+// Emit the translated program as C11 for the native runtime
+void ntv_program(FILE *o, structures s) {
+
+    str = s;
+    out = o;
+    forkNum = 0;
+
+    dataTab = tab_New();
+    dataLblTab = tab_New();
+    iterator it = it_begin(str->ir->data);
+    while(it_hasNext(it)) {
+        ir_data g = it_next(it);
+        tab_insert(dataTab, g->name, g);
+        tab_insert(dataLblTab, lbl_name(g->l), g);
+    }
+    it_free(&it);
+    layout();
+
+    list procs = list_New();
+    it = it_begin(str->ir->procs);
+    while(it_hasNext(it))
+        list_add(procs, Proc(it_next(it)));
+    it_free(&it);
+    onTargets(procs);
+
+    fprintf(out, "// Generated by sire\n");
+    fprintf(out, "#include \"native.h\"\n\n");
+    genConsts();
+
+    // Prototypes, then thunks for the procedures called by an on
+    it = it_begin(procs);
+    while(it_hasNext(it))
+        genPrototype(it_next(it), true);
+    it_free(&it);
+    fprintf(out, "\n");
+    it = it_begin(procs);
+    while(it_hasNext(it)) {
+        proc p = it_next(it);
+        if(tab_lookup(onTab, p->name) != NULL)
+            genThunk(p->name);
+    }
+    it_free(&it);
+
+    it = it_begin(procs);
+    while(it_hasNext(it))
+        genProc(it_next(it));
+    it_free(&it);
+
+    // Start main on core 0
+    fprintf(out, "int main(void) {\n");
+    fprintf(out, "    sire_thr t;\n");
+    fprintf(out, "    sire_init(sire_cp, %u, %d, sire_route);\n",
+            cpWords, str->ir->dpOff);
+    fprintf(out, "    sire_thread(&t, 0);\n");
+    fprintf(out, "    %s(&t);\n", cName("p_", LBL_MAIN));
+    fprintf(out, "    fflush(stdout);\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+}
+
+//========================================================================
+// Preparation
+//========================================================================
+
+// Index the temps and the labels jumped to of a procedure
+static proc Proc(ir_proc ip) {
+    proc p = chkalloc(sizeof(*p));
+    p->p = ip;
+    p->name = frm_name(ip->frm);
+    p->temps = tab_New();
+    p->tempNames = list_New();
+    p->labels = tab_New();
+    p->entries = tab_New();
+    p->numEntries = 0;
+    p->numForks = 0;
+    p->par = false;
+
+    // Formals first, as they may not be used
+    iterator it = it_begin(frm_formalAccesses(ip->frm));
+    while(it_hasNext(it)) {
+        string name = frm_access_name(it_next(it));
+        if(tab_lookup(p->temps, name) == NULL) {
+            list_add(p->tempNames, name);
+            tab_insert(p->temps, name,
+                    (void *) (size_t) list_size(p->tempNames));
+        }
+    }
+    it_free(&it);
+
+    it = it_begin(ip->stmts.ir);
+    while(it_hasNext(it))
+        collectStmt(p, it_next(it));
+    it_free(&it);
+    return p;
+}
+
+// Collect the temps and labels of a statement
+static void collectStmt(proc p, i_stmt st) {
+    iterator it;
+    switch(st->type) {
+    case t_JUMP:     useLabel(p, st->u.JUMP->u.NAME);                break;
+    case t_CJUMP:    collect(p, st->u.CJUMP.expr);
+                     useLabel(p, st->u.CJUMP.then->u.NAME);
+                     useLabel(p, st->u.CJUMP.other->u.NAME);         break;
+    case t_MOVE:     collect(p, st->u.MOVE.dst);
+                     collect(p, st->u.MOVE.src);                     break;
+    case t_INPUT:
+    case t_OUTPUT:   collect(p, st->u.IO.dst);
+                     collect(p, st->u.IO.src);                       break;
+    case t_OPEN:
+    case t_CLOSE:    collect(p, st->u.STREAM.end);
+                     collect(p, st->u.STREAM.chan);                  break;
+    case t_FORK:     collect(p, st->u.FORK.t1);
+                     p->numForks++;                                  break;
+    case t_FORKSET:  collect(p, st->u.FORKSET.sync);
+                     useLabel(p, st->u.FORKSET.l);
+                     tab_insert(p->entries, lbl_name(st->u.FORKSET.l),
+                             (void *) (size_t) ++p->numEntries);
+                     p->par = true;                                  break;
+    case t_JOIN:
+        collect(p, st->u.JOIN.t1);
+        if(st->u.JOIN.master)
+            useLabel(p, st->u.JOIN.exit);
+        break;
+    case t_ON:       collect(p, st->u.ON.dest);
+                     collect(p, st->u.ON.pCall);
+                     collect(p, st->u.ON.handle);                    break;
+    case t_ONJOIN:   collect(p, st->u.ONJOIN.handle);                break;
+    case t_CONNECT:  collect(p, st->u.CONNECT.to);
+                     collect(p, st->u.CONNECT.c1);
+                     collect(p, st->u.CONNECT.c2);                   break;
+    case t_RETURN:   collect(p, st->u.RETURN.expr);                  break;
+    case t_PCALL:
+        it = it_begin(st->u.PCALL.args);
+        while(it_hasNext(it))
+            collect(p, it_next(it));
+        it_free(&it);
+        break;
+    default:
+        break;
+    }
+}
+
+// Collect the local temps of an expression
+static void collect(proc p, i_expr e) {
+    if(e == NULL)
+        return;
+    switch(e->type) {
+    case t_TEMP: {
+        string name = tmp_name(e->u.TEMP);
+        if(tmp_type(e->u.TEMP) == t_tmp_local
+                && tab_lookup(p->temps, name) == NULL) {
+            list_add(p->tempNames, name);
+            tab_insert(p->temps, name,
+                    (void *) (size_t) list_size(p->tempNames));
+        }
+        break;
+    }
+    case t_BINOP:
+        collect(p, e->u.BINOP.left);
+        collect(p, e->u.BINOP.right);
+        break;
+    case t_MEM:
+        collect(p, e->u.MEM.base);
+        collect(p, e->u.MEM.offset);
+        break;
+    case t_SYS:
+        collect(p, e->u.SYS.value);
+        break;
+    case t_FCALL: {
+        iterator it = it_begin(e->u.FCALL.args);
+        while(it_hasNext(it))
+            collect(p, it_next(it));
+        it_free(&it);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Record a label as jumped to, so that it is emitted
+static void useLabel(proc p, label l) {
+    if(tab_lookup(p->labels, lbl_name(l)) == NULL)
+        tab_insert(p->labels, lbl_name(l), l);
+}
+
+// Lay out the constants before the globals, as the interpreter does.
+// Strings are stored with their length in the first byte.
+static void layout(void) {
+    cpWords = 0;
+    cpTab = tab_New();
+    iterator it = it_begin(str->ir->consts);
+    while(it_hasNext(it)) {
+        ir_data d = it_next(it);
+        tab_insert(cpTab, lbl_name(d->l), (void *) (size_t) (cpWords + 1));
+        cpWords += d->type == t_ir_str ? strlen(d->u.strVal) / 4 + 1 : 1;
+    }
+    it_free(&it);
+}
+
+// Find the procedures called by an on, which need a thunk
+static void onTargets(list procs) {
+    onTab = tab_New();
+    iterator it = it_begin(procs);
+    while(it_hasNext(it)) {
+        proc p = it_next(it);
+        iterator sit = it_begin(p->p->stmts.ir);
+        while(it_hasNext(sit)) {
+            i_stmt st = it_next(sit);
+            if(st->type != t_ON)
+                continue;
+            string name = lbl_name(st->u.ON.pCall->u.FCALL.func->u.NAME);
+            if(tab_lookup(onTab, name) == NULL)
+                tab_insert(onTab, name, name);
+        }
+        it_free(&sit);
+    }
+    it_free(&it);
+}
+
+//========================================================================
+// Declarations
+//========================================================================
+
+// The constant pool and the static channel routes
+static void genConsts(void) {
+    unsigned *words = chkalloc(sizeof(unsigned) * (cpWords + 1));
+    memset(words, 0, sizeof(unsigned) * (cpWords + 1));
+    iterator it = it_begin(str->ir->consts);
+    while(it_hasNext(it)) {
+        ir_data d = it_next(it);
+        unsigned off = (size_t) tab_lookup(cpTab, lbl_name(d->l)) - 1;
+        if(d->type == t_ir_str) {
+            int len = strlen(d->u.strVal);
+            int j;
+            words[off] = len & 0xFF;
+            for(j=0; j<len; j++) {
+                int b = j + 1;
+                words[off + b/4] |=
+                    ((unsigned char) d->u.strVal[j]) << (8 * (b%4));
+            }
+        }
+        else
+            words[off] = d->u.value;
+    }
+    it_free(&it);
+
+    unsigned i;
+    fprintf(out, "static const word sire_cp[%u] = {", cpWords + 1);
+    for(i=0; i<=cpWords; i++)
+        fprintf(out, "%s0x%xu", i == 0 ? "\n    " :
+                i%6 == 0 ? ",\n    " : ", ", words[i]);
+    fprintf(out, "\n};\n\n");
+    free(words);
+
+    int j;
+    fprintf(out, "static const int sire_route[%d][2] = {", NUM_PROG_CHANS);
+    for(j=0; j<NUM_PROG_CHANS; j++) {
+        int core, dest;
+        if(!rte_dest(j, &core, &dest))
+            core = dest = -1;
+        fprintf(out, "%s{%d, %d}", j == 0 ? "\n    " :
+                j%6 == 0 ? ",\n    " : ", ", core, dest);
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+// The declaration of the function of a procedure
+static void genPrototype(proc p, bool decl) {
+    fprintf(out, "static word %s(sire_thr *t", cName("p_", p->name));
+    iterator it = it_begin(frm_formalAccesses(p->p->frm));
+    while(it_hasNext(it))
+        fprintf(out, ", word %s",
+                cName("v_", frm_access_name(it_next(it))));
+    it_free(&it);
+    fprintf(out, ")%s\n", decl ? ";" : " {");
+}
+
+// A thunk making a migrated call from its arguments, and the modes of its
+// array arguments, each of which is followed by its length
+static void genThunk(string name) {
+    signature sig = sigTab_lookup(str->sig, name);
+    ir_proc ip = list_getFirst(str->ir->procs, name, &isNamedProc);
+    int n = list_size(frm_formalAccesses(ip->frm));
+    int i;
+
+    fprintf(out, "static const int %s[%d] = {", cName("m_", name), n + 1);
+    for(i=0; i<n; i++) {
+        t_formal type = sig == NULL ? t_formal_int : sig_getFmlType(sig, i);
+        bool array = (type == t_formal_intArray
+                || type == t_formal_chanArray) && i+1 < n;
+        fprintf(out, "%s%d", i == 0 ? "" : ", ",
+                array ? sig_getFmlMode(sig, i) : -1);
+    }
+    fprintf(out, "%s-1};\n", n == 0 ? "" : ", ");
+
+    fprintf(out, "static word %s(sire_thr *t, word *a) {\n",
+            cName("o_", name));
+    fprintf(out, "    return %s(t", cName("p_", name));
+    for(i=0; i<n; i++)
+        fprintf(out, ", a[%d]", i);
+    fprintf(out, ");\n}\n\n");
+}
+
+//========================================================================
+// Procedures
+//========================================================================
+
+// A procedure, with its local arrays on the stack of its thread. That of a
+// par keeps its temps in a frame and enters a body function.
+static void genProc(proc p) {
+    int space = frm_arraySpace(p->p->frm);
+    iterator it;
+    if(DEBUG) printf("Emitting %s\n", p->name);
+
+    if(p->par) {
+        string frm = cName("f_", p->name);
+        fprintf(out, "typedef struct {\n");
+        fprintf(out, "    word fp;\n");
+        it = it_begin(p->tempNames);
+        while(it_hasNext(it))
+            fprintf(out, "    word %s;\n", cName("v_", it_next(it)));
+        it_free(&it);
+        fprintf(out, "    sire_barrier *s[%d];\n", p->numForks);
+        fprintf(out, "} %s;\n\n", frm);
+        genBody(p);
+
+        genPrototype(p, false);
+        fprintf(out, "    %s f;\n", frm);
+        fprintf(out, "    memset(&f, 0, sizeof(f));\n");
+        it = it_begin(frm_formalAccesses(p->p->frm));
+        while(it_hasNext(it)) {
+            string name = cName("v_", frm_access_name(it_next(it)));
+            fprintf(out, "    f.%s = %s;\n", name, name);
+        }
+        it_free(&it);
+        fprintf(out, "    word sp = t->sp;\n");
+        fprintf(out, "    f.fp = sire_push(t, %d);\n", space);
+        fprintf(out, "    word r = %s(t, &f, 0);\n", cName("b_", p->name));
+        fprintf(out, "    t->sp = sp;\n");
+        fprintf(out, "    return r;\n");
+        fprintf(out, "}\n\n");
+        return;
+    }
+
+    genPrototype(p, false);
+    it = it_begin(p->tempNames);
+    int i = 0, numFormals = list_size(frm_formalAccesses(p->p->frm));
+    while(it_hasNext(it)) {
+        string name = it_next(it);
+        if(i++ >= numFormals)
+            fprintf(out, "    word %s = 0;\n", cName("v_", name));
+    }
+    it_free(&it);
+    if(space > 0) {
+        fprintf(out, "    word sp = t->sp;\n");
+        fprintf(out, "    word fp = sire_push(t, %d);\n", space);
+    }
+
+    i_stmt last = NULL;
+    it = it_begin(p->p->stmts.ir);
+    while(it_hasNext(it)) {
+        last = it_next(it);
+        genStmt(p, last, space > 0);
+    }
+    it_free(&it);
+    if(last == NULL || (last->type != t_RETURN && last->type != t_END
+                && last->type != t_JUMP))
+        genStmt(p, i_End(), space > 0);
+    fprintf(out, "}\n\n");
+}
+
+// The body of a procedure with a par, entered at the start or at the label
+// of a branch. The barriers of its forks are held by the master.
+static void genBody(proc p) {
+    fprintf(out, "static word %s(sire_thr *t, void *frame, int entry) {\n",
+            cName("b_", p->name));
+    fprintf(out, "    %s *f = frame;\n", cName("f_", p->name));
+    if(p->numForks > 0)
+        fprintf(out, "    sire_barrier b[%d];\n", p->numForks);
+    fprintf(out, "    switch(entry) {\n");
+    iterator it = it_begin(p->p->stmts.ir);
+    while(it_hasNext(it)) {
+        i_stmt st = it_next(it);
+        if(st->type == t_FORKSET)
+            fprintf(out, "    case %d: goto %s;\n",
+                    (int) (size_t) tab_lookup(p->entries,
+                        lbl_name(st->u.FORKSET.l)),
+                    labelName(st->u.FORKSET.l));
+    }
+    it_free(&it);
+    fprintf(out, "    default: break;\n");
+    fprintf(out, "    }\n");
+
+    forkNum = 0;
+    i_stmt last = NULL;
+    it = it_begin(p->p->stmts.ir);
+    while(it_hasNext(it)) {
+        last = it_next(it);
+        genStmt(p, last, false);
+    }
+    it_free(&it);
+    if(last == NULL || (last->type != t_RETURN && last->type != t_END
+                && last->type != t_JUMP))
+        genStmt(p, i_End(), false);
+    fprintf(out, "}\n\n");
+}
+
+// A statement, restoring the stack of the thread at a return if the
+// procedure allocated arrays on it
+static void genStmt(proc p, i_stmt st, bool arrays) {
+    switch(st->type) {
+    case t_LABEL:
+        if(tab_lookup(p->labels, lbl_name(st->u.LABEL)) != NULL)
+            fprintf(out, "%s: ;\n", labelName(st->u.LABEL));
+        break;
+
+    case t_NOP:
+    case t_FORKSYNC:
+        break;
+
+    case t_JUMP:
+        fprintf(out, "    goto %s;\n", labelName(st->u.JUMP->u.NAME));
+        break;
+
+    case t_CJUMP:
+        fprintf(out, "    if(");
+        genExpr(p, st->u.CJUMP.expr);
+        fprintf(out, ") goto %s;\n", labelName(st->u.CJUMP.then->u.NAME));
+        fprintf(out, "    goto %s;\n", labelName(st->u.CJUMP.other->u.NAME));
+        break;
+
+    case t_MOVE:
+        genMove(p, st->u.MOVE.dst, st->u.MOVE.src);
+        break;
+
+    case t_INPUT:
+        fprintf(out, "    ");
+        genLvalue(p, st->u.IO.dst);
+        fprintf(out, " = sire_in(t, ");
+        genExpr(p, st->u.IO.src);
+        fprintf(out, ");\n");
+        break;
+
+    case t_OUTPUT:
+        fprintf(out, "    sire_out(t, ");
+        genExpr(p, st->u.IO.dst);
+        fprintf(out, ", ");
+        genExpr(p, st->u.IO.src);
+        fprintf(out, ");\n");
+        break;
+
+    case t_OPEN:
+        fprintf(out, "    ");
+        genExpr(p, st->u.STREAM.end);
+        fprintf(out, " = sire_open(t, ");
+        genExpr(p, st->u.STREAM.chan);
+        fprintf(out, ", %s);\n", st->u.STREAM.output ? "true" : "false");
+        break;
+
+    case t_CLOSE:
+        fprintf(out, "    sire_close(t, %s);\n",
+                st->u.STREAM.output ? "true" : "false");
+        break;
+
+    case t_FORK:
+        fprintf(out, "    sire_fork(&b[%d]);\n", forkNum);
+        fprintf(out, "    f->s[%d] = &b[%d];\n", forkNum, forkNum);
+        fprintf(out, "    ");
+        genExpr(p, st->u.FORK.t1);
+        fprintf(out, " = %d;\n", forkNum++);
+        break;
+
+    case t_FORKSET:
+        fprintf(out, "    sire_forkSet(t, f->s[");
+        genExpr(p, st->u.FORKSET.sync);
+        fprintf(out, "], %s, f, sizeof(*f), %d);\n", cName("b_", p->name),
+                (int) (size_t) tab_lookup(p->entries,
+                    lbl_name(st->u.FORKSET.l)));
+        break;
+
+    case t_JOIN:
+        if(st->u.JOIN.master) {
+            fprintf(out, "    sire_join(f->s[");
+            genExpr(p, st->u.JOIN.t1);
+            fprintf(out, "]);\n");
+            fprintf(out, "    goto %s;\n", labelName(st->u.JOIN.exit));
+        }
+        else {
+            fprintf(out, "    sire_arrive(f->s[");
+            genExpr(p, st->u.JOIN.t1);
+            fprintf(out, "]);\n");
+            fprintf(out, "    return 0;\n");
+        }
+        break;
+
+    case t_PCALL:
+        fprintf(out, "    ");
+        genCall(p, st->u.PCALL.proc, st->u.PCALL.args);
+        fprintf(out, ";\n");
+        break;
+
+    case t_ON:
+        genOn(p, st);
+        break;
+
+    case t_ONJOIN:
+        fprintf(out, "    sire_onJoin(t, ");
+        genExpr(p, st->u.ONJOIN.handle);
+        fprintf(out, ");\n");
+        break;
+
+    case t_CONNECT:
+        fprintf(out, "    sire_connect(t, ");
+        genExpr(p, st->u.CONNECT.to);
+        fprintf(out, ", ");
+        genExpr(p, st->u.CONNECT.c1);
+        fprintf(out, ", ");
+        genExpr(p, st->u.CONNECT.c2);
+        fprintf(out, ");\n");
+        break;
+
+    case t_RETURN:
+        if(!arrays) {
+            fprintf(out, "    return ");
+            genExpr(p, st->u.RETURN.expr);
+            fprintf(out, ";\n");
+            break;
+        }
+        fprintf(out, "    {\n");
+        fprintf(out, "        word r = ");
+        genExpr(p, st->u.RETURN.expr);
+        fprintf(out, ";\n");
+        fprintf(out, "        t->sp = sp;\n");
+        fprintf(out, "        return r;\n");
+        fprintf(out, "    }\n");
+        break;
+
+    case t_END:
+        if(arrays)
+            fprintf(out, "    t->sp = sp;\n");
+        fprintf(out, "    return 0;\n");
+        break;
+
+    default: assert(0 && "invalid statement type");
+    }
+}
+
+// Migrate a call, waiting for it, or starting it and setting its handle
+static void genOn(proc p, i_stmt st) {
+    i_expr pCall = st->u.ON.pCall;
+    string name = lbl_name(pCall->u.FCALL.func->u.NAME);
+    int n = list_size(pCall->u.FCALL.args);
+
+    fprintf(out, "    {\n");
+    fprintf(out, "        word a[%d] = {", n + 1);
+    iterator it = it_begin(pCall->u.FCALL.args);
+    while(it_hasNext(it)) {
+        genExpr(p, it_next(it));
+        fprintf(out, ", ");
+    }
+    it_free(&it);
+    fprintf(out, "0};\n");
+
+    fprintf(out, "        ");
+    if(st->u.ON.handle != NULL) {
+        genExpr(p, st->u.ON.handle);
+        fprintf(out, " = sire_onAsync(t, ");
+    }
+    else
+        fprintf(out, "sire_on(t, ");
+    genExpr(p, st->u.ON.dest);
+    fprintf(out, ", %s, %d, a, %s);\n", cName("o_", name), n,
+            cName("m_", name));
+    fprintf(out, "    }\n");
+}
+
+// An assignment to a temp or memory
+static void genMove(proc p, i_expr dst, i_expr src) {
+    fprintf(out, "    ");
+    genLvalue(p, dst);
+    fprintf(out, " = ");
+    genExpr(p, src);
+    fprintf(out, ";\n");
+}
+
+// A temp or memory word stored to
+static void genLvalue(proc p, i_expr dst) {
+    switch(dst->type) {
+    case t_TEMP:
+        genTemp(p, dst->u.TEMP);
+        break;
+    case t_MEM:
+        fprintf(out, "M(t, ");
+        genAddr(p, dst);
+        fprintf(out, ")");
+        break;
+    default: assert(0 && "invalid store destination");
+    }
+}
+
+// A call of a procedure with its arguments
+static void genCall(proc p, i_expr func, list args) {
+    fprintf(out, "%s(t", cName("p_", lbl_name(func->u.NAME)));
+    iterator it = it_begin(args);
+    while(it_hasNext(it)) {
+        fprintf(out, ", ");
+        genExpr(p, it_next(it));
+    }
+    it_free(&it);
+    fprintf(out, ")");
+}
+
+//========================================================================
+// Expressions
+//========================================================================
+
+// An expression, evaluating to a word
+static void genExpr(proc p, i_expr e) {
+    switch(e->type) {
+    case t_CONST:
+        fprintf(out, "%uu", e->u.CONST);
+        break;
+    case t_TEMP:
+        genTemp(p, e->u.TEMP);
+        break;
+    case t_BINOP:
+        genBinop(p, e->u.BINOP.op, e->u.BINOP.left, e->u.BINOP.right);
+        break;
+    case t_MEM:
+        switch(e->u.MEM.type) {
+        case t_mem_spa: case t_mem_dpa: case t_mem_cpa:
+            genAddr(p, e);
+            break;
+        default:
+            fprintf(out, "M(t, ");
+            genAddr(p, e);
+            fprintf(out, ")");
+            break;
+        }
+        break;
+    case t_SYS: {
+        string name = lbl_name(e->u.SYS.name->u.NAME);
+        if(streq(name, CORE_ARRAY))
+            fprintf(out, "sire_coreNum(t, ");
+        else {
+            assert(streq(name, CHAN_ARRAY) && "invalid system variable");
+            fprintf(out, "sire_chanend(t, ");
+        }
+        genExpr(p, e->u.SYS.value);
+        fprintf(out, ")");
+        break;
+    }
+    case t_FCALL:
+        genCall(p, e->u.FCALL.func, e->u.FCALL.args);
+        break;
+    default: assert(0 && "invalid expression type");
+    }
+}
+
+// A binary operation, as the instructions generated for it
+static void genBinop(proc p, t_binop op, i_expr l, i_expr r) {
+    string fn = NULL, cop = NULL;
+    bool sign = false;
+    switch(op) {
+    case i_plus:   cop = "+";                      break;
+    case i_minus:  cop = "-";                      break;
+    case i_mult:   cop = "*";                      break;
+    case i_or:     cop = "|";                      break;
+    case i_and:    cop = "&";                      break;
+    case i_xor:    cop = "^";                      break;
+    case i_eq:     cop = "==";                     break;
+    case i_ne:     cop = "!=";                     break;
+    case i_ls:     cop = "<";  sign = true;        break;
+    case i_le:     cop = "<="; sign = true;        break;
+    case i_gr:     cop = ">";  sign = true;        break;
+    case i_ge:     cop = ">="; sign = true;        break;
+    case i_div:    fn = "sire_div(t, ";            break;
+    case i_rem:    fn = "sire_rem(t, ";            break;
+    case i_lshift: fn = "sire_shl(";               break;
+    case i_rshift: fn = "sire_shr(";               break;
+    case i_ashr:   fn = "sire_ashr(";              break;
+    case i_mulhu:  fn = "sire_mulhu(";             break;
+    default: assert(0 && "invalid binop");
+    }
+
+    if(fn != NULL) {
+        fprintf(out, "%s", fn);
+        genExpr(p, l);
+        fprintf(out, ", ");
+        genExpr(p, r);
+        fprintf(out, ")");
+        return;
+    }
+    fprintf(out, "(word) (%s", sign ? "(int32_t) " : "");
+    genExpr(p, l);
+    fprintf(out, " %s %s", cop, sign ? "(int32_t) " : "");
+    genExpr(p, r);
+    fprintf(out, ")");
+}
+
+// The byte address of a memory access, folded if it is constant
+static void genAddr(proc p, i_expr e) {
+    i_expr off = e->u.MEM.offset;
+    switch(e->u.MEM.type) {
+    case t_mem_abs:
+        fprintf(out, "(");
+        genExpr(p, e->u.MEM.base);
+        break;
+    case t_mem_spl:
+    case t_mem_spa:
+        fprintf(out, "(%s", p->par ? "f->fp" : "fp");
+        break;
+    case t_mem_dp:
+    case t_mem_dpa:
+    case t_mem_cp:
+    case t_mem_cpa:
+        if(off->type == t_CONST) {
+            fprintf(out, "%uu", constAddr(e) + off->u.CONST*BYTES_PER_WORD);
+            return;
+        }
+        fprintf(out, "(%uu", constAddr(e));
+        break;
+    default: assert(0 && "invalid memory access before frames");
+    }
+    if(off->type == t_CONST)
+        fprintf(out, " + %uu)", off->u.CONST*BYTES_PER_WORD);
+    else {
+        fprintf(out, " + ");
+        genExpr(p, off);
+        fprintf(out, " * %du)", BYTES_PER_WORD);
+    }
+}
+
+// A temp of the procedure or its frame, or a global in memory
+static void genTemp(proc p, temp tmp) {
+    string name = tmp_name(tmp);
+    if(tmp_type(tmp) == t_tmp_global) {
+        ir_data g = tab_lookup(dataTab, name);
+        assert(g != NULL && "global has no storage");
+        fprintf(out, "M(t, %uu)", (cpWords + g->off) * BYTES_PER_WORD);
+        return;
+    }
+    fprintf(out, "%s%s", p->par ? "f->" : "", cName("v_", name));
+}
+
+// The byte address of a global or constant
+static unsigned constAddr(i_expr e) {
+    string name = lbl_name(e->u.MEM.base->u.NAME);
+    switch(e->u.MEM.type) {
+    case t_mem_dp:
+    case t_mem_dpa: {
+        ir_data g = tab_lookup(dataLblTab, name);
+        assert(g != NULL && "global does not exist");
+        return (cpWords + g->off) * BYTES_PER_WORD;
+    }
+    default: {
+        size_t index = (size_t) tab_lookup(cpTab, name);
+        assert(index != 0 && "constant does not exist");
+        return (index - 1) * BYTES_PER_WORD;
+    }
+    }
+}
+
+// A C identifier for a name, with a prefix for its kind
+static string cName(string prefix, string name) {
+    string s = StringFmt("%s%s", prefix, name);
+    string c;
+    for(c=s; *c!='\0'; c++) {
+        if(*c == '.')
+            *c = '_';
+    }
+    return s;
+}
+
+static string labelName(label l) {
+    return cName("l_", lbl_name(l));
+}
@@ -0,0 +1,9 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stdio.h>
+#include "structures.h"
+
+void ntv_program(FILE *, structures);
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include "params.h"
+#include "error.h"
+#include "../include/definitions.h"
+
+#define DEBUG 0
+
+// Array parameter analysis:
+//
+// Find whether each array formal of a procedure may be read and whether it
+// may be written, by the procedure itself, through an alias of it, or by a
+// procedure it is passed to. The result is recorded as the mode of the
+// formal in its signature, and migrating an on to a procedure copies an
+// array to the host only if it is accessed, and back only if it is written.
+// A written array is always copied to the host as the procedure may not
+// write every element. Calls form a fixed point, as a procedure's modes
+// depend on those of its callees.
+
+typedef struct {
+    string name;
+    int index;
+} alias;
+
+typedef struct {
+    structures s;
+    signature sig;
+    a_formals formals;
+    list aliases;
+    bool change;
+} context;
+
+static void   proc     (structures, a_procDecl, bool *);
+static void   stmt     (context *, a_stmt);
+static void   expr     (context *, a_expr);
+static void   elem     (context *, a_elem);
+static void   call     (context *, string, a_exprList);
+static void   mark     (context *, string, int);
+static int    formal   (context *, string);
+static a_elem nameElem (a_expr);
+
+// Analyse the array formals of each procedure, and check val formals are
+// not written
+void prm_analyse(structures s, a_procDecls p) {
+
+    a_procDecls d;
+    bool change;
+    do {
+        change = false;
+        for(d=p; d!=NULL; d=d->tail)
+            proc(s, d->head, &change);
+    }
+    while(change);
+
+    for(d=p; d!=NULL; d=d->tail) {
+        signature sig = sigTab_lookup(s->sig, d->head->name->name);
+        a_formals f;
+        a_paramDeclSeq a;
+        int i = 0;
+        for(f=d->head->formals; f!=NULL; f=f->next) {
+            for(a=f->params; a!=NULL; a=a->next, i++) {
+                if(DEBUG) printf("%s.%s: mode %d\n", d->head->name->name,
+                        a->param->name->name, sig_getFmlMode(sig, i));
+                if(sig_isVal(sig, i)
+                        && (sig_getFmlMode(sig, i) & ARG_MODE_OUT))
+                    err_report(t_error, a->param->pos,
+                            "val array '%s' may be modified",
+                            a->param->name->name);
+            }
+        }
+    }
+}
+
+// Analyse the body of a procedure
+static void proc(structures s, a_procDecl p, bool *change) {
+    context c;
+    c.s = s;
+    c.sig = sigTab_lookup(s->sig, p->name->name);
+    c.formals = p->formals;
+    c.aliases = list_New();
+    c.change = false;
+    if(c.sig != NULL)
+        stmt(&c, p->stmt);
+    if(c.change)
+        *change = true;
+
+    iterator it = it_begin(c.aliases);
+    while(it_hasNext(it))
+        free(it_next(it));
+    it_free(&it);
+    list_delete(c.aliases);
+}
+
+// Statement accesses
+static void stmt(context *c, a_stmt p) {
+    a_elem e;
+    switch(p->type) {
+    case t_stmt_return:
+        expr(c, p->u.return_.expr);
+        break;
+    case t_stmt_if:
+        expr(c, p->u.if_.expr);
+        stmt(c, p->u.if_.stmt1);
+        stmt(c, p->u.if_.stmt2);
+        break;
+    case t_stmt_while:
+        expr(c, p->u.while_.expr);
+        stmt(c, p->u.while_.stmt);
+        break;
+    case t_stmt_for:
+        expr(c, p->u.for_.pre);
+        expr(c, p->u.for_.post);
+        stmt(c, p->u.for_.stmt);
+        break;
+    case t_stmt_rep:
+        expr(c, p->u.rep.base);
+        expr(c, p->u.rep.count);
+        stmt(c, p->u.rep.stmt);
+        break;
+    case t_stmt_pCall:
+        call(c, p->u.pCall.name->name, p->u.pCall.exprList);
+        break;
+    case t_stmt_on:
+        elem(c, p->u.on.dest);
+        call(c, p->u.on.pCall->u.call.name->name,
+                p->u.on.pCall->u.call.exprList);
+        break;
+    case t_stmt_join:
+        expr(c, p->u.join.handle);
+        break;
+    case t_stmt_ass:
+        e = p->u.ass.dst;
+        if(e->type == t_elem_sub) {
+            mark(c, e->u.sub.name->name, ARG_MODE_OUT);
+            expr(c, e->u.sub.expr);
+        }
+        expr(c, p->u.ass.src);
+        break;
+    case t_stmt_input:
+        elem(c, p->u.io.dst);
+        e = nameElem(p->u.io.src);
+        if(e != NULL && e->type == t_elem_sub) {
+            mark(c, e->u.sub.name->name, ARG_MODE_OUT);
+            expr(c, e->u.sub.expr);
+        }
+        if(p->u.io.count != NULL)
+            expr(c, p->u.io.count);
+        break;
+    case t_stmt_output:
+        elem(c, p->u.io.dst);
+        expr(c, p->u.io.src);
+        if(p->u.io.count != NULL)
+            expr(c, p->u.io.count);
+        break;
+    case t_stmt_alias: {
+        int i = formal(c, p->u.alias.array->u.name->name);
+        expr(c, p->u.alias.index);
+        if(i != -1) {
+            alias *a = chkalloc(sizeof(alias));
+            a->name = p->u.alias.dst->u.name->name;
+            a->index = i;
+            list_add(c->aliases, a);
+        }
+        break;
+    }
+    case t_stmt_seq: {
+        a_stmtSeq seq;
+        for(seq=p->u.seq; seq!=NULL; seq=seq->tail)
+            stmt(c, seq->head);
+        break;
+    }
+    case t_stmt_par: {
+        a_stmtPar par;
+        for(par=p->u.par; par!=NULL; par=par->tail)
+            stmt(c, par->head);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Expression accesses
+static void expr(context *c, a_expr p) {
+    switch(p->type) {
+    case t_expr_none: case t_expr_neg: case t_expr_not:
+        elem(c, p->u.monadic.elem);
+        break;
+    default:
+        elem(c, p->u.diadic.elem);
+        expr(c, p->u.diadic.expr);
+        break;
+    }
+}
+
+// Element accesses: any other use of an array reads it
+static void elem(context *c, a_elem p) {
+    switch(p->type) {
+    case t_elem_name:
+        mark(c, p->u.name->name, ARG_MODE_IN);
+        break;
+    case t_elem_sub:
+        mark(c, p->u.sub.name->name, ARG_MODE_IN);
+        expr(c, p->u.sub.expr);
+        break;
+    case t_elem_pCall:
+    case t_elem_fCall:
+        call(c, p->u.call.name->name, p->u.call.exprList);
+        break;
+    case t_elem_expr:
+        expr(c, p->u.expr);
+        break;
+    default:
+        break;
+    }
+}
+
+// Accesses by a call: an array passed to an array formal takes its mode,
+// and anything passed to an unknown procedure may be read and written
+static void call(context *c, string name, a_exprList args) {
+    signature sig = sigTab_lookup(c->s->sig, name);
+    int numFormals = sig == NULL ? 0 : sigTab_numArgs(c->s->sig, name);
+    int i = 0;
+    for(; args!=NULL; args=args->tail, i++) {
+        a_elem e = nameElem(args->head);
+        if(e == NULL || e->type != t_elem_name) {
+            expr(c, args->head);
+            continue;
+        }
+        if(sig == NULL || i >= numFormals)
+            mark(c, e->u.name->name, ARG_MODE_IN | ARG_MODE_OUT);
+        else if(sig_getFmlType(sig, i) == t_formal_intArray)
+            mark(c, e->u.name->name, sig_getFmlMode(sig, i));
+        else
+            mark(c, e->u.name->name, ARG_MODE_IN);
+    }
+}
+
+// Add to the mode of a formal, if the name refers to one. A written array
+// is also copied in.
+static void mark(context *c, string name, int mode) {
+    int i = formal(c, name);
+    if(i == -1)
+        return;
+    if(mode & ARG_MODE_OUT)
+        mode |= ARG_MODE_IN;
+    int old = sig_getFmlMode(c->sig, i);
+    if((old | mode) != old) {
+        sig_setFmlMode(c->sig, i, old | mode);
+        c->change = true;
+    }
+}
+
+// The index of the array formal a name refers to, directly or by an alias,
+// or -1
+static int formal(context *c, string name) {
+    a_formals f;
+    a_paramDeclSeq a;
+    int i = 0;
+    for(f=c->formals; f!=NULL; f=f->next) {
+        for(a=f->params; a!=NULL; a=a->next, i++) {
+            if(f->type == t_formal_intArray && streq(a->param->name->name, name))
+                return i;
+        }
+    }
+    iterator it = it_begin(c->aliases);
+    while(it_hasNext(it)) {
+        alias *al = it_next(it);
+        if(streq(al->name, name)) {
+            it_free(&it);
+            return al->index;
+        }
+    }
+    it_free(&it);
+    return -1;
+}
+
+// The element of an expression that is a single element, or NULL
+static a_elem nameElem(a_expr p) {
+    if(p->type != t_expr_none)
+        return NULL;
+    if(p->u.monadic.elem->type == t_elem_expr)
+        return nameElem(p->u.monadic.elem->u.expr);
+    return p->u.monadic.elem;
+}
@@ -0,0 +1,9 @@
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include "ast.h"
+#include "structures.h"
+
+void prm_analyse(structures, a_procDecls);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include "prune.h"
+#include "ir.h"
+#include "block.h"
+#include "regalloc.h"
+#include "codegen.h"
+#include "../include/definitions.h"
+
+#define DEBUG 0
+
+// Unreachable procedures:
+//
+// The call graph is rooted at _main, with an edge for each call, function
+// call and on. Once translated, the children of each procedure are the
+// transitive closure of these, so _main and its children are all that can
+// run. The rest are dropped before blocks are sequenced and registers
+// allocated, and as procedures are numbered when they are generated, those
+// kept have dense jump table indices.
+//
+// Each core image holds the code of every procedure and a word of the size
+// table for it. To report what was saved, the dropped procedures are
+// compiled on their own into a scratch file, after the program.
+
+static bool isReachable(ir_proc, ir_proc);
+
+// Remove the procedures unreachable from _main, returning them
+list prn_unreachable(structures s) {
+    ir_proc root = list_getFirst(s->ir->procs, LBL_MAIN, &isNamedProc);
+    assert(root != NULL && "no main procedure");
+    list removed = list_New();
+
+    iterator it = it_begin(s->ir->procs);
+    while(it_hasNext(it)) {
+        ir_proc p = it_next(it);
+        if(!isReachable(root, p)) {
+            if(DEBUG) printf("Removing unreachable %s\n", frm_name(p->frm));
+            list_add(removed, it_remove(it));
+        }
+    }
+    it_free(&it);
+    return removed;
+}
+
+// Report the bytes of each removed procedure, and their total in each of
+// the core images
+void prn_report(FILE *out, structures s, list removed, int cores) {
+    int n = list_size(removed);
+    int *bytes = chkalloc(sizeof(int) * (n > 0 ? n : 1));
+    int total = 0;
+    int i;
+
+    // Sequence and allocate them as the program was, then generate them
+    if(n > 0) {
+        list procs = s->ir->procs;
+        s->ir->procs = removed;
+        basicBlocks(s, false, NULL);
+        allocRegs(s);
+        s->ir->procs = procs;
+        gen_procBytes(s, removed, bytes);
+    }
+
+    printTitleRule(out, "Unreachable procedures");
+    fprintf(out, "  %-20s %10s %10s\n", "Procedure", "Code", "Data");
+    i = 0;
+    iterator it = it_begin(removed);
+    while(it_hasNext(it)) {
+        ir_proc p = it_next(it);
+        fprintf(out, "  %-20s %10d %10d\n", frm_name(p->frm), bytes[i],
+                BYTES_PER_WORD);
+        total += bytes[i++] + BYTES_PER_WORD;
+    }
+    it_free(&it);
+    fprintf(out, "  Bytes removed from each of %d core image%s: %d\n",
+            cores, cores == 1 ? "" : "s", total);
+    printRule(out);
+    free(bytes);
+}
+
+// Check if a procedure is the root or one of its children
+static bool isReachable(ir_proc root, ir_proc p) {
+    return p == root || list_contains(ir_childCalls(root), 
+            frm_name(p->frm), &isNamedProc);
+}
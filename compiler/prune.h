@@ -0,0 +1,11 @@
+#ifndef PRUNE_H
+#define PRUNE_H
+
+#include <stdio.h>
+#include "list.h"
+#include "structures.h"
+
+list prn_unreachable(structures);
+void prn_report     (FILE *, structures, list, int);
+
+#endif
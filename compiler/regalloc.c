@@ -3,6 +3,7 @@
 #include "liveness.h"
 #include "linearscan.h"
 #include "spill.h"
+#include "slots.h"
 
 // Register allocation:
 //
@@ -16,6 +17,7 @@
 //          defs.
 //    b. Add any necessary stack loads into registers, immediately before the live
 //    range of a variable.
+//    c. Share the stack slots of spilled variables with disjoint live ranges.
 void allocRegs(structures s) {
     
     // Loop through each procedure
@@ -46,6 +48,9 @@ void allocRegs(structures s) {
 
         // Complete by adding any loads from stack and updating used regs in frame
         linScan_complete(proc->frm, liveIntervals, proc->blocks);
+
+        // Colour spill slots so disjoint live ranges share frame space
+        slots_colour(proc->frm, proc->blocks);
         
         // Flatten blocks into list stmts
         proc->stmts.ir = blc_stmtSeq(proc->blocks);
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include "route.h"
+#include "ir.h"
+#include "symbol.h"
+#include "translate.h"
+#include "statistics.h"
+#include "../include/definitions.h"
+
+#define DEBUG 0
+
+#define UNCONNECTED 0
+#define STATIC      1
+#define DYNAMIC     2
+
+// Static channel routing:
+//
+// A connect whose core and channel subscripts are all constant sets the
+// destination of a program channel to a value known at compile time. If
+// every connect of a channel in the program is constant, and they agree on
+// the destination, the channel is entered into a table emitted with the
+// constants and the runtime sets its destination once, when each core starts.
+// The table is applied on every core as it is not known where a connect
+// executes. Any connect with a channel index computed at run time could
+// overwrite any other, so then every connect is left to the runtime.
+// Only the procedures reachable from main, by calls, function calls and
+// ons, are considered, as the rest are removed before code generation.
+
+static int  state[NUM_PROG_CHANS];
+static int  tableCore[NUM_PROG_CHANS];
+static int  tableChan[NUM_PROG_CHANS];
+static bool anyDynamic;
+
+static void reach     (structures, string, list);
+static void stmtCalls (structures, a_stmt, list);
+static void exprCalls (structures, a_expr, list);
+static void elemCalls (structures, a_elem, list);
+static void stmt      (a_stmt);
+static void connect   (a_stmt);
+static bool evalSub   (a_elem, int *);
+static bool evalElem  (a_elem, int *);
+
+// Resolve the constant connects of the program into the routing table
+void rte_resolve(structures s) {
+    int i;
+    for(i=0; i<NUM_PROG_CHANS; i++)
+        state[i] = UNCONNECTED;
+    anyDynamic = false;
+
+    list reached = list_New();
+    reach(s, LBL_MAIN, reached);
+    iterator it = it_begin(reached);
+    while(it_hasNext(it)) {
+        ir_proc p = it_next(it);
+        stmt(p->stmts.as);
+    }
+    it_free(&it);
+    list_delete(reached);
+
+    if(anyDynamic) {
+        for(i=0; i<NUM_PROG_CHANS; i++)
+            state[i] = DYNAMIC;
+    }
+    for(i=0; i<NUM_PROG_CHANS; i++) {
+        if(DEBUG && state[i] == STATIC)
+            printf("chan[%d] -> core[%d]:chan[%d]\n",
+                    i, tableCore[i], tableChan[i]);
+    }
+}
+
+// Check if a connect statement has been entered in the routing table. One
+// in an unreachable procedure may not match it.
+bool rte_isStatic(a_stmt p) {
+    int to, c1, c2;
+    if(!evalSub(p->u.connect.c1, &c1) || c1 < 0 || c1 >= NUM_PROG_CHANS)
+        return false;
+    if(!evalSub(p->u.connect.to, &to) || !evalSub(p->u.connect.c2, &c2))
+        return false;
+    return state[c1] == STATIC && tableCore[c1] == to && tableChan[c1] == c2;
+}
+
+// The static destination of a channel, if it has one
+bool rte_dest(int chan, int *core, int *dest) {
+    if(state[chan] != STATIC)
+        return false;
+    *core = tableCore[chan];
+    *dest = tableChan[chan];
+    return true;
+}
+
+// Add a procedure and those it calls to the reached procedures
+static void reach(structures s, string name, list reached) {
+    ir_proc p = list_getFirst(s->ir->procs, name, &isNamedProc);
+    if(p == NULL || list_contains(reached, name, &isNamedProc))
+        return;
+    list_add(reached, p);
+    stmtCalls(s, p->stmts.as, reached);
+}
+
+// Reach the procedures called by a statement
+static void stmtCalls(structures s, a_stmt p, list reached) {
+    switch(p->type) {
+    case t_stmt_return:
+        exprCalls(s, p->u.return_.expr, reached);
+        break;
+    case t_stmt_if:
+        exprCalls(s, p->u.if_.expr, reached);
+        stmtCalls(s, p->u.if_.stmt1, reached);
+        stmtCalls(s, p->u.if_.stmt2, reached);
+        break;
+    case t_stmt_while:
+        exprCalls(s, p->u.while_.expr, reached);
+        stmtCalls(s, p->u.while_.stmt, reached);
+        break;
+    case t_stmt_for:
+        exprCalls(s, p->u.for_.pre, reached);
+        exprCalls(s, p->u.for_.post, reached);
+        stmtCalls(s, p->u.for_.stmt, reached);
+        break;
+    case t_stmt_rep:
+        exprCalls(s, p->u.rep.base, reached);
+        exprCalls(s, p->u.rep.count, reached);
+        stmtCalls(s, p->u.rep.stmt, reached);
+        break;
+    case t_stmt_pCall: {
+        a_exprList args;
+        for(args=p->u.pCall.exprList; args!=NULL; args=args->tail)
+            exprCalls(s, args->head, reached);
+        reach(s, p->u.pCall.name->name, reached);
+        break;
+    }
+    case t_stmt_ass:
+        elemCalls(s, p->u.ass.dst, reached);
+        exprCalls(s, p->u.ass.src, reached);
+        break;
+    case t_stmt_input:
+    case t_stmt_output:
+        elemCalls(s, p->u.io.dst, reached);
+        exprCalls(s, p->u.io.src, reached);
+        if(p->u.io.count != NULL)
+            exprCalls(s, p->u.io.count, reached);
+        break;
+    case t_stmt_on:
+        elemCalls(s, p->u.on.dest, reached);
+        elemCalls(s, p->u.on.pCall, reached);
+        break;
+    case t_stmt_join:
+        exprCalls(s, p->u.join.handle, reached);
+        break;
+    case t_stmt_alias:
+        exprCalls(s, p->u.alias.index, reached);
+        break;
+    case t_stmt_connect:
+        elemCalls(s, p->u.connect.to, reached);
+        elemCalls(s, p->u.connect.c1, reached);
+        elemCalls(s, p->u.connect.c2, reached);
+        break;
+    case t_stmt_seq: {
+        a_stmtSeq seq;
+        for(seq=p->u.seq; seq!=NULL; seq=seq->tail)
+            stmtCalls(s, seq->head, reached);
+        break;
+    }
+    case t_stmt_par: {
+        a_stmtPar par;
+        for(par=p->u.par; par!=NULL; par=par->tail)
+            stmtCalls(s, par->head, reached);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Reach the functions called by an expression
+static void exprCalls(structures s, a_expr p, list reached) {
+    switch(p->type) {
+    case t_expr_none: case t_expr_neg: case t_expr_not:
+        elemCalls(s, p->u.monadic.elem, reached);
+        break;
+    default:
+        elemCalls(s, p->u.diadic.elem, reached);
+        exprCalls(s, p->u.diadic.expr, reached);
+        break;
+    }
+}
+
+// Reach the functions called by an element
+static void elemCalls(structures s, a_elem e, list reached) {
+    switch(e->type) {
+    case t_elem_sub:
+        exprCalls(s, e->u.sub.expr, reached);
+        break;
+    case t_elem_expr:
+        exprCalls(s, e->u.expr, reached);
+        break;
+    case t_elem_pCall:
+    case t_elem_fCall: {
+        a_exprList args;
+        for(args=e->u.call.exprList; args!=NULL; args=args->tail)
+            exprCalls(s, args->head, reached);
+        reach(s, e->u.call.name->name, reached);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Find the connects in a statement
+static void stmt(a_stmt p) {
+    switch(p->type) {
+    case t_stmt_connect:
+        connect(p);
+        break;
+    case t_stmt_if:
+        stmt(p->u.if_.stmt1);
+        stmt(p->u.if_.stmt2);
+        break;
+    case t_stmt_while:
+        stmt(p->u.while_.stmt);
+        break;
+    case t_stmt_for:
+        stmt(p->u.for_.stmt);
+        break;
+    case t_stmt_rep:
+        stmt(p->u.rep.stmt);
+        break;
+    case t_stmt_seq: {
+        a_stmtSeq seq;
+        for(seq=p->u.seq; seq!=NULL; seq=seq->tail)
+            stmt(seq->head);
+        break;
+    }
+    case t_stmt_par: {
+        a_stmtPar par;
+        for(par=p->u.par; par!=NULL; par=par->tail)
+            stmt(par->head);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Enter a connect into the table, or mark its channel as dynamic
+static void connect(a_stmt p) {
+    int to, c1, c2;
+    if(!evalSub(p->u.connect.c1, &c1) || c1 < 0 || c1 >= NUM_PROG_CHANS) {
+        anyDynamic = true;
+        return;
+    }
+    if(!evalSub(p->u.connect.to, &to) || !evalSub(p->u.connect.c2, &c2)) {
+        state[c1] = DYNAMIC;
+        return;
+    }
+    switch(state[c1]) {
+    case UNCONNECTED:
+        state[c1] = STATIC;
+        tableCore[c1] = to;
+        tableChan[c1] = c2;
+        break;
+    case STATIC:
+        if(tableCore[c1] != to || tableChan[c1] != c2)
+            state[c1] = DYNAMIC;
+        break;
+    default:
+        break;
+    }
+}
+
+// Evaluate the subscript of a core or chan element
+static bool evalSub(a_elem e, int *value) {
+    return e->type == t_elem_sub && rte_evalConst(e->u.sub.expr, value);
+}
+
+// Evaluate a constant expression, if it is one
+bool rte_evalConst(a_expr p, int *value) {
+    int a, b;
+    switch(p->type) {
+    case t_expr_none:
+        return evalElem(p->u.monadic.elem, value);
+    case t_expr_neg:
+        if(!evalElem(p->u.monadic.elem, &a))
+            return false;
+        *value = -a;
+        return true;
+    case t_expr_not:
+        if(!evalElem(p->u.monadic.elem, &a))
+            return false;
+        *value = !a;
+        return true;
+    default:
+        if(!evalElem(p->u.diadic.elem, &a) 
+                || !rte_evalConst(p->u.diadic.expr, &b))
+            return false;
+        if((p->type == t_expr_div || p->type == t_expr_rem) && b == 0)
+            return false;
+        *value = trl_evalOp(p->type, a, b);
+        return true;
+    }
+}
+
+// Evaluate a constant element
+static bool evalElem(a_elem e, int *value) {
+    switch(e->type) {
+    case t_elem_number:
+        *value = e->u.number;
+        return true;
+    case t_elem_name:
+        if(e->sym == NULL || sym_type(e->sym) != t_sym_const)
+            return false;
+        *value = sym_constVal(e->sym);
+        return true;
+    case t_elem_expr:
+        return rte_evalConst(e->u.expr, value);
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include "ast.h"
+#include "structures.h"
+
+void rte_resolve  (structures);
+bool rte_isStatic (a_stmt);
+bool rte_dest     (int chan, int *core, int *dest);
+bool rte_evalConst(a_expr, int *);
+
+#endif
@@ -2,12 +2,15 @@
 #include "../include/platform.h"
 #include "../include/definitions.h"
 #include "translate.h"
+#include "route.h"
 #include "sem.h"
+#include "params.h"
 #include "codegen.h"
 
 #define MAX_CONST 65535
 #define NUM_CONNECT_ARGS 3
 #define NUM_MIGRATE_ARGS 1 // To save sp 
+#define NUM_JOIN_ARGS    1
 
 //TODO:
 //  - functions should exit with a return
@@ -49,10 +52,13 @@ static void stmt_return  (structures, frame, a_stmt);
 static void stmt_if      (structures, frame, a_stmt);
 static void stmt_while   (structures, frame, a_stmt);
 static void stmt_for     (structures, frame, a_stmt);
+static void stmt_rep     (structures, frame, a_stmt);
 static void stmt_pCall   (structures, frame, a_stmt);
 static void stmt_ass     (structures, frame, a_stmt);
 static void stmt_io      (structures, frame, a_stmt);
+static void ioArray      (structures, frame, a_stmt);
 static void stmt_on      (structures, frame, a_stmt);
+static void stmt_join    (structures, frame, a_stmt);
 static void stmt_alias   (structures, frame, a_stmt);
 static void stmt_connect (structures, frame, a_stmt);
 
@@ -105,6 +111,9 @@ static void module_main(structures s, a_module p) {
     procDecls(s, p->procs);
     symTab_endScope(s->sym);
 
+    // Find the modes of array parameters
+    prm_analyse(s, p->procs);
+
     // Check for 'main' procedure
     // TODO should check main is a procedure and not a function
     ir_proc mainProc = list_getFirst(s->ir->procs, "main", &isNamedProc);
@@ -310,8 +319,12 @@ static void formals(structures s, a_formals p, list refs) {
         t_formal type = p->type;
         a_paramDeclSeq a = p->params;
 
-        for(; a!=NULL; a=a->next)
+        for(; a!=NULL; a=a->next) {
+            if(p->val && type != t_formal_intArray)
+                err_report(t_error, a->param->pos, 
+                        "val formal '%s' not an array", a->param->name->name);
             list_add(refs, formal(s, a->param, type));
+        }
     }
 }
 
@@ -376,10 +389,12 @@ static void stmt(structures s, frame f, a_stmt p) {
     case t_stmt_input:    stmt_io(s, f, p);         break;
     case t_stmt_output:   stmt_io(s, f, p);         break;
     case t_stmt_on:       stmt_on(s, f, p);         break;
+    case t_stmt_join:     stmt_join(s, f, p);       break;
     case t_stmt_alias:    stmt_alias(s, f, p);      break;
     case t_stmt_connect:  stmt_connect(s, f, p);    break;
     case t_stmt_seq:      stmt_seq(s, f, p->u.seq); break;
     case t_stmt_par:      stmt_par(s, f, p->u.par); break;
+    case t_stmt_rep:      stmt_rep(s, f, p);        break;
     default: assert(0 && "Invalid stmt type");
     }
 }
@@ -410,6 +425,14 @@ static void stmt_for(structures s, frame f, a_stmt p) {
     stmt(s, f, p->u.for_.stmt);
 }
 
+// Replicated par statement
+static void stmt_rep(structures s, frame f, a_stmt p) {
+    elem(s, f, p->u.rep.var);
+    expr(s, f, p->u.rep.base);
+    expr(s, f, p->u.rep.count);
+    stmt(s, f, p->u.rep.stmt);
+}
+
 // Check procedure call statements have a matching signature
 static void stmt_pCall(structures s, frame f, a_stmt p) {
     
@@ -504,6 +527,50 @@ static void stmt_io(structures s, frame f, a_stmt p) {
                 a_elemTypeStr(e));
         return;
     }
+
+    ioArray(s, f, p);
+}
+
+// Check the operand of an array transfer (c ! a[i..n]) is an integer array,
+// and make a whole array operand (c ! a) a transfer from its first element
+static void ioArray(structures s, frame f, a_stmt p) {
+    
+    a_expr src = p->u.io.src;
+    if(src->type != t_expr_none)
+        return;
+    a_elem e = src->u.monadic.elem;
+    if(e->sym == NULL)
+        return;
+
+    if(p->u.io.count != NULL) {
+        expr(s, f, p->u.io.count);
+        if(sym_type(e->sym) != t_sym_intArray 
+                && sym_type(e->sym) != t_sym_intArrayRef) {
+            err_report(t_error, p->pos, 
+                    "array i/o operand %s not of type integer array", 
+                    sym_name(e->sym));
+        }
+        return;
+    }
+
+    if(e->type != t_elem_name)
+        return;
+    switch(sym_type(e->sym)) {
+    case t_sym_intArray:
+        p->u.io.count = a_expr_monadic(p->pos, t_expr_none, 
+                a_elem_Number(p->pos, sym_constVal(e->sym)));
+        src->u.monadic.elem = a_elem_Sub(p->pos, e->u.name, 
+                a_expr_monadic(p->pos, t_expr_none, a_elem_Number(p->pos, 0)));
+        elem(s, f, src->u.monadic.elem);
+        break;
+    case t_sym_intArrayRef:
+        err_report(t_error, p->pos, 
+                "length of array %s unknown, transfer a range %s[i..n]", 
+                sym_name(e->sym), sym_name(e->sym));
+        break;
+    default:
+        break;
+    }
 }
 
 // On statement
@@ -530,10 +597,28 @@ static void stmt_on(structures s, frame f, a_stmt p) {
     // Check the call
     elem_call(s, f, p->u.on.pCall);
 
+    // Check the handle of an asynchronous on is an integer variable
+    a_elem h = p->u.on.handle;
+    if(h != NULL) {
+        elem(s, f, h);
+        if(h->type != t_elem_name || h->sym == NULL 
+                || sym_type(h->sym) != t_sym_int) {
+            err_report(t_error, p->pos, 
+                    "handle of 'on' must be an integer variable");
+            return;
+        }
+    }
+
     // Make some preservation space for call to migrate
     frm_pCallArgs(f, NUM_MIGRATE_ARGS);
 }
 
+// Join statement: wait for an asynchronous on given by its handle
+static void stmt_join(structures s, frame f, a_stmt p) {
+    expr(s, f, p->u.join.handle);
+    frm_pCallArgs(f, NUM_JOIN_ARGS);
+}
+
 // Alias statement
 // <dest> aliases <array>[<index>..]
 // <dest> : arrayRef or arrayAlias
@@ -721,6 +806,17 @@ static void elem_sub(structures s, frame f, a_elem p) {
         err_report(t_error, p->pos, "variable not of type array");
         return;
     }
+
+    // Check a constant channel subscript is in range: chan[] has the 
+    // program channels left by those kept for asynchronous ons
+    int n;
+    if(sym_type(p->sym) == t_sym_chanArray 
+            && rte_evalConst(p->u.sub.expr, &n) 
+            && (n < 0 || n >= sym_constVal(p->sym))) {
+        err_report(t_error, p->pos, "%s[%d] out of range: %d channels", 
+                name, n, sym_constVal(p->sym));
+        return;
+    }
 }
 
 // Place string in pool, and assign it an identifier
@@ -8,6 +8,8 @@ struct signature_ {
     string name;
     int numFormals;
     t_formal *args;
+    bool *vals;
+    int *modes;
     signature prev;
 };
 
@@ -44,12 +46,17 @@ static signature Signature(a_procDecl p, signature prev) {
             sig->numFormals++;
     }
        
-    // Initialse an array with their types
+    // Initialse an array with their types, and with no access to them
     sig->args = (t_formal *) chkalloc(sizeof(t_formal) * sig->numFormals);
+    sig->vals = (bool *) chkalloc(sizeof(bool) * sig->numFormals);
+    sig->modes = (int *) chkalloc(sizeof(int) * sig->numFormals);
     int i = 0;
     for(f=p->formals; f!=NULL; f=f->next) {
-        for(s=f->params; s!=NULL; s=s->next)
+        for(s=f->params; s!=NULL; s=s->next) {
+            sig->vals[i] = f->val;
+            sig->modes[i] = 0;
             sig->args[i++] = f->type;
+        }
     }
 
     //printf("added signature: "); printSig(sig, stdout);
@@ -162,6 +169,20 @@ t_formal sig_getFmlType(signature s, int arg) {
     return s->args[arg];
 }
 
+// Whether a formal was declared val
+bool sig_isVal(signature s, int arg) {
+    return s->vals[arg];
+}
+
+// The access mode of a formal (ARG_MODE_IN/OUT), set by parameter analysis
+int sig_getFmlMode(signature s, int arg) {
+    return s->modes[arg];
+}
+
+void sig_setFmlMode(signature s, int arg, int mode) {
+    s->modes[arg] = mode;
+}
+
 static void printSig(signature s, FILE *out) {
     int i;
     fprintf(out, "%s [%d] (", s->name, s->numFormals);
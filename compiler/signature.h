@@ -17,5 +17,8 @@ int       sigTab_numArgs(sigTable, string);
 void      sigTab_dump(sigTable, FILE *);
 
 t_formal  sig_getFmlType(signature, int);
+bool      sig_isVal     (signature, int);
+int       sig_getFmlMode(signature, int);
+void      sig_setFmlMode(signature, int, int);
 
 #endif
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "slots.h"
+#include "block.h"
+#include "irt.h"
+#include "statistics.h"
+
+#define DEBUG 0
+
+// Stack slot colouring:
+//
+// Each spilled variable is given its own local slot in the frame by linear
+// scan. Once allocation has converged, compute the live range of each slot
+// over the final statement sequence, then share slots whose ranges are
+// disjoint (an interval graph colouring, as with the registers).
+
+static int  stmtSlot(frame, i_expr);
+static void slotAccesses(frame, i_stmt, int *def, int *use);
+static void rewriteSlot(frame, i_expr, int *colour);
+static int  blockIndex(block *, int, block);
+static int  colourIntervals(int, int *begin, int *end, int *colour);
+
+void slots_colour(frame f, list blocks) {
+
+    int numSlots = frm_numLocalSlots(f);
+    if(numSlots < 2)
+        return;
+
+    // Number the statements and record the first and last of each block
+    blc_labelStmts(blocks);
+    int numBlocks = list_size(blocks);
+    block *blks = chkalloc(sizeof(block) * numBlocks);
+    int *first = chkalloc(sizeof(int) * numBlocks);
+    int *last = chkalloc(sizeof(int) * numBlocks);
+    int n = 0, b = 0;
+    iterator it = it_begin(blocks);
+    while(it_hasNext(it)) {
+        blks[b] = it_next(it);
+        first[b] = n;
+        n += list_size(blc_stmts(blks[b]));
+        last[b] = n - 1;
+        b++;
+    }
+    it_free(&it);
+
+    // Statement slot accesses and successors
+    i_stmt *stmts = chkalloc(sizeof(i_stmt) * n);
+    int *def = chkalloc(sizeof(int) * n);
+    int *use = chkalloc(sizeof(int) * n);
+    int *succ = chkalloc(sizeof(int) * 2 * n);
+    int i, k;
+    for(b=0; b<numBlocks; b++) {
+        i = first[b];
+        iterator stmtIt = it_begin(blc_stmts(blks[b]));
+        while(it_hasNext(stmtIt)) {
+            stmts[i] = it_next(stmtIt);
+            slotAccesses(f, stmts[i], &def[i], &use[i]);
+            succ[2*i]   = i < last[b] ? i + 1 : -1;
+            succ[2*i+1] = -1;
+            i++;
+        }
+        it_free(&stmtIt);
+        if(last[b] >= first[b]) {
+            int s1 = blockIndex(blks, numBlocks, blc_getSucc1(blks[b]));
+            int s2 = blockIndex(blks, numBlocks, blc_getSucc2(blks[b]));
+            succ[2*last[b]]   = s1 != -1 && last[s1] >= first[s1] ? first[s1] : -1;
+            succ[2*last[b]+1] = s2 != -1 && last[s2] >= first[s2] ? first[s2] : -1;
+        }
+    }
+
+    // Iterate in reverse until the live-in sets of slots become stable
+    bool *in = chkalloc(sizeof(bool) * n * numSlots);
+    for(i=0; i<n*numSlots; i++)
+        in[i] = false;
+    bool done = false;
+    while(!done) {
+        done = true;
+        for(i=n-1; i>=0; i--) {
+            for(k=0; k<numSlots; k++) {
+                bool out = (succ[2*i]   != -1 && in[succ[2*i]*numSlots+k])
+                        || (succ[2*i+1] != -1 && in[succ[2*i+1]*numSlots+k]);
+                bool live = use[i] == k || (out && def[i] != k);
+                if(live != in[i*numSlots+k]) {
+                    in[i*numSlots+k] = live;
+                    done = false;
+                }
+            }
+        }
+    }
+
+    // Live interval of each slot: the statements where it is live-in,
+    // live-out, or written
+    int *begin = chkalloc(sizeof(int) * numSlots);
+    int *end = chkalloc(sizeof(int) * numSlots);
+    for(k=0; k<numSlots; k++) {
+        begin[k] = INT_MAX;
+        end[k] = -1;
+    }
+    for(i=0; i<n; i++) {
+        for(k=0; k<numSlots; k++) {
+            bool out = (succ[2*i]   != -1 && in[succ[2*i]*numSlots+k])
+                    || (succ[2*i+1] != -1 && in[succ[2*i+1]*numSlots+k]);
+            if(in[i*numSlots+k] || out || def[i] == k) {
+                if(i < begin[k]) begin[k] = i;
+                if(i > end[k])   end[k] = i;
+            }
+        }
+    }
+
+    // Assign each slot a colour and rewrite the frame accesses
+    int *colour = chkalloc(sizeof(int) * numSlots);
+    int numColours = colourIntervals(numSlots, begin, end, colour);
+    if(numColours < numSlots) {
+        for(i=0; i<n; i++) {
+            i_stmt s = stmts[i];
+            switch(s->type) {
+            case t_MOVE:
+                rewriteSlot(f, s->u.MOVE.dst, colour);
+                rewriteSlot(f, s->u.MOVE.src, colour);
+                break;
+            case t_INPUT:
+            case t_OUTPUT:
+                rewriteSlot(f, s->u.IO.dst, colour);
+                rewriteSlot(f, s->u.IO.src, colour);
+                break;
+            default:
+                break;
+            }
+        }
+        frm_shareLocals(f, colour, numColours);
+        stat_numSharedSlots += numSlots - numColours;
+    }
+
+    if(DEBUG) {
+        printf("Slot colouring for %s:\n", frm_name(f));
+        for(k=0; k<numSlots; k++)
+            printf("  slot %d [%d:%d] -> %d\n", k, begin[k], end[k], colour[k]);
+    }
+
+    free(blks);
+    free(first);
+    free(last);
+    free(stmts);
+    free(def);
+    free(use);
+    free(succ);
+    free(in);
+    free(begin);
+    free(end);
+    free(colour);
+}
+
+// Return the local slot accessed by a MEM sp[local] expression, or -1
+static int stmtSlot(frame f, i_expr e) {
+    if(e == NULL || e->type != t_MEM || e->u.MEM.type != t_mem_spl)
+        return -1;
+    if(e->u.MEM.offset->type != t_CONST)
+        return -1;
+    return frm_localSlot(f, e->u.MEM.offset->u.CONST);
+}
+
+// Spill code only reads or writes slots with moves of the form
+// TEMP <- MEM or MEM <- TEMP
+static void slotAccesses(frame f, i_stmt s, int *def, int *use) {
+    *def = -1;
+    *use = -1;
+    switch(s->type) {
+    case t_MOVE:
+        *def = stmtSlot(f, s->u.MOVE.dst);
+        *use = stmtSlot(f, s->u.MOVE.src);
+        break;
+    case t_INPUT:
+        *def = stmtSlot(f, s->u.IO.dst);
+        *use = stmtSlot(f, s->u.IO.src);
+        break;
+    case t_OUTPUT:
+        *use = stmtSlot(f, s->u.IO.dst);
+        if(*use == -1)
+            *use = stmtSlot(f, s->u.IO.src);
+        break;
+    default:
+        break;
+    }
+}
+
+// Replace the offset of a local slot access with that of its colour
+static void rewriteSlot(frame f, i_expr e, int *colour) {
+    int slot = stmtSlot(f, e);
+    if(slot != -1) {
+        int off = e->u.MEM.offset->u.CONST - slot + colour[slot];
+        e->u.MEM.offset = i_Const(off);
+    }
+}
+
+// Return the index of a block in the array, or -1
+static int blockIndex(block *blks, int numBlocks, block b) {
+    int i;
+    if(b == NULL)
+        return -1;
+    for(i=0; i<numBlocks; i++)
+        if(blks[i] == b)
+            return i;
+    return -1;
+}
+
+// Greedily colour intervals in order of increasing start point, reusing the
+// lowest colour whose last interval has ended. Returns the number of colours.
+static int colourIntervals(int num, int *begin, int *end, int *colour) {
+    int *colourEnd = chkalloc(sizeof(int) * num);
+    bool *done = chkalloc(sizeof(bool) * num);
+    int numColours = 0;
+    int i, j, c;
+
+    for(i=0; i<num; i++)
+        done[i] = false;
+
+    for(i=0; i<num; i++) {
+
+        // Select the next interval by start point
+        int k = -1;
+        for(j=0; j<num; j++)
+            if(!done[j] && (k == -1 || begin[j] < begin[k]))
+                k = j;
+        done[k] = true;
+
+        // An unused slot can share any colour
+        if(end[k] == -1) {
+            colour[k] = 0;
+            if(numColours == 0) {
+                colourEnd[numColours++] = -1;
+            }
+            continue;
+        }
+
+        for(c=0; c<numColours; c++)
+            if(colourEnd[c] < begin[k])
+                break;
+        if(c == numColours)
+            numColours++;
+        colour[k] = c;
+        colourEnd[c] = end[k];
+    }
+
+    free(colourEnd);
+    free(done);
+    return numColours;
+}
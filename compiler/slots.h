@@ -0,0 +1,9 @@
+#ifndef SLOTS_H
+#define SLOTS_H
+
+#include "list.h"
+#include "frame.h"
+
+void slots_colour(frame, list blocks);
+
+#endif
@@ -48,7 +48,7 @@ static void addMemAccesses(structures s, frame frm, list blocks) {
             case t_INPUT:
                 stmt->u.IO.src = addMemLoadsExpr(s, frm, stmtIt, stmt->u.IO.src);
                 stmt->u.IO.dst = addStore(s, frm, stmtIt, 
-                        stmt->u.IO.src, stmt->u.IO.dst);
+                        NULL, stmt->u.IO.dst);
                 break; 
             
             case t_OUTPUT:
@@ -57,6 +57,19 @@ static void addMemAccesses(structures s, frame frm, list blocks) {
                         stmt->u.IO.dst, stmt->u.IO.src);
                 break; 
             
+            // Open defines the channel end, which close uses
+            case t_OPEN:
+                stmt->u.STREAM.chan = addMemLoadsExpr(s, frm, stmtIt, 
+                        stmt->u.STREAM.chan);
+                stmt->u.STREAM.end = addStore(s, frm, stmtIt, 
+                        NULL, stmt->u.STREAM.end);
+                break;
+
+            case t_CLOSE:
+                stmt->u.STREAM.end = addMemLoadsExpr(s, frm, stmtIt, 
+                        stmt->u.STREAM.end);
+                break;
+            
             case t_PCALL:
                 it = it_begin(stmt->u.PCALL.args);
                 while(it_hasNext(it)) {
@@ -75,6 +88,14 @@ static void addMemAccesses(structures s, frame frm, list blocks) {
                     it_replace(it, addMemLoadsExpr(s, frm, stmtIt, e));
                 }
                 it_free(&it);
+                if(stmt->u.ON.handle != NULL)
+                    stmt->u.ON.handle = addStore(s, frm, stmtIt, 
+                            NULL, stmt->u.ON.handle);
+                break;
+
+            case t_ONJOIN:
+                stmt->u.ONJOIN.handle = addMemLoadsExpr(s, frm, stmtIt, 
+                        stmt->u.ONJOIN.handle);
                 break;
 
             case t_CONNECT:
@@ -91,14 +112,17 @@ static void addMemAccesses(structures s, frame frm, list blocks) {
                         stmt->u.RETURN.expr);
                 break;
            
-            // Fork defines three temporaries
+            // Fork defines three temporaries, and uses a replicated count
             case t_FORK:
+                if(stmt->u.FORK.count != NULL)
+                    stmt->u.FORK.count = addMemLoadsExpr(s, frm, stmtIt, 
+                            stmt->u.FORK.count);
                 stmt->u.FORK.t1 = addStore(s, frm, stmtIt, 
-                        stmt->u.FORK.t1, stmt->u.FORK.t1);
+                        NULL, stmt->u.FORK.t1);
                 stmt->u.FORK.t2 = addStore(s, frm, stmtIt, 
-                        stmt->u.FORK.t2, stmt->u.FORK.t2);
+                        NULL, stmt->u.FORK.t2);
                 stmt->u.FORK.t3 = addStore(s, frm, stmtIt, 
-                        stmt->u.FORK.t3, stmt->u.FORK.t3);
+                        NULL, stmt->u.FORK.t3);
                 break;
 
             // ForkSet uses these temporaries
@@ -109,6 +133,9 @@ static void addMemAccesses(structures s, frame frm, list blocks) {
                         stmt->u.FORKSET.thread);
                 stmt->u.FORKSET.space = addMemLoadsExpr(s, frm, stmtIt, 
                         stmt->u.FORKSET.space);
+                if(stmt->u.FORKSET.index != NULL)
+                    stmt->u.FORKSET.index = addMemLoadsExpr(s, frm, stmtIt, 
+                            stmt->u.FORKSET.index);
                 break;
 
             // ForkSet uses these temporaries
@@ -196,8 +223,12 @@ static i_expr addLoad(structures s, frame frm, iterator stmtIt, i_expr expr) {
     }
 }
 
-// Add a store to memory if the src is a TEMP
+// Add a store to memory if the src is a TEMP. A NULL src is a value produced
+// by the statement itself, such as an input, which must be in a register. A
+// MEM dest is stored through, with any spilled base or index loaded.
 static i_expr addStore(structures s, frame frm, iterator stmtIt, i_expr src, i_expr dest) {
+    if(dest->type == t_MEM)
+        return addMemLoadsExpr(s, frm, stmtIt, dest);
     if(dest->type != t_TEMP)
         return dest;
 
@@ -207,7 +238,7 @@ static i_expr addStore(structures s, frame frm, iterator stmtIt, i_expr src, i_e
        
     // If it tries to store an already spilled variable then we have run
     // out of registers
-    if(src->type == t_MEM)
+    if(src != NULL && src->type == t_MEM)
         err_fatal("insufficient regsiters");
 
     // If undefined, then it must be a global (dead statements are elminated
@@ -223,7 +254,8 @@ static i_expr addStore(structures s, frame frm, iterator stmtIt, i_expr src, i_e
     }
 
     // If move contains a BINOP, FNCALL or CONST, add a store to MEM after
-    if(src->type == t_BINOP || src->type == t_CONST || src->type == t_FCALL) {
+    if(src == NULL || src->type == t_BINOP || src->type == t_CONST 
+            || src->type == t_FCALL) {
         temp tmp = frm_addNewTemp(frm, t_tmp_local);
         tmp_setSpilled(tmp, tmp_name(spill));
         i_stmt stmt;
@@ -311,9 +343,15 @@ static i_expr addMemLoadsExpr(structures s, frame frm, iterator stmtIt, i_expr e
         expr->u.SYS.value = addLoad(s, frm, stmtIt, expr->u.SYS.value);
         return expr;
 
+    // A spilled base or index, such as of an array element
+    case t_MEM:
+        if(expr->u.MEM.base != NULL)
+            expr->u.MEM.base = addLoad(s, frm, stmtIt, expr->u.MEM.base);
+        expr->u.MEM.offset = addLoad(s, frm, stmtIt, expr->u.MEM.offset);
+        return expr;
+
     case t_CONST:
     case t_NAME:
-    case t_MEM:
         return expr;
     
     default:
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include "stack.h"
+#include "irt.h"
+#include "statistics.h"
+#include "../include/definitions.h"
+
+#define DEBUG 0
+
+// initThread extends the stack of a new thread by two words
+#define INIT_THREAD_DEPTH 2
+
+#define UNVISITED -2
+#define VISITING  -3
+
+// Stack depth analysis:
+//
+// The depth of a procedure is the number of words of stack it and its callees
+// use below its entry sp: its frame plus the deepest of its calls. A thread
+// forked by par runs the code from its label until its JOIN, and needs the
+// depth of the deepest call it can reach. Recursion and calls into the
+// runtime (on and connect) are unbounded, given as -1.
+//
+// The threads of a fork share one block carved from the global sp. Each has
+// the frame it executes in above its sp and its call depth (or 
+// THREAD_STACK_SPACE if unbounded) below. Replicated threads are laid out at
+// a fixed stride, with the size of the block computed at run time. A thread
+// reads spilled values from its own frame, so the slots it (or a par nested
+// in it) loads are copied into it when it is forked.
+
+static int *depths = NULL;
+
+static int procDepth (structures, ir_proc);
+static int stmtDepth (structures, i_stmt);
+static int callDepth (structures, i_expr);
+static int maxDepth  (int, int);
+static int readSlot  (frame, i_stmt);
+static void addSlot  (i_stmt, int);
+
+// Reset the depth of each procedure, once they have been numbered
+void stk_init(structures s) {
+    int n = list_size(s->ir->procs);
+    int i;
+    if(depths != NULL)
+        free(depths);
+    depths = chkalloc(sizeof(int) * n);
+    for(i=0; i<n; i++)
+        depths[i] = UNVISITED;
+}
+
+// Lay out the stacks of the threads forked in a procedure body, and record
+// the temps live into each thread and the spilled values it reads
+void stk_sizeThreads(structures s, frame f, list stmts) {
+
+    int n = list_size(stmts);
+    if(n == 0)
+        return;
+    i_stmt *a = chkalloc(sizeof(i_stmt) * n);
+    bool *visited = chkalloc(sizeof(bool) * n);
+    int i = 0;
+    iterator it = it_begin(stmts);
+    while(it_hasNext(it))
+        a[i++] = it_next(it);
+    it_free(&it);
+
+    int frameWords = frm_size(f) > 0 ? frm_size(f) : 1;
+    i_stmt fork = NULL;
+    for(i=0; i<n; i++) {
+        if(a[i]->type == t_FORK)
+            fork = a[i];
+        if(a[i]->type != t_FORKSET)
+            continue;
+        assert(fork != NULL && "FORKSET without FORK");
+
+        int k;
+        for(k=0; k<n; k++)
+            visited[k] = false;
+        a[i]->u.FORKSET.slots = chkalloc(sizeof(int) * n);
+        a[i]->u.FORKSET.numSlots = 0;
+
+        // Follow the control flow from the thread label to its join. The
+        // threads of a nested par are followed for the spilled values they
+        // read from this thread's frame, but run on stacks of their own.
+        int *work = chkalloc(sizeof(int) * (2 * n + 1));
+        int numWork = 0;
+        int depth = INIT_THREAD_DEPTH;
+        work[numWork++] = 2 * lbl_pos(a[i]->u.FORKSET.l);
+        while(numWork > 0) {
+            int j = work[--numWork];
+            bool nested = j % 2;
+            j /= 2;
+            if(j < 0 || j >= n || visited[j])
+                continue;
+            visited[j] = true;
+            i_stmt st = a[j];
+            addSlot(a[i], readSlot(f, st));
+            if(!nested)
+                depth = maxDepth(depth, stmtDepth(s, st));
+            switch(st->type) {
+            case t_JUMP:
+                if(st->u.JUMP->type != t_NAME) {
+                    if(!nested)
+                        depth = -1;
+                }
+                else
+                    work[numWork++] = 2 * lbl_pos(st->u.JUMP->u.NAME) + nested;
+                break;
+            case t_CJUMP:
+                work[numWork++] = 2 * lbl_pos(st->u.CJUMP.then->u.NAME) + nested;
+                work[numWork++] = 2 * lbl_pos(st->u.CJUMP.other->u.NAME) + nested;
+                break;
+            case t_FORKSET:
+                work[numWork++] = 2 * lbl_pos(st->u.FORKSET.l) + 1;
+                work[numWork++] = 2 * (j + 1) + nested;
+                break;
+            case t_JOIN:
+                // Only a master join (of a nested par) continues
+                if(st->u.JOIN.master 
+                        && st->u.JOIN.t1->u.TEMP != a[i]->u.FORKSET.sync->u.TEMP)
+                    work[numWork++] = 2 * lbl_pos(st->u.JOIN.exit) + nested;
+                break;
+            case t_RETURN:
+            case t_END:
+                break;
+            default:
+                work[numWork++] = 2 * (j + 1) + nested;
+                break;
+            }
+        }
+        free(work);
+
+        // Its frame also holds any incoming arguments it reads
+        int words = frameWords;
+        k = a[i]->u.FORKSET.numSlots;
+        if(k > 0 && a[i]->u.FORKSET.slots[k-1] + 1 > words)
+            words = a[i]->u.FORKSET.slots[k-1] + 1;
+        int frameSpace = BYTES_PER_WORD * words;
+
+        // Place it after the previous threads of the fork
+        int callSpace = depth == -1 ? THREAD_STACK_SPACE 
+            : BYTES_PER_WORD * depth;
+        a[i]->u.FORKSET.stack = depth;
+        a[i]->u.FORKSET.live = a[lbl_pos(a[i]->u.FORKSET.l)]->in;
+        if(fork->u.FORK.count != NULL) {
+            a[i]->u.FORKSET.stride = callSpace + frameSpace;
+            fork->u.FORK.space = callSpace + frameSpace;
+            fork->u.FORK.spOff = callSpace;
+        }
+        else {
+            a[i]->u.FORKSET.spOff = fork->u.FORK.space + callSpace;
+            fork->u.FORK.space += callSpace + frameSpace;
+        }
+        stat_threadStackSpace += callSpace + frameSpace;
+        if(DEBUG) printf("thread %s: stack %d, %d spilled values\n",
+                lbl_name(a[i]->u.FORKSET.l), depth, a[i]->u.FORKSET.numSlots);
+    }
+
+    free(a);
+    free(visited);
+}
+
+// The stack depth in words of a procedure and its calls, or -1 if unbounded
+int stk_procDepth(structures s, ir_proc p) {
+    return procDepth(s, p);
+}
+
+// The stack depth of a procedure
+static int procDepth(structures s, ir_proc p) {
+
+    if(depths[p->pos] == VISITING)
+        return -1;
+    if(depths[p->pos] != UNVISITED)
+        return depths[p->pos];
+
+    depths[p->pos] = VISITING;
+    int depth = 0;
+    iterator it = it_begin(p->stmts.ir);
+    while(it_hasNext(it) && depth != -1)
+        depth = maxDepth(depth, stmtDepth(s, it_next(it)));
+    it_free(&it);
+
+    if(depth != -1)
+        depth += frm_size(p->frm);
+    depths[p->pos] = depth;
+    if(DEBUG) printf("proc %s: stack %d\n", frm_name(p->frm), depth);
+    return depth;
+}
+
+// The stack depth of any call made by a statement
+static int stmtDepth(structures s, i_stmt st) {
+    switch(st->type) {
+    case t_PCALL:
+        return callDepth(s, st->u.PCALL.proc);
+    case t_MOVE:
+        if(st->u.MOVE.src->type == t_FCALL)
+            return callDepth(s, st->u.MOVE.src->u.FCALL.func);
+        return 0;
+    case t_ON:
+    case t_ONJOIN:
+    case t_CONNECT:
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+// The stack depth of a called procedure
+static int callDepth(structures s, i_expr func) {
+    ir_proc p = list_getFirst(s->ir->procs,
+            lbl_name(func->u.NAME), &isNamedProc);
+    return p == NULL ? -1 : procDepth(s, p);
+}
+
+// Maximum of two depths, where -1 is unbounded
+static int maxDepth(int a, int b) {
+    if(a == -1 || b == -1)
+        return -1;
+    return a > b ? a : b;
+}
+
+// The sp offset of a spilled local or incoming argument loaded by a
+// statement, or -1
+static int readSlot(frame f, i_stmt st) {
+    if(st->type != t_MOVE || st->u.MOVE.src->type != t_MEM
+            || st->u.MOVE.src->u.MEM.offset->type != t_CONST)
+        return -1;
+    switch(st->u.MOVE.src->u.MEM.type) {
+    case t_mem_spl:
+        return frm_localOff(f) + st->u.MOVE.src->u.MEM.offset->u.CONST;
+    case t_mem_spi:
+        return frm_inArgOff(f) + st->u.MOVE.src->u.MEM.offset->u.CONST;
+    default:
+        return -1;
+    }
+}
+
+// Add an sp offset to the ascending slots a thread reads
+static void addSlot(i_stmt forkSet, int slot) {
+    if(slot == -1)
+        return;
+    int *slots = forkSet->u.FORKSET.slots;
+    int i = forkSet->u.FORKSET.numSlots;
+    while(i > 0 && slots[i-1] > slot)
+        i--;
+    if(i > 0 && slots[i-1] == slot)
+        return;
+    int j;
+    for(j=forkSet->u.FORKSET.numSlots; j>i; j--)
+        slots[j] = slots[j-1];
+    slots[i] = slot;
+    forkSet->u.FORKSET.numSlots++;
+}
@@ -0,0 +1,12 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include "list.h"
+#include "frame.h"
+#include "structures.h"
+
+void stk_init(structures);
+void stk_sizeThreads(structures, frame, list stmts);
+int  stk_procDepth(structures, ir_proc);
+
+#endif
@@ -7,6 +7,14 @@ void stats_init() {
     stat_numSpiltVars     = 0;
     stat_numInstructions  = 0;
     stat_numBlocksRemoved = 0;
+    stat_numCallerSaves   = 0;
+    stat_numFramelessProcs = 0;
+    stat_numSharedSlots   = 0;
+    stat_numUnrolledLoops = 0;
+    stat_threadStackSpace = 0;
+    stat_numElidedRegCopies = 0;
+    stat_numSerialisedBranches = 0;
+    stat_numStaticConnects = 0;
 }
 
 void stats_dump(FILE *out) {
@@ -15,7 +23,15 @@ void stats_dump(FILE *out) {
     fprintf(out, "  Procedures/functions: %d\n", stat_numProcedures);
     fprintf(out, "  Basic blocks removed: %d\n", stat_numBlocksRemoved);
     fprintf(out, "  Killed statements:    %d\n", stat_numKilledStmts);
+    fprintf(out, "  Unrolled loops:       %d\n", stat_numUnrolledLoops);
     fprintf(out, "  Spilt variables:      %d\n", stat_numSpiltVars);
+    fprintf(out, "  Shared stack slots:   %d\n", stat_numSharedSlots);
+    fprintf(out, "  Caller-saved regs:    %d\n", stat_numCallerSaves);
+    fprintf(out, "  Frameless procedures: %d\n", stat_numFramelessProcs);
+    fprintf(out, "  Serialised branches:  %d\n", stat_numSerialisedBranches);
+    fprintf(out, "  Thread stack bytes:   %d\n", stat_threadStackSpace);
+    fprintf(out, "  Elided thread copies: %d\n", stat_numElidedRegCopies);
+    fprintf(out, "  Static connects:      %d\n", stat_numStaticConnects);
     fprintf(out, "  Instructions:         %d\n", stat_numInstructions);
     printRule(out);
 }
@@ -10,6 +10,14 @@ int stat_numKilledStmts;
 int stat_numSpiltVars;
 int stat_numInstructions;
 int stat_numBlocksRemoved;
+int stat_numCallerSaves;
+int stat_numFramelessProcs;
+int stat_numSharedSlots;
+int stat_numUnrolledLoops;
+int stat_threadStackSpace;
+int stat_numElidedRegCopies;
+int stat_numSerialisedBranches;
+int stat_numStaticConnects;
 
 void stats_init(void);
 void stats_dump(FILE *);
@@ -1,8 +1,34 @@
+#include <stdlib.h>
+#include <limits.h>
 #include "error.h"
 #include "../include/definitions.h"
 #include "temp.h"
 #include "label.h"
+#include "statistics.h"
 #include "translate.h"
+#include "route.h"
+
+// Bound the total growth from unrolling to an eighth of memory, taking 
+// each IR statement as roughly one word of code
+#define UNROLL_MAX_GROWTH (RAM_SIZE / 8 / BYTES_PER_WORD)
+
+static int    unrollBudget;
+static int    unrollGrowth;
+static list   commProcs;
+static profile feedback;
+static bool   coldProc;
+static string copyPrefix;
+static int    numCopyLabels;
+static int    threads;
+
+static void   findCommProcs(structures s);
+static void   findThreads (structures s);
+static void   stmtThreads (structures, a_stmt, int, bool *);
+static void   exprThreads (structures, a_expr, int, bool *);
+static void   elemThreads (structures, a_elem, int, bool *);
+static void   callThreads (structures, string, int, bool *);
+static int    shareThreads(int, int);
+static int    repThreads  (int, a_expr);
 
 static void   buildChildren(structures s);
 
@@ -18,17 +44,43 @@ static void   stmt_pCall  (structures, frame, a_stmt, list);
 static void   stmt_ass    (structures, frame, a_stmt, list);
 static void   stmt_input  (structures, frame, a_stmt, list);
 static void   stmt_output (structures, frame, a_stmt, list);
+static void   stmt_ioArray(structures, frame, a_stmt, bool, list);
 static void   stmt_seq    (structures, frame, a_stmtSeq, list);
-static void   stmt_par    (structures, frame, a_stmtPar, list);
+static void   stmt_par    (structures, frame, a_stmt, list);
+static void   stmt_rep    (structures, frame, a_stmt, list);
+static a_stmtPar multiplex(structures, a_stmtPar, int, int, int);
 static void   stmt_on     (structures, frame, a_stmt, list);
+static void   stmt_join   (structures, frame, a_stmt, list);
 static void   stmt_alias  (structures, frame, a_stmt, list);
 static void   stmt_connect(structures, frame, a_stmt, list);
+static void   forLoop     (structures, frame, a_stmt, temp, i_expr, int, int,
+                           label, label, label, list, list);
+static void   forBody     (structures, frame, a_stmt, list, list);
+static label  newLabel    (structures);
 
 // Expression translations
 static i_expr expr        (structures, frame, a_expr, list);
 static i_expr expr_monadic(structures, frame, a_expr, list);
 static i_expr expr_diadic (structures, frame, a_expr, list);
 static void   argList     (structures, frame, a_exprList, list args, list stmts);
+static int    countStmts  (list);
+static bool   assignsVar  (a_stmt, string);
+static bool   isNamedElem (a_elem, string);
+static bool   communicates(structures, a_stmt);
+static bool   isPortElem  (a_elem);
+static bool   exprComms   (structures, a_expr);
+static bool   elemComms   (structures, a_elem);
+static bool   callComms   (structures, string);
+static bool   isNamedStr  (void *, void *);
+
+// Multiplication, division and remainder by a constant
+static i_expr lowerMult   (frame, temp, int, list);
+static i_expr lowerDiv    (frame, temp, int, list);
+static i_expr lowerRem    (frame, temp, int, list);
+static i_expr divPositive (frame, temp, unsigned int, list);
+static temp   liftBinop   (frame, t_binop, i_expr, i_expr, list);
+static int    log2Exact   (unsigned int);
+static void   magicDiv    (unsigned int, unsigned int *, int *);
 
 // Element translations
 static i_expr elem        (structures, frame, a_elem, list);
@@ -40,12 +92,22 @@ static i_expr elem_boolean(a_elem);
 static i_expr elem_string (a_elem);
 
 // Main method
-void translate(structures s) {
+void translate(structures s, int budget, profile p) {
    
+    unrollBudget = budget;
+    unrollGrowth = 0;
+    feedback = p;
+    copyPrefix = NULL;
+    findCommProcs(s);
+    findThreads(s);
+    rte_resolve(s);
+
     // Translate each procedure body
     iterator it = it_begin(s->ir->procs);
     while(it_hasNext(it)) {
         ir_proc p = it_next(it);
+        coldProc = feedback != NULL && prf_cold(feedback, frm_name(p->frm));
+        threads = p->threads;
         p->stmts.ir = body(s, p->frm, p->stmts.as);
     }
     it_free(&it);
@@ -93,6 +155,183 @@ static void buildChildren(structures s) {
     while(change);
 }
 
+// Find the procedures that communicate, directly or through their calls,
+// before their bodies are translated
+static void findCommProcs(structures s) {
+    bool change;
+    commProcs = list_New();
+    do {
+        change = false;
+        iterator it = it_begin(s->ir->procs);
+        while(it_hasNext(it)) {
+            ir_proc p = it_next(it);
+            string name = frm_name(p->frm);
+            if(!list_contains(commProcs, name, &isNamedStr) 
+                    && communicates(s, p->stmts.as)) {
+                list_add(commProcs, name);
+                change = true;
+            }
+        }
+        it_free(&it);
+    }
+    while(change);
+}
+
+// Find the hardware threads free to each procedure before their bodies are
+// translated: the fewest free at any of its calls. A migrated procedure 
+// shares its core with the host on thread 0. A par takes a thread for each
+// branch, and gives each an even share of the rest for any pars it nests.
+static void findThreads(structures s) {
+    bool change;
+    do {
+        change = false;
+        iterator it = it_begin(s->ir->procs);
+        while(it_hasNext(it)) {
+            ir_proc p = it_next(it);
+            stmtThreads(s, p->stmts.as, p->threads, &change);
+        }
+        it_free(&it);
+    }
+    while(change);
+}
+
+// Limit the threads of the procedures called by a statement with n free
+static void stmtThreads(structures s, a_stmt p, int n, bool *change) {
+    switch(p->type) {
+    case t_stmt_return:
+        exprThreads(s, p->u.return_.expr, n, change);
+        break;
+    case t_stmt_if:
+        exprThreads(s, p->u.if_.expr, n, change);
+        stmtThreads(s, p->u.if_.stmt1, n, change);
+        stmtThreads(s, p->u.if_.stmt2, n, change);
+        break;
+    case t_stmt_while:
+        exprThreads(s, p->u.while_.expr, n, change);
+        stmtThreads(s, p->u.while_.stmt, n, change);
+        break;
+    case t_stmt_for:
+        exprThreads(s, p->u.for_.pre, n, change);
+        exprThreads(s, p->u.for_.post, n, change);
+        stmtThreads(s, p->u.for_.stmt, n, change);
+        break;
+    case t_stmt_rep:
+        exprThreads(s, p->u.rep.base, n, change);
+        exprThreads(s, p->u.rep.count, n, change);
+        stmtThreads(s, p->u.rep.stmt, repThreads(n, p->u.rep.count), change);
+        break;
+    case t_stmt_pCall: {
+        a_exprList args;
+        for(args=p->u.pCall.exprList; args!=NULL; args=args->tail)
+            exprThreads(s, args->head, n, change);
+        callThreads(s, p->u.pCall.name->name, n, change);
+        break;
+    }
+    case t_stmt_ass:
+        elemThreads(s, p->u.ass.dst, n, change);
+        exprThreads(s, p->u.ass.src, n, change);
+        break;
+    case t_stmt_input:
+    case t_stmt_output:
+        elemThreads(s, p->u.io.dst, n, change);
+        exprThreads(s, p->u.io.src, n, change);
+        if(p->u.io.count != NULL)
+            exprThreads(s, p->u.io.count, n, change);
+        break;
+    case t_stmt_on: {
+        a_exprList args;
+        a_elem pCall = p->u.on.pCall;
+        elemThreads(s, p->u.on.dest, n, change);
+        for(args=pCall->u.call.exprList; args!=NULL; args=args->tail)
+            exprThreads(s, args->head, n, change);
+        callThreads(s, pCall->u.call.name->name, MAX_THREADS-1, change);
+        break;
+    }
+    case t_stmt_join:
+        exprThreads(s, p->u.join.handle, n, change);
+        break;
+    case t_stmt_alias:
+        exprThreads(s, p->u.alias.index, n, change);
+        break;
+    case t_stmt_seq: {
+        a_stmtSeq seq;
+        for(seq=p->u.seq; seq!=NULL; seq=seq->tail)
+            stmtThreads(s, seq->head, n, change);
+        break;
+    }
+    case t_stmt_par: {
+        a_stmtPar par;
+        int k = 0;
+        for(par=p->u.par; par!=NULL; par=par->tail)
+            k++;
+        int share = shareThreads(n, k < n ? k : n);
+        for(par=p->u.par; par!=NULL; par=par->tail)
+            stmtThreads(s, par->head, share, change);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Limit the threads of the functions called by an expression
+static void exprThreads(structures s, a_expr p, int n, bool *change) {
+    switch(p->type) {
+    case t_expr_none: case t_expr_neg: case t_expr_not:
+        elemThreads(s, p->u.monadic.elem, n, change);
+        break;
+    default:
+        elemThreads(s, p->u.diadic.elem, n, change);
+        exprThreads(s, p->u.diadic.expr, n, change);
+        break;
+    }
+}
+
+// Limit the threads of the functions called by an element
+static void elemThreads(structures s, a_elem e, int n, bool *change) {
+    switch(e->type) {
+    case t_elem_sub:
+        exprThreads(s, e->u.sub.expr, n, change);
+        break;
+    case t_elem_expr:
+        exprThreads(s, e->u.expr, n, change);
+        break;
+    case t_elem_pCall:
+    case t_elem_fCall: {
+        a_exprList args;
+        for(args=e->u.call.exprList; args!=NULL; args=args->tail)
+            exprThreads(s, args->head, n, change);
+        callThreads(s, e->u.call.name->name, n, change);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Limit the threads of a called procedure to those free at the call
+static void callThreads(structures s, string name, int n, bool *change) {
+    ir_proc p = list_getFirst(s->ir->procs, name, &isNamedProc);
+    if(p != NULL && n < p->threads) {
+        p->threads = n;
+        *change = true;
+    }
+}
+
+// The threads free to each thread of a par using some of those free to it
+static int shareThreads(int avail, int used) {
+    return 1 + (avail - used) / used;
+}
+
+// The threads free to each thread of a replicated par. A count that is not
+// constant, or more than are free, may take them all.
+static int repThreads(int avail, a_expr count) {
+    int n;
+    if(!rte_evalConst(count, &n) || n < 1 || n > avail)
+        return 1;
+    return shareThreads(avail, n);
+}
+
 // Dump the list of children to a file
 void dumpChildren(structures s, FILE *out) {
     
@@ -119,7 +358,7 @@ void dumpChildren(structures s, FILE *out) {
 // Translate a procedure body
 static list body(structures s, frame f, a_stmt p) {
     list stmts = list_New();
-    label epilogue = lblMap_NewLabel(s->lbl);
+    label epilogue = newLabel(s);
     frm_setEpilogueLbl(f, epilogue);
     stmt(s, f, p, stmts);
     list_add(stmts, i_Label(epilogue));
@@ -144,8 +383,10 @@ static void stmt(structures s, frame f, a_stmt p, list l) {
     case t_stmt_input:    stmt_input  (s, f, p, l);        break;
     case t_stmt_output:   stmt_output (s, f, p, l);        break;
     case t_stmt_seq:      stmt_seq    (s, f, p->u.seq, l); break;
-    case t_stmt_par:      stmt_par    (s, f, p->u.par, l); break;
+    case t_stmt_par:      stmt_par    (s, f, p, l);        break;
+    case t_stmt_rep:      stmt_rep    (s, f, p, l);        break;
     case t_stmt_on:       stmt_on     (s, f, p, l);        break;
+    case t_stmt_join:     stmt_join   (s, f, p, l);        break;
     case t_stmt_connect:  stmt_connect(s, f, p, l);        break;
     case t_stmt_alias:    stmt_alias  (s, f, p, l);        break;
     default: assert(0 && "Invalid stmt type");
@@ -171,9 +412,9 @@ static void stmt_return(structures s, frame f, a_stmt p, list stmts) {
 //     stmts
 //   LABEL end
 static void stmt_if(structures s, frame f, a_stmt p, list stmts) {
-    label lThen = lblMap_NewLabel(s->lbl);
-    label lElse = lblMap_NewLabel(s->lbl);
-    label lEnd = lblMap_NewLabel(s->lbl);
+    label lThen = newLabel(s);
+    label lElse = newLabel(s);
+    label lEnd = newLabel(s);
    
     // Lift any non-temp elements from condition
     i_expr cond = expr(s, f, p->u.if_.expr, stmts);
@@ -205,9 +446,9 @@ static void stmt_if(structures s, frame f, a_stmt p, list stmts) {
 //   LABEL end
 static void stmt_while(structures s, frame f, a_stmt p, list stmts) {   
 
-    label lStart = lblMap_NewLabel(s->lbl);
-    label lThen = lblMap_NewLabel(s->lbl);
-    label lEnd = lblMap_NewLabel(s->lbl);
+    label lStart = newLabel(s);
+    label lThen = newLabel(s);
+    label lEnd = newLabel(s);
     
     list_add(stmts, i_Label(lStart));
     
@@ -241,21 +482,121 @@ static void stmt_while(structures s, frame f, a_stmt p, list stmts) {
 //      var := var + 1
 //      JUMP start
 //   LABEL end
+//
+// When both bounds are constant, the loop is unrolled within the budget:
+// completely if the whole trip fits, otherwise by a factor k with the 
+// remainder iterations run by a second loop:
+//   var := precondition
+//   LABEL start
+//   tmp := var <= pre + (trip/k)*k - 1
+//   CJUMP tmp label-then label-end
+//   LABEL then
+//      (stmts; var := var + 1) * k
+//      JUMP start
+//   LABEL end
+//   (remainder loop)
+// The loops of a procedure the profile found cold are kept rolled.
 static void stmt_for(structures s, frame f, a_stmt p, list stmts) {
 
-    label lStart = lblMap_NewLabel(s->lbl);
-    label lThen = lblMap_NewLabel(s->lbl);
-    label lEnd = lblMap_NewLabel(s->lbl);
-  
-    // Add the precondition assignment and start label
     string name = p->u.for_.var->u.name->name;
     temp varTmp = frm_addTemp(f, name, t_tmp_local);
     i_expr preCond = expr(s, f, p->u.for_.pre, stmts);
+    int budget = coldProc ? 0 : unrollBudget;
+
+    // The loop takes the labels of one loop and one copy of its body
+    // however it is unrolled
+    label lStart = newLabel(s);
+    label lThen = newLabel(s);
+    label lEnd = newLabel(s);
+    
+    // Check for a constant trip count, to bound the loop even if it is not
+    // unrolled
+    i_expr postCond = NULL;
+    if(preCond->type == t_CONST 
+            && !assignsVar(p->u.for_.stmt, name)) {
+        list scratch = list_New();
+        postCond = expr(s, f, p->u.for_.post, scratch);
+        if(postCond->type != t_CONST || !list_empty(scratch))
+            postCond = NULL;
+        list_delete(scratch);
+    }
+   
+    if(postCond != NULL) {
+        int pre = preCond->u.CONST;
+        int post = postCond->u.CONST;
+        long long trip = (long long) post - pre + 1;
+        if(trip < 0) trip = 0;
+
+        // Size the body from its first copy, plus the increment
+        list first = list_New();
+        stmt(s, f, p->u.for_.stmt, first);
+        int size = countStmts(first) + 1;
+        int k = budget / size;
+        int rem = k > 1 ? trip % k : 0;
+        string prefix = copyPrefix;
+        int numLabels = numCopyLabels;
+        copyPrefix = lbl_name(lStart);
+        numCopyLabels = 0;
+
+        // Unroll completely
+        if(budget > 0 && trip * size <= budget 
+                && unrollGrowth + trip * size <= UNROLL_MAX_GROWTH) {
+            int i;
+            for(i=0; i<trip; i++) {
+                list_add(stmts, i_Move(i_Temp(varTmp), i_Const(pre + i)));
+                forBody(s, f, p, i == 0 ? first : NULL, stmts);
+            }
+            list_add(stmts, i_Move(i_Temp(varTmp), i_Const(pre + trip)));
+            if(trip == 0)
+                list_delete(first);
+            unrollGrowth += trip * size;
+            stat_numUnrolledLoops++;
+        }
+
+        // Unroll partially with a remainder loop
+        else if(k > 1 && trip > k 
+                && unrollGrowth + (k + (rem > 0)) * size <= UNROLL_MAX_GROWTH) {
+            int n = trip / k;
+            list_add(stmts, i_Move(i_Temp(varTmp), preCond));
+            forLoop(s, f, p, varTmp, i_Const(pre + n * k - 1), 
+                    n, k, lStart, lThen, lEnd, first, stmts);
+            if(rem > 0)
+                forLoop(s, f, p, varTmp, postCond, rem, 1, newLabel(s), 
+                        newLabel(s), newLabel(s), NULL, stmts);
+            unrollGrowth += (k + (rem > 0)) * size;
+            stat_numUnrolledLoops++;
+        }
+
+        else {
+            list_add(stmts, i_Move(i_Temp(varTmp), preCond));
+            forLoop(s, f, p, varTmp, postCond, 
+                    trip > INT_MAX ? -1 : (int) trip, 1, 
+                    lStart, lThen, lEnd, first, stmts);
+        }
+        copyPrefix = prefix;
+        numCopyLabels = numLabels;
+        return;
+    }
+
     list_add(stmts, i_Move(i_Temp(varTmp), preCond));
+    forLoop(s, f, p, varTmp, NULL, -1, 1, lStart, lThen, lEnd, NULL, stmts);
+}
+
+// Emit a for loop testing var against bound, or re-evaluating the 
+// post-condition if bound is NULL, with copies of the body per test. The
+// number of iterations, if known, is kept with its start label.
+static void forLoop(structures s, frame f, a_stmt p, temp varTmp, 
+        i_expr bound, int trips, int copies, label lStart, label lThen, 
+        label lEnd, list first, list stmts) {
+
+    int i;
+
+    lbl_setBound(lStart, trips);
+  
     list_add(stmts, i_Label(lStart));
     
     // Create the post-condition expr and lift any non-temp elements from condition
-    i_expr postCond = expr(s, f, p->u.for_.post, stmts);
+    i_expr postCond = bound != NULL ? bound : expr(s, f, p->u.for_.post, stmts);
     if(postCond->type != t_TEMP) {
         temp t = frm_addNewTemp(f, t_tmp_local);
         list_add(stmts, i_Move(i_Temp(t), postCond));
@@ -267,18 +608,44 @@ static void stmt_for(structures s, frame f, a_stmt p, list stmts) {
     i_expr cond = i_Binop(i_le, i_Temp(varTmp), postCond);
     list_add(stmts, i_Move(i_Temp(condTmp), cond));
 
-    // Construct the CJUMP, label and body
+    // Construct the CJUMP, label and body with increments
     list_add(stmts, i_CJump(i_Temp(condTmp), i_Name(lThen), i_Name(lEnd)));
     list_add(stmts, i_Label(lThen));
-    stmt(s, f, p->u.for_.stmt, stmts);
+    for(i=0; i<copies; i++) {
+        forBody(s, f, p, i == 0 ? first : NULL, stmts);
+        list_add(stmts, i_Move(i_Temp(varTmp), 
+                    i_Binop(i_plus, i_Temp(varTmp), i_Const(1))));
+    }
 
-    // Close the loop: increment, jump and end
-    list_add(stmts, i_Move(i_Temp(varTmp), 
-                i_Binop(i_plus, i_Temp(varTmp), i_Const(1))));
+    // Close the loop: jump and end
     list_add(stmts, i_Jump(i_Name(lStart)));
     list_add(stmts, i_Label(lEnd));
 }
 
+// Add a copy of a for loop body. Each copy after the first is translated
+// again so that it gets its own labels.
+static void forBody(structures s, frame f, a_stmt p, list first, list stmts) {
+    if(first != NULL) {
+        list_appendList(stmts, first);
+        list_delete(first);
+    }
+    else 
+        stmt(s, f, p->u.for_.stmt, stmts);
+}
+
+// Create a new label. The copies of an unrolled loop body after the first
+// take labels named after the loop, so that the labels of the rest of the
+// program are the same whether or not it is unrolled, and a profile of it
+// still applies with loops of cold procedures kept rolled.
+static label newLabel(structures s) {
+    if(copyPrefix == NULL)
+        return lblMap_NewLabel(s->lbl);
+    string name = StringFmt("%s.%d", copyPrefix, numCopyLabels++);
+    label l = lblMap_NewNamedLabel(s->lbl, name);
+    free(name);
+    return l;
+}
+
 // Procedure call statement
 static void stmt_pCall(structures s, frame f, a_stmt p, list stmts) {
     
@@ -312,6 +679,11 @@ static void stmt_ass(structures s, frame f, a_stmt p, list stmts) {
 // Input statement
 static void stmt_input(structures s, frame f, a_stmt p, list stmts) {
     
+    if(p->u.io.count != NULL) {
+        stmt_ioArray(s, f, p, false, stmts);
+        return;
+    }
+
     i_expr dst = expr(s, f, p->u.io.src, stmts);
     i_expr src = elem(s, f, p->u.io.dst, stmts);
 
@@ -325,7 +697,9 @@ static void stmt_input(structures s, frame f, a_stmt p, list stmts) {
     // If dst not TEMP, lift below
     if(dst->type != t_TEMP) {
         temp t = frm_addNewTemp(f, t_tmp_local);
-        list_add(stmts, i_Move(i_Temp(t), i_Temp(t)));
+        list_add(stmts, i_Input(i_Temp(t), src));
+        list_add(stmts, i_Move(dst, i_Temp(t)));
+        return;
     }
     
     list_add(stmts, i_Input(dst, src));
@@ -334,6 +708,11 @@ static void stmt_input(structures s, frame f, a_stmt p, list stmts) {
 // Output statement
 static void stmt_output(structures s, frame f, a_stmt p, list stmts) {
     
+    if(p->u.io.count != NULL) {
+        stmt_ioArray(s, f, p, true, stmts);
+        return;
+    }
+
     i_expr dst = elem(s, f, p->u.io.dst, stmts);
     i_expr src = expr(s, f, p->u.io.src, stmts);
     
@@ -354,6 +733,91 @@ static void stmt_output(structures s, frame f, a_stmt p, list stmts) {
     list_add(stmts, i_Output(dst, src));
 }
 
+// Array input and output statement
+// ===================================
+//   c ! a[i..n]   or   c ? a[i..n]
+// ===================================
+//   end := open c             (chan[] only)
+//   k := i
+//   lim := i + n
+//   LABEL start
+//   tmp := k >= lim
+//   CJUMP tmp label-end label-then
+//   LABEL then
+//      end ! a[k]   or   end ? t; a[k] := t
+//      k := k + 1
+//      JUMP start
+//   LABEL end
+//   close end                 (chan[] only)
+//
+// A system channel is opened once and the words streamed through it, rather
+// than each making its own begin and end handshake. The exit is taken on the
+// condition so that the body is sequenced in line, keeping the live ranges of
+// the channel end and index short.
+static void stmt_ioArray(structures s, frame f, a_stmt p, bool output, 
+        list stmts) {
+    
+    a_elem a = p->u.io.src->u.monadic.elem;
+    i_expr chan = elem(s, f, p->u.io.dst, stmts);
+    i_expr count = expr(s, f, p->u.io.count, stmts);
+    if(count->type != t_TEMP && count->type != t_CONST) {
+        temp t = frm_addNewTemp(f, t_tmp_local);
+        list_add(stmts, i_Move(i_Temp(t), count));
+        count = i_Temp(t);
+    }
+    label lStart = newLabel(s);
+    label lThen = newLabel(s);
+    label lEnd = newLabel(s);
+
+    // The channel end, opened if a system channel
+    temp end = frm_addNewTemp(f, t_tmp_local);
+    if(chan->type == t_SYS)
+        list_add(stmts, i_Open(i_Temp(end), chan, output));
+    else
+        list_add(stmts, i_Move(i_Temp(end), chan));
+
+    // The array base address
+    a_elem name = a_elem_Name(a->pos, a->u.sub.name);
+    name->sym = a->sym;
+    i_expr addr = elem_name(s, f, name);
+    if(addr->type != t_TEMP) {
+        temp t = frm_addNewTemp(f, t_tmp_local);
+        list_add(stmts, i_Move(i_Temp(t), addr));
+        addr = i_Temp(t);
+    }
+
+    // The index and its limit
+    temp k = frm_addNewTemp(f, t_tmp_local);
+    temp lim = frm_addNewTemp(f, t_tmp_local);
+    i_expr base = expr(s, f, a->u.sub.expr, stmts);
+    list_add(stmts, i_Move(i_Temp(k), base));
+    list_add(stmts, i_Move(i_Temp(lim), i_Binop(i_plus, i_Temp(k), count)));
+
+    // Loop over the words
+    temp cond = frm_addNewTemp(f, t_tmp_local);
+    list_add(stmts, i_Label(lStart));
+    list_add(stmts, i_Move(i_Temp(cond), 
+                i_Binop(i_ge, i_Temp(k), i_Temp(lim))));
+    list_add(stmts, i_CJump(i_Temp(cond), i_Name(lEnd), i_Name(lThen)));
+    list_add(stmts, i_Label(lThen));
+    temp t = frm_addNewTemp(f, t_tmp_local);
+    i_expr word = i_Mem(t_mem_abs, addr, i_Temp(k));
+    if(output) {
+        list_add(stmts, i_Move(i_Temp(t), word));
+        list_add(stmts, i_Output(i_Temp(end), i_Temp(t)));
+    }
+    else {
+        list_add(stmts, i_Input(i_Temp(t), i_Temp(end)));
+        list_add(stmts, i_Move(word, i_Temp(t)));
+    }
+    list_add(stmts, i_Move(i_Temp(k), i_Binop(i_plus, i_Temp(k), i_Const(1))));
+    list_add(stmts, i_Jump(i_Name(lStart)));
+    list_add(stmts, i_Label(lEnd));
+
+    if(chan->type == t_SYS)
+        list_add(stmts, i_Close(i_Temp(end), output));
+}
+
 // On statement
 static void stmt_on(structures s, frame f, a_stmt p, list stmts) {
     
@@ -368,13 +832,35 @@ static void stmt_on(structures s, frame f, a_stmt p, list stmts) {
     argList(s, f, pCall->u.call.exprList, args, stmts);
     i_expr pCallExpr = i_FCall(i_Name(l), args);
 
-    // Add the statement
-    list_add(stmts, i_On(dest, pCallExpr));
+    // Add the statement, and for an asynchronous on, set the handle from a
+    // new temp that it defines
+    if(p->u.on.handle != NULL) {
+        temp t = frm_addNewTemp(f, t_tmp_local);
+        list_add(stmts, i_On(dest, pCallExpr, i_Temp(t)));
+        list_add(stmts, i_Move(elem(s, f, p->u.on.handle, stmts), i_Temp(t)));
+    }
+    else
+        list_add(stmts, i_On(dest, pCallExpr, NULL));
     
     // Add the call to the list of children
     ir_addChildCall(s->ir, frm_name(f), lbl_name(l));
 }
 
+// Join statement
+static void stmt_join(structures s, frame f, a_stmt p, list stmts) {
+    
+    i_expr handle = expr(s, f, p->u.join.handle, stmts);
+
+    // Lift a non-TEMP handle out
+    if(handle->type != t_TEMP) {
+        temp t = frm_addNewTemp(f, t_tmp_local);
+        list_add(stmts, i_Move(i_Temp(t), handle));
+        handle = i_Temp(t);
+    }
+
+    list_add(stmts, i_OnJoin(handle));
+}
+
 // Alias statement
 static void stmt_alias(structures s, frame f, a_stmt p, list stmts) {
    
@@ -399,7 +885,7 @@ static void stmt_alias(structures s, frame f, a_stmt p, list stmts) {
             list_add(stmts, i_Move(i_Temp(t), index));
             index = i_Temp(t);
         }
-        list_add(stmts, i_Move(dst, i_Binop(i_mult, index, i_Const(4))));
+        list_add(stmts, i_Move(dst, i_Binop(i_lshift, index, i_Const(2))));
         index = dst;
     }
 
@@ -409,6 +895,12 @@ static void stmt_alias(structures s, frame f, a_stmt p, list stmts) {
 
 // Connect statement
 static void stmt_connect(structures s, frame f, a_stmt p, list stmts) {
+
+    // Constant connects are made at startup from the routing table
+    if(rte_isStatic(p)) {
+        stat_numStaticConnects++;
+        return;
+    }
    
     i_expr to = elem(s, f, p->u.connect.to, stmts);
     i_expr c1 = elem(s, f, p->u.connect.c1, stmts);
@@ -498,9 +990,10 @@ static i_expr expr_diadic(structures s, frame f, a_expr p, list stmts) {
 
     // If to constant value operands, evaluate them now
     if(left->type == t_CONST && right->type == t_CONST) {
+        int value = trl_evalOp(p->type, left->u.CONST, right->u.CONST);
         i_deleteExpr(left);
         i_deleteExpr(right);
-        return i_Const(trl_evalOp(p->type, left->u.CONST, right->u.CONST));
+        return i_Const(value);
     }
 
     // Lift any left expr not TEMP, NAME or CONST
@@ -517,6 +1010,26 @@ static i_expr expr_diadic(structures s, frame f, a_expr p, list stmts) {
         right = i_Temp(t);
     }
 
+    // Multiplication is commutative, so put any constant on the right
+    if(p->type == t_expr_mult && left->type == t_CONST) {
+        i_expr tmp = left;
+        left = right;
+        right = tmp;
+    }
+
+    // Lower multiplication, division and remainder by a constant
+    if(left->type == t_TEMP && right->type == t_CONST) {
+        i_expr e = NULL;
+        switch(p->type) {
+        case t_expr_mult: e = lowerMult(f, left->u.TEMP, right->u.CONST, stmts); break;
+        case t_expr_div:  e = lowerDiv (f, left->u.TEMP, right->u.CONST, stmts); break;
+        case t_expr_rem:  e = lowerRem (f, left->u.TEMP, right->u.CONST, stmts); break;
+        default: break;
+        }
+        if(e != NULL)
+            return e;
+    }
+
     // Otherwise create a BINOP node
     t_binop op;
     switch(p->type) {
@@ -671,8 +1184,14 @@ static i_expr elem_sub(structures s, frame f, a_elem p, list stmts) {
     // This will be in data, in local or from a reference
     switch(sym_scope(p->sym)) {
     
+    // System resource offsets are always used from registers
     case t_scope_system: {
         label l = lblMap_getNamed(s->lbl, name);
+        if(offset->type != t_TEMP) {
+            temp t = frm_addNewTemp(f, t_tmp_local);
+            list_add(stmts, i_Move(i_Temp(t), offset));
+            offset = i_Temp(t);
+        }
         return i_Sys(i_Name(l), offset);
     }
 
@@ -782,10 +1301,318 @@ int trl_evalOp(t_expr type, int a, int b) {
     }
 }
 
+// ==================================================================
+// Multiplication, division and remainder by a constant
+// ==================================================================
+//
+// Division is a long multi-cycle instruction, so operations with a constant
+// right operand are lowered to shifts and multiplies (see Warren, "Hacker's
+// Delight", ch. 10). Each returns NULL if the constant is not handled.
+
+// n * c: shift left for a power of two
+static i_expr lowerMult(frame f, temp n, int c, list stmts) {
+    unsigned int a = c < 0 ? -(unsigned int) c : (unsigned int) c;
+    int k = log2Exact(a);
+    
+    if(c == 0) return i_Const(0);
+    if(c == 1) return i_Temp(n);
+    if(k == -1) return NULL;
+
+    // n * 2^k = n << k
+    if(c > 0)
+        return i_Binop(i_lshift, i_Temp(n), i_Const(k));
+    
+    // n * -2^k = 0 - (n << k)
+    temp t = liftBinop(f, i_lshift, i_Temp(n), i_Const(k), stmts);
+    return i_Binop(i_minus, i_Const(0), i_Temp(t));
+}
+
+// n / c: truncating signed division
+static i_expr lowerDiv(frame f, temp n, int c, list stmts) {
+    if(c == 0 || c == INT_MIN) return NULL;
+    if(c == 1) return i_Temp(n);
+    if(c == -1) return i_Binop(i_minus, i_Const(0), i_Temp(n));
+    
+    i_expr q = divPositive(f, n, c < 0 ? -c : c, stmts);
+    if(c > 0)
+        return q;
+    
+    // n / -c = -(n / c)
+    temp t = frm_addNewTemp(f, t_tmp_local);
+    list_add(stmts, i_Move(i_Temp(t), q));
+    return i_Binop(i_minus, i_Const(0), i_Temp(t));
+}
+
+// n rem c: the sign of the result follows n, so only |c| matters
+static i_expr lowerRem(frame f, temp n, int c, list stmts) {
+    if(c == 0 || c == INT_MIN) return NULL;
+    
+    unsigned int a = c < 0 ? -c : c;
+    int k = log2Exact(a);
+    if(a == 1) return i_Const(0);
+
+    // n rem 2^k = n - ((n + bias) and -2^k), where bias = 2^k-1 if n < 0
+    if(k != -1) {
+        temp sign = liftBinop(f, i_ashr, i_Temp(n), i_Const(32), stmts);
+        temp bias = liftBinop(f, i_rshift, i_Temp(sign), i_Const(32-k), stmts);
+        temp t1 = liftBinop(f, i_plus, i_Temp(n), i_Temp(bias), stmts);
+        temp t2 = liftBinop(f, i_and, i_Temp(t1), i_Const(-a), stmts);
+        return i_Binop(i_minus, i_Temp(n), i_Temp(t2));
+    }
+
+    // n rem c = n - (n / c) * c
+    temp q = frm_addNewTemp(f, t_tmp_local);
+    list_add(stmts, i_Move(i_Temp(q), divPositive(f, n, a, stmts)));
+    temp t = liftBinop(f, i_mult, i_Temp(q), i_Const(a), stmts);
+    return i_Binop(i_minus, i_Temp(n), i_Temp(t));
+}
+
+// n / d for d > 1
+static i_expr divPositive(frame f, temp n, unsigned int d, list stmts) {
+    int k = log2Exact(d);
+    
+    // sign = n ashr 32, i.e. -1 if n < 0, otherwise 0
+    temp sign = liftBinop(f, i_ashr, i_Temp(n), i_Const(32), stmts);
+    
+    // n / 2^k = (n + bias) ashr k, where bias = 2^k-1 if n < 0 so the
+    // result rounds towards zero
+    if(k != -1) {
+        temp bias = liftBinop(f, i_rshift, i_Temp(sign), i_Const(32-k), stmts);
+        temp t = liftBinop(f, i_plus, i_Temp(n), i_Temp(bias), stmts);
+        return i_Binop(i_ashr, i_Temp(t), i_Const(k));
+    }
+
+    // Otherwise, multiply by a magic number M and take the high word. The
+    // signed high word is mulhu(n, M) - (n < 0 ? M : 0) and, when M is
+    // negative, the +n correction cancels the -n term. The result is
+    // shifted right by s and 1 is added if n is negative.
+    unsigned int m;
+    int s;
+    magicDiv(d, &m, &s);
+    temp hi = liftBinop(f, i_mulhu, i_Temp(n), i_Const(m), stmts);
+    temp adj = liftBinop(f, i_and, i_Temp(sign), i_Const(m), stmts);
+    temp q = liftBinop(f, i_minus, i_Temp(hi), i_Temp(adj), stmts);
+    if(s > 0)
+        q = liftBinop(f, i_ashr, i_Temp(q), i_Const(s), stmts);
+    return i_Binop(i_minus, i_Temp(q), i_Temp(sign));
+}
+
+// Add the statement t := left op right and return t
+static temp liftBinop(frame f, t_binop op, i_expr left, i_expr right, 
+        list stmts) {
+    temp t = frm_addNewTemp(f, t_tmp_local);
+    list_add(stmts, i_Move(i_Temp(t), i_Binop(op, left, right)));
+    return t;
+}
+
+// Return k if v = 2^k, otherwise -1
+static int log2Exact(unsigned int v) {
+    int k = 0;
+    if(v == 0 || (v & (v - 1)) != 0)
+        return -1;
+    while(v >>= 1)
+        k++;
+    return k;
+}
+
+// Compute the magic number and shift for signed division by d >= 2
+static void magicDiv(unsigned int d, unsigned int *m, int *s) {
+    const unsigned int two31 = 0x80000000;
+    unsigned int anc = two31 - 1 - two31 % d;
+    unsigned int q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned int q2 = two31 / d,   r2 = two31 - q2 * d;
+    unsigned int delta;
+    int p = 31;
+    do {
+        p++;
+        q1 = 2 * q1; r1 = 2 * r1;
+        if(r1 >= anc) { q1++; r1 -= anc; }
+        q2 = 2 * q2; r2 = 2 * r2;
+        if(r2 >= d)   { q2++; r2 -= d;   }
+        delta = d - r2;
+    } while(q1 < delta || (q1 == delta && r1 == 0));
+    *m = q2 + 1;
+    *s = p - 32;
+}
+
 // ==================================================================
 // Helper functions
 // ==================================================================
 
+// Count the statements in a list, excluding labels
+static int countStmts(list stmts) {
+    int n = 0;
+    iterator it = it_begin(stmts);
+    while(it_hasNext(it)) {
+        i_stmt st = it_next(it);
+        if(st->type != t_LABEL)
+            n++;
+    }
+    it_free(&it);
+    return n;
+}
+
+// Check if a statement assigns to a named variable
+static bool assignsVar(a_stmt p, string name) {
+    switch(p->type) {
+    case t_stmt_ass:
+        return isNamedElem(p->u.ass.dst, name);
+    case t_stmt_input:
+        return p->u.io.src->type == t_expr_none 
+            && isNamedElem(p->u.io.src->u.monadic.elem, name);
+    case t_stmt_alias:
+        return isNamedElem(p->u.alias.dst, name);
+    case t_stmt_on:
+        return p->u.on.handle != NULL && isNamedElem(p->u.on.handle, name);
+    case t_stmt_if:
+        return assignsVar(p->u.if_.stmt1, name) 
+            || assignsVar(p->u.if_.stmt2, name);
+    case t_stmt_while:
+        return assignsVar(p->u.while_.stmt, name);
+    case t_stmt_for:
+        return isNamedElem(p->u.for_.var, name) 
+            || assignsVar(p->u.for_.stmt, name);
+    case t_stmt_rep:
+        return isNamedElem(p->u.rep.var, name) 
+            || assignsVar(p->u.rep.stmt, name);
+    case t_stmt_seq: {
+        a_stmtSeq seq;
+        for(seq=p->u.seq; seq!=NULL; seq=seq->tail)
+            if(assignsVar(seq->head, name))
+                return true;
+        return false;
+    }
+    case t_stmt_par: {
+        a_stmtPar par;
+        for(par=p->u.par; par!=NULL; par=par->tail)
+            if(assignsVar(par->head, name))
+                return true;
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+// Check if an element is a plain name
+static bool isNamedElem(a_elem e, string name) {
+    return e->type == t_elem_name && streq(e->u.name->name, name);
+}
+
+// Check if a statement may input or output on a channel end, which could pair
+// with a sibling branch and deadlock if the two ran in sequence. A port, an
+// on (other than by the procedure it calls), a join and a connect wait on no
+// other branch. Nested pars only take threads from the share of the branch
+// running them.
+static bool communicates(structures s, a_stmt p) {
+    switch(p->type) {
+    case t_stmt_skip:
+        return false;
+    case t_stmt_input:
+    case t_stmt_output:
+        return !isPortElem(p->u.io.dst) || exprComms(s, p->u.io.src)
+            || (p->u.io.count != NULL && exprComms(s, p->u.io.count));
+    case t_stmt_on:
+        return elemComms(s, p->u.on.dest) || elemComms(s, p->u.on.pCall);
+    case t_stmt_join:
+        return exprComms(s, p->u.join.handle);
+    case t_stmt_connect:
+        return elemComms(s, p->u.connect.to) || elemComms(s, p->u.connect.c1)
+            || elemComms(s, p->u.connect.c2);
+    case t_stmt_par: {
+        a_stmtPar par;
+        for(par=p->u.par; par!=NULL; par=par->tail)
+            if(communicates(s, par->head))
+                return true;
+        return false;
+    }
+    case t_stmt_rep:
+        return exprComms(s, p->u.rep.base) || exprComms(s, p->u.rep.count)
+            || communicates(s, p->u.rep.stmt);
+    case t_stmt_return:
+        return exprComms(s, p->u.return_.expr);
+    case t_stmt_if:
+        return exprComms(s, p->u.if_.expr) 
+            || communicates(s, p->u.if_.stmt1)
+            || communicates(s, p->u.if_.stmt2);
+    case t_stmt_while:
+        return exprComms(s, p->u.while_.expr)
+            || communicates(s, p->u.while_.stmt);
+    case t_stmt_for:
+        return exprComms(s, p->u.for_.pre) || exprComms(s, p->u.for_.post)
+            || communicates(s, p->u.for_.stmt);
+    case t_stmt_pCall: {
+        a_exprList args;
+        for(args=p->u.pCall.exprList; args!=NULL; args=args->tail)
+            if(exprComms(s, args->head))
+                return true;
+        return callComms(s, p->u.pCall.name->name);
+    }
+    case t_stmt_ass:
+        return elemComms(s, p->u.ass.dst) || exprComms(s, p->u.ass.src);
+    case t_stmt_alias:
+        return exprComms(s, p->u.alias.index);
+    case t_stmt_seq: {
+        a_stmtSeq seq;
+        for(seq=p->u.seq; seq!=NULL; seq=seq->tail)
+            if(communicates(s, seq->head))
+                return true;
+        return false;
+    }
+    default:
+        return true;
+    }
+}
+
+// Check if an element is a port
+static bool isPortElem(a_elem e) {
+    return e->type == t_elem_name && e->sym != NULL 
+        && sym_type(e->sym) == t_sym_port;
+}
+
+// Check if an expression may communicate
+static bool exprComms(structures s, a_expr p) {
+    switch(p->type) {
+    case t_expr_none: case t_expr_neg: case t_expr_not:
+        return elemComms(s, p->u.monadic.elem);
+    default:
+        return elemComms(s, p->u.diadic.elem) 
+            || exprComms(s, p->u.diadic.expr);
+    }
+}
+
+// Check if an element may communicate
+static bool elemComms(structures s, a_elem e) {
+    switch(e->type) {
+    case t_elem_sub:
+        return exprComms(s, e->u.sub.expr);
+    case t_elem_expr:
+        return exprComms(s, e->u.expr);
+    case t_elem_pCall:
+    case t_elem_fCall: {
+        a_exprList args;
+        for(args=e->u.call.exprList; args!=NULL; args=args->tail)
+            if(exprComms(s, args->head))
+                return true;
+        return callComms(s, e->u.call.name->name);
+    }
+    default:
+        return false;
+    }
+}
+
+// Check if a call is to a procedure that communicates, or an unknown one
+static bool callComms(structures s, string name) {
+    if(!list_contains(s->ir->procs, name, &isNamedProc))
+        return true;
+    return list_contains(commProcs, name, &isNamedStr);
+}
+
+// Comparison of strings
+static bool isNamedStr(void *item, void *str) {
+    return streq(item, str);
+}
+
 // PCall or FCall argument list
 static void argList(structures s, frame f, a_exprList p, list args, list stmts) {
     if(p != NULL) {
@@ -828,9 +1655,26 @@ void stmt_seq(structures s, frame frm, a_stmtSeq p, list stmts) {
 //      ...
 //    JOIN
 //  .exit:
-void stmt_par(structures s, frame f, a_stmtPar p, list stmts) {
+void stmt_par(structures s, frame f, a_stmt p, list stmts) {
 
+    a_stmtPar branches = p->u.par;
     a_stmtPar par;
+    int avail = threads;
+    int n = 0;
+
+    // Run any branches beyond the free threads on the master
+    for(par=branches; par!=NULL; par=par->tail)
+        n++;
+    if(n > avail) {
+        branches = multiplex(s, branches, n, avail, p->pos);
+        if(branches == NULL)
+            return;
+        if(branches->tail == NULL) {
+            stmt(s, f, branches->head, stmts);
+            return;
+        }
+        n = avail;
+    }
 
     // Add temporaries it needs
     temp t1 = frm_addNewTemp(f, t_tmp_local);
@@ -839,33 +1683,32 @@ void stmt_par(structures s, frame f, a_stmtPar p, list stmts) {
 
     // Fork
     list threadLabels = list_New();
-    list_add(stmts, i_Fork(i_Temp(t1), i_Temp(t2), i_Temp(t3), threadLabels));
+    list_add(stmts, i_Fork(i_Temp(t1), i_Temp(t2), i_Temp(t3), threadLabels, 
+                NULL));
     
     // Create the FORK_SET statements
     bool master = true;
-    for(par=p; par!=NULL; par=par->tail) {
+    for(par=branches; par!=NULL; par=par->tail) {
         
         // Create a thread label
-        label l = lblMap_NewLabel(s->lbl);
+        label l = newLabel(s);
         list_add(threadLabels, l);
         
         if(!master) 
-            list_add(stmts, i_ForkSet(i_Temp(t1), i_Temp(t2), i_Temp(t3), l));
+            list_add(stmts, i_ForkSet(i_Temp(t1), i_Temp(t2), i_Temp(t3), l, 
+                        NULL));
         master = false;
     }
 
     // ForkSync
     list_add(stmts, i_ForkSync(i_Temp(t1)));
     
-    // Check number of threads
-    if(list_size(threadLabels) > MAX_THREADS)
-        err_report(t_error, -1, "insufficient threads");
-
-    label exit = lblMap_NewLabel(s->lbl);
+    label exit = newLabel(s);
+    threads = shareThreads(avail, n);
 
     iterator lblIt = it_begin(threadLabels);
     master = true;
-    for(par=p; par!=NULL; par=par->tail) {
+    for(par=branches; par!=NULL; par=par->tail) {
 
         // Add a thread label
         list_add(stmts, i_Label(it_next(lblIt)));
@@ -878,5 +1721,230 @@ void stmt_par(structures s, frame f, a_stmtPar p, list stmts) {
 
     // Exit
     list_add(stmts, i_Label(exit));
+    threads = avail;
+}
+
+// Select the branches of a par to run in sequence on the master thread, so
+// that the rest fit in the free threads. Running a branch later can only
+// deadlock if it communicates, so those that don't are taken first, and at
+// most one that does. The master's branch then becomes:
+//   { comm ; pure1 ; pure2 ; ... }
+static a_stmtPar multiplex(structures s, a_stmtPar p, int n, int avail, 
+        int pos) {
+
+    a_stmt *branches = chkalloc(sizeof(a_stmt) * n);
+    bool *chosen = chkalloc(sizeof(bool) * n);
+    int numSeq = n - avail + 1;
+    int count = 0;
+    int comm = -1;
+    int i;
+
+    a_stmtPar par;
+    for(i=0, par=p; par!=NULL; i++, par=par->tail) {
+        branches[i] = par->head;
+        chosen[i] = false;
+    }
+    for(i=0; i<n && count<numSeq; i++) {
+        if(!communicates(s, branches[i])) {
+            chosen[i] = true;
+            count++;
+        }
+    }
+    for(i=0; i<n && count<numSeq; i++) {
+        if(!chosen[i]) {
+            chosen[i] = true;
+            comm = i;
+            count++;
+            break;
+        }
+    }
+    if(count < numSeq) {
+        err_report(t_error, pos, 
+                "insufficient threads: %d par branches for %d free threads "
+                "communicate", n, avail);
+        free(branches);
+        free(chosen);
+        return NULL;
+    }
+
+    // Build the sequence for the master, and the spawned branches
+    a_stmtSeq seq = NULL;
+    a_stmtPar spawned = NULL;
+    for(i=n-1; i>=0; i--) {
+        if(!chosen[i])
+            spawned = a_StmtPar(branches[i], spawned);
+        else if(i != comm)
+            seq = a_StmtSeq(branches[i], seq);
+    }
+    if(comm != -1)
+        seq = a_StmtSeq(branches[comm], seq);
+    stat_numSerialisedBranches += numSeq - 1;
+
+    free(branches);
+    free(chosen);
+    return a_StmtPar(a_stmt_Seq(pos, seq), spawned);
 }
 
+// Replicated par
+// --------------
+// The master spawns a thread for each index but the last, which it runs 
+// itself. All threads share one body and take their index from the copy of
+// its register made by FORKSET. Only the master reaches the body with k equal
+// to last, which selects the join at its end.
+//    last := count - 1
+//    CJUMP last >= 0, start, exit
+//  .start:
+//    var := base; k := 0
+//    FORK .T * last
+//  .loop:
+//    CJUMP k < last, spawn, sync
+//  .spawn:
+//    FORKSET .T # k
+//    var := var + 1; k := k + 1
+//    JUMP loop
+//  .sync:
+//    FORKSYNC
+//  .T:
+//      ...
+//    CJUMP k = last, .master, .slave
+//  .slave:
+//    JOIN
+//  .master:
+//    JOIN (master)
+//  .exit:
+// Unless the count is a constant within the free threads, the spawned threads
+// are capped at those free, and the master runs the rest of the indices in
+// sequence. Only the master reaches the body with k at least slaves:
+//    slaves := last
+//    CJUMP slaves > free - 1, .cap, .start
+//  .cap:
+//    slaves := free - 1
+//  .start:
+//    ... FORK .T * slaves; spawn while k < slaves ...
+//  .T:
+//      ...
+//    CJUMP k < slaves, .slave, .next
+//  .next:
+//    CJUMP k < last, .seq, .master
+//  .seq:
+//    var := var + 1; k := k + 1
+//    JUMP .T
+void stmt_rep(structures s, frame f, a_stmt p, list stmts) {
+
+    string name = p->u.rep.var->u.name->name;
+    temp varTmp = frm_addTemp(f, name, t_tmp_local);
+    temp t1 = frm_addNewTemp(f, t_tmp_local);
+    temp t2 = frm_addNewTemp(f, t_tmp_local);
+    temp t3 = frm_addNewTemp(f, t_tmp_local);
+    temp last = frm_addNewTemp(f, t_tmp_local);
+    temp index = frm_addNewTemp(f, t_tmp_local);
+    temp cond = frm_addNewTemp(f, t_tmp_local);
+    
+    label lStart = newLabel(s);
+    label lLoop = newLabel(s);
+    label lSpawn = newLabel(s);
+    label lSync = newLabel(s);
+    label lThread = newLabel(s);
+    label lSlave = newLabel(s);
+    label lMaster = newLabel(s);
+    label lExit = newLabel(s);
+
+    // Running indices in sequence can only deadlock if the body communicates
+    int avail = threads;
+    int n;
+    bool constant = rte_evalConst(p->u.rep.count, &n);
+    bool capped = !constant || n > avail;
+    if(constant && capped && communicates(s, p->u.rep.stmt)) {
+        err_report(t_error, p->pos, 
+                "insufficient threads: %d replicated threads for %d free "
+                "threads communicate", n, avail);
+        return;
+    }
+    temp slaves = capped ? frm_addNewTemp(f, t_tmp_local) : last;
+    label lCap = capped ? newLabel(s) : NULL;
+    label lNext = capped ? newLabel(s) : NULL;
+    label lSeq = capped ? newLabel(s) : NULL;
+
+    // Evaluate the base and count, and skip an empty replication
+    i_expr base = expr(s, f, p->u.rep.base, stmts);
+    i_expr count = expr(s, f, p->u.rep.count, stmts);
+    if(count->type != t_TEMP) {
+        temp t = frm_addNewTemp(f, t_tmp_local);
+        list_add(stmts, i_Move(i_Temp(t), count));
+        count = i_Temp(t);
+    }
+    list_add(stmts, i_Move(i_Temp(last), 
+                i_Binop(i_minus, count, i_Const(1))));
+    list_add(stmts, i_Move(i_Temp(cond), 
+                i_Binop(i_ge, i_Temp(last), i_Const(0))));
+    list_add(stmts, i_CJump(i_Temp(cond), 
+                i_Name(capped ? lCap : lStart), i_Name(lExit)));
+    if(capped) {
+        label lLimit = newLabel(s);
+        list_add(stmts, i_Label(lCap));
+        list_add(stmts, i_Move(i_Temp(slaves), i_Temp(last)));
+        list_add(stmts, i_Move(i_Temp(cond), 
+                    i_Binop(i_gr, i_Temp(slaves), i_Const(avail-1))));
+        list_add(stmts, i_CJump(i_Temp(cond), 
+                    i_Name(lLimit), i_Name(lStart)));
+        list_add(stmts, i_Label(lLimit));
+        list_add(stmts, i_Move(i_Temp(slaves), i_Const(avail-1)));
+    }
+    list_add(stmts, i_Label(lStart));
+    list_add(stmts, i_Move(i_Temp(varTmp), base));
+    list_add(stmts, i_Move(i_Temp(index), i_Const(0)));
+
+    // Fork and spawn the threads
+    list threadLabels = list_New();
+    list_add(threadLabels, lThread);
+    list_add(stmts, i_Fork(i_Temp(t1), i_Temp(t2), i_Temp(t3), threadLabels, 
+                i_Temp(slaves)));
+    list_add(stmts, i_Label(lLoop));
+    list_add(stmts, i_Move(i_Temp(cond), 
+                i_Binop(i_ls, i_Temp(index), i_Temp(slaves))));
+    list_add(stmts, i_CJump(i_Temp(cond), i_Name(lSpawn), i_Name(lSync)));
+    list_add(stmts, i_Label(lSpawn));
+    list_add(stmts, i_ForkSet(i_Temp(t1), i_Temp(t2), i_Temp(t3), lThread, 
+                i_Temp(index)));
+    list_add(stmts, i_Move(i_Temp(varTmp), 
+                i_Binop(i_plus, i_Temp(varTmp), i_Const(1))));
+    list_add(stmts, i_Move(i_Temp(index), 
+                i_Binop(i_plus, i_Temp(index), i_Const(1))));
+    list_add(stmts, i_Jump(i_Name(lLoop)));
+    list_add(stmts, i_Label(lSync));
+    list_add(stmts, i_ForkSync(i_Temp(t1)));
+
+    // The shared body and joins
+    list_add(stmts, i_Label(lThread));
+    threads = repThreads(avail, p->u.rep.count);
+    stmt(s, f, p->u.rep.stmt, stmts);
+    threads = avail;
+    if(capped) {
+        list_add(stmts, i_Move(i_Temp(cond), 
+                    i_Binop(i_ls, i_Temp(index), i_Temp(slaves))));
+        list_add(stmts, i_CJump(i_Temp(cond), 
+                    i_Name(lSlave), i_Name(lNext)));
+        list_add(stmts, i_Label(lNext));
+        list_add(stmts, i_Move(i_Temp(cond), 
+                    i_Binop(i_ls, i_Temp(index), i_Temp(last))));
+        list_add(stmts, i_CJump(i_Temp(cond), 
+                    i_Name(lSeq), i_Name(lMaster)));
+        list_add(stmts, i_Label(lSeq));
+        list_add(stmts, i_Move(i_Temp(varTmp), 
+                    i_Binop(i_plus, i_Temp(varTmp), i_Const(1))));
+        list_add(stmts, i_Move(i_Temp(index), 
+                    i_Binop(i_plus, i_Temp(index), i_Const(1))));
+        list_add(stmts, i_Jump(i_Name(lThread)));
+    }
+    else {
+        list_add(stmts, i_Move(i_Temp(cond), 
+                    i_Binop(i_eq, i_Temp(index), i_Temp(last))));
+        list_add(stmts, i_CJump(i_Temp(cond), 
+                    i_Name(lMaster), i_Name(lSlave)));
+    }
+    list_add(stmts, i_Label(lSlave));
+    list_add(stmts, i_Join(i_Temp(t1), false, lExit));
+    list_add(stmts, i_Label(lMaster));
+    list_add(stmts, i_Join(i_Temp(t1), true, lExit));
+    list_add(stmts, i_Label(lExit));
+}
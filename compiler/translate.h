@@ -6,13 +6,14 @@
 #include "irt.h"
 #include "frame.h"
 #include "structures.h"
+#include "../profiler/profile.h"
 
 #define TRUE     0xFFFFFFFF
 #define ALLONES  0xFFFFFFFF
 #define FALSE    0
 #define WORDSIZE 1 
 
-void translate(structures);
+void translate(structures, int unrollBudget, profile);
 int  trl_evalOp(t_expr type, int a, int b);
 void dumpChildren(structures, FILE *);
 
@@ -0,0 +1,658 @@
+#include <stdlib.h>
+#include <string.h>
+#include "wcet.h"
+#include "frame.h"
+#include "stack.h"
+#include "../include/definitions.h"
+
+#define DEBUG 0
+
+// The issue rate and divide latency of the XS1 pipeline, as simulated
+#define PIPELINE_STAGES 4
+#define DIVIDE_CYCLES   32
+
+// Up to PIPELINE_STAGES threads on a core each issue every PIPELINE_STAGES
+// cycles, and n more every n cycles. Each procedure is bounded for both.
+#define NUM_RATES 2
+
+#define UNVISITED 0
+#define VISITING  1
+#define VISITED   2
+
+// Worst-case execution time:
+//
+// The instructions emitted for each procedure are recorded, split into
+// blocks at labels and after branches, and the longest path from its entry
+// is found, charging each instruction its issue time for the number of
+// threads on the core, or DIVIDE_CYCLES for a divide. A loop is bounded by
+// the constant range of the for loop it was translated from, kept with its
+// start label. It costs its bound times its longest iteration, plus its
+// longest path out, and is collapsed into its header before the loop around
+// it is bounded. A call costs its callee, and a master join the longest of
+// the threads it waits for, each from its label to its ssync. A while loop,
+// a for loop with a variable range or recursion is unbounded. The time a
+// thread is blocked on a channel, a synchroniser or the runtime is not
+// counted.
+
+static const int rateThreads[NUM_RATES] = { PIPELINE_STAGES, MAX_THREADS };
+
+// A recorded instruction or label
+typedef struct {
+    bool   isLabel;
+    t_inst op;
+    int    reg;
+    string imm;      // immediate or label operand, or the label
+    list   threads;  // labels of the threads an mjoin waits for
+} *entry;
+
+// A block of the instruction stream
+typedef struct {
+    string label;
+    int    first;    // entries first to last-1
+    int    last;
+    int    succ[2];
+    int    numSucc;
+} *node;
+
+// A bound on a path
+typedef struct {
+    bool          bounded;
+    unsigned long cycles;
+    unsigned long insts;
+    string        path;  // the labels along it, or why it is unbounded
+} cost;
+
+// The instructions of a procedure
+typedef struct {
+    string name;
+    list   entries;
+    entry *e;
+    node  *nodes;
+    int    numNodes;
+    int    state[NUM_RATES];
+    cost   wcet[NUM_RATES];
+} *stream;
+
+// The analysis of a region of a procedure
+typedef struct {
+    structures s;
+    stream st;
+    int    rate;
+    bool  *reach;
+    int   *dfs;
+    bool  *back;     // whether each successor edge is a back edge
+    int   *rep;      // the loop header a node has been collapsed into
+    cost  *base;     // the cost of each node, or collapsed loop
+    cost  *memo;
+    int   *state;
+} *region;
+
+static list   streams = NULL;
+static stream current = NULL;
+static int    lastSync;
+static list   forks[NUM_GPRS];
+
+static stream Stream    (string);
+static void   build     (stream);
+static int    findNode  (stream, string);
+static stream streamAt  (structures, int);
+static cost   procCost  (structures, stream, int);
+static cost   regionCost(structures, stream, int, int);
+static void   visit     (region, int);
+static void   loopBody  (region, int, bool *);
+static cost   collapse  (region, int, bool *);
+static cost   search    (region, int, bool, int, bool *);
+static cost   longest   (region, int, bool, int, bool *);
+static void   take      (cost *, bool *, cost);
+static cost   nodeCost  (region, node);
+static int    issue     (t_inst, int);
+static cost   Cost      (string);
+static cost   Unbounded (string);
+static cost   NoPath    (void);
+static bool   isNoPath  (cost);
+static cost   add       (cost, cost);
+static bool   worse     (cost, cost);
+
+// Begin recording the instructions of each procedure
+void wct_begin(void) {
+    int i;
+    streams = list_New();
+    for(i=0; i<NUM_GPRS; i++)
+        forks[i] = NULL;
+}
+
+void wct_beginProc(string name) {
+    if(streams == NULL)
+        return;
+    current = Stream(name);
+    list_add(streams, current);
+}
+
+void wct_endProc(void) {
+    current = NULL;
+}
+
+// Record a label
+void wct_label(string name) {
+    if(current == NULL)
+        return;
+    entry e = chkalloc(sizeof(*e));
+    e->isLabel = true;
+    e->imm = name;
+    e->threads = NULL;
+    list_add(current->entries, e);
+}
+
+// Record an instruction, with its first register and any immediate. The
+// threads forked with a synchroniser are waited for by its mjoin.
+void wct_inst(t_inst op, int reg, string imm) {
+    if(current == NULL)
+        return;
+    entry e = chkalloc(sizeof(*e));
+    e->isLabel = false;
+    e->op = op;
+    e->reg = reg;
+    e->imm = imm;
+    e->threads = NULL;
+    list_add(current->entries, e);
+
+    switch(op) {
+    case i_GETST:
+        assert(reg >= 0 && reg < NUM_GPRS && "invalid synchroniser");
+        lastSync = reg;
+        break;
+    case i_LDAP:
+        if(forks[lastSync] == NULL)
+            forks[lastSync] = list_New();
+        list_add(forks[lastSync], imm);
+        break;
+    case i_MJOIN:
+        assert(reg >= 0 && reg < NUM_GPRS && "invalid synchroniser");
+        e->threads = forks[reg];
+        forks[reg] = NULL;
+        break;
+    default:
+        break;
+    }
+}
+
+// Report the worst-case cycles and stack depth of each procedure, and the
+// labels along its worst-case path
+void wct_report(FILE *out, structures s) {
+    iterator it;
+
+    printTitleRule(out, "Worst-case execution");
+    fprintf(out, "  %-20s %10s %14s %14s %8s\n", "Procedure", "Insts",
+            "Cycles", "Cycles", "Stack");
+    fprintf(out, "  %-20s %10s %14s %14s %8s\n", "", "",
+            StringFmt("(%d threads)", rateThreads[0]),
+            StringFmt("(%d threads)", rateThreads[1]), "(words)");
+    it = it_begin(streams);
+    while(it_hasNext(it)) {
+        stream st = it_next(it);
+        cost c = procCost(s, st, 0);
+        cost c8 = procCost(s, st, 1);
+        ir_proc p = list_getFirst(s->ir->procs, st->name, &isNamedProc);
+        int depth = p == NULL ? -1 : stk_procDepth(s, p);
+        fprintf(out, "  %-20s %10s %14s %14s %8s\n", st->name,
+                c.bounded ? StringFmt("%lu", c.insts) : "-",
+                c.bounded ? StringFmt("%lu", c.cycles) : "-",
+                c8.bounded ? StringFmt("%lu", c8.cycles) : "-",
+                depth != -1 ? StringFmt("%d", depth) : "-");
+    }
+    it_free(&it);
+
+    printTitleRule(out, "Worst-case paths");
+    it = it_begin(streams);
+    while(it_hasNext(it)) {
+        stream st = it_next(it);
+        cost c = procCost(s, st, 0);
+        fprintf(out, "  %s: %s%s\n", st->name, c.bounded ? "" : "unbounded, ",
+                c.path);
+    }
+    it_free(&it);
+    printRule(out);
+}
+
+// Stream constructor
+static stream Stream(string name) {
+    int i;
+    stream st = chkalloc(sizeof(*st));
+    st->name = name;
+    st->entries = list_New();
+    st->e = NULL;
+    st->nodes = NULL;
+    st->numNodes = 0;
+    for(i=0; i<NUM_RATES; i++)
+        st->state[i] = UNVISITED;
+    return st;
+}
+
+// Split the instructions into blocks, each ending at a branch or before a
+// label, and link them
+static void build(stream st) {
+    int n = list_size(st->entries);
+    int i, j = 0;
+
+    st->e = chkalloc(sizeof(entry) * (n + 1));
+    st->nodes = chkalloc(sizeof(node) * (n + 1));
+    iterator it = it_begin(st->entries);
+    while(it_hasNext(it))
+        st->e[j++] = it_next(it);
+    it_free(&it);
+
+    node b = NULL;
+    for(i=0; i<n; i++) {
+        entry e = st->e[i];
+        if(b == NULL || e->isLabel) {
+            if(b != NULL)
+                b->last = i;
+            b = chkalloc(sizeof(*b));
+            b->label = e->isLabel ? e->imm : NULL;
+            b->first = i;
+            b->last = n;
+            st->nodes[st->numNodes++] = b;
+        }
+        if(!e->isLabel && (e->op == i_BU || e->op == i_BT || e->op == i_BF
+                || e->op == i_RETSP || e->op == i_SSYNC)) {
+            b->last = i + 1;
+            b = NULL;
+        }
+    }
+
+    for(i=0; i<st->numNodes; i++) {
+        b = st->nodes[i];
+        b->numSucc = 0;
+        entry e = b->last > b->first ? st->e[b->last-1] : NULL;
+        bool branch = e != NULL && !e->isLabel;
+        if(branch && (e->op == i_BU || e->op == i_BT || e->op == i_BF)) {
+            int t = findNode(st, e->imm);
+            if(t != -1)
+                b->succ[b->numSucc++] = t;
+        }
+        if(branch && (e->op == i_BU || e->op == i_RETSP || e->op == i_SSYNC))
+            continue;
+        if(i + 1 < st->numNodes)
+            b->succ[b->numSucc++] = i + 1;
+    }
+    if(DEBUG) printf("%s: %d blocks\n", st->name, st->numNodes);
+}
+
+// The block beginning with a label, or -1
+static int findNode(stream st, string label) {
+    int i;
+    for(i=0; i<st->numNodes; i++) {
+        if(st->nodes[i]->label != NULL && streq(st->nodes[i]->label, label))
+            return i;
+    }
+    return -1;
+}
+
+// The procedure called through an entry of the jump table
+static stream streamAt(structures s, int index) {
+    iterator it = it_begin(s->ir->procs);
+    string name = NULL;
+    while(it_hasNext(it)) {
+        ir_proc p = it_next(it);
+        if(p->pos == index)
+            name = frm_name(p->frm);
+    }
+    it_free(&it);
+    if(name == NULL)
+        return NULL;
+
+    it = it_begin(streams);
+    while(it_hasNext(it)) {
+        stream st = it_next(it);
+        if(streq(st->name, name)) {
+            it_free(&it);
+            return st;
+        }
+    }
+    it_free(&it);
+    return NULL;
+}
+
+// The worst-case cost of a procedure, with its calls
+static cost procCost(structures s, stream st, int rate) {
+    if(st->state[rate] == VISITING)
+        return Unbounded(StringFmt("recursion in %s", st->name));
+    if(st->state[rate] == VISITED)
+        return st->wcet[rate];
+
+    st->state[rate] = VISITING;
+    if(st->nodes == NULL)
+        build(st);
+    cost c = st->numNodes == 0 ? Cost("") : regionCost(s, st, 0, rate);
+    st->wcet[rate] = c;
+    st->state[rate] = VISITED;
+    return c;
+}
+
+// The worst-case cost of the code reached from a block, to a return or the
+// end of a thread
+static cost regionCost(structures s, stream st, int entry, int rate) {
+    int n = st->numNodes;
+    int i, j, k;
+
+    region r = chkalloc(sizeof(*r));
+    r->s = s;
+    r->st = st;
+    r->rate = rate;
+    r->reach = chkalloc(sizeof(bool) * n);
+    r->dfs = chkalloc(sizeof(int) * n);
+    r->back = chkalloc(sizeof(bool) * 2 * n);
+    r->rep = chkalloc(sizeof(int) * n);
+    r->base = chkalloc(sizeof(cost) * n);
+    r->memo = chkalloc(sizeof(cost) * n);
+    r->state = chkalloc(sizeof(int) * n);
+    for(i=0; i<n; i++) {
+        r->reach[i] = false;
+        r->dfs[i] = UNVISITED;
+        r->back[2*i] = r->back[2*i+1] = false;
+        r->rep[i] = i;
+    }
+
+    // Find the back edges, then the body of each loop
+    visit(r, entry);
+    int numLoops = 0;
+    int *headers = chkalloc(sizeof(int) * n);
+    bool **bodies = chkalloc(sizeof(bool *) * n);
+    int *sizes = chkalloc(sizeof(int) * n);
+    for(i=0; i<n; i++) {
+        if(r->reach[i])
+            r->base[i] = nodeCost(r, st->nodes[i]);
+        for(k=0; k<st->nodes[i]->numSucc; k++) {
+            int h = st->nodes[i]->succ[k];
+            if(!r->back[2*i+k])
+                continue;
+            for(j=0; j<numLoops && headers[j]!=h; j++)
+                ;
+            if(j == numLoops) {
+                headers[numLoops] = h;
+                bodies[numLoops] = chkalloc(sizeof(bool) * n);
+                numLoops++;
+            }
+        }
+    }
+    for(j=0; j<numLoops; j++) {
+        loopBody(r, headers[j], bodies[j]);
+        sizes[j] = 0;
+        for(i=0; i<n; i++)
+            sizes[j] += bodies[j][i];
+    }
+
+    // Collapse loops from the innermost out
+    while(numLoops > 0) {
+        int min = 0;
+        for(j=1; j<numLoops; j++) {
+            if(sizes[j] < sizes[min])
+                min = j;
+        }
+        int h = headers[min];
+        bool *body = bodies[min];
+        r->base[h] = collapse(r, h, body);
+        for(i=0; i<n; i++) {
+            if(body[i])
+                r->rep[i] = h;
+        }
+        free(body);
+        numLoops--;
+        headers[min] = headers[numLoops];
+        bodies[min] = bodies[numLoops];
+        sizes[min] = sizes[numLoops];
+    }
+
+    // Then take the longest path out of the region
+    cost c = search(r, r->rep[entry], false, -1, r->reach);
+    if(isNoPath(c))
+        c = Unbounded(StringFmt("no way out of %s", st->name));
+
+    free(headers);
+    free(bodies);
+    free(sizes);
+    free(r->reach);
+    free(r->dfs);
+    free(r->back);
+    free(r->rep);
+    free(r->base);
+    free(r->memo);
+    free(r->state);
+    free(r);
+    return c;
+}
+
+// Mark the blocks reached, and each edge to a block being visited as a back
+// edge
+static void visit(region r, int i) {
+    node b = r->st->nodes[i];
+    int k;
+    r->reach[i] = true;
+    r->dfs[i] = VISITING;
+    for(k=0; k<b->numSucc; k++) {
+        if(r->dfs[b->succ[k]] == VISITING)
+            r->back[2*i+k] = true;
+        else if(r->dfs[b->succ[k]] == UNVISITED)
+            visit(r, b->succ[k]);
+    }
+    r->dfs[i] = VISITED;
+}
+
+// The blocks of the loop with header h: those that reach one of its back
+// edges without passing through h
+static void loopBody(region r, int h, bool *body) {
+    int n = r->st->numNodes;
+    int *work = chkalloc(sizeof(int) * 2 * n);
+    int numWork = 0;
+    int i, k;
+
+    for(i=0; i<n; i++)
+        body[i] = false;
+    body[h] = true;
+    for(i=0; i<n; i++) {
+        for(k=0; k<r->st->nodes[i]->numSucc; k++) {
+            if(r->back[2*i+k] && r->st->nodes[i]->succ[k] == h)
+                work[numWork++] = i;
+        }
+    }
+    while(numWork > 0) {
+        int j = work[--numWork];
+        if(body[j])
+            continue;
+        body[j] = true;
+        for(i=0; i<n; i++) {
+            if(!r->reach[i] || body[i])
+                continue;
+            for(k=0; k<r->st->nodes[i]->numSucc; k++) {
+                if(r->st->nodes[i]->succ[k] == j && numWork < 2 * n) {
+                    work[numWork++] = i;
+                    break;
+                }
+            }
+        }
+    }
+    free(work);
+}
+
+// The cost of a loop: its bound times the longest iteration, plus the
+// longest path out of it
+static cost collapse(region r, int h, bool *body) {
+    string label = r->st->nodes[h]->label;
+    int bound = label == NULL ? -1 : lbl_bound(lblMap_getNamed(r->s->lbl, label));
+    if(bound == -1)
+        return Unbounded(StringFmt("loop at %s",
+                    label == NULL ? r->st->name : label));
+
+    cost iter = search(r, h, true, h, body);
+    cost exit = search(r, h, false, h, body);
+    if(isNoPath(exit))
+        return Unbounded(StringFmt("no way out of loop at %s", label));
+    if(!iter.bounded)
+        return iter;
+    if(!exit.bounded)
+        return exit;
+
+    cost c = Cost(StringFmt("(%s)x%d %s", iter.path, bound, exit.path));
+    c.cycles = iter.cycles * bound + exit.cycles;
+    c.insts = iter.insts * bound + exit.insts;
+    return c;
+}
+
+// The longest path from the (collapsed) block u in a loop body, or the
+// region if h is -1, to a back edge to h if iter, or out of it. There may
+// be none.
+static cost search(region r, int u, bool iter, int h, bool *body) {
+    int i;
+    for(i=0; i<r->st->numNodes; i++)
+        r->state[i] = UNVISITED;
+    return longest(r, u, iter, h, body);
+}
+
+static cost longest(region r, int u, bool iter, int h, bool *body) {
+    string label = r->st->nodes[u]->label;
+    bool found = false;
+    cost best = Cost("");
+    int i, k;
+
+    if(r->state[u] == VISITING)
+        return Unbounded(StringFmt("irreducible flow at %s",
+                    label == NULL ? r->st->name : label));
+    if(r->state[u] == VISITED)
+        return r->memo[u];
+
+    // Follow the edges of each block collapsed into u
+    r->state[u] = VISITING;
+    for(i=0; i<r->st->numNodes; i++) {
+        if(!body[i] || r->rep[i] != u)
+            continue;
+        node b = r->st->nodes[i];
+        if(b->numSucc == 0 && !iter)
+            take(&best, &found, Cost(""));
+        for(k=0; k<b->numSucc; k++) {
+            int m = b->succ[k];
+            if(m == h) {
+                if(iter)
+                    take(&best, &found, Cost(""));
+            }
+            else if(!body[m]) {
+                if(!iter)
+                    take(&best, &found, Cost(""));
+            }
+            else if(r->rep[m] != u)
+                take(&best, &found, longest(r, r->rep[m], iter, h, body));
+        }
+    }
+    r->memo[u] = found ? add(r->base[u], best) : NoPath();
+    r->state[u] = VISITED;
+    return r->memo[u];
+}
+
+// Keep the longer of two paths
+static void take(cost *best, bool *found, cost c) {
+    if(isNoPath(c))
+        return;
+    if(!*found || worse(c, *best))
+        *best = c;
+    *found = true;
+}
+
+// The cost of the instructions of a block, its calls and the threads it
+// waits for
+static cost nodeCost(region r, node b) {
+    cost c = Cost(b->label != NULL ? b->label : "");
+    int i;
+    for(i=b->first; i<b->last; i++) {
+        entry e = r->st->e[i];
+        if(e->isLabel)
+            continue;
+        c.cycles += issue(e->op, r->rate);
+        c.insts++;
+
+        // Add the callee, without its path
+        if(e->op == i_BLACP) {
+            stream callee = streamAt(r->s, atoi(e->imm) - JUMP_INDEX_OFFSET);
+            if(callee != NULL) {
+                cost f = procCost(r->s, callee, r->rate);
+                if(!f.bounded)
+                    return f;
+                c.cycles += f.cycles;
+                c.insts += f.insts;
+            }
+        }
+
+        // Wait for the longest thread
+        else if(e->op == i_MJOIN && e->threads != NULL) {
+            unsigned long wait = 0;
+            iterator it = it_begin(e->threads);
+            while(it_hasNext(it)) {
+                int t = findNode(r->st, it_next(it));
+                if(t == -1)
+                    continue;
+                cost f = regionCost(r->s, r->st, t, r->rate);
+                if(!f.bounded) {
+                    it_free(&it);
+                    return f;
+                }
+                if(f.cycles > wait)
+                    wait = f.cycles;
+            }
+            it_free(&it);
+            c.cycles += wait;
+        }
+    }
+    return c;
+}
+
+// The cycles for a thread to issue an instruction, with the threads of a
+// rate on its core
+static int issue(t_inst op, int rate) {
+    if(op == i_DIVS || op == i_REMS)
+        return DIVIDE_CYCLES;
+    return rateThreads[rate] > PIPELINE_STAGES ?
+        rateThreads[rate] : PIPELINE_STAGES;
+}
+
+// Cost constructor
+static cost Cost(string path) {
+    cost c;
+    c.bounded = true;
+    c.cycles = 0;
+    c.insts = 0;
+    c.path = path;
+    return c;
+}
+
+static cost Unbounded(string why) {
+    cost c = Cost(why);
+    c.bounded = false;
+    return c;
+}
+
+// The cost of a block that reaches no end of the search
+static cost NoPath(void) {
+    return Unbounded(NULL);
+}
+
+static bool isNoPath(cost c) {
+    return !c.bounded && c.path == NULL;
+}
+
+// A path followed by another
+static cost add(cost a, cost b) {
+    if(!a.bounded)
+        return a;
+    if(!b.bounded)
+        return b;
+    cost c = Cost(strlen(a.path) == 0 ? b.path : strlen(b.path) == 0 ? a.path
+            : StringFmt("%s %s", a.path, b.path));
+    c.cycles = a.cycles + b.cycles;
+    c.insts = a.insts + b.insts;
+    return c;
+}
+
+// Whether a path takes longer than another, where unbounded is longest
+static bool worse(cost a, cost b) {
+    if(!a.bounded || !b.bounded)
+        return !a.bounded && b.bounded;
+    return a.cycles > b.cycles;
+}
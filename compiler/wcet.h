@@ -0,0 +1,16 @@
+#ifndef WCET_H
+#define WCET_H
+
+#include <stdio.h>
+#include "util.h"
+#include "instructions.h"
+#include "structures.h"
+
+void wct_begin    (void);
+void wct_beginProc(string);
+void wct_endProc  (void);
+void wct_label    (string);
+void wct_inst     (t_inst, int reg, string imm);
+void wct_report   (FILE *, structures);
+
+#endif
@@ -66,11 +66,11 @@ extern int yylex();
 %token <boolval> TRUE FALSE
 %token LBRACKET RBRACKET LPAREN RPAREN
 %token PROC FUNC IS BODY RETURN
-%token IF THEN ELSE WHILE DO TO FOR ON SKP ALIASES DOTS CONNECT CORE
+%token IF THEN ELSE WHILE DO TO FOR PAR ON JOIN SKP ALIASES DOTS CONNECT CORE
 %token ASS INPUT OUTPUT
 %token START END
 %token SEMICOLON BAR COMMA COLON
-%token VAR CHAN CHANEND PORT TIMER INT CONST
+%token VAL VAR CHAN CHANEND PORT TIMER INT CONST
 %token MASTER SLAVE
 %token PLUS MINUS MULT DIV REM OR AND XOR LSHIFT RSHIFT
     EQ NE LS LE GR GE NOT NEG
@@ -214,9 +214,13 @@ formals :
 
 formals_seq :
     param_decl_seq COLON param_type
-                                            { $$ = a_Formals($3, $1, NULL); }
+                                     { $$ = a_Formals($3, false, $1, NULL); }
   | param_decl_seq COLON param_type SEMICOLON formals_seq
-                                            { $$ = a_Formals($3, $1, $5); }
+                                     { $$ = a_Formals($3, false, $1, $5); }
+  | VAL param_decl_seq COLON param_type
+                                     { $$ = a_Formals($4, true, $2, NULL); }
+  | VAL param_decl_seq COLON param_type SEMICOLON formals_seq
+                                     { $$ = a_Formals($4, true, $2, $6); }
   ;
 
 param_type :
@@ -241,12 +245,21 @@ stmt :
   | left ASS expr                { $$ = a_stmt_Ass     (tp, $1, $3);     }
   | left INPUT expr              { $$ = a_stmt_In      (tp, $1, $3);     }
   | left OUTPUT expr             { $$ = a_stmt_Out     (tp, $1, $3);     }
+  | left INPUT name LBRACKET expr DOTS expr RBRACKET
+                { $$ = a_stmt_InArray (tp, $1, a_elem_Sub(tp, $3, $5), $7); }
+  | left OUTPUT name LBRACKET expr DOTS expr RBRACKET
+                { $$ = a_stmt_OutArray(tp, $1, a_elem_Sub(tp, $3, $5), $7); }
   | IF expr THEN stmt ELSE stmt  { $$ = a_stmt_If      (tp, $2, $4, $6); }
   | WHILE expr DO stmt           { $$ = a_stmt_While   (tp, $2, $4);     }
   | FOR left ASS expr TO expr DO stmt
                                  { $$ = a_stmt_For (tp, $2, $4, $6, $8); }
+  | PAR left ASS expr FOR expr DO stmt
+                                 { $$ = a_stmt_Rep (tp, $2, $4, $6, $8); }
   | ON left COLON on_proc_call
                                  { $$ = a_stmt_On      (tp, $2, $4);     }
+  | left ASS ON left COLON on_proc_call
+                                 { $$ = a_stmt_OnAsync (tp, $1, $4, $6); }
+  | JOIN expr                    { $$ = a_stmt_Join    (tp, $2);         }
   | CONNECT left TO left COLON left
                                  { $$ = a_stmt_Connect (tp, $4, $2, $6); }
   | name_elem ALIASES name_elem LBRACKET expr DOTS RBRACKET
@@ -14,7 +14,11 @@
 #define LBL_MIGRATE            "migrate"
 #define LBL_INIT_THREAD        "initThread"
 #define LBL_CONNECT            "connect"
+#define LBL_MIGRATE_ASYNC      "migrateAsync"
+#define LBL_JOIN_ASYNC         "joinAsync"
 #define LBL_CHAN_ARRAY         "progChan"
+#define LBL_CONN_TABLE         "connTable"
+#define LBL_PROFILE            "_blockCounts"
 
 // System variables
 #define CHAN_ARRAY             "chan"
@@ -24,6 +28,8 @@
 #define JUMPI_MIGRATE         0
 #define JUMPI_INIT_THREAD     1
 #define JUMPI_CONNECT         2
+#define JUMPI_MIGRATE_ASYNC   3
+#define JUMPI_JOIN_ASYNC      4
 
 // Hardware specs
 #define RAM_BASE               0x10000
@@ -40,14 +46,27 @@
 #define SIZE_TAB_SIZE          20
 #define KERNEL_SPACE           0x200
 #define THREAD_STACK_SPACE     0x400
-#define JUMP_INDEX_OFFSET      3
+#define JUMP_INDEX_OFFSET      5
 #define PROG_CHAN_OFF          (MAX_THREADS+1)
-#define NUM_PROG_CHANS         (MAX_CHANNELS-PROG_CHAN_OFF)
+#define NUM_ASYNC_CHANS        8 // Left free for asynchronous ons
+#define NUM_PROG_CHANS         (MAX_CHANNELS-PROG_CHAN_OFF-NUM_ASYNC_CHANS)
+#define CONN_NONE              -1
 
 // Closure elements
 #define CLOSURE_NUM_ARGS       0
 #define CLOSURE_NUM_PROCS      1
-#define CLOSURE_ARGS           2
+#define CLOSURE_ARG_MODES      2
+#define CLOSURE_ARGS           3
+
+// Send a closure as one stream, or 0 with a handshake around each part
+#ifndef CLOSURE_STREAMED
+#define CLOSURE_STREAMED       1
+#endif
+
+// Argument modes: whether an array is copied to the host and back
+#define ARG_MODE_IN            0x1
+#define ARG_MODE_OUT           0x2
+#define ARG_MODE(modes, i)     (((modes) >> (2*(i))) & 0x3)
 
 // Ports
 #define LED_PORT               67072
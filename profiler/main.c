@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../compiler/util.h"
+#include "../compiler/error.h"
+
+#include "profile.h"
+
+// Global options
+int    maxBlocks;
+string mapFile;
+string freqFile;
+
+// Print some usage info
+void printHelp(void) {
+    printf("Usage: sireprof [options] <dump> [<dump> ...]\n");
+    printf("Report the block counts of a program compiled with -pg, from a\n");
+    printf("dump of the counters of each core\n");
+    printf("Options:\n");
+    printf("  -h          Display this help message\n");
+    printf("  -m=<file>   Counter map (default program.map)\n");
+    printf("  -n=<n>      Report the n hottest blocks (default 20)\n");
+    printf("  -o=<file>   Write the block frequencies, for sire -f\n");
+}
+
+// Set the number of hot blocks to report
+void setMaxBlocks(char *arg) {
+    char *end;
+    arg += 3;
+    maxBlocks = strtol(arg, &end, 10);
+    if(*arg == '\0' || *end != '\0' || maxBlocks < 0)
+        err_fatal("invalid number of blocks");
+}
+
+// Parse command line options, leaving the dump files
+int parseOptions(int *argc, char ***argv) {
+
+    // Default options
+    maxBlocks = 20;
+    mapFile   = "program.map";
+    freqFile  = NULL;
+
+    // Get options
+    while((*argc > 1) && ((*argv)[1][0] == '-')) {
+        switch((*argv)[1][1]) {
+        case 'h': printHelp();                      return FAIL;
+        case 'm': mapFile = String((*argv)[1] + 3); break;
+        case 'n': setMaxBlocks((*argv)[1]);         break;
+        case 'o': freqFile = String((*argv)[1] + 3); break;
+        default:
+            err_fatal("invalid option %s", (*argv)[1]);
+            return FAIL;
+        }
+        ++*argv;
+        --*argc;
+    }
+
+    if(*argc == 1) {
+        printHelp();
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    int i;
+
+    if(parseOptions(&argc, &argv))
+        return EXIT_FAILURE;
+
+    profile p = prf_load(mapFile);
+    if(p == NULL)
+        return EXIT_FAILURE;
+    for(i=1; i<argc; i++) {
+        if(!prf_addDump(p, argv[i]))
+            return EXIT_FAILURE;
+    }
+
+    prf_report(p, stdout, maxBlocks);
+    if(freqFile != NULL && !prf_writeFreqs(p, freqFile))
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "profile.h"
+#include "../compiler/error.h"
+#include "../compiler/table.h"
+
+#define DEBUG 0
+
+// Characters in a line of a map or dump
+#define LINE_LEN 512
+
+// A procedure is cold if it ran fewer than 1/COLD_RATIO of the blocks
+// executed
+#define COLD_RATIO 1000
+
+// Block profile:
+//
+// A program compiled with -pg counts the executions of each of its blocks
+// in an array in the data section of each core, and the compiler maps each
+// counter to its procedure and block label in program.map. A dump of the
+// array, from the memory of a device or from the simulator, is a list of
+// words in counter order: any text up to the last ':' of a line, such as
+// the address of a memory dump, is ignored. The dumps of several cores are
+// summed, as a migrated or forked procedure counts on the core it runs on.
+// An increment is not atomic, so threads of a core running the same block
+// at once can lose counts, which the simulator's own counts do not.
+//
+// The counts are written as block frequencies, a line for each block:
+//   <procedure> <block label> <executions>
+// which the compiler reads back to lay out and allocate registers for the
+// program compiled with the same options.
+
+static profile Profile   (void);
+static void    grow      (profile, int, int *);
+static void    indexCounts(profile);
+static int     cmpCounts (const void *, const void *);
+
+static unsigned long *sortKeys;
+
+// Load the map of the counters written by the compiler
+profile prf_load(string mapFile) {
+    char line[LINE_LEN];
+    char name[LINE_LEN], proc[LINE_LEN], lbl[LINE_LEN];
+    int index, n = 0, i;
+
+    FILE *in = fopen(mapFile, "r");
+    if(in == NULL) {
+        err_fatal("opening map file %s", mapFile);
+        return NULL;
+    }
+    if(fgets(line, LINE_LEN, in) == NULL
+            || sscanf(line, "counters %s", name) != 1) {
+        err_fatal("%s is not a block profile map", mapFile);
+        fclose(in);
+        return NULL;
+    }
+
+    // Counters are numbered in the order blocks were sequenced, and listed
+    // in the order procedures were emitted
+    profile p = Profile();
+    p->counters = String(name);
+    while(fgets(line, LINE_LEN, in) != NULL) {
+        if(sscanf(line, "%d %s %s", &index, proc, lbl) != 3 || index < 0) {
+            err_fatal("invalid line in %s: %s", mapFile, line);
+            fclose(in);
+            return NULL;
+        }
+        grow(p, index, &n);
+        p->procs[index] = String(proc);
+        p->labels[index] = String(lbl);
+        if(index >= p->numBlocks)
+            p->numBlocks = index + 1;
+    }
+    fclose(in);
+
+    for(i=0; i<p->numBlocks; i++) {
+        if(p->procs[i] == NULL) {
+            err_fatal("counter %d missing from %s", i, mapFile);
+            return NULL;
+        }
+    }
+    if(DEBUG) printf("Loaded %d blocks from %s\n", p->numBlocks, mapFile);
+    return p;
+}
+
+// Load the block frequencies written by prf_writeFreqs
+profile prf_loadFreqs(string freqFile) {
+    char line[LINE_LEN];
+    char proc[LINE_LEN], lbl[LINE_LEN];
+    unsigned long count;
+    int n = 0;
+
+    FILE *in = fopen(freqFile, "r");
+    if(in == NULL) {
+        err_fatal("opening profile %s", freqFile);
+        return NULL;
+    }
+    profile p = Profile();
+    while(fgets(line, LINE_LEN, in) != NULL) {
+        if(sscanf(line, "%s %s %lu", proc, lbl, &count) != 3) {
+            err_fatal("invalid line in %s: %s", freqFile, line);
+            fclose(in);
+            return NULL;
+        }
+        grow(p, p->numBlocks, &n);
+        p->procs[p->numBlocks] = String(proc);
+        p->labels[p->numBlocks] = String(lbl);
+        p->counts[p->numBlocks++] = count;
+    }
+    fclose(in);
+    if(DEBUG) printf("Loaded %d blocks from %s\n", p->numBlocks, freqFile);
+    return p;
+}
+
+// Add the counts in a dump of the counter array
+bool prf_addDump(profile p, string dumpFile) {
+    char line[LINE_LEN];
+    int n = 0;
+
+    FILE *in = fopen(dumpFile, "r");
+    if(in == NULL) {
+        err_fatal("opening dump file %s", dumpFile);
+        return false;
+    }
+    while(fgets(line, LINE_LEN, in) != NULL) {
+        char *s = strrchr(line, ':');
+        char *tok = strtok(s == NULL ? line : s + 1, " \t\r\n,");
+        for(; tok!=NULL; tok=strtok(NULL, " \t\r\n,")) {
+            char *end;
+            unsigned long v = strtoul(tok, &end, 0);
+            if(*end != '\0' || !isdigit((unsigned char) *tok))
+                continue;
+            if(n < p->numBlocks)
+                p->counts[n] += v;
+            n++;
+        }
+    }
+    fclose(in);
+
+    if(n < p->numBlocks)
+        err_report(t_warning, -1, "%s holds %d of %d counters", dumpFile, n,
+                p->numBlocks);
+    return true;
+}
+
+// Write the counts as a dump, one word per line
+bool prf_write(profile p, string dumpFile) {
+    int i;
+    FILE *out = fopen(dumpFile, "w");
+    if(out == NULL) {
+        err_fatal("opening dump file %s", dumpFile);
+        return false;
+    }
+    for(i=0; i<p->numBlocks; i++)
+        fprintf(out, "%lu\n", p->counts[i]);
+    fclose(out);
+    return true;
+}
+
+// Write the counts as block frequencies, keyed by procedure and label
+bool prf_writeFreqs(profile p, string freqFile) {
+    int i;
+    FILE *out = fopen(freqFile, "w");
+    if(out == NULL) {
+        err_fatal("opening profile %s", freqFile);
+        return false;
+    }
+    for(i=0; i<p->numBlocks; i++)
+        fprintf(out, "%s %s %lu\n", p->procs[i], p->labels[i], p->counts[i]);
+    fclose(out);
+    return true;
+}
+
+// The executions of a block, or -1 if it was not profiled
+long prf_block(profile p, string proc, string label) {
+    indexCounts(p);
+    string key = StringFmt("%s %s", proc, label);
+    size_t i = (size_t) tab_lookup(p->index, key);
+    free(key);
+    return i == 0 ? -1 : (long) p->counts[i-1];
+}
+
+// Whether a procedure ran too little to be worth optimising for speed. One
+// that was not profiled is not cold.
+bool prf_cold(profile p, string proc) {
+    indexCounts(p);
+    size_t i = (size_t) tab_lookup(p->index, proc);
+    return i != 0 && p->execs[i-1] * COLD_RATIO < p->total;
+}
+
+// Report the executions of each procedure, with the calls counted by its
+// entry block, and the hottest blocks
+void prf_report(profile p, FILE *out, int maxBlocks) {
+    int *procs = chkalloc(sizeof(int) * (p->numBlocks + 1));
+    int *blocks = chkalloc(sizeof(int) * (p->numBlocks + 1));
+    unsigned long *execs, total;
+    int numProcs = 0;
+    int i, j;
+
+    // The entry of each procedure is its first counter
+    indexCounts(p);
+    execs = p->execs;
+    total = p->total;
+    for(i=0; i<p->numBlocks; i++) {
+        blocks[i] = i;
+        if((size_t) tab_lookup(p->index, p->procs[i]) == (size_t) i + 1)
+            procs[numProcs++] = i;
+    }
+
+    sortKeys = execs;
+    qsort(procs, numProcs, sizeof(int), cmpCounts);
+
+    printTitleRule(out, "Block profile");
+    fprintf(out, "  %-20s %12s %14s %7s\n", "Procedure", "Calls",
+            "Executions", "%");
+    for(i=0; i<numProcs; i++) {
+        j = procs[i];
+        fprintf(out, "  %-20s %12lu %14lu %7.2f\n", p->procs[j],
+                p->counts[j], execs[j],
+                total == 0 ? 0.0 : 100.0 * execs[j] / total);
+    }
+    fprintf(out, "  %-20s %12s %14lu\n", "Total", "", total);
+
+    sortKeys = p->counts;
+    qsort(blocks, p->numBlocks, sizeof(int), cmpCounts);
+    printTitleRule(out, "Hot blocks");
+    fprintf(out, "  %-20s %12s %14s %7s\n", "Procedure", "Block",
+            "Executions", "%");
+    for(i=0; i<p->numBlocks && i<maxBlocks; i++) {
+        j = blocks[i];
+        if(p->counts[j] == 0)
+            break;
+        fprintf(out, "  %-20s %12s %14lu %7.2f\n", p->procs[j],
+                p->labels[j], p->counts[j], 100.0 * p->counts[j] / total);
+    }
+    printRule(out);
+
+    free(procs);
+    free(blocks);
+}
+
+// Constructor
+static profile Profile(void) {
+    profile p = chkalloc(sizeof(*p));
+    p->counters = NULL;
+    p->numBlocks = 0;
+    p->procs = NULL;
+    p->labels = NULL;
+    p->counts = NULL;
+    p->index = NULL;
+    p->execs = NULL;
+    p->total = 0;
+    return p;
+}
+
+// Make room for a counter, from n allocated
+static void grow(profile p, int index, int *n) {
+    int i;
+    if(index < *n)
+        return;
+    int m = index + 16;
+    p->procs = realloc(p->procs, sizeof(string) * m);
+    p->labels = realloc(p->labels, sizeof(string) * m);
+    p->counts = realloc(p->counts, sizeof(unsigned long) * m);
+    for(i=*n; i<m; i++) {
+        p->procs[i] = p->labels[i] = NULL;
+        p->counts[i] = 0;
+    }
+    *n = m;
+}
+
+// Index the counters by procedure and label, and by procedure for the
+// executions of each, once the counts are complete
+static void indexCounts(profile p) {
+    int i;
+    if(p->index != NULL)
+        return;
+    p->index = tab_New();
+    p->execs = chkalloc(sizeof(unsigned long) * (p->numBlocks + 1));
+    p->total = 0;
+    for(i=0; i<p->numBlocks; i++) {
+        tab_insert(p->index, StringFmt("%s %s", p->procs[i], p->labels[i]),
+                (void *) (size_t) (i + 1));
+        size_t e = (size_t) tab_lookup(p->index, p->procs[i]);
+        if(e == 0) {
+            tab_insert(p->index, p->procs[i], (void *) (size_t) (i + 1));
+            p->execs[i] = 0;
+            e = i + 1;
+        }
+        p->execs[e-1] += p->counts[i];
+        p->total += p->counts[i];
+    }
+}
+
+// Order counters by decreasing key, then as they were mapped
+static int cmpCounts(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    unsigned long cx = sortKeys[x], cy = sortKeys[y];
+    if(cx != cy)
+        return cx < cy ? 1 : -1;
+    return x - y;
+}
@@ -0,0 +1,31 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "../compiler/util.h"
+#include "../compiler/table.h"
+
+typedef struct profile_ *profile;
+
+// The blocks of a program compiled with -pg and their execution counts
+struct profile_ {
+    string counters;     // label of the counter array
+    int numBlocks;
+    string *procs;       // procedure of each block
+    string *labels;      // label of each block
+    unsigned long *counts;
+    table index;         // counter of each procedure and label, from 1
+    unsigned long *execs; // executions of the procedure of each counter
+    unsigned long total;
+};
+
+profile prf_load      (string mapFile);
+profile prf_loadFreqs (string freqFile);
+bool    prf_addDump   (profile, string dumpFile);
+bool    prf_write     (profile, string dumpFile);
+bool    prf_writeFreqs(profile, string freqFile);
+void    prf_report    (profile, FILE *, int maxBlocks);
+long    prf_block     (profile, string proc, string label);
+bool    prf_cold      (profile, string proc);
+
+#endif
@@ -4,13 +4,27 @@
 #include "../include/definitions.h"
 
 // External globals
+#ifdef __XC__
 extern unsigned fp;
 extern unsigned sp;
 extern unsigned fpLock;
+extern unsigned liveBytes;
 extern unsigned mSpawnChan;
 extern unsigned spawnChan[MAX_THREADS];
 extern unsigned progChan[NUM_PROG_CHANS];  
-extern unsigned sizeTable[SIZE_TAB_SIZE];
+extern unsigned sizeTable[SIZE_TAB_SIZE]; // Resident procedures, by jump index
+#else
+// Built for Linux, those of the emulated core the thread runs on
+#include "ops.h"
+#define fp         (ops_globals()->fp)
+#define sp         (ops_globals()->sp)
+#define fpLock     (ops_globals()->fpLock)
+#define liveBytes  (ops_globals()->liveBytes)
+#define mSpawnChan (ops_globals()->mSpawnChan)
+#define spawnChan  (ops_globals()->spawnChan)
+#define progChan   (ops_globals()->progChan)
+#define sizeTable  (ops_globals()->sizeTable)
+#endif
 
 // External functions
 extern void excepHandler(void);
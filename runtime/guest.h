@@ -2,5 +2,7 @@
 #define GUEST_H
 
 void migrate(unsigned int, unsigned int[]);
+unsigned migrateAsync(unsigned int, unsigned int[]);
+void joinAsync(unsigned int);
 
 #endif
@@ -0,0 +1,531 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+// Native runtime:
+// The C11 emitted by 'sire -native' includes this to run on POSIX threads.
+// Each core has its own memory, holding the constants, then the globals,
+// then a stack for each thread running on it, so addresses are 32-bit as on
+// the XS1 and a migrated call sees only the arrays copied to it. A par
+// starts a pthread for each branch, which the master waits for at its join,
+// and an on starts a pthread on the destination core, pinned to a processor
+// where that is supported. Channel ends are lock-free rings with a single
+// consumer, and as several ends may be connected to one, producers claim
+// their slots in turn: an output waits until its word has been taken,
+// except in an open stream, which waits at its close.
+//
+// Compile with: cc -std=c11 -O2 -pthread -I runtime program.c
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "../include/definitions.h"
+#include "../include/platform.h"
+
+// Words of memory of each core and of the stack of each thread, which may
+// be raised with -D for larger problems
+#ifndef SIRE_MEM_WORDS
+#define SIRE_MEM_WORDS   (1 << 24)
+#endif
+#ifndef SIRE_STACK_WORDS
+#define SIRE_STACK_WORDS (1 << 18)
+#endif
+
+// Words buffered at a channel end, a power of 2
+#define SIRE_CHAN_WORDS  64
+
+#define SIRE_RES_CHANEND 2
+
+typedef uint32_t word;
+
+typedef struct {
+    word buf[SIRE_CHAN_WORDS];
+    _Atomic word head;   // words taken by the receiver
+    _Atomic word tail;   // words put by the senders
+    _Atomic word claim;  // slots claimed by the senders
+    _Atomic int destCore, destChan;
+} sire_chan;
+
+typedef struct {
+    word *mem;
+    word stackBase;      // word index of the first thread stack
+    int numStacks;
+    bool *stacks;
+    pthread_mutex_t lock;
+    sire_chan chans[NUM_PROG_CHANS];
+} sire_core;
+
+typedef struct {
+    int core;
+    int stack;
+    word sp, limit;      // word indices of the top and bottom of its stack
+    word *mem;
+    sire_chan *stream;   // the destination of an open output stream
+    word ticket;
+} sire_thr;
+
+// A par: its master waits at the join until the slaves have arrived
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int live;
+} sire_barrier;
+
+// A slave of a par, running the body of a procedure from an entry
+typedef struct {
+    word (*body)(sire_thr *, void *, int);
+    void *frame;
+    int entry;
+    int core;
+} sire_slave;
+
+// A call migrated to another core
+typedef struct {
+    pthread_t thread;
+    word (*call)(sire_thr *, word *);
+    int guest, host;
+    int numArgs;
+    word args[NUM_ARGS*2];
+    word addr[NUM_ARGS*2];
+    const int *modes;
+    sire_thr *t;
+} sire_mig;
+
+static sire_core   sire_cores[NUM_CORES];
+static sire_mig  **sire_migs;
+static int         sire_numMigs;
+static pthread_mutex_t sire_migLock = PTHREAD_MUTEX_INITIALIZER;
+
+#define M(t, a) ((t)->mem[(word) (a) >> 2])
+
+// Report a runtime error and stop
+static inline void sire_fault(sire_thr *t, const char *format, ...) {
+    va_list ap;
+    fflush(stdout);
+    fprintf(stderr, "error: ");
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fprintf(stderr, " (core %d)\n", t->core);
+    exit(EXIT_FAILURE);
+}
+
+// Wait for another thread to make progress
+static inline void sire_yield(void) {
+    sched_yield();
+}
+
+//========================================================================
+// Cores and threads
+//========================================================================
+
+// Lay out the memory of each core with the constants and globals and the
+// static channel routes
+static inline void sire_init(const word *cp, int cpWords, int dpWords,
+        const int route[][2]) {
+    int i, j;
+    for(i=0; i<NUM_CORES; i++) {
+        sire_core *k = &sire_cores[i];
+        k->mem = calloc(SIRE_MEM_WORDS, sizeof(word));
+        if(k->mem == NULL) {
+            fprintf(stderr, "error: no memory for core %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(k->mem, cp, cpWords * sizeof(word));
+        k->stackBase = cpWords + dpWords;
+        k->numStacks = (SIRE_MEM_WORDS - k->stackBase) / SIRE_STACK_WORDS;
+        k->stacks = calloc(k->numStacks, sizeof(bool));
+        pthread_mutex_init(&k->lock, NULL);
+        for(j=0; j<NUM_PROG_CHANS; j++) {
+            atomic_init(&k->chans[j].head, 0);
+            atomic_init(&k->chans[j].tail, 0);
+            atomic_init(&k->chans[j].claim, 0);
+            atomic_init(&k->chans[j].destCore, route[j][0]);
+            atomic_init(&k->chans[j].destChan, route[j][1]);
+        }
+    }
+}
+
+// Set up a thread on a core with a free stack
+static inline void sire_thread(sire_thr *t, int c) {
+    sire_core *k = &sire_cores[c];
+    int i;
+    pthread_mutex_lock(&k->lock);
+    for(i=0; i<k->numStacks && k->stacks[i]; i++)
+        ;
+    if(i < k->numStacks)
+        k->stacks[i] = true;
+    pthread_mutex_unlock(&k->lock);
+    t->core = c;
+    if(i == k->numStacks)
+        sire_fault(t, "insufficient thread stacks");
+    t->stack = i;
+    t->limit = k->stackBase + i * SIRE_STACK_WORDS;
+    t->sp = t->limit + SIRE_STACK_WORDS;
+    t->mem = k->mem;
+    t->stream = NULL;
+    t->ticket = 0;
+}
+
+// Release the stack of a thread
+static inline void sire_exit(sire_thr *t) {
+    sire_core *k = &sire_cores[t->core];
+    pthread_mutex_lock(&k->lock);
+    k->stacks[t->stack] = false;
+    pthread_mutex_unlock(&k->lock);
+}
+
+// Allocate words on the stack of a thread, giving their byte address
+static inline word sire_push(sire_thr *t, word words) {
+    if(t->sp - t->limit < words)
+        sire_fault(t, "stack overflow allocating %u words", words);
+    t->sp -= words;
+    return t->sp * 4;
+}
+
+// Pin the calling thread to a processor for a core
+static inline void sire_pin(int c) {
+#if defined(__linux__)
+    cpu_set_t set;
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    CPU_ZERO(&set);
+    CPU_SET(c % (n > 0 ? n : 1), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void) c;
+#endif
+}
+
+//========================================================================
+// Par
+//========================================================================
+
+static inline void sire_fork(sire_barrier *b) {
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->done, NULL);
+    b->live = 0;
+}
+
+static void *sire_runSlave(void *p) {
+    sire_slave *s = p;
+    sire_thr t;
+    sire_thread(&t, s->core);
+    s->body(&t, s->frame, s->entry);
+    sire_exit(&t);
+    free(s->frame);
+    free(s);
+    return NULL;
+}
+
+// Start a slave from a copy of the frame of the master
+static inline void sire_forkSet(sire_thr *t, sire_barrier *b,
+        word (*body)(sire_thr *, void *, int), const void *frame,
+        size_t size, int entry) {
+    pthread_t thread;
+    sire_slave *s = malloc(sizeof(sire_slave));
+    s->body = body;
+    s->frame = malloc(size);
+    memcpy(s->frame, frame, size);
+    s->entry = entry;
+    s->core = t->core;
+    pthread_mutex_lock(&b->lock);
+    b->live++;
+    pthread_mutex_unlock(&b->lock);
+    if(pthread_create(&thread, NULL, sire_runSlave, s) != 0)
+        sire_fault(t, "unable to start a thread");
+    pthread_detach(thread);
+}
+
+// A slave arrives at its join
+static inline void sire_arrive(sire_barrier *b) {
+    pthread_mutex_lock(&b->lock);
+    if(--b->live == 0)
+        pthread_cond_signal(&b->done);
+    pthread_mutex_unlock(&b->lock);
+}
+
+// The master waits at its join for the slaves
+static inline void sire_join(sire_barrier *b) {
+    pthread_mutex_lock(&b->lock);
+    while(b->live > 0)
+        pthread_cond_wait(&b->done, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+    pthread_cond_destroy(&b->done);
+    pthread_mutex_destroy(&b->lock);
+}
+
+//========================================================================
+// On
+//========================================================================
+
+static void *sire_runHost(void *p) {
+    sire_mig *m = p;
+    sire_pin(m->host);
+    m->call(m->t, m->args);
+    return NULL;
+}
+
+// Start a call on a thread of another core. Each array argument is followed
+// by its length, and is copied to the stack of the host if it reads it.
+static inline sire_mig *sire_migrate(sire_thr *t, word dest,
+        word (*call)(sire_thr *, word *), int numArgs, const word *args,
+        const int *modes) {
+    int i;
+    word j;
+    if(dest >= NUM_CORES)
+        sire_fault(t, "invalid core %u", dest);
+    sire_mig *m = malloc(sizeof(sire_mig));
+    m->call = call;
+    m->guest = t->core;
+    m->host = dest;
+    m->numArgs = numArgs;
+    m->modes = modes;
+    m->t = malloc(sizeof(sire_thr));
+    sire_thread(m->t, dest);
+    for(i=0; i<numArgs; i++) {
+        m->args[i] = args[i];
+        if(modes[i] < 0)
+            continue;
+        word len = args[i+1];
+        m->addr[i] = args[i];
+        m->args[i] = sire_push(m->t, len);
+        if(modes[i] & ARG_MODE_IN) {
+            for(j=0; j<len; j++)
+                M(m->t, m->args[i] + j*4) = M(t, args[i] + j*4);
+        }
+    }
+    if(pthread_create(&m->thread, NULL, sire_runHost, m) != 0)
+        sire_fault(t, "unable to start a thread on core %u", dest);
+    return m;
+}
+
+// Wait for a migrated call and copy back the arrays it writes
+static inline void sire_complete(sire_thr *t, sire_mig *m) {
+    int i;
+    word j;
+    pthread_join(m->thread, NULL);
+    for(i=0; i<m->numArgs; i++) {
+        if(m->modes[i] < 0 || !(m->modes[i] & ARG_MODE_OUT))
+            continue;
+        for(j=0; j<m->args[i+1]; j++)
+            M(t, m->addr[i] + j*4) = M(m->t, m->args[i] + j*4);
+    }
+    sire_exit(m->t);
+    free(m->t);
+    free(m);
+}
+
+// Make a call on another core and wait for it
+static inline void sire_on(sire_thr *t, word dest,
+        word (*call)(sire_thr *, word *), int numArgs, const word *args,
+        const int *modes) {
+    sire_complete(t, sire_migrate(t, dest, call, numArgs, args, modes));
+}
+
+// Start a call on another core, giving a handle to join it with
+static inline word sire_onAsync(sire_thr *t, word dest,
+        word (*call)(sire_thr *, word *), int numArgs, const word *args,
+        const int *modes) {
+    sire_mig *m = sire_migrate(t, dest, call, numArgs, args, modes);
+    pthread_mutex_lock(&sire_migLock);
+    if(sire_numMigs % 16 == 0)
+        sire_migs = realloc(sire_migs, sizeof(sire_mig *)
+                * (sire_numMigs + 16));
+    sire_migs[sire_numMigs++] = m;
+    word h = sire_numMigs;
+    pthread_mutex_unlock(&sire_migLock);
+    return h;
+}
+
+// Join an asynchronous call
+static inline void sire_onJoin(sire_thr *t, word h) {
+    sire_mig *m = NULL;
+    if(h == 0)
+        return;
+    pthread_mutex_lock(&sire_migLock);
+    if(h <= (word) sire_numMigs) {
+        m = sire_migs[h-1];
+        sire_migs[h-1] = NULL;
+    }
+    pthread_mutex_unlock(&sire_migLock);
+    if(m == NULL)
+        sire_fault(t, "join of an invalid handle %u", h);
+    sire_complete(t, m);
+}
+
+//========================================================================
+// Channels and ports
+//========================================================================
+
+// A core number
+static inline word sire_coreNum(sire_thr *t, word v) {
+    if(v >= NUM_CORES)
+        sire_fault(t, "invalid core %u", v);
+    return v;
+}
+
+// The identifier of a channel end of this core
+static inline word sire_chanend(sire_thr *t, word v) {
+    if(v >= NUM_PROG_CHANS)
+        sire_fault(t, "invalid channel %u", v);
+    return (t->core << 16) | (v << 8) | SIRE_RES_CHANEND;
+}
+
+static inline sire_chan *sire_end(sire_thr *t, word id) {
+    word c = id >> 16, n = (id >> 8) & 0xFF;
+    if((id & 0xFF) != SIRE_RES_CHANEND || c >= NUM_CORES
+            || n >= NUM_PROG_CHANS)
+        sire_fault(t, "invalid channel end 0x%x", id);
+    return &sire_cores[c].chans[n];
+}
+
+// The channel end that a channel end outputs to
+static inline sire_chan *sire_dest(sire_thr *t, sire_chan *e) {
+    int c = atomic_load_explicit(&e->destCore, memory_order_acquire);
+    int n = atomic_load_explicit(&e->destChan, memory_order_acquire);
+    if(c < 0 || c >= NUM_CORES || n < 0 || n >= NUM_PROG_CHANS)
+        sire_fault(t, "output on an unconnected channel");
+    return &sire_cores[c].chans[n];
+}
+
+// Set the destination of a channel end of this core
+static inline void sire_connect(sire_thr *t, word to, word c1, word c2) {
+    sire_chan *e = sire_end(t, c1);
+    atomic_store_explicit(&e->destCore, sire_coreNum(t, to),
+            memory_order_release);
+    atomic_store_explicit(&e->destChan, (c2 >> 8) & 0xFF,
+            memory_order_release);
+}
+
+// Queue a word at a channel end in the slot claimed for it, waiting while
+// the slot is still full, then for the words of earlier slots to be put
+static inline word sire_put(sire_chan *d, word v) {
+    word slot = atomic_fetch_add_explicit(&d->claim, 1, memory_order_relaxed);
+    while(slot - atomic_load_explicit(&d->head, memory_order_acquire)
+            >= SIRE_CHAN_WORDS)
+        sire_yield();
+    d->buf[slot % SIRE_CHAN_WORDS] = v;
+    while(atomic_load_explicit(&d->tail, memory_order_acquire) != slot)
+        sire_yield();
+    atomic_store_explicit(&d->tail, slot + 1, memory_order_release);
+    return slot + 1;
+}
+
+// Wait until the words put at a channel end up to a ticket have been taken
+static inline void sire_taken(sire_chan *d, word ticket) {
+    while((int32_t) (atomic_load_explicit(&d->head, memory_order_acquire)
+                - ticket) < 0)
+        sire_yield();
+}
+
+static inline void sire_portOut(word port, word v) {
+    if(port == 0)
+        putchar(v & 0xFF);
+    else
+        printf("port 0x%x: %u\n", port, v);
+}
+
+static inline word sire_portIn(word port) {
+    if(port != 0)
+        return 0;
+    int c = getchar();
+    return c == EOF ? 0xFFFFFFFF : (word) c;
+}
+
+// Output a word to a channel end and wait for it to be taken, or to a port
+static inline void sire_out(sire_thr *t, word id, word v) {
+    if((id & 0xFF) != SIRE_RES_CHANEND) {
+        sire_portOut(id, v);
+        return;
+    }
+    sire_chan *e = sire_end(t, id);
+    sire_chan *d = sire_dest(t, e);
+    word ticket = sire_put(d, v);
+    if(e == t->stream)
+        t->ticket = ticket;
+    else
+        sire_taken(d, ticket);
+}
+
+// Input a word from a channel end, waiting until it holds one, or a port
+static inline word sire_in(sire_thr *t, word id) {
+    if((id & 0xFF) != SIRE_RES_CHANEND)
+        return sire_portIn(id);
+    sire_chan *e = sire_end(t, id);
+    word head = atomic_load_explicit(&e->head, memory_order_relaxed);
+    while(atomic_load_explicit(&e->tail, memory_order_acquire) == head)
+        sire_yield();
+    word v = e->buf[head % SIRE_CHAN_WORDS];
+    atomic_store_explicit(&e->head, head + 1, memory_order_release);
+    return v;
+}
+
+// Open a channel end of this core for a stream of words
+static inline word sire_open(sire_thr *t, word id, bool output) {
+    if(output) {
+        sire_chan *e = sire_end(t, id);
+        t->stream = e;
+        t->ticket = atomic_load_explicit(&sire_dest(t, e)->tail,
+                memory_order_relaxed);
+    }
+    return id;
+}
+
+// Close a stream, once an output stream has been taken
+static inline void sire_close(sire_thr *t, bool output) {
+    if(output && t->stream != NULL) {
+        sire_taken(sire_dest(t, t->stream), t->ticket);
+        t->stream = NULL;
+    }
+}
+
+//========================================================================
+// Arithmetic, as the instructions generated for it
+//========================================================================
+
+static inline word sire_div(sire_thr *t, word a, word b) {
+    if(b == 0)
+        sire_fault(t, "division by zero");
+    if(a == 0x80000000 && b == 0xFFFFFFFF)
+        return a;
+    return (word) ((int32_t) a / (int32_t) b);
+}
+
+static inline word sire_rem(sire_thr *t, word a, word b) {
+    if(b == 0)
+        sire_fault(t, "division by zero");
+    if(a == 0x80000000 && b == 0xFFFFFFFF)
+        return 0;
+    return (word) ((int32_t) a % (int32_t) b);
+}
+
+static inline word sire_shl(word a, word b) {
+    return b >= 32 ? 0 : a << b;
+}
+
+static inline word sire_shr(word a, word b) {
+    return b >= 32 ? 0 : a >> b;
+}
+
+static inline word sire_ashr(word a, word b) {
+    int32_t s = (int32_t) a;
+    if(b >= 32)
+        return s < 0 ? 0xFFFFFFFF : 0;
+    return s < 0 ? ~(~a >> b) : a >> b;
+}
+
+static inline word sire_mulhu(word a, word b) {
+    return (word) (((uint64_t) a * b) >> 32);
+}
+
+#endif
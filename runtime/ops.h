@@ -0,0 +1,69 @@
+#ifndef OPS_H
+#define OPS_H
+
+#include "../include/definitions.h"
+
+// Operations of the runtime protocols: the XS1 instructions when built by
+// xcc, or when built for Linux, those of the emulated system in
+// tests/protocol, so the protocols can be tested between pthreads.
+
+#ifdef __XC__
+
+#define OUT(c, v)     asm("out res[%0], %1" :: "r"(c), "r"(v))
+#define IN(c, v)      asm("in %0, res[%1]" : "=r"(v) : "r"(c))
+#define OUTCT(c, ct)  asm("outct res[%0], " S(ct) :: "r"(c))
+#define CHKCT(c, ct)  asm("chkct res[%0], " S(ct) :: "r"(c))
+#define SETD(c, d)    asm("setd res[%0], %1" :: "r"(c), "r"(d))
+#define LDW(v, a, i)  asm("ldw %0, %1[%2]" : "=r"(v) : "r"(a), "r"(i))
+#define STW(v, a, i)  asm("stw %0, %1[%2]" :: "r"(v), "r"(a), "r"(i))
+#define GETCP(v)      asm("ldaw r11, cp[0]\n\t" \
+                          "mov %0, r11" : "=r"(v) :: "r11")
+#define LOCK(l)       asm("in r11, res[%0]" :: "r"(l))
+#define UNLOCK(l)     asm("out res[%0], r11" :: "r"(l))
+#define GETR(v, type) asm("getr %0, " S(type) : "=r"(v))
+#define FREER(r)      asm("freer res[%0]" :: "r"(r))
+
+#else
+
+// The runtime globals of an emulated core
+typedef struct {
+    unsigned fp;
+    unsigned sp;
+    unsigned fpLock;
+    unsigned liveBytes;
+    unsigned mSpawnChan;
+    unsigned spawnChan[MAX_THREADS];
+    unsigned progChan[NUM_PROG_CHANS];
+    unsigned sizeTable[SIZE_TAB_SIZE];
+} ops_core;
+
+ops_core *ops_globals(void);
+void      ops_out    (unsigned c, unsigned v);
+unsigned  ops_in     (unsigned c);
+void      ops_outct  (unsigned c, unsigned ct);
+void      ops_chkct  (unsigned c, unsigned ct);
+void      ops_setd   (unsigned c, unsigned d);
+unsigned  ops_ldw    (unsigned a, unsigned i);
+void      ops_stw    (unsigned v, unsigned a, unsigned i);
+unsigned  ops_cp     (void);
+void      ops_lock   (unsigned l);
+void      ops_unlock (unsigned l);
+unsigned  ops_getr   (unsigned type);
+void      ops_freer  (unsigned r);
+
+#define OUT(c, v)     ops_out(c, v)
+#define IN(c, v)      ((v) = ops_in(c))
+#define OUTCT(c, ct)  ops_outct(c, ct)
+#define CHKCT(c, ct)  ops_chkct(c, ct)
+#define SETD(c, d)    ops_setd(c, d)
+#define LDW(v, a, i)  ((v) = ops_ldw(a, i))
+#define STW(v, a, i)  ops_stw(v, a, i)
+#define GETCP(v)      ((v) = ops_cp())
+#define LOCK(l)       ops_lock(l)
+#define UNLOCK(l)     ops_unlock(l)
+#define GETR(v, type) ((v) = ops_getr(type))
+#define FREER(r)      ops_freer(r)
+
+#endif
+
+#endif
@@ -5,6 +5,7 @@ extern void initThread();
 extern void connect(unsigned, int, int);
 
 void initSystem();
+void connectStatic();
 void yeild();
 void idle();
 void wait();
@@ -0,0 +1,820 @@
+#include <stdlib.h>
+#include <ctype.h>
+#include "image.h"
+#include "../compiler/error.h"
+#include "../compiler/list.h"
+#include "../include/definitions.h"
+
+#define DEBUG 0
+
+// Characters in a line of assembly
+#define LINE_LEN     512
+
+// Operands of an instruction, as written
+#define MAX_OPERANDS 8
+
+// Image loader:
+//
+// The three files written by the code generator are assembled into the image
+// of a core. The code is laid out from the base of memory, after an entry for
+// each runtime routine the program can reach, then the constant pool, with
+// the jump table at its base, and then the data, after the globals of the
+// runtime. Each instruction is decoded once into the t_inst it was emitted
+// as, by its mnemonic and the shape of its operands, with its size in bytes
+// taken from the XS1 encoding it would assemble to, so that the addresses of
+// labels and the procedure sizes in sizeTable are close to those the linker
+// would give.
+
+typedef enum { t_sec_text, t_sec_cp, t_sec_dp } t_sec;
+
+typedef struct {
+    t_sec sec;
+    unsigned off;
+} label;
+
+// A word of data, evaluated once the labels are placed
+typedef struct {
+    t_sec sec;
+    unsigned off;
+    string expr;
+    string file;
+    int line;
+} word;
+
+// An operand: a register, an immediate or label, a bare sp, dp or cp, an
+// indexed operand base[index], or a thread register t[r]:field
+typedef enum {
+    t_opd_reg,
+    t_opd_imm,
+    t_opd_lbl,
+    t_opd_sp,
+    t_opd_dp,
+    t_opd_cp,
+    t_opd_idx,
+    t_opd_thr
+} t_opd;
+
+typedef struct {
+    t_opd type;
+    t_opd base;          // for an index, the base: a register, sp, dp, cp,
+    string baseName;     // or a named resource space ("res" or "ps")
+    int reg;
+    t_opd index;         // for an index: a register, immediate or label
+    int value;
+    string lbl;
+    string field;
+} operand;
+
+// The forms of each instruction. Operand shapes are: r register, i
+// immediate, l label or immediate, x r[r], n r[imm], S sp[..], D dp[..],
+// C cp[..], R res[r], P ps[r], T t[r]:field, and s, d, c a bare sp, dp, cp.
+static struct {
+    string mn;
+    string shape;
+    t_inst op;
+} forms[] = {
+    { "add",    "rrr",    i_ADD     }, { "add",   "rri", i_ADDI   },
+    { "sub",    "rrr",    i_SUB     }, { "sub",   "rri", i_SUBI   },
+    { "mul",    "rrr",    i_MUL     }, { "divs",  "rrr", i_DIVS   },
+    { "rems",   "rrr",    i_REMS    }, { "or",    "rrr", i_OR     },
+    { "and",    "rrr",    i_AND     }, { "xor",   "rrr", i_XOR    },
+    { "shl",    "rrr",    i_SHL     }, { "shl",   "rri", i_SHLI   },
+    { "shr",    "rrr",    i_SHR     }, { "shr",   "rri", i_SHRI   },
+    { "ashr",   "rrr",    i_ASHR    }, { "ashr",  "rri", i_ASHRI  },
+    { "eq",     "rrr",    i_EQ      }, { "eq",    "rri", i_EQI    },
+    { "lss",    "rrr",    i_LSS     }, { "lmul",  "rrrrrr", i_LMUL },
+    { "ldw",    "rx",     i_LDW     }, { "ldw",   "rn",  i_LDWI   },
+    { "ldw",    "rS",     i_LDWSP   }, { "ldw",   "rD",  i_LDWDP  },
+    { "ldw",    "rC",     i_LDWCP   }, { "stw",   "rx",  i_STW    },
+    { "stw",    "rn",     i_STWI    }, { "stw",   "rS",  i_STWSP  },
+    { "stw",    "rD",     i_STWDP   }, { "ldaw",  "rS",  i_LDAWSP },
+    { "ldaw",   "rD",     i_LDAWDP  }, { "ldaw",  "rC",  i_LDAWCP },
+    { "ldaw",   "rn",     i_LDAWF   }, { "mov",   "rr",  i_MOVE   },
+    { "ldc",    "ri",     i_LDC     }, { "ldap",  "rl",  i_LDAP   },
+    { "in",     "rR",     i_IN      }, { "out",   "Rr",  i_OUT    },
+    { "outct",  "Ri",     i_OUTCT   }, { "chkct", "Ri",  i_CHKCT  },
+    { "setc",   "Rr",     i_SETC    }, { "setc",  "Ri",  i_SETCI  },
+    { "setclk", "Rr",     i_SETCLK  }, { "get",   "rP",  i_GETPS  },
+    { "set",    "Pr",     i_SETPS   }, { "set",   "Tr",  i_TSETR  },
+    { "set",    "sr",     i_SETSP   }, { "set",   "dr",  i_SETDP  },
+    { "set",    "cr",     i_SETCP   }, { "init",  "Tr",  i_TINITPC },
+    { "getr",   "ri",     i_GETR    }, { "getst", "rR",  i_GETST  },
+    { "msync",  "R",      i_MSYNC   }, { "mjoin", "R",   i_MJOIN  },
+    { "ssync",  "",       i_SSYNC   }, { "waiteu", "",   i_WAITEU },
+    { "bt",     "rl",     i_BT      }, { "bf",    "rl",  i_BF     },
+    { "bu",     "l",      i_BU      }, { "bl",    "l",   i_BL     },
+    { "bla",    "C",      i_BLACP   }, { "entsp", "i",   i_ENTSP  },
+    { "extsp",  "i",      i_EXTSP   }, { "retsp", "i",   i_RETSP  },
+    { "kcall",  "r",      i_KCALL   }, { "kcall", "i",   i_KCALLI },
+};
+
+#define NUM_FORMS ((int) (sizeof(forms) / sizeof(forms[0])))
+
+// The code of the runtime reached through the jump table, and the returns
+// out of main and out of a hosted procedure, in t_sys order
+static string sysCode[] = {
+    LBL_MIGRATE,
+    LBL_INIT_THREAD,
+    LBL_CONNECT,
+    LBL_MIGRATE_ASYNC,
+    LBL_JOIN_ASYNC,
+    "runMain",
+    LBL_RUN_THREAD
+};
+
+// The data of the runtime, ahead of that of the program
+static struct {
+    string name;
+    int words;
+} sysData[] = {
+    { "mSpawnChan",   1              },
+    { "spawnChan",    MAX_THREADS    },
+    { LBL_CHAN_ARRAY, NUM_PROG_CHANS },
+    { "fpLock",       1              },
+    { "fp",           1              },
+    { "liveBytes",    1              },
+    { "sp",           1              },
+    { "_pc",          1              }
+};
+
+#define NUM_SYS_DATA ((int) (sizeof(sysData) / sizeof(sysData[0])))
+
+static image    img;
+static list     insts;
+static list     words;
+static list     procs;
+static unsigned secSize[3];
+static t_sec    sec;
+static string   file;
+static int      lineNum;
+static bool     inComment;
+
+static bool   parse      (string);
+static void   line       (string);
+static void   directive  (string);
+static void   instruction(string);
+static int    operands   (string, operand *);
+static bool   operand_   (string, operand *);
+static bool   match      (string, operand *, int);
+static void   decode     (inst *, string, operand *, int);
+static int    instSize   (inst *);
+static void   define     (string, t_sec, unsigned);
+static void   layout     (void);
+static void   resolve    (inst *);
+static bool   evaluate   (string, unsigned *);
+static bool   address    (string, unsigned *, t_sec *);
+static void   error      (string, int, string, ...);
+static string trim       (string);
+static string copy       (string, int);
+static bool   identChar  (char);
+
+// Assemble the program, jump table and constant pool into an image. Returns
+// NULL if any of them could not be read or assembled.
+image img_load(string asmFile, string jumpTabFile, string cpFile) {
+
+    int i;
+    img = chkalloc(sizeof(*img));
+    img->labels = tab_New();
+    insts = list_New();
+    words = list_New();
+    procs = list_New();
+    for(i=0; i<3; i++)
+        secSize[i] = 0;
+
+    // The runtime routines are first in the code, and its data first in dp
+    for(i=0; i<t_sys_none; i++) {
+        inst *in = chkalloc(sizeof(inst));
+        in->op = i_BU;
+        in->sys = i;
+        in->size = 2;
+        in->addr = secSize[t_sec_text];
+        in->proc = list_size(procs);
+        in->text = sysCode[i];
+        define(sysCode[i], t_sec_text, in->addr);
+        list_add(procs, sysCode[i]);
+        list_add(insts, in);
+        secSize[t_sec_text] += in->size;
+    }
+    for(i=0; i<NUM_SYS_DATA; i++) {
+        define(sysData[i].name, t_sec_dp, secSize[t_sec_dp]);
+        secSize[t_sec_dp] += sysData[i].words * BYTES_PER_WORD;
+    }
+
+    // The jump table is linked first in cp, then the constants
+    if(!parse(jumpTabFile) || !parse(cpFile) || !parse(asmFile))
+        return NULL;
+    if(err_anyErrors())
+        return NULL;
+    layout();
+    if(err_anyErrors())
+        return NULL;
+    return img;
+}
+
+// The address of a label
+bool img_label(image m, string name, unsigned *addr) {
+    label *l = tab_lookup(m->labels, name);
+    if(l == NULL)
+        return false;
+    switch(l->sec) {
+    case t_sec_text: *addr = m->codeBase + l->off; break;
+    case t_sec_cp:   *addr = m->cpBase + l->off;   break;
+    case t_sec_dp:   *addr = m->dpBase + l->off;   break;
+    default: assert(0 && "invalid section");
+    }
+    return true;
+}
+
+// The instruction at an address, or NULL
+inst *img_fetch(image m, unsigned addr) {
+    if(addr < m->codeBase || addr >= m->cpBase || addr % 2 != 0)
+        return NULL;
+    int i = m->at[(addr - m->codeBase) / 2];
+    return i == -1 ? NULL : &m->insts[i];
+}
+
+//========================================================================
+// Parsing
+//========================================================================
+
+// Parse each line of a file
+static bool parse(string name) {
+    char buf[LINE_LEN];
+    FILE *f = fopen(name, "r");
+    if(f == NULL) {
+        err_fatal("opening input file: %s", name);
+        return false;
+    }
+    file = name;
+    lineNum = 0;
+    inComment = false;
+    sec = t_sec_text;
+    while(fgets(buf, LINE_LEN, f) != NULL) {
+        lineNum++;
+        line(buf);
+    }
+    fclose(f);
+    return true;
+}
+
+// A line: any labels, then a directive or an instruction
+static void line(string s) {
+
+    // Remove comments
+    char *p = s, *q = s;
+    while(*p != '\0') {
+        if(inComment) {
+            if(p[0] == '*' && p[1] == '/') {
+                inComment = false;
+                p++;
+            }
+        }
+        else if(p[0] == '/' && p[1] == '*') {
+            inComment = true;
+            p++;
+        }
+        else if(p[0] == '/' && p[1] == '/')
+            break;
+        else
+            *q++ = *p;
+        p++;
+    }
+    *q = '\0';
+    s = trim(s);
+
+    // Labels
+    for(;;) {
+        p = s;
+        while(identChar(*p))
+            p++;
+        if(p == s || *p != ':')
+            break;
+        *p = '\0';
+        define(String(s), sec, secSize[sec]);
+        if(sec == t_sec_text && s[0] != '.')
+            list_add(procs, String(s));
+        s = trim(p + 1);
+    }
+
+    if(*s == '\0')
+        return;
+    if(*s == '.')
+        directive(s);
+    else
+        instruction(s);
+}
+
+// A directive: sections, alignment and data are placed, and the symbol
+// attributes and extents used by the linker are ignored
+static void directive(string s) {
+    char *p = s;
+    while(*p != '\0' && !isspace(*p))
+        p++;
+    string name = copy(s, p - s);
+    string args = trim(p);
+
+    if(streq(name, ".text"))
+        sec = t_sec_text;
+    else if(streq(name, ".section")) {
+        if(strncmp(args, ".cp.", 4) == 0)
+            sec = t_sec_cp;
+        else if(strncmp(args, ".dp.", 4) == 0)
+            sec = t_sec_dp;
+        else
+            error(file, lineNum, "unknown section '%s'", args);
+    }
+    else if(streq(name, ".align")) {
+        unsigned n = strtoul(args, NULL, 0);
+        if(n > 0 && secSize[sec] % n != 0)
+            secSize[sec] += n - secSize[sec] % n;
+    }
+    else if(streq(name, ".space"))
+        secSize[sec] += strtoul(args, NULL, 0);
+    else if(streq(name, ".word")) {
+        if(sec == t_sec_text) {
+            error(file, lineNum, "data in the code section");
+            return;
+        }
+        char *e = strtok(args, ",");
+        while(e != NULL) {
+            word *w = chkalloc(sizeof(word));
+            w->sec = sec;
+            w->off = secSize[sec];
+            w->expr = String(trim(e));
+            w->file = file;
+            w->line = lineNum;
+            list_add(words, w);
+            secSize[sec] += BYTES_PER_WORD;
+            e = strtok(NULL, ",");
+        }
+    }
+    else if(!streq(name, ".globl") && !streq(name, ".extern")
+            && !streq(name, ".set") && !streq(name, ".cc_top")
+            && !streq(name, ".cc_bottom"))
+        error(file, lineNum, "unknown directive '%s'", name);
+}
+
+// An instruction, decoded by the first form its operands match
+static void instruction(string s) {
+    operand ops[MAX_OPERANDS];
+    char *p = s;
+    int i;
+
+    if(sec != t_sec_text) {
+        error(file, lineNum, "instruction outside the code section");
+        return;
+    }
+    while(isalpha(*p))
+        p++;
+    string mn = copy(s, p - s);
+    int n = operands(trim(p), ops);
+    if(n == -1) {
+        error(file, lineNum, "invalid operands of '%s'", mn);
+        return;
+    }
+
+    for(i=0; i<NUM_FORMS; i++) {
+        if(streq(forms[i].mn, mn) && match(forms[i].shape, ops, n))
+            break;
+    }
+    if(i == NUM_FORMS) {
+        error(file, lineNum, "unknown instruction '%s'", s);
+        return;
+    }
+
+    inst *in = chkalloc(sizeof(inst));
+    in->op = forms[i].op;
+    in->sys = t_sys_none;
+    in->proc = list_size(procs) - 1;
+    in->text = String(s);
+    decode(in, forms[i].shape, ops, n);
+    if(in->op == i_TSETR && ops[0].field[0] != 'r')
+        error(file, lineNum, "invalid thread register '%s'", ops[0].field);
+    if(in->op == i_TINITPC) {
+        string f = ops[0].field;
+        if(streq(f, "lr")) in->op = i_TINITLR;
+        else if(streq(f, "sp")) in->op = i_TINITSP;
+        else if(streq(f, "dp")) in->op = i_TINITDP;
+        else if(streq(f, "cp")) in->op = i_TINITCP;
+        else if(!streq(f, "pc"))
+            error(file, lineNum, "invalid thread register '%s'", f);
+    }
+    if(in->proc == -1) {
+        error(file, lineNum, "instruction outside a procedure");
+        return;
+    }
+    in->size = instSize(in);
+    in->addr = secSize[t_sec_text];
+    secSize[t_sec_text] += in->size;
+    list_add(insts, in);
+}
+
+// Split the operands at commas outside of brackets. Returns the number of
+// operands or -1 if any is invalid.
+static int operands(string s, operand *ops) {
+    int n = 0;
+    int depth = 0;
+    char *start = s, *p;
+    if(*s == '\0')
+        return 0;
+    for(p=s; ; p++) {
+        if(*p == '[') depth++;
+        if(*p == ']') depth--;
+        if((*p == ',' && depth == 0) || *p == '\0') {
+            if(n == MAX_OPERANDS)
+                return -1;
+            string op = trim(copy(start, p - start));
+            if(!operand_(op, &ops[n++]))
+                return -1;
+            if(*p == '\0')
+                break;
+            start = p + 1;
+        }
+    }
+    return n;
+}
+
+// Classify an operand
+static bool operand_(string s, operand *op) {
+    char *end;
+    op->field = NULL;
+    op->lbl = NULL;
+    op->baseName = NULL;
+
+    // Register or bare pointer
+    if(s[0] == 'r' && isdigit(s[1]) && strchr(s, '[') == NULL) {
+        op->type = t_opd_reg;
+        op->reg = strtol(s+1, &end, 10);
+        return *end == '\0' && op->reg < 12;
+    }
+    if(streq(s, "sp")) { op->type = t_opd_sp; return true; }
+    if(streq(s, "dp")) { op->type = t_opd_dp; return true; }
+    if(streq(s, "cp")) { op->type = t_opd_cp; return true; }
+
+    // Immediate
+    if(isdigit(s[0]) || s[0] == '-') {
+        op->type = t_opd_imm;
+        op->value = strtol(s, &end, 0);
+        return *end == '\0';
+    }
+
+    char *open = strchr(s, '[');
+
+    // Label
+    if(open == NULL) {
+        char *p = s;
+        while(identChar(*p))
+            p++;
+        op->type = t_opd_lbl;
+        op->lbl = s;
+        return p != s && *p == '\0';
+    }
+
+    // Thread register t[r]:field, or an index base[index]
+    char *close = strchr(open, ']');
+    if(close == NULL)
+        return false;
+    string base = copy(s, open - s);
+    string index = copy(open+1, close - open - 1);
+    operand idx;
+    if(!operand_(index, &idx))
+        return false;
+
+    // An index named sp, dp or cp is a label, as in dp[sp]
+    if(idx.type == t_opd_sp || idx.type == t_opd_dp || idx.type == t_opd_cp) {
+        idx.type = t_opd_lbl;
+        idx.lbl = index;
+    }
+    if(streq(base, "t")) {
+        if(close[1] != ':' || idx.type != t_opd_reg)
+            return false;
+        op->type = t_opd_thr;
+        op->reg = idx.reg;
+        op->field = String(close + 2);
+        return true;
+    }
+    if(close[1] != '\0')
+        return false;
+    op->type = t_opd_idx;
+    if(base[0] == 'r' && isdigit(base[1])) {
+        op->base = t_opd_reg;
+        op->reg = strtol(base+1, &end, 10);
+        if(*end != '\0' || op->reg >= 12)
+            return false;
+    }
+    else if(streq(base, "sp")) op->base = t_opd_sp;
+    else if(streq(base, "dp")) op->base = t_opd_dp;
+    else if(streq(base, "cp")) op->base = t_opd_cp;
+    else if(streq(base, "res") || streq(base, "ps")) {
+        op->base = t_opd_lbl;
+        op->baseName = base;
+    }
+    else
+        return false;
+    op->index = idx.type;
+    op->value = idx.type == t_opd_reg ? idx.reg : idx.value;
+    op->lbl = idx.lbl;
+    return idx.type == t_opd_reg || idx.type == t_opd_imm
+        || idx.type == t_opd_lbl;
+}
+
+// Whether operands match the shape of a form
+static bool match(string shape, operand *ops, int n) {
+    int i;
+    if((int) strlen(shape) != n)
+        return false;
+    for(i=0; i<n; i++) {
+        operand *o = &ops[i];
+        bool idx = o->type == t_opd_idx;
+        bool named = idx && o->base == t_opd_lbl;
+        bool ok;
+        switch(shape[i]) {
+        case 'r': ok = o->type == t_opd_reg; break;
+        case 'i': ok = o->type == t_opd_imm; break;
+        case 'l': ok = o->type == t_opd_imm || o->type == t_opd_lbl; break;
+        case 's': ok = o->type == t_opd_sp; break;
+        case 'd': ok = o->type == t_opd_dp; break;
+        case 'c': ok = o->type == t_opd_cp; break;
+        case 'T': ok = o->type == t_opd_thr; break;
+        case 'x': ok = idx && o->base == t_opd_reg
+                  && o->index == t_opd_reg; break;
+        case 'n': ok = idx && o->base == t_opd_reg
+                  && o->index == t_opd_imm; break;
+        case 'S': ok = idx && o->base == t_opd_sp
+                  && o->index == t_opd_imm; break;
+        case 'D': ok = idx && o->base == t_opd_dp
+                  && o->index != t_opd_reg; break;
+        case 'C': ok = idx && o->base == t_opd_cp
+                  && o->index != t_opd_reg; break;
+        case 'R': ok = named && streq(o->baseName, "res")
+                  && o->index == t_opd_reg; break;
+        case 'P': ok = named && streq(o->baseName, "ps")
+                  && o->index == t_opd_reg; break;
+        default: assert(0 && "invalid operand shape");
+        }
+        if(!ok)
+            return false;
+    }
+    return true;
+}
+
+// Take the registers of the operands in the order they are written, and any
+// immediate or label
+static void decode(inst *in, string shape, operand *ops, int n) {
+    int r = 0;
+    int i;
+    in->imm = 0;
+    in->lbl = NULL;
+    for(i=0; i<NUM_OPERANDS; i++)
+        in->r[i] = 0;
+    for(i=0; i<n; i++) {
+        operand *o = &ops[i];
+        switch(shape[i]) {
+        case 'r': case 'R': case 'P':
+            in->r[r++] = o->type == t_opd_reg ? o->reg : o->value;
+            break;
+        case 'x':
+            in->r[r++] = o->reg;
+            in->r[r++] = o->value;
+            break;
+        case 'n':
+            in->r[r++] = o->reg;
+            in->imm = o->value;
+            break;
+        case 'T':
+            in->r[r++] = o->reg;
+            if(o->field[0] == 'r')
+                in->r[r++] = atoi(o->field + 1);
+            break;
+        case 'i':
+            in->imm = o->value;
+            break;
+        case 'l':
+            if(o->type == t_opd_lbl)
+                in->lbl = o->lbl;
+            else
+                in->imm = o->value;
+            break;
+        case 'S': case 'D': case 'C':
+            if(o->index == t_opd_lbl)
+                in->lbl = o->lbl;
+            else
+                in->imm = o->value;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// The bytes of the encoding of an instruction: most are short, with a
+// prefix for an immediate beyond 6 bits, and the long forms are the
+// multiply, divide, thread and 3-operand long instructions, and those
+// referring to a label elsewhere in memory
+static int instSize(inst *in) {
+    switch(in->op) {
+    case i_MUL: case i_DIVS: case i_REMS: case i_XOR: case i_ASHR:
+    case i_ASHRI: case i_LMUL: case i_TSETR: case i_TINITPC:
+    case i_TINITLR: case i_TINITSP: case i_TINITDP: case i_TINITCP:
+    case i_LDAP: case i_BL:
+        return 4;
+    case i_LDWDP: case i_STWDP: case i_LDAWDP: case i_LDWCP:
+    case i_LDAWCP: case i_BLACP:
+        return in->lbl != NULL || in->imm > 63 ? 4 : 2;
+    case i_LDC: case i_LDWSP: case i_STWSP: case i_LDAWSP:
+    case i_ENTSP: case i_EXTSP: case i_RETSP: case i_GETR:
+    case i_LDAWF: case i_STWI: case i_LDWI:
+        return in->imm > 63 ? 4 : 2;
+    default:
+        return 2;
+    }
+}
+
+// Define a label at an offset in a section
+static void define(string name, t_sec s, unsigned off) {
+    if(tab_lookup(img->labels, name) != NULL) {
+        error(file, lineNum, "label '%s' defined more than once", name);
+        return;
+    }
+    label *l = chkalloc(sizeof(label));
+    l->sec = s;
+    l->off = off;
+    tab_insert(img->labels, name, l);
+}
+
+//========================================================================
+// Layout
+//========================================================================
+
+// Place the sections, resolve the labels referred to by instructions and
+// evaluate the data words
+static void layout(void) {
+
+    int i;
+    img->codeBase = RAM_BASE;
+    img->cpBase = img->codeBase + (secSize[t_sec_text] + 3) / 4 * 4;
+    img->dpBase = img->cpBase + (secSize[t_sec_cp] + 3) / 4 * 4;
+    img->bssEnd = img->dpBase + (secSize[t_sec_dp] + 3) / 4 * 4;
+    if(img->bssEnd - RAM_BASE + KERNEL_SPACE + THREAD_STACK_SPACE > RAM_SIZE) {
+        err_report(t_error, -1, "program exceeds core memory");
+        return;
+    }
+
+    // Procedures
+    img->numProcs = list_size(procs);
+    img->procs = chkalloc(sizeof(string) * img->numProcs);
+    i = 0;
+    iterator it = it_begin(procs);
+    while(it_hasNext(it))
+        img->procs[i++] = it_next(it);
+    it_free(&it);
+
+    // Instructions, and the instruction at each halfword
+    img->numInsts = list_size(insts);
+    img->insts = chkalloc(sizeof(inst) * img->numInsts);
+    int halfwords = (img->cpBase - img->codeBase) / 2;
+    img->at = chkalloc(sizeof(int) * halfwords);
+    for(i=0; i<halfwords; i++)
+        img->at[i] = -1;
+    i = 0;
+    it = it_begin(insts);
+    while(it_hasNext(it)) {
+        inst *in = it_next(it);
+        in->addr += img->codeBase;
+        resolve(in);
+        img->insts[i] = *in;
+        img->at[(in->addr - img->codeBase) / 2] = i;
+        i++;
+    }
+    it_free(&it);
+
+    // Data words
+    img->data = chkalloc((img->bssEnd - img->cpBase));
+    memset(img->data, 0, img->bssEnd - img->cpBase);
+    it = it_begin(words);
+    while(it_hasNext(it)) {
+        word *w = it_next(it);
+        unsigned v;
+        unsigned addr = w->off + (w->sec == t_sec_cp ? img->cpBase
+                : img->dpBase);
+        if(!evaluate(w->expr, &v))
+            error(w->file, w->line, "invalid word '%s'", w->expr);
+        else
+            img->data[(addr - img->cpBase) / BYTES_PER_WORD] = v;
+    }
+    it_free(&it);
+}
+
+// Resolve the label of an instruction: the address of code, or the offset
+// in words of a constant or data item from cp or dp
+static void resolve(inst *in) {
+    unsigned addr;
+    t_sec s;
+    if(in->lbl == NULL)
+        return;
+    if(!address(in->lbl, &addr, &s)) {
+        err_report(t_error, -1, "%s: undefined label '%s'",
+                img->procs[in->proc], in->lbl);
+        return;
+    }
+    switch(in->op) {
+    case i_LDWDP: case i_STWDP: case i_LDAWDP:
+        if(s != t_sec_dp)
+            err_report(t_error, -1, "%s: '%s' is not in dp",
+                    img->procs[in->proc], in->lbl);
+        in->imm = (addr - img->dpBase) / BYTES_PER_WORD;
+        break;
+    case i_LDWCP: case i_LDAWCP: case i_BLACP:
+        if(s != t_sec_cp)
+            err_report(t_error, -1, "%s: '%s' is not in cp",
+                    img->procs[in->proc], in->lbl);
+        in->imm = (addr - img->cpBase) / BYTES_PER_WORD;
+        break;
+    default:
+        if(s != t_sec_text)
+            err_report(t_error, -1, "%s: '%s' is not code",
+                    img->procs[in->proc], in->lbl);
+        in->imm = addr;
+        break;
+    }
+}
+
+// Evaluate a sum of numbers and label addresses
+static bool evaluate(string e, unsigned *v) {
+    char *p = e;
+    unsigned sum = 0;
+    bool any = false;
+    while(*p != '\0') {
+        int sign = 1;
+        while(isspace(*p) || *p == '+' || *p == '-') {
+            if(*p == '-')
+                sign = -sign;
+            p++;
+        }
+        unsigned term;
+        if(isdigit(*p))
+            term = strtoul(p, &p, 0);
+        else {
+            char *start = p;
+            while(identChar(*p))
+                p++;
+            if(p == start)
+                return false;
+            if(!address(copy(start, p - start), &term, NULL))
+                return false;
+        }
+        sum += sign == 1 ? term : -term;
+        any = true;
+        while(isspace(*p))
+            p++;
+    }
+    *v = sum;
+    return any;
+}
+
+// The address and section of a label
+static bool address(string name, unsigned *addr, t_sec *s) {
+    label *l = tab_lookup(img->labels, name);
+    if(l == NULL)
+        return false;
+    if(s != NULL)
+        *s = l->sec;
+    return img_label(img, name, addr);
+}
+
+//========================================================================
+// Utilities
+//========================================================================
+
+// Report an error at a line of a file
+static void error(string f, int n, string format, ...) {
+    char msg[LINE_LEN];
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(msg, sizeof(msg), format, ap);
+    va_end(ap);
+    err_report(t_error, -1, "%s:%d: %s", f, n, msg);
+}
+
+// A copy of the first n characters of a string
+static string copy(string s, int n) {
+    string p = chkalloc(n + 1);
+    strncpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+// Remove leading and trailing space
+static string trim(string s) {
+    while(isspace(*s))
+        s++;
+    char *e = s + strlen(s);
+    while(e > s && isspace(e[-1]))
+        *--e = '\0';
+    return s;
+}
+
+// Whether a character may be part of a label
+static bool identChar(char c) {
+    return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
@@ -0,0 +1,54 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "../compiler/util.h"
+#include "../compiler/table.h"
+#include "../compiler/instructions.h"
+
+// Runtime routines, in jump table order, then the returns out of main and
+// out of a hosted procedure
+typedef enum {
+    t_sys_migrate,
+    t_sys_initThread,
+    t_sys_connect,
+    t_sys_migrateAsync,
+    t_sys_joinAsync,
+    t_sys_runMain,
+    t_sys_runThread,
+    t_sys_none
+} t_sys;
+
+// Registers named by the operands of an instruction
+#define NUM_OPERANDS 6
+
+// A decoded instruction at an address in the code
+typedef struct {
+    t_inst op;
+    int r[NUM_OPERANDS];
+    int imm;             // immediate, word offset or resolved label address
+    string lbl;          // label operand, resolved when the image is laid out
+    t_sys sys;           // the runtime routine at this address, if any
+    unsigned addr;
+    int size;            // bytes
+    int proc;            // index of the procedure it belongs to
+    string text;
+} inst;
+
+typedef struct image_ *image;
+
+struct image_ {
+    inst *insts;
+    int numInsts;
+    int *at;             // instruction at each halfword of code, or -1
+    string *procs;       // procedure names
+    int numProcs;
+    unsigned codeBase, cpBase, dpBase, bssEnd;
+    unsigned *data;      // initial words from cpBase to bssEnd
+    table labels;
+};
+
+image    img_load   (string asmFile, string jumpTabFile, string cpFile);
+bool     img_label  (image, string, unsigned *);
+inst    *img_fetch  (image, unsigned addr);
+
+#endif
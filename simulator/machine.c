@@ -0,0 +1,759 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "../compiler/error.h"
+#include "machine.h"
+#include "system.h"
+
+// XS1 machine:
+// Each core has eight threads, which share a four stage pipeline. Threads
+// that can issue are taken in turn, one each cycle, and a thread's next
+// instruction cannot issue until the last has left the pipeline, so one
+// thread issues at most every four cycles and n > 4 threads every n.
+// Threads blocked on a channel, synchroniser or divide take no slots, and
+// when none can issue the clock moves to the next event. Tokens arrive at a
+// channel end after a latency that grows with the hops between the cores,
+// and are buffered there until an output would overflow it.
+
+#define PIPELINE_STAGES 4
+#define DIVIDE_CYCLES   32
+#define CHAN_LATENCY    3
+#define HOP_LATENCY     10
+
+// The port written with characters for the standard output
+#define STDOUT_PORT     0
+
+image         img;
+core          cores[NUM_CORES];
+unsigned long now;
+bool          mainDone;
+unsigned long numMigrations;
+unsigned long numWords;
+
+static FILE  *output;
+static bool   tracing;
+static bool   halted;
+static profile blocks;
+static events chanEvents;
+static int    *blockAt;  // counter of the block at each halfword, or -1
+
+static void      run       (unsigned long);
+static bool      mapBlocks (void);
+static bool      issue     (core *);
+static t_exec    step      (thread);
+static t_exec    execute   (thread, inst *);
+static t_exec    input     (thread, unsigned, bool, unsigned, unsigned *);
+static t_exec    output_   (thread, unsigned, bool, unsigned);
+static t_exec    getr      (thread, int, unsigned *);
+static t_exec    getst     (thread, unsigned, unsigned *);
+static t_exec    sync_     (thread, unsigned, bool);
+static thread    slave     (thread, unsigned);
+static chanend  *chanendOf (thread, unsigned);
+static synchroniser *syncOf(thread, unsigned);
+static unsigned long nextEvent(void);
+static void      deadlock  (void);
+static void      report    (FILE *);
+static string    procName  (thread);
+
+// Load the image on each core and run main on core 0, reporting the cycles
+// and instructions of each thread, counting the executions of the blocks of
+// a profile and recording channel events if given. Returns FAIL if the
+// program faulted or deadlocked before main completed.
+int mch_run(image m, FILE *out, unsigned long maxCycles, bool trace,
+        profile p, events e) {
+    int i, j;
+    img = m;
+    output = out;
+    tracing = trace;
+    blocks = p;
+    chanEvents = e;
+    if(blocks != NULL && !mapBlocks())
+        return FAIL;
+    halted = false;
+    mainDone = false;
+    now = 0;
+    numMigrations = 0;
+    numWords = 0;
+    for(i=0; i<NUM_CORES; i++) {
+        core *k = &cores[i];
+        memset(k, 0, sizeof(core));
+        k->mem = chkalloc(MEM_WORDS * BYTES_PER_WORD);
+        memset(k->mem, 0, MEM_WORDS * BYTES_PER_WORD);
+        memcpy(&k->mem[(img->cpBase - RAM_BASE) / BYTES_PER_WORD],
+                img->data, img->bssEnd - img->cpBase);
+        for(j=0; j<MAX_THREADS; j++) {
+            thread t = &k->threads[j];
+            t->core = i;
+            t->num = j;
+            t->state = t_thr_free;
+            t->sync = -1;
+        }
+    }
+    sys_init();
+    run(maxCycles);
+    if(chanEvents != NULL)
+        chanEvents->cycles = now;
+    fflush(out);
+    if(!halted)
+        report(out);
+    for(i=0; i<NUM_CORES; i++)
+        free(cores[i].mem);
+    if(blocks != NULL)
+        free(blockAt);
+    return halted ? FAIL : SUCCESS;
+}
+
+// Report a fault in the procedure a thread is executing, and stop
+t_exec mch_fault(thread t, string format, ...) {
+    char msg[256];
+    va_list ap;
+    if(!halted) {
+        va_start(ap, format);
+        vsnprintf(msg, sizeof(msg), format, ap);
+        va_end(ap);
+        err_report(t_error, -1, "%s: %s (core %d, thread %d)",
+                procName(t), msg, t->core, t->num);
+        halted = true;
+    }
+    return t_exec_fault;
+}
+
+// Load a word from the memory of a thread's core
+bool mch_load(thread t, unsigned addr, unsigned *v) {
+    if(addr < RAM_BASE || addr >= RAM_BASE + RAM_SIZE || addr % 4 != 0) {
+        mch_fault(t, "invalid load from 0x%x", addr);
+        return false;
+    }
+    *v = cores[t->core].mem[(addr - RAM_BASE) / BYTES_PER_WORD];
+    return true;
+}
+
+// Store a word to the memory of a thread's core
+bool mch_store(thread t, unsigned addr, unsigned v) {
+    if(addr < img->cpBase || addr >= RAM_BASE + RAM_SIZE || addr % 4 != 0) {
+        mch_fault(t, "invalid store to 0x%x", addr);
+        return false;
+    }
+    cores[t->core].mem[(addr - RAM_BASE) / BYTES_PER_WORD] = v;
+    return true;
+}
+
+// A free thread on a core, or NULL
+thread mch_thread(int c) {
+    int i;
+    for(i=1; i<MAX_THREADS; i++) {
+        if(cores[c].threads[i].state == t_thr_free)
+            return &cores[c].threads[i];
+    }
+    return NULL;
+}
+
+// Start a run of a thread
+void mch_start(thread t, t_thr state) {
+    t->state = state;
+    t->ready = now;
+    t->busy = 0;
+    t->phase = 0;
+    t->hosted = NULL;
+    t->m = NULL;
+    t->waiting = false;
+    t->start = now;
+    t->runs++;
+}
+
+// End the run of a thread
+void mch_free(thread t, t_thr state) {
+    if(t->waiting)
+        t->waits += now - t->since;
+    t->cycles += now - t->start;
+    t->waiting = false;
+    t->state = state;
+    t->sync = -1;
+}
+
+// The cycles for a token to travel between two cores
+int mch_latency(int from, int to) {
+    int hops = 0;
+    unsigned d = from ^ to;
+    while(d != 0) {
+        hops += d & 1;
+        d >>= 1;
+    }
+    return CHAN_LATENCY + hops * HOP_LATENCY;
+}
+
+// Record an event of a thread, completing now after any time it was
+// blocked, giving its number, or 0 if events are not recorded
+unsigned long mch_event(thread t, t_evt kind, unsigned res, unsigned peer,
+        unsigned value) {
+    if(chanEvents == NULL)
+        return 0;
+    return evt_add(chanEvents, kind, t->core, t->num, now,
+            t->waiting ? now - t->since : 0, res, peer, value);
+}
+
+//========================================================================
+// Issue
+//========================================================================
+
+// Issue on each core every cycle until the program completes, deadlocks or
+// runs for too long
+static void run(unsigned long maxCycles) {
+    int i;
+    while(!halted) {
+        bool issued = false;
+        for(i=0; i<NUM_CORES && !halted; i++) {
+            if(issue(&cores[i]))
+                issued = true;
+        }
+        if(halted)
+            break;
+        if(issued)
+            now++;
+        else {
+            unsigned long next = nextEvent();
+            if(next == 0) {
+                deadlock();
+                break;
+            }
+            now = next;
+        }
+        if(now >= maxCycles) {
+            err_report(t_warning, -1, "simulation stopped after %lu cycles",
+                    now);
+            break;
+        }
+    }
+
+    // Close the runs of the threads still active
+    for(i=0; i<NUM_CORES; i++) {
+        int j;
+        for(j=0; j<MAX_THREADS; j++) {
+            thread t = &cores[i].threads[j];
+            if(t->state != t_thr_free && t->state != t_thr_idle)
+                mch_free(t, t->state);
+        }
+    }
+}
+
+// Issue an instruction from the next thread of a core that can
+static bool issue(core *k) {
+    int i;
+    for(i=0; i<MAX_THREADS; i++) {
+        thread t = &k->threads[(k->next + i) % MAX_THREADS];
+        if(t->state != t_thr_run || t->ready > now)
+            continue;
+        switch(step(t)) {
+        case t_exec_done:
+            t->insts++;
+            if(t->waiting) {
+                t->waits += now - t->since;
+                t->waiting = false;
+            }
+            if(t->ready < now + PIPELINE_STAGES)
+                t->ready = now + PIPELINE_STAGES;
+            k->next = (t->num + 1) % MAX_THREADS;
+            return true;
+        case t_exec_blocked:
+            if(!t->waiting) {
+                t->waiting = true;
+                t->since = now;
+            }
+            break;
+        case t_exec_fault:
+            return true;
+        }
+    }
+    return false;
+}
+
+// Issue the next instruction of a thread: one of a runtime routine it is in
+// the middle of, or the one at its pc
+static t_exec step(thread t) {
+    if(t->busy > 0) {
+        t->busy--;
+        return t_exec_done;
+    }
+    inst *in = img_fetch(img, t->pc);
+    if(in == NULL)
+        return mch_fault(t, "invalid pc 0x%x", t->pc);
+    if(tracing && t->phase == 0)
+        fprintf(output, "%10lu  %d.%d  %-16s %s\n", now, t->core, t->num,
+                img->procs[in->proc], in->text);
+    if(in->sys != t_sys_none)
+        return sys_call(t, in->sys);
+    t_exec e = execute(t, in);
+    if(blocks != NULL && e == t_exec_done) {
+        int b = blockAt[(in->addr - img->codeBase) / 2];
+        if(b != -1)
+            blocks->counts[b]++;
+    }
+    return e;
+}
+
+// Find the address of each block of the profile, as the counters of the
+// program compiled with -pg count them on entry to its label
+static bool mapBlocks(void) {
+    int n = (img->cpBase - img->codeBase) / 2;
+    unsigned addr;
+    int i;
+    blockAt = chkalloc(sizeof(int) * n);
+    for(i=0; i<n; i++)
+        blockAt[i] = -1;
+    for(i=0; i<blocks->numBlocks; i++) {
+        if(!img_label(img, blocks->labels[i], &addr)
+                || addr < img->codeBase || addr >= img->cpBase) {
+            err_report(t_error, -1, "block %s of %s is not in the program",
+                    blocks->labels[i], blocks->procs[i]);
+            free(blockAt);
+            return false;
+        }
+        blockAt[(addr - img->codeBase) / 2] = i;
+    }
+    return true;
+}
+
+// The cycle of the next thread to become ready or token to arrive, or 0 if
+// there is nothing left to happen
+static unsigned long nextEvent(void) {
+    unsigned long next = 0;
+    int i, j, k;
+    for(i=0; i<NUM_CORES; i++) {
+        for(j=0; j<MAX_THREADS; j++) {
+            thread t = &cores[i].threads[j];
+            if(t->state == t_thr_run && t->ready > now
+                    && (next == 0 || t->ready < next))
+                next = t->ready;
+        }
+        for(j=0; j<MAX_CHANNELS; j++) {
+            chanend *c = &cores[i].chans[j];
+            for(k=0; k<c->count; k++) {
+                token *tk = &c->buf[(c->head + k) % CHAN_BUFFER_TOKENS];
+                if(tk->arrives > now && (next == 0 || tk->arrives < next))
+                    next = tk->arrives;
+            }
+        }
+    }
+    return next;
+}
+
+//========================================================================
+// Execution
+//========================================================================
+
+#define R(i) t->r[in->r[i]]
+
+// Execute an instruction, advancing the pc unless it branched or blocked
+static t_exec execute(thread t, inst *in) {
+    unsigned pc = in->addr + in->size;
+    unsigned v;
+    t_exec e = t_exec_done;
+
+    switch(in->op) {
+    case i_ADD:   R(0) = R(1) + R(2);  break;
+    case i_SUB:   R(0) = R(1) - R(2);  break;
+    case i_MUL:   R(0) = R(1) * R(2);  break;
+    case i_OR:    R(0) = R(1) | R(2);  break;
+    case i_AND:   R(0) = R(1) & R(2);  break;
+    case i_XOR:   R(0) = R(1) ^ R(2);  break;
+    case i_EQ:    R(0) = R(1) == R(2); break;
+    case i_LSS:   R(0) = (int) R(1) < (int) R(2); break;
+    case i_SHL:   R(0) = R(2) >= 32 ? 0 : R(1) << R(2); break;
+    case i_SHR:   R(0) = R(2) >= 32 ? 0 : R(1) >> R(2); break;
+    case i_ASHR:
+        v = R(2) >= 32 ? 31 : R(2);
+        R(0) = (int) R(1) < 0 ? ~(~R(1) >> v) : R(1) >> v;
+        break;
+    case i_ADDI:  R(0) = R(1) + in->imm;  break;
+    case i_SUBI:  R(0) = R(1) - in->imm;  break;
+    case i_EQI:   R(0) = R(1) == (unsigned) in->imm; break;
+    case i_SHLI:  R(0) = in->imm >= 32 ? 0 : R(1) << in->imm; break;
+    case i_SHRI:  R(0) = in->imm >= 32 ? 0 : R(1) >> in->imm; break;
+    case i_ASHRI:
+        v = in->imm >= 32 ? 31 : in->imm;
+        R(0) = (int) R(1) < 0 ? ~(~R(1) >> v) : R(1) >> v;
+        break;
+
+    case i_DIVS:
+    case i_REMS: {
+        int a = R(1), b = R(2);
+        if(b == 0 || (a == INT_MIN && b == -1))
+            return mch_fault(t, "arithmetic exception in %s", in->text);
+        R(0) = in->op == i_DIVS ? a / b : a % b;
+        t->ready = now + DIVIDE_CYCLES;
+        break;
+    }
+    case i_LMUL: {
+        unsigned long long p = (unsigned long long) R(2) * R(3) + R(4) + R(5);
+        R(0) = p >> 32;
+        R(1) = (unsigned) p;
+        break;
+    }
+
+    // Memory
+    case i_LDW:
+        if(!mch_load(t, R(1) + R(2) * BYTES_PER_WORD, &R(0)))
+            return t_exec_fault;
+        break;
+    case i_STW:
+        if(!mch_store(t, R(1) + R(2) * BYTES_PER_WORD, R(0)))
+            return t_exec_fault;
+        break;
+    case i_LDWI:
+        if(!mch_load(t, R(1) + in->imm * BYTES_PER_WORD, &R(0)))
+            return t_exec_fault;
+        break;
+    case i_STWI:
+        if(!mch_store(t, R(1) + in->imm * BYTES_PER_WORD, R(0)))
+            return t_exec_fault;
+        break;
+    case i_LDAWF: R(0) = R(1) + in->imm * BYTES_PER_WORD; break;
+    case i_LDWSP:
+        if(!mch_load(t, t->sp + in->imm * BYTES_PER_WORD, &R(0)))
+            return t_exec_fault;
+        break;
+    case i_STWSP:
+        if(!mch_store(t, t->sp + in->imm * BYTES_PER_WORD, R(0)))
+            return t_exec_fault;
+        break;
+    case i_LDAWSP: R(0) = t->sp + in->imm * BYTES_PER_WORD; break;
+    case i_LDWDP:
+        if(!mch_load(t, t->dp + in->imm * BYTES_PER_WORD, &R(0)))
+            return t_exec_fault;
+        break;
+    case i_STWDP:
+        if(!mch_store(t, t->dp + in->imm * BYTES_PER_WORD, R(0)))
+            return t_exec_fault;
+        break;
+    case i_LDAWDP: R(0) = t->dp + in->imm * BYTES_PER_WORD; break;
+    case i_LDWCP:
+        if(!mch_load(t, t->cp + in->imm * BYTES_PER_WORD, &R(0)))
+            return t_exec_fault;
+        break;
+    case i_LDAWCP: R(0) = t->cp + in->imm * BYTES_PER_WORD; break;
+    case i_MOVE:  R(0) = R(1);    break;
+    case i_LDC:   R(0) = in->imm; break;
+    case i_LDAP:  R(0) = in->imm; break;
+    case i_SETSP: t->sp = R(0);   break;
+    case i_SETDP: t->dp = R(0);   break;
+    case i_SETCP: t->cp = R(0);   break;
+
+    // Stack and branches
+    case i_ENTSP:
+        if(in->imm > 0) {
+            if(!mch_store(t, t->sp, t->lr))
+                return t_exec_fault;
+            t->sp -= in->imm * BYTES_PER_WORD;
+        }
+        break;
+    case i_EXTSP:
+        t->sp -= in->imm * BYTES_PER_WORD;
+        break;
+    case i_RETSP:
+        if(in->imm > 0) {
+            t->sp += in->imm * BYTES_PER_WORD;
+            if(!mch_load(t, t->sp, &t->lr))
+                return t_exec_fault;
+        }
+        pc = t->lr;
+        break;
+    case i_BU:    pc = in->imm; break;
+    case i_BT:    if(R(0) != 0) pc = in->imm; break;
+    case i_BF:    if(R(0) == 0) pc = in->imm; break;
+    case i_BL:
+        t->lr = pc;
+        pc = in->imm;
+        break;
+    case i_BLACP:
+        t->lr = pc;
+        if(!mch_load(t, t->cp + in->imm * BYTES_PER_WORD, &pc))
+            return t_exec_fault;
+        break;
+
+    // Resources
+    case i_GETR:  e = getr(t, in->imm, &R(0));  break;
+    case i_GETST: e = getst(t, R(1), &R(0));    break;
+    case i_MSYNC: e = sync_(t, R(0), false);    break;
+    case i_MJOIN: e = sync_(t, R(0), true);     break;
+    case i_SSYNC:
+        if(t->sync == -1)
+            return mch_fault(t, "ssync by a thread that is not a slave");
+        mch_event(t, t_evt_ssync, RES_ID(t->core, t->sync, RES_SYNC), 0, 0);
+        t->state = t_thr_paused;
+        t->waiting = true;
+        t->since = now;
+        break;
+    case i_TINITPC: case i_TINITLR: case i_TINITSP: case i_TINITDP:
+    case i_TINITCP: case i_TSETR: {
+        thread s = slave(t, R(0));
+        if(s == NULL)
+            return t_exec_fault;
+        switch(in->op) {
+        case i_TINITPC: s->pc = R(1); break;
+        case i_TINITLR: s->lr = R(1); break;
+        case i_TINITSP: s->sp = R(1); break;
+        case i_TINITDP: s->dp = R(1); break;
+        case i_TINITCP: s->cp = R(1); break;
+        default:
+            if(in->r[1] >= NUM_REGS)
+                return mch_fault(t, "invalid register in %s", in->text);
+            s->r[in->r[1]] = R(2);
+            break;
+        }
+        break;
+    }
+    case i_IN:    e = input(t, R(1), false, 0, &R(0));    break;
+    case i_CHKCT: e = input(t, R(0), true, in->imm, &v);  break;
+    case i_OUT:   e = output_(t, R(0), false, R(1));      break;
+    case i_OUTCT: e = output_(t, R(0), true, in->imm);    break;
+    case i_GETPS: R(0) = 0; break;
+    case i_SETPS: case i_SETC: case i_SETCI: case i_SETCLK:
+        break;
+    case i_WAITEU:
+        t->state = t_thr_halted;
+        return t_exec_blocked;
+    case i_KCALL: case i_KCALLI:
+        return mch_fault(t, "kernel call");
+    default:
+        assert(0 && "invalid instruction");
+    }
+
+    if(e == t_exec_done)
+        t->pc = pc;
+    return e;
+}
+
+// Input a word or check for a control token, from a port or a channel end
+static t_exec input(thread t, unsigned id, bool ct, unsigned expected,
+        unsigned *v) {
+    if(RES_TYPE(id) == RES_PORT && !ct) {
+        int c = RES_NUM(id) == STDOUT_PORT ? getchar() : 0;
+        *v = c == EOF ? 0 : c;
+        return t_exec_done;
+    }
+    chanend *c = chanendOf(t, id);
+    if(c == NULL)
+        return t_exec_fault;
+    token *tk = &c->buf[c->head];
+    if(c->count == 0 || tk->arrives > now)
+        return t_exec_blocked;
+    if(ct && (!tk->ct || tk->value != expected))
+        return mch_fault(t, "control token %u expected", expected);
+    if(!ct && tk->ct)
+        return mch_fault(t, "data expected, control token %u received",
+                tk->value);
+    mch_event(t, ct ? t_evt_chkct : t_evt_in, id, tk->sent, tk->value);
+    *v = tk->value;
+    c->head = (c->head + 1) % CHAN_BUFFER_TOKENS;
+    c->count--;
+    c->tokens -= tk->ct ? 1 : TOKENS_PER_WORD;
+    return t_exec_done;
+}
+
+// Output a word or control token to a port or the destination of a channel
+// end, blocking while its buffer is full
+static t_exec output_(thread t, unsigned id, bool ct, unsigned v) {
+    if(RES_TYPE(id) == RES_PORT && !ct) {
+        if(RES_NUM(id) == STDOUT_PORT)
+            fputc(v, output);
+        else
+            fprintf(output, "port 0x%x: %u\n", id, v);
+        return t_exec_done;
+    }
+    chanend *c = chanendOf(t, id);
+    if(c == NULL)
+        return t_exec_fault;
+    if(c->dest == 0)
+        return mch_fault(t, "output on unconnected channel end 0x%x", id);
+    chanend *d = chanendOf(t, c->dest);
+    if(d == NULL)
+        return t_exec_fault;
+    int n = ct ? 1 : TOKENS_PER_WORD;
+    if(d->tokens + n > CHAN_BUFFER_TOKENS)
+        return t_exec_blocked;
+    token *tk = &d->buf[(d->head + d->count) % CHAN_BUFFER_TOKENS];
+    tk->ct = ct;
+    tk->value = v;
+    tk->arrives = now + mch_latency(t->core, RES_CORE(c->dest));
+    tk->sent = mch_event(t, ct ? t_evt_outct : t_evt_out, id, c->dest, v);
+    d->count++;
+    d->tokens += n;
+    if(!ct)
+        numWords++;
+    return t_exec_done;
+}
+
+// Allocate a resource of a thread's core, giving 0 if none are free
+static t_exec getr(thread t, int type, unsigned *id) {
+    core *k = &cores[t->core];
+    int i;
+    *id = 0;
+    switch(type) {
+    case RES_CHANEND:
+        for(i=0; i<MAX_CHANNELS; i++) {
+            chanend *c = &k->chans[i];
+            if(!c->used) {
+                memset(c, 0, sizeof(chanend));
+                c->used = true;
+                *id = RES_ID(t->core, i, RES_CHANEND);
+                break;
+            }
+        }
+        return t_exec_done;
+    case RES_SYNC:
+        for(i=0; i<SYNCS_PER_CORE; i++) {
+            if(!k->syncs[i].used) {
+                k->syncs[i].used = true;
+                k->syncs[i].master = t->num;
+                *id = RES_ID(t->core, i, RES_SYNC);
+                break;
+            }
+        }
+        return t_exec_done;
+    case RES_LOCK:
+        *id = RES_ID(t->core, 0, RES_LOCK);
+        return t_exec_done;
+    default:
+        return mch_fault(t, "getr of resource type %d", type);
+    }
+}
+
+// Allocate a thread bound to a synchroniser, giving 0 if none are free
+static t_exec getst(thread t, unsigned id, unsigned *tid) {
+    synchroniser *s = syncOf(t, id);
+    if(s == NULL)
+        return t_exec_fault;
+    thread n = mch_thread(t->core);
+    *tid = 0;
+    if(n == NULL)
+        return t_exec_done;
+    memset(n->r, 0, sizeof(n->r));
+    n->pc = n->lr = n->sp = n->dp = n->cp = 0;
+    mch_start(n, t_thr_paused);
+    n->sync = RES_NUM(id);
+    n->waiting = true;
+    n->since = now;
+    *tid = RES_ID(t->core, n->num, RES_THREAD);
+    return t_exec_done;
+}
+
+// Synchronise the master of a synchroniser with its slaves once none are
+// running: msync releases them and mjoin ends them
+static t_exec sync_(thread t, unsigned id, bool join) {
+    synchroniser *s = syncOf(t, id);
+    int i, slaves = 0;
+    if(s == NULL)
+        return t_exec_fault;
+    if(s->master != t->num)
+        return mch_fault(t, "synchronising 0x%x from a slave", id);
+    core *k = &cores[t->core];
+    for(i=0; i<MAX_THREADS; i++) {
+        thread n = &k->threads[i];
+        if(n->sync == (int) RES_NUM(id) && n->state != t_thr_paused)
+            return t_exec_blocked;
+    }
+    for(i=0; i<MAX_THREADS; i++) {
+        thread n = &k->threads[i];
+        if(n->sync != (int) RES_NUM(id))
+            continue;
+        slaves++;
+        if(join)
+            mch_free(n, t_thr_free);
+        else {
+            mch_event(n, t_evt_fork, id, 0, 0);
+            n->state = t_thr_run;
+            n->ready = now + 1;
+        }
+    }
+    mch_event(t, join ? t_evt_mjoin : t_evt_msync, id, 0, slaves);
+    return t_exec_done;
+}
+
+// A synchronised thread of a core, not yet started
+static thread slave(thread t, unsigned id) {
+    thread s = &cores[t->core].threads[RES_NUM(id) % MAX_THREADS];
+    if(RES_TYPE(id) != RES_THREAD || RES_CORE(id) != (unsigned) t->core
+            || RES_NUM(id) >= MAX_THREADS || s->state != t_thr_paused
+            || s->sync == -1) {
+        mch_fault(t, "invalid thread 0x%x", id);
+        return NULL;
+    }
+    return s;
+}
+
+// An allocated channel end on any core
+static chanend *chanendOf(thread t, unsigned id) {
+    if(RES_TYPE(id) != RES_CHANEND || RES_CORE(id) >= NUM_CORES
+            || RES_NUM(id) >= MAX_CHANNELS
+            || !cores[RES_CORE(id)].chans[RES_NUM(id)].used) {
+        mch_fault(t, "invalid channel end 0x%x", id);
+        return NULL;
+    }
+    return &cores[RES_CORE(id)].chans[RES_NUM(id)];
+}
+
+// An allocated synchroniser of a thread's core
+static synchroniser *syncOf(thread t, unsigned id) {
+    if(RES_TYPE(id) != RES_SYNC || RES_CORE(id) != (unsigned) t->core
+            || RES_NUM(id) >= SYNCS_PER_CORE
+            || !cores[t->core].syncs[RES_NUM(id)].used) {
+        mch_fault(t, "invalid synchroniser 0x%x", id);
+        return NULL;
+    }
+    return &cores[t->core].syncs[RES_NUM(id)];
+}
+
+//========================================================================
+// Reporting
+//========================================================================
+
+// Report the threads left blocked, which is an error unless main completed
+static void deadlock(void) {
+    int i, j;
+    for(i=0; i<NUM_CORES; i++) {
+        for(j=0; j<MAX_THREADS; j++) {
+            thread t = &cores[i].threads[j];
+            if(t->state != t_thr_run && t->state != t_thr_halted)
+                continue;
+            inst *in = img_fetch(img, t->pc);
+            err_report(mainDone ? t_warning : t_error, -1,
+                    "deadlock: thread %d on core %d blocked in %s at '%s'",
+                    j, i, procName(t), in != NULL ? in->text : "?");
+        }
+    }
+    if(!mainDone)
+        halted = true;
+}
+
+// Report the runs, instructions and cycles of each thread that ran
+static void report(FILE *out) {
+    unsigned long insts = 0;
+    int i, j;
+    printTitleRule(out, "Simulated cycles");
+    fprintf(out, "  %-6s %-6s %6s %14s %12s %12s\n", "Core", "Thread",
+            "Runs", "Instructions", "Cycles", "Waiting");
+    for(i=0; i<NUM_CORES; i++) {
+        for(j=0; j<MAX_THREADS; j++) {
+            thread t = &cores[i].threads[j];
+            if(t->runs == 0)
+                continue;
+            fprintf(out, "  %-6d %-6d %6lu %14lu %12lu %12lu\n", i, j,
+                    t->runs, t->insts, t->cycles, t->waits);
+            insts += t->insts;
+        }
+    }
+    fprintf(out, "  Cycles:              %lu\n", now);
+    fprintf(out, "  Instructions:        %lu\n", insts);
+    fprintf(out, "  Migrations:          %lu\n", numMigrations);
+    fprintf(out, "  Channel words:       %lu\n", numWords);
+    printRule(out);
+}
+
+// The procedure a thread is executing
+static string procName(thread t) {
+    inst *in = img_fetch(img, t->pc);
+    return in != NULL ? img->procs[in->proc] : "?";
+}
@@ -0,0 +1,131 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "image.h"
+#include "../include/definitions.h"
+#include "../include/platform.h"
+#include "../profiler/profile.h"
+#include "../tracer/events.h"
+
+#define NUM_REGS       12
+#define MEM_WORDS      (RAM_SIZE / BYTES_PER_WORD)
+#define SYNCS_PER_CORE 7
+
+// Tokens buffered at a channel end before an output to it blocks
+#define CHAN_BUFFER_TOKENS 8
+#define TOKENS_PER_WORD    4
+
+// Resource types, in the low byte of an identifier
+#define RES_PORT    0x0
+#define RES_CHANEND 0x2
+#define RES_SYNC    0x3
+#define RES_THREAD  0x4
+#define RES_LOCK    0x5
+
+#define RES_ID(core, num, type) (((core) << 16) | ((num) << 8) | (type))
+#define RES_CORE(id)            ((id) >> 16)
+#define RES_NUM(id)             (((id) >> 8) & 0xFF)
+#define RES_TYPE(id)            ((id) & 0xFF)
+
+// The outcome of issuing an instruction
+typedef enum {
+    t_exec_done,
+    t_exec_blocked,
+    t_exec_fault
+} t_exec;
+
+typedef enum {
+    t_thr_free,
+    t_thr_idle,          // thread 0 of a core waiting to host a migration
+    t_thr_run,
+    t_thr_paused,        // a synchronised thread not started or at an ssync
+    t_thr_halted         // waiting for an event that never comes
+} t_thr;
+
+typedef struct thread_ *thread;
+typedef struct mig_    *mig;
+
+struct thread_ {
+    int core, num;
+    t_thr state;
+    unsigned r[NUM_REGS];
+    unsigned pc, lr, sp, dp, cp;
+    int sync;            // synchroniser of a slave, or -1
+    unsigned long ready; // cycle it may next issue
+    int busy;            // runtime instructions left to issue
+    int phase;           // progress through a runtime routine
+    mig hosted;          // the migration it hosts
+    mig m;               // the migration it waits for, as a guest
+    bool waiting;
+    unsigned long start; // cycle its current run started
+    unsigned long since; // cycle it started waiting
+    unsigned long runs, insts, cycles, waits;
+};
+
+// A call migrated to another core
+struct mig_ {
+    thread guest, host;
+    int numArgs;
+    unsigned modes;
+    unsigned len[NUM_ARGS];
+    unsigned guestAddr[NUM_ARGS];
+    unsigned hostAddr[NUM_ARGS];
+    unsigned *results[NUM_ARGS];
+    unsigned handle;     // channel end of an asynchronous migration, or 0
+    bool done;
+    unsigned long event; // last event of its migration
+};
+
+// A word or control token in flight to, or buffered at, a channel end
+typedef struct {
+    bool ct;
+    unsigned value;
+    unsigned long arrives;
+    unsigned long sent;  // event of its output
+} token;
+
+typedef struct {
+    bool used;
+    unsigned dest;
+    token buf[CHAN_BUFFER_TOKENS];
+    int head, count, tokens;
+    mig m;
+} chanend;
+
+typedef struct {
+    bool used;
+    int master;
+} synchroniser;
+
+typedef struct {
+    unsigned *mem;
+    struct thread_ threads[MAX_THREADS];
+    chanend chans[MAX_CHANNELS];
+    synchroniser syncs[SYNCS_PER_CORE];
+    int next;            // thread to issue from next
+    unsigned fp;         // top of the space of migrated arguments
+    unsigned codeTop;    // top of the procedures received, below fp
+    int regions;         // migrations holding space from fp
+    bool resident[JUMP_TAB_SIZE];
+} core;
+
+extern image         img;
+extern core          cores[NUM_CORES];
+extern unsigned long now;
+extern bool          mainDone;
+extern unsigned long numMigrations;
+extern unsigned long numWords;
+
+int      mch_run    (image, FILE *, unsigned long maxCycles, bool trace,
+                     profile, events);
+t_exec   mch_fault  (thread, string, ...);
+bool     mch_load   (thread, unsigned, unsigned *);
+bool     mch_store  (thread, unsigned, unsigned);
+thread   mch_thread (int core);
+void     mch_start  (thread, t_thr);
+void     mch_free   (thread, t_thr);
+int      mch_latency(int, int);
+unsigned long mch_event(thread, t_evt, unsigned res, unsigned peer,
+                     unsigned value);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../compiler/util.h"
+#include "../compiler/error.h"
+
+#include "image.h"
+#include "machine.h"
+
+// Events kept of a run, the last of which are written
+#define EVENT_BUFFER 65536
+
+// Global options
+bool          trace;
+unsigned long maxCycles;
+string        asmFile;
+string        jumpTabFile;
+string        cpFile;
+string        profileFile;
+string        eventFile;
+
+// Print some usage info
+void printHelp(void) {
+    printf("Usage: xs1sim [options] [<program> <jump-table> <cp>]\n");
+    printf("Options:\n");
+    printf("  -h          Display this help message\n");
+    printf("  -t          Trace each instruction issued\n");
+    printf("  -c=<n>      Stop after n cycles\n");
+    printf("  -p=<file>   Count the blocks of a program compiled with -pg,\n");
+    printf("              written to file in counter order\n");
+    printf("  -e=<file>   Record the last %d channel, synchroniser and\n",
+            EVENT_BUFFER);
+    printf("              migration events, written to file\n");
+}
+
+// Set the maximum cycles to simulate
+void setMaxCycles(char *arg) {
+    char *end;
+    arg += 3;
+    maxCycles = strtoul(arg, &end, 10);
+    if(*arg == '\0' || *end != '\0' || maxCycles == 0)
+        err_fatal("invalid cycle limit");
+}
+
+// Parse command line options and input files
+int parseOptions(int argc, char **argv) {
+
+    // Default options
+    trace       = false;
+    maxCycles   = 100000000;
+    asmFile     = "program.S";
+    jumpTabFile = "jumpTable.S";
+    cpFile      = "cp.S";
+    profileFile = NULL;
+    eventFile   = NULL;
+
+    // Get options
+    while((argc > 1) && (argv[1][0] == '-')) {
+        switch(argv[1][1]) {
+        case 'h': printHelp();              return FAIL;
+        case 't': trace = true;             break;
+        case 'c': setMaxCycles(argv[1]);    break;
+        case 'p': profileFile = argv[1] + 3; break;
+        case 'e': eventFile = argv[1] + 3;  break;
+        default:
+            err_fatal("invalid option %s", argv[1]);
+            return FAIL;
+        }
+        ++argv;
+        --argc;
+    }
+
+    // The files output by the compiler, or those given
+    if(argc == 4) {
+        asmFile     = argv[1];
+        jumpTabFile = argv[2];
+        cpFile      = argv[3];
+    }
+    else if(argc != 1) {
+        printHelp();
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+// The map written by the compiler next to a program
+string mapFileOf(string file) {
+    char *dot = strrchr(file, '.');
+    int len = dot == NULL ? (int) strlen(file) : dot - file;
+    char *map = chkalloc(len + 5);
+    sprintf(map, "%.*s.map", len, file);
+    return map;
+}
+
+int main(int argc, char *argv[]) {
+    profile p = NULL;
+    events e = NULL;
+
+    if(parseOptions(argc, argv))
+        return EXIT_FAILURE;
+
+    if(profileFile != NULL) {
+        p = prf_load(mapFileOf(asmFile));
+        if(p == NULL)
+            return EXIT_FAILURE;
+    }
+    if(eventFile != NULL)
+        e = evt_New(EVENT_BUFFER);
+    image img = img_load(asmFile, jumpTabFile, cpFile);
+    if(img == NULL || mch_run(img, stdout, maxCycles, trace, p, e)) {
+        if(img != NULL && e != NULL)
+            evt_write(e, eventFile);
+        err_summary();
+        return EXIT_FAILURE;
+    }
+    if(p != NULL && !prf_write(p, profileFile))
+        return EXIT_FAILURE;
+    if(e != NULL && !evt_write(e, eventFile))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
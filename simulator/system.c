@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "system.h"
+
+// Runtime:
+// The routines of the runtime are not simulated instruction by instruction,
+// but performed directly when a thread reaches them, with the instructions
+// they would have executed issued as a count of empty slots and the round
+// trips of their protocols as a wait. A migration picks a host thread on the
+// destination core, as the runtime does: thread 0 when it is idle, otherwise
+// a new thread with its own stack. The closure is received at the host's fp
+// with any procedures that are not resident, and the results of the arrays
+// it writes are kept until the guest, or the join of an asynchronous
+// migration, receives them.
+
+// Instructions of each routine, beyond those to send or receive each word
+#define WORD_INSTS        5
+#define CALL_INSTS        20
+#define INIT_THREAD_INSTS 8
+#define CONNECT_INSTS     12
+
+// Round trips to open a connection and send a closure, and to complete it
+// and return the results
+#define OPEN_TRIPS        5
+#define RESULT_TRIPS      2
+
+static unsigned label   (string);
+static t_exec   migrate (thread, bool);
+static t_exec   join    (thread);
+static t_exec   receive (thread, mig);
+static t_exec   connect (thread);
+static t_exec   complete(thread);
+static thread   host    (int);
+
+// Initialise the runtime state of each core: its channel ends, static
+// channel connections, stack and argument space, and run main on core 0
+void sys_init(void) {
+    unsigned connTable = label(LBL_CONN_TABLE);
+    unsigned spawnChan = label("spawnChan");
+    unsigned progChan = label(LBL_CHAN_ARRAY);
+    int i, j;
+
+    for(i=0; i<NUM_CORES; i++) {
+        core *k = &cores[i];
+        thread t = &k->threads[0];
+        for(j=0; j<PROG_CHAN_OFF+NUM_PROG_CHANS; j++)
+            k->chans[j].used = true;
+        k->mem[(label("mSpawnChan") - RAM_BASE) / BYTES_PER_WORD] =
+            RES_ID(i, 0, RES_CHANEND);
+        for(j=0; j<MAX_THREADS; j++)
+            k->mem[(spawnChan - RAM_BASE) / BYTES_PER_WORD + j] =
+                RES_ID(i, 1+j, RES_CHANEND);
+        for(j=0; j<NUM_PROG_CHANS; j++) {
+            unsigned w = (connTable - RAM_BASE) / BYTES_PER_WORD + 2*j;
+            k->mem[(progChan - RAM_BASE) / BYTES_PER_WORD + j] =
+                RES_ID(i, PROG_CHAN_OFF+j, RES_CHANEND);
+            if((int) k->mem[w] != CONN_NONE)
+                k->chans[PROG_CHAN_OFF+j].dest = RES_ID(k->mem[w],
+                        PROG_CHAN_OFF+k->mem[w+1], RES_CHANEND);
+        }
+
+        // Forked threads are given space below that of thread 0
+        t->sp = RAM_BASE + RAM_SIZE - 8 - KERNEL_SPACE;
+        t->dp = img->dpBase;
+        t->cp = img->cpBase;
+        k->mem[(label("sp") - RAM_BASE) / BYTES_PER_WORD] =
+            t->sp - THREAD_STACK_SPACE;
+        k->fp = k->codeTop = img->bssEnd;
+        t->state = t_thr_idle;
+    }
+
+    // Main runs on core 0, where every procedure is resident
+    thread t = &cores[0].threads[0];
+    for(i=0; i<JUMP_TAB_SIZE; i++)
+        cores[0].resident[i] = true;
+    mch_start(t, t_thr_run);
+    t->pc = label(LBL_MAIN);
+    t->lr = label("runMain");
+}
+
+// Perform a runtime routine
+t_exec sys_call(thread t, t_sys s) {
+    switch(s) {
+    case t_sys_migrate:      return migrate(t, false);
+    case t_sys_migrateAsync: return migrate(t, true);
+    case t_sys_joinAsync:    return join(t);
+    case t_sys_connect:      return connect(t);
+    case t_sys_runThread:    return complete(t);
+    case t_sys_initThread:
+        t->busy = INIT_THREAD_INSTS - 1;
+        t->pc = t->lr;
+        return t_exec_done;
+    case t_sys_runMain:
+        mainDone = true;
+        mch_free(t, t_thr_free);
+        return t_exec_done;
+    default:
+        assert(0 && "invalid runtime routine");
+    }
+    return t_exec_fault;
+}
+
+// The address of a label of the runtime or program
+static unsigned label(string name) {
+    unsigned addr;
+    if(!img_label(img, name, &addr))
+        assert(0 && "missing runtime label");
+    return addr;
+}
+
+// Migrate the procedure of the closure at r1 to the core in r0. The guest
+// waits for it in phase 1, unless it is asynchronous and a channel end is
+// free for its handle, which is returned in r0.
+static t_exec migrate(thread t, bool async) {
+    unsigned dest = t->r[0], closure = t->r[1];
+    unsigned numArgs, numProcs, modes, len, val, idx, size, pc;
+    unsigned words, dataWords = 0, addr, limit;
+    int i, j;
+
+    if(t->phase == 1) {
+        if(!t->m->done)
+            return t_exec_blocked;
+        t->phase = 0;
+        t->pc = t->lr;
+        return receive(t, t->m);
+    }
+
+    if(dest >= NUM_CORES)
+        return mch_fault(t, "migration to invalid core %u", dest);
+    if(!mch_load(t, closure + CLOSURE_NUM_ARGS*4, &numArgs)
+            || !mch_load(t, closure + CLOSURE_NUM_PROCS*4, &numProcs)
+            || !mch_load(t, closure + CLOSURE_ARG_MODES*4, &modes))
+        return t_exec_fault;
+    if(numArgs > NUM_ARGS || numProcs == 0)
+        return mch_fault(t, "invalid closure at 0x%x", closure);
+    thread h = host(dest);
+    if(h == NULL)
+        return t_exec_blocked;
+    core *k = &cores[dest];
+    mig m = chkalloc(sizeof(struct mig_));
+    memset(m, 0, sizeof(struct mig_));
+    m->guest = t;
+    m->host = h;
+    m->numArgs = numArgs;
+    m->modes = modes;
+    words = 4 + numArgs + 2*numProcs + 1;
+
+    // The header gives the jump index and size of each procedure, and those
+    // not resident on the host are sent first
+    for(j=0; j<(int) numProcs; j++) {
+        if(!mch_load(t, closure + (CLOSURE_ARGS+2*numArgs+j)*4, &idx))
+            return t_exec_fault;
+        if(idx >= JUMP_TAB_SIZE)
+            return mch_fault(t, "invalid jump index %u", idx);
+        if(j == 0 && !mch_load(t, t->cp + idx*4, &pc))
+            return t_exec_fault;
+        if(k->resident[idx])
+            continue;
+        if(!mch_load(t, label("sizeTable") + idx*4, &size))
+            return t_exec_fault;
+        size = (size + 3) / 4 * 4;
+        words += size / 4;
+        k->fp += size;
+        k->codeTop = k->fp;
+        k->resident[idx] = true;
+    }
+
+    // Then the arguments, with space at fp for each array
+    for(i=0; i<(int) numArgs; i++) {
+        if(!mch_load(t, closure + (CLOSURE_ARGS+2*i)*4, &len)
+                || !mch_load(t, closure + (CLOSURE_ARGS+2*i+1)*4, &val))
+            return t_exec_fault;
+        m->len[i] = len;
+        m->guestAddr[i] = val;
+        if(len > 1)
+            dataWords += len;
+    }
+    addr = k->fp;
+    limit = k->mem[(label("sp") - RAM_BASE) / BYTES_PER_WORD];
+    if(addr + dataWords*4 > limit)
+        return mch_fault(t, "no space on core %u for migrated arguments",
+                dest);
+    k->fp += dataWords*4;
+    k->regions++;
+    for(i=0; i<(int) numArgs; i++) {
+        if(m->len[i] == 1) {
+            h->r[i] = m->guestAddr[i];
+            words++;
+            continue;
+        }
+        h->r[i] = m->hostAddr[i] = addr;
+        if(ARG_MODE(modes, i) & ARG_MODE_IN) {
+            for(j=0; j<(int) m->len[i]; j++) {
+                unsigned v;
+                if(!mch_load(t, m->guestAddr[i] + j*4, &v))
+                    return t_exec_fault;
+                k->mem[(addr - RAM_BASE) / BYTES_PER_WORD + j] = v;
+            }
+            words += m->len[i];
+        }
+        addr += m->len[i]*4;
+    }
+
+    // Start the host once the closure has arrived. A new thread is given
+    // space below the stack of the last.
+    int lat = mch_latency(t->core, dest);
+    unsigned sp = label("sp");
+    mch_start(h, t_thr_run);
+    if(h->num != 0) {
+        h->sp = k->mem[(sp - RAM_BASE) / BYTES_PER_WORD];
+        k->mem[(sp - RAM_BASE) / BYTES_PER_WORD] -= THREAD_STACK_SPACE;
+    }
+    h->dp = img->dpBase;
+    h->cp = img->cpBase;
+    h->pc = pc;
+    h->lr = label(LBL_RUN_THREAD);
+    h->hosted = m;
+    h->ready = now + 2*OPEN_TRIPS*lat + words*TOKENS_PER_WORD;
+    h->busy = words * WORD_INSTS;
+    numMigrations++;
+    numWords += words;
+    m->event = mch_event(t, t_evt_migrate, dest, 0, words);
+    mch_event(h, t_evt_host, t->core, m->event, words);
+
+    // The guest waits for replies while sending
+    t->ready = now + 2*OPEN_TRIPS*lat;
+    t->busy = CALL_INSTS + words * WORD_INSTS - 1;
+    if(async) {
+        for(i=PROG_CHAN_OFF+NUM_PROG_CHANS; i<MAX_CHANNELS; i++) {
+            chanend *c = &cores[t->core].chans[i];
+            if(!c->used) {
+                memset(c, 0, sizeof(chanend));
+                c->used = true;
+                c->m = m;
+                m->handle = RES_ID(t->core, i, RES_CHANEND);
+                break;
+            }
+        }
+    }
+    t->r[0] = m->handle;
+    if(m->handle != 0)
+        t->pc = t->lr;
+    else {
+        t->m = m;
+        t->phase = 1;
+    }
+    return t_exec_done;
+}
+
+// Join the asynchronous migration with the handle in r0, once it completes
+static t_exec join(thread t) {
+    unsigned c = t->r[0];
+    if(c == 0) {
+        t->pc = t->lr;
+        return t_exec_done;
+    }
+    chanend *e = &cores[t->core].chans[RES_NUM(c) % MAX_CHANNELS];
+    if(RES_TYPE(c) != RES_CHANEND || RES_CORE(c) != (unsigned) t->core
+            || RES_NUM(c) >= MAX_CHANNELS || !e->used || e->m == NULL)
+        return mch_fault(t, "join of invalid handle 0x%x", c);
+    if(!e->m->done)
+        return t_exec_blocked;
+    mig m = e->m;
+    e->used = false;
+    e->m = NULL;
+    t->pc = t->lr;
+    return receive(t, m);
+}
+
+// Receive the results of a completed migration
+static t_exec receive(thread t, mig m) {
+    unsigned words = 0;
+    int i, j;
+    for(i=0; i<m->numArgs; i++) {
+        if(m->results[i] == NULL)
+            continue;
+        for(j=0; j<(int) m->len[i]; j++) {
+            if(!mch_store(t, m->guestAddr[i] + j*4, m->results[i][j]))
+                return t_exec_fault;
+        }
+        words += m->len[i];
+        free(m->results[i]);
+    }
+    int lat = mch_latency(m->host->core, t->core);
+    t->ready = now + 2*RESULT_TRIPS*lat + words*TOKENS_PER_WORD;
+    t->busy = CALL_INSTS + words * WORD_INSTS - 1;
+    t->m = NULL;
+    numWords += words;
+    mch_event(t, t_evt_receive, m->host->core, m->event, words);
+    free(m);
+    return t_exec_done;
+}
+
+// Connect program channel r1 of this core to channel r2 of core r0
+static t_exec connect(thread t) {
+    unsigned to = t->r[0], c1 = t->r[1], c2 = t->r[2];
+    if(to >= NUM_CORES || c1 >= NUM_PROG_CHANS || c2 >= NUM_PROG_CHANS)
+        return mch_fault(t, "invalid connection");
+    cores[t->core].chans[PROG_CHAN_OFF+c1].dest =
+        RES_ID(to, PROG_CHAN_OFF+c2, RES_CHANEND);
+    t->busy = CONNECT_INSTS - 1;
+    t->pc = t->lr;
+    return t_exec_done;
+}
+
+// Complete a hosted procedure: keep the arrays it may have written for the
+// guest and release its argument space and thread
+static t_exec complete(thread h) {
+    mig m = h->hosted;
+    core *k = &cores[h->core];
+    int i;
+    if(m == NULL)
+        return mch_fault(h, "return from a procedure that was not migrated");
+    for(i=0; i<m->numArgs; i++) {
+        if(m->len[i] <= 1 || !(ARG_MODE(m->modes, i) & ARG_MODE_OUT))
+            continue;
+        m->results[i] = chkalloc(m->len[i] * BYTES_PER_WORD);
+        memcpy(m->results[i],
+                &k->mem[(m->hostAddr[i] - RAM_BASE) / BYTES_PER_WORD],
+                m->len[i] * BYTES_PER_WORD);
+    }
+    if(--k->regions == 0)
+        k->fp = k->codeTop;
+    if(h->num != 0)
+        k->mem[(label("sp") - RAM_BASE) / BYTES_PER_WORD] +=
+            THREAD_STACK_SPACE;
+    m->done = true;
+    m->event = mch_event(h, t_evt_complete, m->guest->core, 0, 0);
+    h->hosted = NULL;
+    mch_free(h, h->num == 0 ? t_thr_idle : t_thr_free);
+    return t_exec_done;
+}
+
+// A thread to host a migration to a core: thread 0 if it is idle, otherwise
+// any free thread, or NULL if there are none
+static thread host(int c) {
+    if(cores[c].threads[0].state == t_thr_idle)
+        return &cores[c].threads[0];
+    return mch_thread(c);
+}
@@ -0,0 +1,9 @@
+#ifndef SYSTEM_H
+#define SYSTEM_H
+
+#include "machine.h"
+
+void     sys_init   (void);
+t_exec   sys_call   (thread, t_sys);
+
+#endif
@@ -0,0 +1,15 @@
+port out : 0x00010600
+var r: int[16]
+
+proc main() is
+  var i, a, b, c, d, e, f, g, h, j, k, l, m, n, o, p, q: int
+{ a := 1; b := 2; c := 3; d := 4; e := 5; f := 6; g := 7; h := 8;
+  j := 9; k := 10; l := 11; m := 12; n := 13; o := 14; p := 15; q := 16;
+  par i := 0 for 12 do
+    r[i] := a + b + c + d + e + f + g + h + j + k + l + m + n + o + p + q + i;
+  { r[12] := a * b + c * d + e * f + g * h + j * k + l * m + n * o + p * q
+  | r[13] := a + b + c + d + e + f + g + h + j + k + l + m + n + o + p + q
+  | r[14] := q + (0 - p) + (0 - a) + b + c };
+  i := 0;
+  while i < 15 do { out ! r[i]; i := i + 1 }
+}
@@ -0,0 +1,390 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "emulate.h"
+#include "xs1.h"
+
+// Emulation:
+// Each thread of the emulated system is a pthread, given the core it runs on
+// and its thread identifier. Each core has its own memory, with its jump
+// table at the base, the runtime globals and a lock for fp. Channel ends have
+// resource identifiers as on the XS1, and each buffers the tokens sent to it,
+// up to the tokens a channel buffers in one direction: an output blocks while
+// its destination is full, and an input or chkct while its end is empty. As
+// through the switch, the first token from an end opens a route to its
+// destination, which other ends cannot send to until an END token closes it.
+// A chkct must find the expected control token and an in must find data, or
+// the emulation fails, as it does if an operation blocks for longer than
+// EMU_TIMEOUT or a thread makes a channel operation holding a lock.
+
+#define CHAN_BUFFER_TOKENS 8
+#define TOKENS_PER_WORD    4
+#define JUMP_TABLE         RAM_BASE
+
+#define RES_ID(core, n)    ((core) << 16 | (n) << 8 | XS1_RES_TYPE_CHANEND)
+#define LOCK_ID(core)      ((unsigned) (core) << 16 | XS1_RES_TYPE_LOCK)
+#define RES_CORE(id)       ((id) >> 16)
+#define RES_NUM(id)        (((id) >> 8) & 0xFF)
+
+typedef struct {
+    bool ct;
+    unsigned value;
+} item;
+
+typedef struct {
+    bool used;
+    unsigned dest;
+    unsigned route;
+    item items[CHAN_BUFFER_TOKENS];
+    int head, size;
+    int tokens;
+} chanend;
+
+typedef struct {
+    int core;
+    unsigned threadId;
+    emu_thread fn;
+    void *arg;
+} start;
+
+static unsigned *word    (int, unsigned);
+static void     *run     (void *);
+static unsigned  allocate(int);
+static chanend  *lookup  (unsigned);
+static void      block   (const string, unsigned);
+static void      send    (const string, unsigned, bool, unsigned, int);
+static item      receive (const string, unsigned, int);
+
+static unsigned        memory[EMU_CORES][RAM_SIZE / BYTES_PER_WORD];
+static ops_core        globals[EMU_CORES];
+static pthread_mutex_t locks[EMU_CORES];
+static double          lockHeld[EMU_CORES];
+static double          lockLongest[EMU_CORES];
+static chanend         ends[EMU_CORES][EMU_CHANENDS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  changed = PTHREAD_COND_INITIALIZER;
+static pthread_t       threads[EMU_THREADS];
+static start           starts[EMU_THREADS];
+static int             numThreads = 0;
+
+static __thread int      thisCore;
+static __thread unsigned thisThreadId;
+static __thread double   lockTime;
+static __thread bool     holding;
+
+//========================================================================
+// System
+//========================================================================
+
+// Reset each core: clear its memory and globals, free its channel ends and
+// allocate those of the runtime, and leave fp above the kernel space
+void emu_init(void) {
+    static bool initialised = false;
+    int i, j;
+    for(i=0; i<EMU_CORES; i++) {
+        if(!initialised)
+            pthread_mutex_init(&locks[i], NULL);
+        memset(memory[i], 0, sizeof(memory[i]));
+        memset(&globals[i], 0, sizeof(globals[i]));
+        lockHeld[i] = lockLongest[i] = 0;
+        for(j=0; j<EMU_CHANENDS; j++)
+            ends[i][j].used = false;
+        globals[i].mSpawnChan = emu_chanend(i);
+        for(j=0; j<MAX_THREADS; j++)
+            globals[i].spawnChan[j] = emu_chanend(i);
+        globals[i].fpLock = LOCK_ID(i);
+        globals[i].fp = RAM_BASE + KERNEL_SPACE;
+        globals[i].sp = RAM_BASE + RAM_SIZE;
+    }
+    initialised = true;
+}
+
+// The runtime globals of a core
+ops_core *emu_globals(int core) {
+    return &globals[core];
+}
+
+// Load a word from the memory of a core
+unsigned emu_load(int core, unsigned addr) {
+    return *word(core, addr);
+}
+
+// Store a word to the memory of a core
+void emu_store(int core, unsigned addr, unsigned v) {
+    *word(core, addr) = v;
+}
+
+// The seconds the fp lock of a core has been held for since it was reset,
+// and the longest it was held for at once
+double emu_lockHeld(int core, double *longest) {
+    *longest = lockLongest[core];
+    return lockHeld[core];
+}
+
+// The time in seconds
+double emu_time(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static unsigned *word(int core, unsigned addr) {
+    if(addr < RAM_BASE || addr >= RAM_BASE + RAM_SIZE 
+            || addr % BYTES_PER_WORD != 0)
+        emu_fail("invalid address %x", addr);
+    return &memory[core][(addr - RAM_BASE) / BYTES_PER_WORD];
+}
+
+//========================================================================
+// Threads
+//========================================================================
+
+// Run a function as a thread on a core; threads may spawn others
+void emu_spawn(int core, unsigned threadId, emu_thread fn, void *arg) {
+    pthread_mutex_lock(&lock);
+    assert(numThreads < EMU_THREADS && "too many emulated threads");
+    start *s = &starts[numThreads];
+    s->core = core;
+    s->threadId = threadId;
+    s->fn = fn;
+    s->arg = arg;
+    if(pthread_create(&threads[numThreads++], NULL, run, s) != 0)
+        emu_fail("could not create a thread");
+    pthread_mutex_unlock(&lock);
+}
+
+// Wait for every thread to finish, including those spawned by threads, and
+// check nothing is left in a channel
+void emu_join(void) {
+    int i, j;
+    for(i=0; ; i++) {
+        pthread_mutex_lock(&lock);
+        bool done = i == numThreads;
+        pthread_mutex_unlock(&lock);
+        if(done)
+            break;
+        pthread_join(threads[i], NULL);
+    }
+    numThreads = 0;
+    for(i=0; i<EMU_CORES; i++) {
+        for(j=0; j<EMU_CHANENDS; j++) {
+            if(ends[i][j].used && ends[i][j].size != 0)
+                emu_fail("tokens left in chanend %x", RES_ID(i, j));
+        }
+    }
+}
+
+// The core of the current thread
+int emu_core(void) {
+    return thisCore;
+}
+
+// The thread identifier of the current thread
+unsigned emu_threadId(void) {
+    return thisThreadId;
+}
+
+// Report a failure of the emulated system and exit
+void emu_fail(const string fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "Error: core %d thread %u: ", thisCore, thisThreadId);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+
+static void *run(void *p) {
+    start *s = p;
+    thisCore = s->core;
+    thisThreadId = s->threadId;
+    s->fn(s->arg);
+    return NULL;
+}
+
+//========================================================================
+// Channel ends
+//========================================================================
+
+// Allocate a channel end on a core
+unsigned emu_chanend(int core) {
+    unsigned c = allocate(core);
+    if(c == 0)
+        emu_fail("no free chanend on core %d", core);
+    return c;
+}
+
+// Set the destinations of two channel ends to each other
+void emu_connect(unsigned a, unsigned b) {
+    ops_setd(a, b);
+    ops_setd(b, a);
+}
+
+// Allocate a channel end on a core, or return 0 if none are free
+static unsigned allocate(int core) {
+    int i;
+    pthread_mutex_lock(&lock);
+    for(i=0; i<EMU_CHANENDS && ends[core][i].used; i++)
+        ;
+    if(i < EMU_CHANENDS) {
+        ends[core][i].used = true;
+        ends[core][i].dest = ends[core][i].route = 0;
+        ends[core][i].head = ends[core][i].size = ends[core][i].tokens = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return i < EMU_CHANENDS ? RES_ID(core, i) : 0;
+}
+
+// The end with a resource identifier, which must be allocated
+static chanend *lookup(unsigned id) {
+    chanend *e = NULL;
+    if((id & 0xFF) == XS1_RES_TYPE_CHANEND && RES_CORE(id) < EMU_CORES
+            && RES_NUM(id) < EMU_CHANENDS)
+        e = &ends[RES_CORE(id)][RES_NUM(id)];
+    if(e == NULL || !e->used)
+        emu_fail("invalid chanend %x", id);
+    return e;
+}
+
+// Wait, with the lock held, for a channel to change
+static void block(const string op, unsigned c) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += EMU_TIMEOUT;
+    if(pthread_cond_timedwait(&changed, &lock, &t) == ETIMEDOUT)
+        emu_fail("%s on chanend %x blocked: deadlock", op, c);
+}
+
+// Send a token from an end, once the route to its destination is free and
+// the destination has room
+static void send(const string op, unsigned c, bool ct, unsigned value,
+        int tokens) {
+    if(holding)
+        emu_fail("%s on chanend %x holding a lock", op, c);
+    pthread_mutex_lock(&lock);
+    chanend *e = lookup(c);
+    if(e->dest == 0)
+        emu_fail("%s on chanend %x with no destination", op, c);
+    chanend *d = lookup(e->dest);
+    while((d->route != 0 && d->route != c)
+            || d->tokens + tokens > CHAN_BUFFER_TOKENS)
+        block(op, c);
+    item *i = &d->items[(d->head + d->size++) % CHAN_BUFFER_TOKENS];
+    i->ct = ct;
+    i->value = value;
+    d->tokens += tokens;
+    d->route = ct && value == XS1_CT_END ? 0 : c;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+// Receive a token at an end, once one has arrived: a control token for a
+// chkct, of one token, or data for an in
+static item receive(const string op, unsigned c, int tokens) {
+    if(holding)
+        emu_fail("%s on chanend %x holding a lock", op, c);
+    pthread_mutex_lock(&lock);
+    chanend *e = lookup(c);
+    while(e->size == 0)
+        block(op, c);
+    item i = e->items[e->head];
+    if(i.ct && tokens != 1)
+        emu_fail("%s on chanend %x found control token %d", op, c, i.value);
+    if(!i.ct && tokens == 1)
+        emu_fail("%s on chanend %x found data", op, c);
+    e->head = (e->head + 1) % CHAN_BUFFER_TOKENS;
+    e->size--;
+    e->tokens -= tokens;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    return i;
+}
+
+//========================================================================
+// Channel operations
+//========================================================================
+
+void ops_out(unsigned c, unsigned v) {
+    send("out", c, false, v, TOKENS_PER_WORD);
+}
+
+unsigned ops_in(unsigned c) {
+    return receive("in", c, TOKENS_PER_WORD).value;
+}
+
+void ops_outct(unsigned c, unsigned ct) {
+    send("outct", c, true, ct, 1);
+}
+
+void ops_chkct(unsigned c, unsigned ct) {
+    item i = receive("chkct", c, 1);
+    if(i.value != ct)
+        emu_fail("chkct %d on chanend %x found control token %d",
+                ct, c, i.value);
+}
+
+void ops_setd(unsigned c, unsigned d) {
+    pthread_mutex_lock(&lock);
+    lookup(c)->dest = d;
+    pthread_mutex_unlock(&lock);
+}
+
+//========================================================================
+// Memory, locks and resources
+//========================================================================
+
+ops_core *ops_globals(void) {
+    return &globals[thisCore];
+}
+
+unsigned ops_ldw(unsigned a, unsigned i) {
+    return *word(thisCore, a + i * BYTES_PER_WORD);
+}
+
+void ops_stw(unsigned v, unsigned a, unsigned i) {
+    *word(thisCore, a + i * BYTES_PER_WORD) = v;
+}
+
+unsigned ops_cp(void) {
+    return JUMP_TABLE;
+}
+
+void ops_lock(unsigned l) {
+    if(l != LOCK_ID(thisCore))
+        emu_fail("invalid lock %x", l);
+    pthread_mutex_lock(&locks[thisCore]);
+    lockTime = emu_time();
+    holding = true;
+}
+
+void ops_unlock(unsigned l) {
+    if(l != LOCK_ID(thisCore) || !holding)
+        emu_fail("invalid lock %x", l);
+    double held = emu_time() - lockTime;
+    lockHeld[thisCore] += held;
+    if(held > lockLongest[thisCore])
+        lockLongest[thisCore] = held;
+    holding = false;
+    pthread_mutex_unlock(&locks[thisCore]);
+}
+
+unsigned ops_getr(unsigned type) {
+    if(type != XS1_RES_TYPE_CHANEND)
+        emu_fail("getr of resource type %d", type);
+    return allocate(thisCore);
+}
+
+void ops_freer(unsigned r) {
+    pthread_mutex_lock(&lock);
+    chanend *e = lookup(r);
+    if(e->size != 0)
+        emu_fail("freer of chanend %x with tokens left", r);
+    e->used = false;
+    pthread_mutex_unlock(&lock);
+}
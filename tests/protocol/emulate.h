@@ -0,0 +1,34 @@
+#ifndef EMULATE_H
+#define EMULATE_H
+
+#include "../../compiler/util.h"
+#include "../../runtime/ops.h"
+
+// Emulated system
+#define EMU_CORES      4
+#define EMU_CHANENDS   32  // Per core
+#define EMU_THREADS    32  // Running at once, over all cores
+#define EMU_TIMEOUT    2   // Seconds an operation may block before failing
+
+typedef void (*emu_thread)(void *);
+
+// System
+void     emu_init     (void);
+ops_core *emu_globals (int core);
+unsigned emu_load     (int core, unsigned addr);
+void     emu_store    (int core, unsigned addr, unsigned v);
+double   emu_lockHeld (int core, double *longest);
+double   emu_time     (void);
+
+// Threads
+void     emu_spawn    (int core, unsigned threadId, emu_thread, void *);
+void     emu_join     (void);
+int      emu_core     (void);
+unsigned emu_threadId (void);
+void     emu_fail     (const string fmt, ...);
+
+// Channel ends
+unsigned emu_chanend  (int core);
+void     emu_connect  (unsigned, unsigned);
+
+#endif
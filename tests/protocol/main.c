@@ -0,0 +1,500 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulate.h"
+#include "../../compiler/channel.h"
+#include "../../runtime/guest.h"
+#include "../../runtime/host.h"
+
+// Protocol tests:
+// The channel protocols of the compiler and runtime are run between threads
+// of an emulated system, each end on its own core, and fail if an end traps
+// or deadlocks, or the words received are not those sent. The runtime is
+// built for Linux with the closure protocol of CLOSURE_STREAMED, and a
+// migration is made by running migrate, or migrateAsync and joinAsync, on the
+// guest against runThread on the host. Migrations are also made at once from
+// several cores to one host, to measure the time the lock on its fp is held.
+
+#define STREAM_MAX_WORDS 64
+
+// Cores of a migration, and the guest memory of its procedures and of the
+// arrays of each guest thread
+#define GUEST_CORE       0
+#define HOST_CORE        1
+#define GUEST_CODE       (RAM_BASE + 0x1000)
+#define GUEST_DATA       (RAM_BASE + 0x4000)
+#define CODE_BYTES       0x100
+#define REGION_BYTES     0x400
+#define THREAD_BYTES     0x1000
+
+// Migrations made at once, each from its own guest thread
+#define MAX_MIGRATIONS   6
+
+// Words of the procedures and of the arrays before and after a migration
+#define CODE_WORD(p, j)     ((unsigned) ((p) << 16 | (j)))
+#define ARRAY_WORD(i, j)    ((unsigned) (0x1000 * ((i) + 1) + (j)))
+#define RESULT_WORD(i, j)   ((unsigned) (0x8000 * ((i) + 1) + (j)))
+
+typedef struct {
+    unsigned c;
+    bool output;
+    int words;
+    bool streamed;
+    unsigned data[STREAM_MAX_WORDS];
+    int handshakes;
+} stream;
+
+// A migration from a guest core and thread: the arguments and procedures of
+// its closure, which includes procedure 0, the one it runs
+typedef struct {
+    int core;
+    unsigned thread;
+    int numArgs;
+    unsigned modes;
+    int len[NUM_ARGS];
+    unsigned values[NUM_ARGS];
+    int numProcs;
+    int procs[MAX_PROCS];
+    unsigned sizes[MAX_PROCS];
+    bool async;
+    unsigned closure[CLOSURE_ARGS + 2*NUM_ARGS + MAX_PROCS];
+    int runs;
+} migration;
+
+// One end of a query of the procedures resident on a host, and the transfer
+// of those it needs
+typedef struct {
+    unsigned c;
+    int numProcs;
+    unsigned procs[MAX_PROCS];
+    int received[MAX_PROCS];
+    unsigned sizes[MAX_PROCS];
+    unsigned send;
+} query;
+
+// Routines of the runtime used directly
+void     sendProcedures   (unsigned, int, int, unsigned[]);
+unsigned replyResident    (unsigned, unsigned, int, unsigned, int[],
+                           unsigned[], unsigned[]);
+void     receiveProcedures(unsigned, int, int[], unsigned[], unsigned[],
+                           unsigned);
+
+static void handshake     (unsigned, bool, int);
+static void streamEnd     (void *);
+static void testStream    (void);
+static void checkProcedure(int, int, unsigned);
+static void guest         (void *);
+static void host          (void *);
+static void dispatch      (void *);
+static void hostThread    (void *);
+static void installProc   (int, int, unsigned);
+static void install       (migration *);
+static void checkResults  (migration *);
+static void migrate1      (migration *);
+static void testClosure   (void);
+static void testConcurrent(void);
+static void queryEnd      (void *);
+static void replyEnd      (void *);
+static void testResident  (void);
+
+// The migrations being run, and the guests connected to the host
+static migration *running[MAX_MIGRATIONS];
+static int        numRunning;
+static unsigned   senders[MAX_MIGRATIONS];
+
+int main(void) {
+    printf("Closure protocol: %s\n", 
+            CLOSURE_STREAMED ? "streamed" : "unstreamed");
+    testStream();
+    testClosure();
+    testResident();
+    testConcurrent();
+    printf("Protocol tests passed\n");
+    return EXIT_SUCCESS;
+}
+
+// Make one end of a control token handshake, as generated by the compiler
+static void handshake(unsigned c, bool output, int token) {
+    chn_op ops[2];
+    int n = chn_handshake(output, token, ops);
+    int i;
+    for(i=0; i<n; i++) {
+        if(ops[i].op == t_chn_outct)
+            ops_outct(c, ops[i].token);
+        else
+            ops_chkct(c, ops[i].token);
+    }
+}
+
+//========================================================================
+// Streams over system channels
+//========================================================================
+
+// One end of an array transfer over a system channel, as generated for
+// c ! a[i..n] and c ? a[i..n]: streamed between one pair of handshakes, or
+// with a pair around each word
+static void streamEnd(void *p) {
+    stream *s = p;
+    int i;
+    if(s->streamed) {
+        handshake(s->c, s->output, CT_BEGIN);
+        s->handshakes++;
+    }
+    for(i=0; i<s->words; i++) {
+        if(!s->streamed) {
+            handshake(s->c, s->output, CT_BEGIN);
+            s->handshakes++;
+        }
+        if(s->output)
+            ops_out(s->c, s->data[i]);
+        else
+            s->data[i] = ops_in(s->c);
+        if(!s->streamed) {
+            handshake(s->c, s->output, CT_END);
+            s->handshakes++;
+        }
+    }
+    if(s->streamed) {
+        handshake(s->c, s->output, CT_END);
+        s->handshakes++;
+    }
+}
+
+// Stream arrays of various lengths, streamed and as single words
+static void testStream(void) {
+    int lengths[] = {0, 1, 2, 3, 8, STREAM_MAX_WORDS};
+    int i, j, k;
+    emu_init();
+    for(i=0; i<(int) (sizeof(lengths) / sizeof(int)); i++) {
+        int handshakes[2];
+        for(j=0; j<2; j++) {
+            stream s[2];
+            for(k=0; k<2; k++) {
+                s[k].c = emu_chanend(k);
+                s[k].output = k == 0;
+                s[k].words = lengths[i];
+                s[k].streamed = j == 0;
+                s[k].handshakes = 0;
+            }
+            emu_connect(s[0].c, s[1].c);
+            for(k=0; k<lengths[i]; k++) {
+                s[0].data[k] = 0x1000 + k;
+                s[1].data[k] = 0;
+            }
+            emu_spawn(0, 0, streamEnd, &s[0]);
+            emu_spawn(1, 0, streamEnd, &s[1]);
+            emu_join();
+            for(k=0; k<lengths[i]; k++) {
+                if(s[1].data[k] != s[0].data[k])
+                    emu_fail("stream word %d received as %x", k,
+                            s[1].data[k]);
+            }
+            handshakes[j] = s[0].handshakes;
+        }
+        printf("stream %d words: %d handshakes, %d unstreamed\n",
+                lengths[i], handshakes[0], handshakes[1]);
+    }
+}
+
+//========================================================================
+// Migrations
+//========================================================================
+
+// Routines of the runtime built only for the XS1
+unsigned getThreadId(void) {
+    return emu_threadId();
+}
+
+unsigned destResId(unsigned dest) {
+    return emu_globals(dest)->mSpawnChan;
+}
+
+void initThread(void) {
+}
+
+// Check a procedure is resident on a core, with its code and size
+static void checkProcedure(int core, int p, unsigned size) {
+    unsigned addr = emu_load(core, ops_cp() + p*4);
+    int j;
+    if(emu_globals(core)->sizeTable[p] != size)
+        emu_fail("procedure %d size %d", p, emu_globals(core)->sizeTable[p]);
+    for(j=0; j<(int) size/BYTES_PER_WORD; j++) {
+        if(emu_load(core, addr + j*4) != CODE_WORD(p, j))
+            emu_fail("procedure %d word %d", p, j);
+    }
+}
+
+// Run the procedure of a migration on the host: check every procedure of its
+// closure is resident and each argument has arrived, then write the results
+// of the arrays it may write
+void runProcedure(unsigned c, int threadId, int procIndex, unsigned args[]) {
+    migration *m = NULL;
+    int i, j;
+    for(i=0; i<numRunning; i++) {
+        if(running[i]->procs[0] == procIndex)
+            m = running[i];
+    }
+    if(m == NULL)
+        emu_fail("ran procedure %d, of no migration", procIndex);
+    for(i=0; i<m->numProcs; i++)
+        checkProcedure(emu_core(), m->procs[i], m->sizes[i]);
+    for(i=0; i<m->numArgs; i++) {
+        if(m->len[i] == 1) {
+            if(args[i] != m->values[i])
+                emu_fail("argument %d is %x", i, args[i]);
+            continue;
+        }
+        for(j=0; j<m->len[i]; j++) {
+            if((ARG_MODE(m->modes, i) & ARG_MODE_IN) 
+                    && ops_ldw(args[i], j) != ARRAY_WORD(i, j))
+                emu_fail("argument %d word %d is %x", i, j, 
+                        ops_ldw(args[i], j));
+            if(ARG_MODE(m->modes, i) & ARG_MODE_OUT)
+                ops_stw(RESULT_WORD(i, j), args[i], j);
+        }
+    }
+    m->runs++;
+    (void) c;
+    (void) threadId;
+}
+
+// The guest of a migration
+static void guest(void *p) {
+    migration *m = p;
+    if(m->async)
+        joinAsync(migrateAsync(HOST_CORE, m->closure));
+    else
+        migrate(HOST_CORE, m->closure);
+}
+
+// The host of a migration, thread 0 of its core
+static void host(void *p) {
+    (void) p;
+    runThread(setHost());
+}
+
+// Thread 0 of the host, connecting to each of a number of guests in turn and
+// hosting each migration on a thread of its own, as spawnHost does
+static void dispatch(void *p) {
+    int n = *(int *) p;
+    int i;
+    for(i=0; i<n; i++) {
+        senders[i] = setHost();
+        emu_spawn(HOST_CORE, i+1, hostThread, &senders[i]);
+    }
+}
+
+// A host thread, for a guest thread 0 is connected to
+static void hostThread(void *p) {
+    runThread(*(unsigned *) p);
+}
+
+// Install a procedure on a core, with its jump table and size table entries
+static void installProc(int core, int p, unsigned size) {
+    unsigned addr = GUEST_CODE + p*CODE_BYTES;
+    int j;
+    emu_store(core, ops_cp() + p*4, addr);
+    emu_globals(core)->sizeTable[p] = size;
+    for(j=0; j<(int) size/BYTES_PER_WORD; j++)
+        emu_store(core, addr + j*4, CODE_WORD(p, j));
+}
+
+// Install the procedures and arrays of a migration on its guest and make its
+// closure, as the compiler generates them for an on
+static void install(migration *m) {
+    unsigned *closure = m->closure;
+    int i, j;
+    closure[CLOSURE_NUM_ARGS] = m->numArgs;
+    closure[CLOSURE_NUM_PROCS] = m->numProcs;
+    closure[CLOSURE_ARG_MODES] = m->modes;
+    for(i=0; i<m->numArgs; i++) {
+        unsigned addr = GUEST_DATA + m->thread*THREAD_BYTES + i*REGION_BYTES;
+        closure[CLOSURE_ARGS+2*i] = m->len[i];
+        closure[CLOSURE_ARGS+2*i+1] = m->len[i] == 1 ? m->values[i] : addr;
+        for(j=0; m->len[i] > 1 && j<m->len[i]; j++)
+            emu_store(m->core, addr + j*4, ARRAY_WORD(i, j));
+    }
+    for(i=0; i<m->numProcs; i++) {
+        closure[CLOSURE_ARGS+2*m->numArgs+i] = m->procs[i];
+        installProc(m->core, m->procs[i], m->sizes[i]);
+    }
+    m->runs = 0;
+}
+
+// Check a migration ran once, and the arrays the procedure may write were
+// copied back and others left alone
+static void checkResults(migration *m) {
+    int i, j;
+    if(m->runs != 1)
+        emu_fail("procedure %d ran %d times", m->procs[0], m->runs);
+    for(i=0; i<m->numArgs; i++) {
+        unsigned addr = GUEST_DATA + m->thread*THREAD_BYTES + i*REGION_BYTES;
+        for(j=0; m->len[i] > 1 && j<m->len[i]; j++) {
+            unsigned v = emu_load(m->core, addr + j*4);
+            unsigned expect = (ARG_MODE(m->modes, i) & ARG_MODE_OUT) ?
+                RESULT_WORD(i, j) : ARRAY_WORD(i, j);
+            if(v != expect)
+                emu_fail("procedure %d result %d word %d is %x", 
+                        m->procs[0], i, j, v);
+        }
+    }
+}
+
+// Make a migration and check its results, and that the host keeps the
+// procedures it did not have but reclaims the space of the arguments
+static void migrate1(migration *m) {
+    ops_core *h = emu_globals(HOST_CORE);
+    unsigned top = h->fp;
+    int i;
+    for(i=0; i<m->numProcs; i++) {
+        if(h->sizeTable[m->procs[i]] == 0)
+            top += m->sizes[i];
+    }
+    running[0] = m;
+    numRunning = 1;
+    emu_spawn(m->core, m->thread, guest, m);
+    emu_spawn(HOST_CORE, 0, host, NULL);
+    emu_join();
+    checkResults(m);
+    if(h->fp != top || h->liveBytes != 0)
+        emu_fail("fp %x with %d bytes of arguments left on the host",
+                h->fp, h->liveBytes);
+}
+
+// Migrate closures of values and arrays in each mode, with one or several
+// procedures, synchronously and asynchronously
+static void testClosure(void) {
+    migration ms[] = {
+        { GUEST_CORE, 0, 1, ARG_MODE_IN, {1}, {7}, 1, {5}, {12}, false, 
+            {0}, 0 },
+        { GUEST_CORE, 0, 4, ARG_MODE_IN | (ARG_MODE_IN|ARG_MODE_OUT) << 2 
+            | ARG_MODE_OUT << 4 | ARG_MODE_IN << 6,
+            {1, 5, 3, 2}, {9, 0, 0, 0}, 2, {6, 7}, {16, 8}, false, {0}, 0 },
+        { GUEST_CORE, 0, 2, (ARG_MODE_IN|ARG_MODE_OUT) | ARG_MODE_IN << 2, 
+            {4, 1}, {0, 3}, 3, {8, 9, 10}, {4, 20, 8}, true, {0}, 0 }
+    };
+    int i;
+    for(i=0; i<(int) (sizeof(ms) / sizeof(migration)); i++) {
+        emu_init();
+        install(&ms[i]);
+        migrate1(&ms[i]);
+        printf("closure %d args %d procs%s: ok\n", ms[i].numArgs, 
+                ms[i].numProcs, ms[i].async ? " async" : "");
+    }
+}
+
+// Migrate from several guest threads to one host at once, each with its own
+// procedure and two it shares with the others, and measure the time taken
+// and the time the lock on the host's fp is held. Migrations are synchronous
+// as the runtime records asynchronous ones by channel end, not by core.
+static void testConcurrent(void) {
+    int cores[] = {0, 2, 3};
+    migration ms[MAX_MIGRATIONS];
+    double start, held, longest;
+    int i;
+    emu_init();
+    for(i=0; i<MAX_MIGRATIONS; i++) {
+        migration m = { cores[i/2], i%2, 3, (ARG_MODE_IN|ARG_MODE_OUT)
+            | (ARG_MODE_IN|ARG_MODE_OUT) << 2 | ARG_MODE_IN << 4,
+            {256, 256, 1}, {0, 0, i}, 3, {5+i, 11, 12},
+            {32 + 16*i, 64, 128}, false, {0}, 0 };
+        ms[i] = m;
+        install(&ms[i]);
+        running[i] = &ms[i];
+    }
+    numRunning = MAX_MIGRATIONS;
+    start = emu_time();
+    emu_spawn(HOST_CORE, 0, dispatch, &numRunning);
+    for(i=0; i<MAX_MIGRATIONS; i++)
+        emu_spawn(ms[i].core, ms[i].thread, guest, &ms[i]);
+    emu_join();
+    for(i=0; i<MAX_MIGRATIONS; i++)
+        checkResults(&ms[i]);
+    if(emu_globals(HOST_CORE)->liveBytes != 0)
+        emu_fail("%d bytes of arguments left on the host",
+                emu_globals(HOST_CORE)->liveBytes);
+    held = emu_lockHeld(HOST_CORE, &longest);
+    printf("concurrent %d migrations: ok in %.0f us, "
+            "fp lock held %.1f us, at most %.1f us\n", MAX_MIGRATIONS,
+            (emu_time() - start) * 1e6, held * 1e6, longest * 1e6);
+}
+
+//========================================================================
+// Resident procedures
+//========================================================================
+
+// The guest end of a query, sending the procedures the host needs
+static void queryEnd(void *p) {
+    query *q = p;
+    sendProcedures(q->c, q->numProcs, 0, q->procs);
+}
+
+// The host end of a query, receiving the procedures it needs into the space
+// reserved for them
+static void replyEnd(void *p) {
+    query *q = p;
+    unsigned addrs[MAX_PROCS];
+    int i;
+    replyResident(q->c, 0, q->numProcs, 0, q->received, q->sizes, addrs);
+    receiveProcedures(q->c, q->numProcs, q->received, q->sizes, addrs,
+            ops_cp());
+    q->send = 0;
+    for(i=0; i<q->numProcs; i++) {
+        if(addrs[i] != 0)
+            q->send |= 1 << i;
+    }
+}
+
+// Query the procedures resident on a host directly, then check a procedure
+// is only sent to a core once over several migrations
+static void testResident(void) {
+    
+    // Procedures 5 and 7 are in the host's image and 6, 8 and 9 are not
+    unsigned resident[] = {5, 7};
+    query q[2];
+    int i, k;
+    emu_init();
+    for(i=0; i<2; i++)
+        installProc(HOST_CORE, resident[i], 4);
+    for(i=0; i<5; i++)
+        installProc(GUEST_CORE, 5 + i, 4);
+    for(k=0; k<2; k++) {
+        q[k].c = emu_chanend(k == 0 ? GUEST_CORE : HOST_CORE);
+        q[k].numProcs = 5;
+        for(i=0; i<q[k].numProcs; i++)
+            q[k].procs[i] = 5 + i;
+    }
+    emu_connect(q[0].c, q[1].c);
+    emu_spawn(GUEST_CORE, 0, queryEnd, &q[0]);
+    emu_spawn(HOST_CORE, 0, replyEnd, &q[1]);
+    emu_join();
+    for(i=0; i<q[1].numProcs; i++) {
+        if(q[1].received[i] != (int) q[0].procs[i] || q[1].sizes[i] != 4)
+            emu_fail("queried procedure %d received as %d size %d", i, 
+                    q[1].received[i], q[1].sizes[i]);
+        checkProcedure(HOST_CORE, q[0].procs[i], 4);
+    }
+    if(q[1].send != 0x1A)
+        emu_fail("resident query replied %x", q[1].send);
+    printf("resident query: ok\n");
+
+    // Each procedure is received, and takes space at fp, only once
+    migration ms[] = {
+        { GUEST_CORE, 0, 1, ARG_MODE_IN, {1}, {1}, 2, {5, 6}, {16, 8}, 
+            false, {0}, 0 },
+        { GUEST_CORE, 0, 1, ARG_MODE_IN, {1}, {2}, 2, {5, 6}, {16, 8}, 
+            false, {0}, 0 },
+        { GUEST_CORE, 0, 1, ARG_MODE_IN, {1}, {3}, 3, {7, 6, 5}, {12, 8, 16},
+            true, {0}, 0 }
+    };
+    unsigned added[] = {24, 0, 12};
+    emu_init();
+    for(i=0; i<(int) (sizeof(ms) / sizeof(migration)); i++) {
+        unsigned fp = emu_globals(HOST_CORE)->fp;
+        install(&ms[i]);
+        migrate1(&ms[i]);
+        if(emu_globals(HOST_CORE)->fp != fp + added[i])
+            emu_fail("migration %d received %d bytes of procedures", i,
+                    emu_globals(HOST_CORE)->fp - fp);
+    }
+    printf("resident procedures: ok\n");
+}
@@ -0,0 +1,12 @@
+#ifndef XS1_H
+#define XS1_H
+
+// The definitions of the XS1 used by the runtime when built for Linux
+
+#define XS1_CT_END                0x1
+#define XS1_CT_START_TRANSACTION  0x3
+#define XS1_RES_TYPE_CHANEND      0x2
+#define XS1_RES_TYPE_THREAD       0x4
+#define XS1_RES_TYPE_LOCK         0x5
+
+#endif
@@ -1,31 +1,21 @@
-module tree {
+port led : 0x00010600
 
-  proc create(int depth, chanend root) is
-    
-    chan left, right;
-    
-    proc node(chanend top, chanend left, chanend right) is
-    { % blah
-    }
+% A binary tree of threads: each leaf reports 0 and each node its depth,
+% alongside the two subtrees below it
+proc leaf() is
+  led ! 0
 
-    proc leaf(c: chanend) is
-    { % blah
-    }
+proc node(depth: int) is
+  led ! depth
 
-  { if depth = 0 
-    then leaf(root)
-    else
-    { tree(depth - 1, left)
-    | tree(depth - 1, right)
-    | node(bottom, left, right)
-    }
+proc create(depth: int) is
+  if depth = 0
+  then leaf()
+  else
+  { create(depth - 1)
+  | create(depth - 1)
+  | node(depth)
   }
-}
-
-import tree;
 
 proc main() is
-  var c: chan
-{ tree.create(4, c)
-; c ! 0
-}
+  create(4)
@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "events.h"
+#include "../compiler/error.h"
+
+#define DEBUG 0
+
+// Identifies a file of events
+#define MAGIC 0x54564553  // "SEVT"
+
+// Cores and threads that can be named by an event
+#define MAX_IDS 256
+
+// Channel events:
+//
+// A program run with xs1sim -e records an event for each word or control
+// token that passes through a channel end, each msync, mjoin and ssync,
+// and each migration sent, hosted, completed and received. Each carries
+// the cycle it completed, the cycles its thread was blocked before it, and
+// the core and thread that performed it. Only the last events of a run are
+// kept, in a ring buffer, which is written in order from the oldest:
+//   header: magic, size, total, cycles
+//   record: time, wait, res, peer, value, kind, core, thread
+// as little-endian words. An input names the output of the token it
+// received, and a host or guest the event that started or completed its
+// migration, by number, so the path of each is traced even if its other
+// end was overwritten.
+
+typedef struct {
+    unsigned res;
+    unsigned long words, tokens, outWait, inWait;
+} chanStats;
+
+static string kindName[NUM_EVENT_KINDS] = {
+    "out", "outct", "in", "chkct", "msync", "mjoin", "thread", "ssync",
+    "migrate", "host", "complete", "receive"
+};
+
+static void     putWord   (FILE *, unsigned long, int);
+static bool     getWord   (FILE *, unsigned long *, int);
+static bool     kept      (events, unsigned long, unsigned, unsigned long *);
+static double   micros    (unsigned long);
+static chanStats *statsOf (chanStats *, int *, unsigned);
+static int      cmpStats  (const void *, const void *);
+
+// Constructor
+events evt_New(int size) {
+    assert(size > 0 && "invalid event buffer size");
+    events e = chkalloc(sizeof(*e));
+    e->size = size;
+    e->total = 0;
+    e->cycles = 0;
+    e->buf = chkalloc(sizeof(event) * size);
+    return e;
+}
+
+// Add an event, overwriting the oldest if the buffer is full, and return
+// its number
+unsigned long evt_add(events e, t_evt kind, int core, int thread,
+        unsigned long time, unsigned wait, unsigned res, unsigned peer,
+        unsigned value) {
+    event *v = &e->buf[e->total % e->size];
+    v->time = time;
+    v->wait = wait;
+    v->res = res;
+    v->peer = peer;
+    v->value = value;
+    v->kind = kind;
+    v->core = core;
+    v->thread = thread;
+    if(time > e->cycles)
+        e->cycles = time;
+    return e->total++;
+}
+
+// The event with a number from evt_first to total-1
+event *evt_get(events e, unsigned long n) {
+    assert(n >= evt_first(e) && n < e->total && "event not kept");
+    return &e->buf[n % e->size];
+}
+
+// The number of the oldest event kept
+unsigned long evt_first(events e) {
+    return e->total > (unsigned long) e->size ? e->total - e->size : 0;
+}
+
+// Write the events kept, from the oldest
+bool evt_write(events e, string file) {
+    unsigned long n;
+    FILE *out = fopen(file, "wb");
+    if(out == NULL) {
+        err_fatal("opening event file %s", file);
+        return false;
+    }
+    putWord(out, MAGIC, 4);
+    putWord(out, e->size, 4);
+    putWord(out, e->total, 8);
+    putWord(out, e->cycles, 8);
+    for(n=evt_first(e); n<e->total; n++) {
+        event *v = evt_get(e, n);
+        putWord(out, v->time, 8);
+        putWord(out, v->wait, 4);
+        putWord(out, v->res, 4);
+        putWord(out, v->peer, 4);
+        putWord(out, v->value, 4);
+        putWord(out, v->kind, 1);
+        putWord(out, v->core, 1);
+        putWord(out, v->thread, 1);
+    }
+    fclose(out);
+    return true;
+}
+
+// Load the events written by evt_write
+events evt_load(string file) {
+    unsigned long magic, size, total, cycles, numKept, n, w[8];
+
+    FILE *in = fopen(file, "rb");
+    if(in == NULL) {
+        err_fatal("opening event file %s", file);
+        return NULL;
+    }
+    if(!getWord(in, &magic, 4) || magic != MAGIC || !getWord(in, &size, 4)
+            || !getWord(in, &total, 8) || !getWord(in, &cycles, 8)
+            || size == 0 || size > (unsigned long) INT_MAX) {
+        err_fatal("%s is not an event file", file);
+        fclose(in);
+        return NULL;
+    }
+    events e = evt_New((int) size);
+    numKept = total < size ? total : size;
+    e->total = total - numKept;
+    for(n=0; n<numKept; n++) {
+        if(!getWord(in, &w[0], 8) || !getWord(in, &w[1], 4)
+                || !getWord(in, &w[2], 4) || !getWord(in, &w[3], 4)
+                || !getWord(in, &w[4], 4) || !getWord(in, &w[5], 1)
+                || !getWord(in, &w[6], 1) || !getWord(in, &w[7], 1)
+                || w[5] >= NUM_EVENT_KINDS) {
+            err_fatal("%s is truncated after %lu events", file, n);
+            fclose(in);
+            return NULL;
+        }
+        evt_add(e, w[5], w[6], w[7], w[0], w[1], w[2], w[3], w[4]);
+    }
+    e->cycles = cycles;
+    fclose(in);
+    if(DEBUG) printf("Loaded %lu of %lu events from %s\n", numKept, total,
+            file);
+    return e;
+}
+
+// Report the words and tokens sent to each channel end, and the cycles
+// threads were blocked sending to or receiving on it, the longest first
+void evt_report(events e, FILE *out) {
+    chanStats *chans = chkalloc(sizeof(chanStats) * (MAX_IDS + 1));
+    unsigned long kinds[NUM_EVENT_KINDS];
+    int numChans = 0;
+    unsigned long n;
+    int i;
+
+    for(i=0; i<NUM_EVENT_KINDS; i++)
+        kinds[i] = 0;
+    for(n=evt_first(e); n<e->total; n++) {
+        event *v = evt_get(e, n);
+        kinds[v->kind]++;
+        if(v->kind > t_evt_chkct)
+            continue;
+        chanStats *c = statsOf(chans, &numChans, v->kind <= t_evt_outct ?
+                v->peer : v->res);
+        if(c == NULL)
+            continue;
+        if(v->kind == t_evt_out)
+            c->words++;
+        else if(v->kind == t_evt_outct)
+            c->tokens++;
+        if(v->kind <= t_evt_outct)
+            c->outWait += v->wait;
+        else
+            c->inWait += v->wait;
+    }
+    qsort(chans, numChans, sizeof(chanStats), cmpStats);
+
+    printTitleRule(out, "Channel events");
+    fprintf(out, "  Events:   %lu of %lu kept, over %lu cycles\n",
+            e->total - evt_first(e), e->total, e->cycles);
+    fprintf(out, "  Outputs:  %lu words, %lu tokens\n", kinds[t_evt_out],
+            kinds[t_evt_outct]);
+    fprintf(out, "  Threads:  %lu forked, %lu migrations\n", kinds[t_evt_fork],
+            kinds[t_evt_migrate]);
+    fprintf(out, "  %-12s %10s %10s %14s %14s\n", "Channel end", "Words",
+            "Tokens", "Output wait", "Input wait");
+    for(i=0; i<numChans; i++) {
+        fprintf(out, "  0x%-10x %10lu %10lu %14lu %14lu\n", chans[i].res,
+                chans[i].words, chans[i].tokens, chans[i].outWait,
+                chans[i].inWait);
+    }
+    printRule(out);
+    free(chans);
+}
+
+// Write the events in the Chrome trace event format, with a process for
+// each core and a thread for each of its threads. Channel and runtime
+// operations are slices covering the time blocked, slaves and hosted
+// migrations are slices from start to end, and each token and migration
+// is a flow between them.
+void evt_writeJson(events e, FILE *out) {
+    static unsigned char depth[MAX_IDS][MAX_IDS];
+    static bool seen[MAX_IDS][MAX_IDS];
+    unsigned long n, from;
+    bool first = true;
+    int i, j;
+
+    memset(depth, 0, sizeof(depth));
+    memset(seen, 0, sizeof(seen));
+    fprintf(out, "{\"traceEvents\":[\n");
+    for(n=evt_first(e); n<e->total; n++) {
+        event *v = evt_get(e, n);
+        if((v->kind == t_evt_ssync || v->kind == t_evt_complete)
+                && depth[v->core][v->thread] == 0)
+            continue;
+        seen[v->core][v->thread] = true;
+        double ts = micros(v->time - v->wait);
+        string sep = first ? "" : ",\n";
+        first = false;
+        switch(v->kind) {
+        case t_evt_fork:
+        case t_evt_host:
+            depth[v->core][v->thread]++;
+            fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"thread\",\"ph\":\"B\","
+                    "\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"res\":\"0x%x\"}}", sep, kindName[v->kind],
+                    micros(v->time), v->core, v->thread, v->res);
+            break;
+        case t_evt_ssync:
+        case t_evt_complete:
+            depth[v->core][v->thread]--;
+            fprintf(out, "%s{\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    sep, micros(v->time), v->core, v->thread);
+            break;
+        default:
+            fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"res\":\"0x%x\",\"peer\":\"0x%x\","
+                    "\"value\":%u}}", sep, kindName[v->kind],
+                    v->kind <= t_evt_chkct ? "chan" : "runtime", ts,
+                    micros(v->wait), v->core, v->thread, v->res, v->peer,
+                    v->value);
+            break;
+        }
+
+        // Link an input or migration to the event that caused it
+        if((v->kind == t_evt_in || v->kind == t_evt_chkct
+                || v->kind == t_evt_host || v->kind == t_evt_receive)
+                && kept(e, n, v->peer, &from)) {
+            event *u = evt_get(e, from);
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"flow\",\"ph\":\"s\","
+                    "\"id\":%lu,\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    kindName[u->kind], from, micros(u->time), u->core,
+                    u->thread);
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"flow\",\"ph\":\"f\","
+                    "\"bp\":\"e\",\"id\":%lu,\"ts\":%.3f,\"pid\":%d,"
+                    "\"tid\":%d}", kindName[u->kind], from, micros(v->time),
+                    v->core, v->thread);
+        }
+    }
+
+    // Name each core and thread
+    for(i=0; i<MAX_IDS; i++) {
+        bool named = false;
+        for(j=0; j<MAX_IDS; j++) {
+            if(!seen[i][j])
+                continue;
+            if(!named) {
+                fprintf(out, "%s{\"name\":\"process_name\",\"ph\":\"M\","
+                        "\"pid\":%d,\"args\":{\"name\":\"core %d\"}}",
+                        first ? "" : ",\n", i, i);
+                first = false;
+                named = true;
+            }
+            fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                    i, j, j);
+        }
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{"
+            "\"events\":%lu,\"dropped\":%lu,\"cycles\":%lu,\"clockMHz\":%d}}\n",
+            e->total, evt_first(e), e->cycles, CLOCK_MHZ);
+}
+
+// Write a little-endian word of n bytes
+static void putWord(FILE *out, unsigned long v, int n) {
+    int i;
+    for(i=0; i<n; i++)
+        fputc((v >> (8*i)) & 0xFF, out);
+}
+
+static bool getWord(FILE *in, unsigned long *v, int n) {
+    int i;
+    *v = 0;
+    for(i=0; i<n; i++) {
+        int c = fgetc(in);
+        if(c == EOF)
+            return false;
+        *v |= (unsigned long) c << (8*i);
+    }
+    return true;
+}
+
+// Whether the event numbered peer, in the low word, before event n, is
+// kept, giving its number
+static bool kept(events e, unsigned long n, unsigned peer,
+        unsigned long *from) {
+    unsigned long back = (unsigned) ((unsigned) n - peer);
+    if(back == 0 || back > n - evt_first(e))
+        return false;
+    *from = n - back;
+    return true;
+}
+
+// The time in microseconds of a cycle
+static double micros(unsigned long cycles) {
+    return (double) cycles / CLOCK_MHZ;
+}
+
+// The statistics of a channel end, added if there is room
+static chanStats *statsOf(chanStats *chans, int *n, unsigned res) {
+    int i;
+    for(i=0; i<*n; i++) {
+        if(chans[i].res == res)
+            return &chans[i];
+    }
+    if(*n == MAX_IDS)
+        return NULL;
+    chanStats *c = &chans[(*n)++];
+    memset(c, 0, sizeof(chanStats));
+    c->res = res;
+    return c;
+}
+
+// Order channel ends by decreasing cycles blocked
+static int cmpStats(const void *a, const void *b) {
+    const chanStats *x = a, *y = b;
+    unsigned long wx = x->outWait + x->inWait, wy = y->outWait + y->inWait;
+    if(wx != wy)
+        return wx < wy ? 1 : -1;
+    return x->res < y->res ? -1 : x->res > y->res;
+}
@@ -0,0 +1,57 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdio.h>
+#include "../compiler/util.h"
+
+// The core clock, to convert cycles to time
+#define CLOCK_MHZ 400
+
+typedef enum {
+    t_evt_out,           // word output on a channel end, to peer
+    t_evt_outct,         // control token output on a channel end, to peer
+    t_evt_in,            // word input, from the output event peer
+    t_evt_chkct,         // control token input, from the output event peer
+    t_evt_msync,         // master starting the slaves of a synchroniser
+    t_evt_mjoin,         // master joining the slaves of a synchroniser
+    t_evt_fork,          // slave started by an msync
+    t_evt_ssync,         // slave reaching its ssync
+    t_evt_migrate,       // guest sending a closure to core res
+    t_evt_host,          // host starting the migration event peer
+    t_evt_complete,      // host completing a migration, at runThread
+    t_evt_receive,       // guest receiving the results of event peer
+    NUM_EVENT_KINDS
+} t_evt;
+
+typedef struct {
+    unsigned long time;  // cycle it completed
+    unsigned wait;       // cycles it was blocked for before
+    unsigned res;        // channel end, synchroniser or core
+    unsigned peer;
+    unsigned value;
+    unsigned char kind, core, thread;
+} event;
+
+typedef struct events_ *events;
+
+// A ring buffer of the last events of a run. Events are numbered from 0 in
+// the order they were added, of which the last size are kept.
+struct events_ {
+    int size;
+    unsigned long total;
+    unsigned long cycles;  // length of the run
+    event *buf;
+};
+
+events        evt_New      (int size);
+unsigned long evt_add      (events, t_evt, int core, int thread,
+                            unsigned long time, unsigned wait, unsigned res,
+                            unsigned peer, unsigned value);
+event        *evt_get      (events, unsigned long);
+unsigned long evt_first    (events);
+bool          evt_write    (events, string file);
+events        evt_load     (string file);
+void          evt_report   (events, FILE *);
+void          evt_writeJson(events, FILE *);
+
+#endif
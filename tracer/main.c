@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../compiler/util.h"
+#include "../compiler/error.h"
+
+#include "events.h"
+
+// Global options
+string jsonFile;
+bool   quiet;
+
+// Print some usage info
+void printHelp(void) {
+    printf("Usage: siretrace [options] <events>\n");
+    printf("Convert the channel events recorded by xs1sim -e to the Chrome\n");
+    printf("trace event format, and report the traffic of each channel end\n");
+    printf("Options:\n");
+    printf("  -h          Display this help message\n");
+    printf("  -o=<file>   Trace file (default trace.json)\n");
+    printf("  -q          Do not report the traffic\n");
+}
+
+// Parse command line options, leaving the event file
+int parseOptions(int *argc, char ***argv) {
+
+    // Default options
+    jsonFile = "trace.json";
+    quiet    = false;
+
+    // Get options
+    while((*argc > 1) && ((*argv)[1][0] == '-')) {
+        switch((*argv)[1][1]) {
+        case 'h': printHelp();                       return FAIL;
+        case 'o': jsonFile = String((*argv)[1] + 3); break;
+        case 'q': quiet = true;                      break;
+        default:
+            err_fatal("invalid option %s", (*argv)[1]);
+            return FAIL;
+        }
+        ++*argv;
+        --*argc;
+    }
+
+    if(*argc != 2) {
+        printHelp();
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+
+    if(parseOptions(&argc, &argv))
+        return EXIT_FAILURE;
+
+    events e = evt_load(argv[1]);
+    if(e == NULL)
+        return EXIT_FAILURE;
+
+    FILE *out = fopen(jsonFile, "w");
+    if(out == NULL) {
+        err_fatal("opening trace file %s", jsonFile);
+        return EXIT_FAILURE;
+    }
+    evt_writeJson(e, out);
+    fclose(out);
+
+    if(!quiet)
+        evt_report(e, stdout);
+    return EXIT_SUCCESS;
+}